@@ -7,28 +7,39 @@
 #include <functional>
 #include <algorithm>
 #include <stdexcept>
+#include <thread>
+#include <string>
+#include <chrono>
+#include "MTreeStorage.hpp"
 #include "MTreeNodes.hpp"
-#include "TreeObject.hpp"
+#include "MTreeSearchContext.hpp"
+#include "MTreeSplitPolicies.hpp"
+#include "MTreeBulkLoader.hpp"
+#include "MTreeSerialization.hpp"
+#include "MTreeAnalysis.hpp"
+#include "MTreeSlimDown.hpp"
+#include "MTreeNNIterator.hpp"
 #include "includes/dbgmsg.hpp"
 #include "indexing/NNList.hpp"
+#include "indexing/KNNBatch.hpp"
 #include "indexing/DistanceFunction.hpp"
 
-// Global variable for counting the number of nodes
-extern size_t totalNodes;
-
 /**
  * @brief Class representing an M-Tree.
  *
  * The M-Tree is a data structure used for organizing and searching data in metric spaces.
+ * The tree owns a copy of the indexed objects and keeps its nodes in a NodeArena,
+ * so nodes and entries are addressed by indices instead of pointers.
  *
  * @tparam T The type of elements stored in the M-Tree.
+ * @tparam Metric The distance function (see indexing/DistanceFunction.hpp), called without virtual dispatch.
+ * @tparam Split The policy used to split overflown nodes (see MTreeSplitPolicies.hpp).
  */
-template <typename T>
+template <typename T, typename Metric = EuclideanDistance<T>, typename Split = DefaultSplitPolicy>
 class MTree
 {
 public:
-    typedef std::shared_ptr<Node<T>> NodePtr;
-
+    typedef MTreeStorage<T> Storage;
 
     /**
      * @brief Constructs an M-Tree with a specified maximum node capacity and distance function.
@@ -41,12 +52,17 @@ public:
      *                  2. d(x, y) = 0 if and only if x = y
      *                  3. d(x, y) = d(y, x) for all x, y
      *                  4. d(x, z) <= d(x, y) + d(y, z) for all x, y, z
+     * @param splitPolicy The split policy, for policies with parameters (e.g. the sample size of SamplingPromotion).
      */
-    MTree(size_t maxNodeCapacity, DistanceFunction<T> &distance)
-        : maxNodeCapacity(maxNodeCapacity), distance(distance), treeSize(0), height(1)
+    MTree(size_t maxNodeCapacity, const Metric &distance = Metric(), const Split &splitPolicy = Split())
+        : maxNodeCapacity(maxNodeCapacity), distance(distance), splitPolicy(splitPolicy), storage(maxNodeCapacity), height(1)
     {
-        totalNodes = 0;
-        root = std::make_shared<LeafNode<T>>(maxNodeCapacity, true, nullptr, nullptr);
+        if (maxNodeCapacity < 2)
+        {
+            throw std::invalid_argument("The node capacity must be at least 2");
+        }
+        storage.root = storage.nodes.allocate(true);
+        storage.nodes.header(storage.root).isRoot = true;
     }
 
     /**
@@ -56,86 +72,284 @@ public:
      */
     void insert(const T &element)
     {
-        INSDEBUG_MSG("Inserting element " << element << " into the node " << root->getNodeId());
+        checkDimension(element);
+
+        // The tree keeps its own copy of the element, entries refer to it by id
+        ObjectId objectId = static_cast<ObjectId>(storage.objects.size());
+        storage.objects.push_back(element);
+        storage.pivots.addObject(element, distance);
+
+        INSDEBUG_MSG("Inserting element " << element << " into the node " << storage.root);
 
         // Inserts the element recursively via the root node
-        root->insert(element, distance);
+        NodeIndex oldRoot = storage.root;
+        Node<T>(storage, storage.root).insert(objectId, distance, splitPolicy);
 
-        // Check if root has to be updated, in case of a split
-        if (root->getIsRoot() == false)
+        // Check if root has been replaced, in case of a split
+        if (storage.root != oldRoot)
         {
-            // If the old root is not the root anymore, search for the new root
-            // by going up the tree until the new root is found
-            NodePtr node = root;
-            while (node->getIsRoot() == false)
-                node = node->getParentNode();
-            
-            root = node;
-            INSDEBUG_MSG("New root is node " << root->getNodeId());
+            INSDEBUG_MSG("New root is node " << storage.root);
 
             // Update the height of the tree, because a split in the root node increases the height
             height++;
         }
+    }
+
+    /**
+     * @brief Chooses global pivots whose distances prune entries during searches (PM-tree).
+     *
+     * Every entry stores, for each pivot, the ring of quantized distances between the pivot and
+     * the objects of its subtree, and each search computes the distances between the query and
+     * the pivots once. An entry whose rings miss the query ball is pruned without computing its
+     * distance (see PivotTable). Each inserted object costs count more distance computations.
+     * The tree must be empty.
+     *
+     * @param sample Objects to choose the pivots from (e.g. the elements to be indexed).
+     * @param count The number of pivots (0 to stop using pivots).
+     * @param bits The size of a quantized distance, 8 or 16.
+     * @param seed Seed for the sampling of the pivots.
+     */
+    void usePivots(const std::vector<T> &sample, size_t count, unsigned int bits = 8, unsigned int seed = 42)
+    {
+        if (size() != 0)
+        {
+            throw std::logic_error("Pivots must be chosen before the M-Tree is built");
+        }
+        storage = Storage(maxNodeCapacity, PivotTable<T>::choose(sample, count, bits, distance, seed));
+        storage.root = storage.nodes.allocate(true);
+        storage.nodes.header(storage.root).isRoot = true;
+    }
+
+    /**
+     * @brief Gets the number of pivots of the M-Tree (see usePivots).
+     */
+    size_t getNumPivots() const
+    {
+        return storage.pivots.size();
+    }
+
+    /**
+     * @brief Builds the M-Tree from a set of elements at once, instead of inserting them one by one.
+     *
+     * The elements are recursively clustered into a balanced tree (see BulkLoader). The tree
+     * must be empty; elements can still be inserted one by one afterwards. The pivots chosen
+     * with usePivots are kept.
+     *
+     * @param elements The elements to be indexed.
+     * @param occupancy Fraction of the node capacity filled by the bulk load, in (0, 1].
+     * @param threads Maximum number of threads used to build the subtrees.
+     * @param seed Seed for the sampling of the cluster centers.
+     */
+    void bulkLoad(const std::vector<T> &elements, double occupancy = 0.8, size_t threads = std::thread::hardware_concurrency(), unsigned int seed = 42)
+    {
+        if (size() != 0)
+        {
+            throw std::logic_error("bulkLoad requires an empty M-Tree");
+        }
+        if (elements.empty())
+        {
+            return;
+        }
+
+        for (const T &element : elements)
+        {
+            if (element.size() != elements[0].size())
+            {
+                throw std::invalid_argument("All elements of the M-Tree must have the same dimension");
+            }
+        }
+
+        // Discard the empty root created by the constructor, keeping the pivots
+        storage = Storage(maxNodeCapacity, std::move(storage.pivots));
+        storage.objects = elements;
+        storage.pivots.setObjects(elements, distance, std::max<size_t>(1, threads));
+
+        BulkLoader<T, Metric> loader(storage, distance, occupancy, std::max<size_t>(1, threads), seed);
+        height = loader.load();
+    }
+
+    /**
+     * @brief Reorganizes the leaves of the built M-Tree to reduce the overlap between them (Slim-Down).
+     *
+     * Leaf entries are moved to sibling leaves whose covering ball already holds them, until
+     * no more entry can move. Covering radii shrink, leaves left empty are freed, and searches
+     * read fewer nodes. Only distances to the routing objects of the siblings are computed, so
+     * the pass costs far less than a rebuild. The objects, their ids and the height are kept.
+     *
+     * @param threads Maximum number of threads used to reorganize disjoint groups of leaves.
+     * @return What the pass did (see SlimDown).
+     */
+    SlimDownResult optimize(size_t threads = std::thread::hardware_concurrency())
+    {
+        return SlimDown<T, Metric>(storage, distance).run(std::max<size_t>(1, threads));
+    }
+
+    /**
+     * @brief Saves the M-Tree (nodes and objects) to a binary file.
+     *
+     * See MTreeFileHeader for the layout. Only objects with an ObjectCodec can be saved.
+     *
+     * @param path The path of the file.
+     */
+    void save(const std::string &path) const
+    {
+        saveStorage(path, storage, height);
+    }
 
-        treeSize++;
+    /**
+     * @brief Replaces the contents of the M-Tree with a tree saved by save().
+     *
+     * The file is memory mapped, so the nodes are not read at load time and are shared
+     * between processes that load the same file. The node capacity comes from the file.
+     * The loaded tree can still be searched and inserted into. With FeatureView objects the
+     * feature matrix is used in place as well; Features copy their rows, one allocation each
+     * (see loadStorage), so a large saved tree is best loaded as MTree<FeatureView<float>>.
+     *
+     * @param path The path of the file.
+     */
+    void load(const std::string &path)
+    {
+        size_t loadedHeight;
+        storage = loadStorage<T>(path, loadedHeight);
+        maxNodeCapacity = storage.nodes.getNodeCapacity();
+        height = loadedHeight;
     }
 
     /**
      * @brief Searches for the nearest neighbors of a query element in the M-Tree.
      *
+     * The search does not modify the tree, so it can run concurrently with other searches.
+     *
      * @param query The query element.
      * @param k The number of nearest neighbors to search for.
-     * @return A list of the k nearest neighbors.
-     */
-    NNList<T> knn(const T &query, size_t k) {
-        // Benchmarking
-        nodesAccessed = 0;
-
-        /* Create a list to store the k nearest neighbors, initialized with infinite distance.
-        The list is sorted in ascending order of distance to the query. */
-        NNList<T> nnList(k, std::numeric_limits<double>::infinity());
-        
-        /* Create list of candidates that consists in a node and the lower 
-        bound on the distance between the query and any object in the 
-        subtree defined by the node.
-            dmin = max{d(query, routingObj) - coveringRadius, 0}
-        If dmin = 0, the query is in the subtree defined by the node. */
-        std::vector<std::pair<NodePtr, double>> candidates;
-        
-        // The lower bound doesnt matter for the root node, so initialize it with 0
-        candidates.emplace_back(root, 0.0);
+     * @param stats If not null, receives the SearchStats of the search.
+     * @return The ids of the k nearest neighbors (see getObject), sorted by distance.
+     */
+    NNList knn(const T &query, size_t k, SearchStats *stats = nullptr) const
+    {
+        return knn(query, k, std::numeric_limits<float>::infinity(), stats);
+    }
 
-        KNNDEBUG_MSG("KNN: " << nnList);
-        #ifdef KNNDEBUG
-        printCandidates(candidates);
-        #endif
+    /**
+     * @brief Searches for the nearest neighbors of a query element, using a caller-owned search context.
+     *
+     * Reusing the context across queries (e.g. one per thread) keeps the memory of the
+     * candidate queue. The SearchStats of the search are left in context.stats.
+     *
+     * @param query The query element.
+     * @param k The number of nearest neighbors to search for.
+     * @param context The search state, reset at the start of the search.
+     * @return The ids of the k nearest neighbors (see getObject), sorted by distance.
+     */
+    NNList knn(const T &query, size_t k, SearchContext<T> &context) const
+    {
+        return knn(query, k, std::numeric_limits<float>::infinity(), context);
+    }
 
-        // Search for the k nearest neighbors
-        while (!candidates.empty())
+    /**
+     * @brief Searches for the nearest neighbors of a query element within a maximum distance.
+     *
+     * dk starts at maxDistance instead of infinity, so the search prunes from the first node
+     * on instead of only once it has found k objects (see SearchStats::distancesBeforeBound).
+     *
+     * @param query The query element.
+     * @param k The number of nearest neighbors to search for.
+     * @param maxDistance Objects farther than it are not returned.
+     * @param stats If not null, receives the SearchStats of the search.
+     * @return The ids of the (at most) k nearest neighbors within maxDistance, sorted by distance.
+     */
+    NNList knn(const T &query, size_t k, float maxDistance, SearchStats *stats = nullptr) const
+    {
+        SearchContext<T> context;
+        NNList nnList = knn(query, k, maxDistance, context);
+        if (stats)
         {
-            // Select entry which the lower bound (dmin) is the smallest
-            auto minCandidate = std::min_element(candidates.begin(), candidates.end(), [](const auto &a, const auto &b) {
-                return a.second < b.second;
-            });
-            
-            // Then remove the pair from the candidates list
-            NodePtr node = minCandidate->first;
-            // @ TODO: Why discard the lower bound? Can I be reused?
-            //double dmin = minCandidate->second;
-            candidates.erase(minCandidate);
+            *stats = context.stats;
+        }
+        return nnList;
+    }
+
+    /**
+     * @brief Searches for the nearest neighbors of a query element within a maximum distance, using a caller-owned search context.
+     *
+     * @param query The query element.
+     * @param k The number of nearest neighbors to search for.
+     * @param maxDistance Objects farther than it are not returned.
+     * @param context The search state, reset at the start of the search.
+     * @return The ids of the (at most) k nearest neighbors within maxDistance, sorted by distance.
+     */
+    NNList knn(const T &query, size_t k, float maxDistance, SearchContext<T> &context) const
+    {
+        NNList nnList(k, maxDistance);
+        search(query, nnList, context);
+        return nnList;
+    }
 
-            KNNDEBUG_MSG("Searching in Node" << node->getNodeId() << " (dmin = " << dmin << ", dk = " << nnList.getMaxDistance() << ")");
+    /**
+     * @brief Searches for all the elements within a distance of a query element.
+     *
+     * It is the k-NN search with an unbounded k (see NNList::UNBOUNDED): dk stays at radius
+     * for the whole search.
+     *
+     * @param query The query element.
+     * @param radius The largest distance of an element returned.
+     * @param stats If not null, receives the SearchStats of the search.
+     * @return The ids of the elements within radius, sorted by distance.
+     */
+    NNList rangeQuery(const T &query, float radius, SearchStats *stats = nullptr) const
+    {
+        return knn(query, NNList::UNBOUNDED, radius, stats);
+    }
 
-            nodesAccessed++;
-            node->search(query, nnList, candidates, distance);
+    /**
+     * @brief Searches for all the elements within a distance of a query element, using a caller-owned search context.
+     *
+     * @param query The query element.
+     * @param radius The largest distance of an element returned.
+     * @param context The search state, reset at the start of the search.
+     * @return The ids of the elements within radius, sorted by distance.
+     */
+    NNList rangeQuery(const T &query, float radius, SearchContext<T> &context) const
+    {
+        return knn(query, NNList::UNBOUNDED, radius, context);
+    }
 
-            KNNDEBUG_MSG("KNN: " << nnList);
-            #ifdef KNNDEBUG
-            printCandidates(candidates);
-            #endif
-        }
-        
-        return nnList;
+    /**
+     * @brief Searches for the nearest neighbors of many query elements in parallel.
+     *
+     * Each thread reuses one SearchContext for all the queries it runs.
+     *
+     * @param queries The query elements.
+     * @param k The number of nearest neighbors to search for (NNList::UNBOUNDED for range queries).
+     * @param threads The number of threads to use (including the calling thread).
+     * @param maxDistance Objects farther than it are not returned (infinity by default).
+     * @return The k nearest neighbors of each query, in query order, with the summary of their SearchStats.
+     */
+    KNNBatchResult knnBatch(const std::vector<T> &queries, size_t k, size_t threads, float maxDistance = std::numeric_limits<float>::infinity()) const
+    {
+        std::vector<SearchContext<T>> contexts(std::max<size_t>(1, threads));
+        return runKnnBatch(queries, threads, [this, k, maxDistance, &contexts](const T &query, size_t worker, SearchStats &stats)
+                           {
+            NNList nnList = knn(query, k, maxDistance, contexts[worker]);
+            std::swap(stats, contexts[worker].stats);
+            return nnList; });
+    }
+
+    /**
+     * @brief Starts an incremental search of the nearest neighbors of a query element.
+     *
+     * The iterator yields the neighbors in increasing order of distance, one next() at a time,
+     * and keeps its queue between calls, so more neighbors can be asked for (e.g. to break a
+     * tie among the first k) without searching again. The tree must outlive the iterator and
+     * must not be modified while it is used.
+     *
+     * @param query The query element.
+     * @return The iterator, before the first neighbor.
+     */
+    NNIterator<T, Metric> nnIterator(const T &query) const
+    {
+        checkDimension(query);
+        return NNIterator<T, Metric>(storage, distance, query);
     }
 
     /**
@@ -145,7 +359,18 @@ public:
      */
     size_t size() const
     {
-        return treeSize;
+        return storage.objects.size();
+    }
+
+    /**
+     * @brief Gets an element of the M-Tree by its id (the insertion order).
+     *
+     * @param id The id of the element.
+     * @return The element.
+     */
+    const T &getObject(ObjectId id) const
+    {
+        return storage.objects[id];
     }
 
     /**
@@ -159,23 +384,28 @@ public:
     }
 
     /**
-     * @brief Gets the number of nodes accessed during the last search.
+     * @brief Gets the total number of nodes in the M-Tree.
      *
-     * @return The number of nodes accessed during the last search.
+     * @return The total number of nodes in the M-Tree.
      */
-    size_t getNodesAccessed() const
+    size_t getTotalNodes() const
     {
-        return nodesAccessed;
+        return storage.nodes.size();
     }
 
     /**
-     * @brief Gets the total number of nodes in the M-Tree.
+     * @brief Measures the quality of the structure of the M-Tree: nodes and occupancy per level,
+     * covering radii, fat factor and estimated costs of range queries (see TreeAnalyzer).
      *
-     * @return The total number of nodes in the M-Tree.
+     * Only the point queries of the fat factor and the sampled pairs of objects compute distances,
+     * so builds can be compared without running a query workload.
+     *
+     * @param options The sample sizes and the radii of the range queries.
+     * @return The report.
      */
-    size_t getTotalNodes() const
+    TreeQualityReport analyze(const TreeAnalysisOptions &options = TreeAnalysisOptions()) const
     {
-        return totalNodes;
+        return TreeAnalyzer<T, Metric>(storage, height, distance).analyze(options);
     }
 
     /**
@@ -185,35 +415,119 @@ public:
      * @param mtree The M-Tree to be printed.
      * @return The output stream.
      */
-    friend std::ostream &operator<<(std::ostream &os, const MTree<T> &mtree)
+    friend std::ostream &operator<<(std::ostream &os, const MTree &mtree)
     {
         // Print the M-Tree recursively starting from the root node
         os << "M-Tree:\n";
-        os << *mtree.root;
+        MTree &tree = const_cast<MTree &>(mtree);
+        os << Node<T>(tree.storage, tree.storage.root);
         return os;
     }
 
 private:
+    /**
+     * @brief Runs the search shared by knn and rangeQuery: best-first over the nodes, with dk
+     * the max distance of nnList.
+     *
+     * @param query The query element.
+     * @param nnList The list that receives the neighbors, empty, with its k and maximum distance.
+     * @param context The search state, reset at the start of the search.
+     */
+    void search(const T &query, NNList &nnList, SearchContext<T> &context) const
+    {
+        checkDimension(query);
+        context.reset(query);
+        SearchStats &stats = context.stats;
+        auto start = std::chrono::steady_clock::now();
+        context.measurePivots(storage.pivots, distance);
+
+        /* The context holds a priority queue of candidates that consists in a node and the lower
+        bound on the distance between the query and any object in the
+        subtree defined by the node.
+            dmin = max{d(query, routingObj) - coveringRadius, 0}
+        If dmin = 0, the query is in the subtree defined by the node.
+        Each candidate also keeps d(query, routingObj), needed to search the node. */
+        CandidateQueue &candidates = context.candidates;
+
+        // The lower bound doesnt matter for the root node, so initialize it with 0
+        candidates.push(storage.root, 0.0, 0.0, 0);
+        stats.queueHighWater = 1;
+
+        KNNDEBUG_MSG("KNN: " << nnList);
+        #ifdef KNNDEBUG
+        printCandidates(candidates);
+        #endif
+
+        // Searching only reads the storage, the handles just need a non-const reference to it
+        Storage &searchStorage = const_cast<Storage &>(storage);
+
+        // Search for the k nearest neighbors
+        while (!candidates.empty())
+        {
+            // Select entry which the lower bound (dmin) is the smallest
+            Candidate candidate = candidates.top();
+
+            // dk may have shrunk since the candidate was pushed. As candidates are popped
+            // in ascending order of dmin, if this one cannot contain a neighbor closer than
+            // dk, neither can any of the remaining ones, so the search is over
+            if (candidate.dmin > nnList.getMaxDistance())
+            {
+                KNNDEBUG_MSG("Stopping: dmin = " << candidate.dmin << " > dk = " << nnList.getMaxDistance() << ", " << candidates.size() << " candidates discarded");
+                break;
+            }
+            candidates.pop();
+
+            KNNDEBUG_MSG("Searching in Node" << candidate.node << " (dmin = " << candidate.dmin << ", dk = " << nnList.getMaxDistance() << ")");
+
+            stats.visitNode(candidate.level);
+            context.dQueryParent = candidate.dQueryRouting;
+            context.level = candidate.level;
+            Node<T>(searchStorage, candidate.node).search(nnList, context, distance);
+            stats.queueHighWater = std::max(stats.queueHighWater, candidates.size());
+
+            KNNDEBUG_MSG("KNN: " << nnList);
+            #ifdef KNNDEBUG
+            printCandidates(candidates);
+            #endif
+        }
 
-    void printCandidates(std::vector<std::pair<NodePtr, double>> &candidates) const
+        nnList.finalize();
+        stats.wallTimeMicros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    /**
+     * @brief Checks that an element has the dimension of the objects of the M-Tree.
+     *
+     * The distance functions do not check the sizes of their arguments, so this is done
+     * once per inserted element and per query instead of once per distance computation.
+     *
+     * @param element The element.
+     * @throws std::invalid_argument if the dimensions differ.
+     */
+    void checkDimension(const T &element) const
+    {
+        if (!storage.objects.empty() && element.size() != storage.objects[0].size())
+        {
+            throw std::invalid_argument("The element does not have the dimension of the M-Tree");
+        }
+    }
+
+    void printCandidates(const CandidateQueue &candidates) const
     {
         std::cout << "Candidates: ";
         for (const auto &candidate : candidates)
         {
-            std::cout << "(" << candidate.first->getNodeId() << ", " << candidate.second << ") ";
+            std::cout << "(" << candidate.node << ", " << candidate.dmin << ") ";
         }
         std::cout << std::endl;
     }
 
     
     size_t maxNodeCapacity;         ///< The maximum number of elements a node can hold.
-    DistanceFunction<T> &distance;   ///< Function that computes the distance between two elements of type T.
-    size_t treeSize;                ///< Number of elements in the M-Tree.
+    Metric distance;                ///< Function that computes the distance between two elements of type T.
+    Split splitPolicy;              ///< Promotion and partition used to split overflown nodes.
+    Storage storage;                ///< Node arena and objects of the M-Tree.
     size_t height;                  ///< Height of the M-Tree.
-    NodePtr root;                   ///< Pointer to the root node of the M-Tree.
-    
-    // Parameters for benchmarking
-    size_t nodesAccessed;           ///< Number of nodes accessed during search.
 };
 
 #endif // MTREE_HPP
\ No newline at end of file
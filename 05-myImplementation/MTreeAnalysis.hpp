@@ -0,0 +1,346 @@
+#ifndef MTREEANALYSIS_HPP
+#define MTREEANALYSIS_HPP
+
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <ostream>
+#include <ios>
+#include "MTreeStorage.hpp"
+#include "indexing/SearchStats.hpp"
+
+/**
+ * @brief Parameters of the analysis of an M-Tree (see TreeAnalyzer).
+ */
+struct TreeAnalysisOptions
+{
+    size_t fatFactorSample = 10000;   ///< Objects whose point query is counted for the fat factor (0 for all)
+    size_t distanceSample = 10000;    ///< Pairs of objects sampled to estimate the distance distribution
+    std::vector<double> radii;        ///< Radii of the range queries to estimate (empty for rangeQuantiles of the distances)
+    std::vector<double> rangeQuantiles = {0.001, 0.01, 0.1}; ///< Fractions of the distance distribution used as default radii
+    unsigned int seed = 42;           ///< Seed of the samples
+};
+
+/**
+ * @brief Shape of one level of an M-Tree, the root being level 0.
+ */
+struct LevelQuality
+{
+    size_t nodes;                               ///< Number of nodes of the level
+    size_t entries;                             ///< Number of entries in those nodes
+    double meanOccupancy;                       ///< Mean fraction of the node capacity used
+    SearchStatsSummary::Percentiles coveringRadius; ///< Covering radii of the entries (all 0 in leaves)
+};
+
+/**
+ * @brief Estimated cost of a range query of a given radius.
+ */
+struct RangeCostEstimate
+{
+    double radius;               ///< Radius of the query
+    double selectivity;          ///< Fraction of the objects expected in the answer, F(radius)
+    double nodesAccessed;        ///< Expected number of nodes read
+    double distanceComputations; ///< Expected number of distances computed (an upper bound, see TreeAnalyzer)
+};
+
+/**
+ * @brief How good the structure of an M-Tree is, without running queries against it.
+ */
+struct TreeQualityReport
+{
+    size_t numObjects;                          ///< Number of indexed objects
+    size_t totalNodes;                          ///< Number of nodes reachable from the root
+    size_t height;                              ///< Number of levels
+    size_t nodeCapacity;                        ///< Maximum number of entries of a node
+    std::vector<LevelQuality> levels;           ///< Per level, from the root down
+    std::vector<size_t> occupancyHistogram;     ///< Nodes per tenth of the capacity used (the last bucket includes full nodes)
+    double fatFactor;                           ///< Slim-tree fat factor, 0 for no overlap and 1 for the worst tree
+    size_t fatFactorSample;                     ///< Number of point queries the fat factor was computed from
+    std::vector<RangeCostEstimate> rangeCosts;  ///< Estimated costs of range queries
+
+    /**
+     * @brief Prints the report as text.
+     *
+     * @param os The output stream.
+     */
+    void print(std::ostream &os) const
+    {
+        os << "Objects: " << numObjects << ", Nodes: " << totalNodes << ", Height: " << height << ", Node capacity: " << nodeCapacity << "\n";
+        os << "Fat factor: " << fatFactor << " (" << fatFactorSample << " point queries)\n";
+        for (size_t level = 0; level < levels.size(); level++)
+        {
+            const LevelQuality &l = levels[level];
+            os << "Level " << level << ": " << l.nodes << " nodes, " << l.entries << " entries, occupancy " << l.meanOccupancy * 100 << "%";
+            if (l.coveringRadius.max > 0)
+            {
+                os << ", covering radius mean " << l.coveringRadius.mean << " p50 " << l.coveringRadius.p50 << " p90 " << l.coveringRadius.p90 << " max " << l.coveringRadius.max;
+            }
+            os << "\n";
+        }
+        os << "Occupancy histogram (tenths of the capacity):";
+        for (size_t count : occupancyHistogram)
+        {
+            os << " " << count;
+        }
+        os << "\n";
+        for (const RangeCostEstimate &cost : rangeCosts)
+        {
+            os << "Range query r = " << cost.radius << " (selectivity " << cost.selectivity << "): " << cost.nodesAccessed << " nodes, " << cost.distanceComputations << " distances\n";
+        }
+    }
+
+    /**
+     * @brief Writes the report as a JSON object.
+     *
+     * @param os The output stream.
+     */
+    void writeJson(std::ostream &os) const
+    {
+        std::ios_base::fmtflags flags = os.flags(std::ios_base::fmtflags());
+        std::streamsize precision = os.precision(15);
+        os << "{\"numObjects\": " << numObjects << ", \"totalNodes\": " << totalNodes << ", \"height\": " << height
+           << ", \"nodeCapacity\": " << nodeCapacity << ", \"fatFactor\": " << fatFactor << ", \"fatFactorSample\": " << fatFactorSample
+           << ", \"levels\": [";
+        for (size_t level = 0; level < levels.size(); level++)
+        {
+            const LevelQuality &l = levels[level];
+            os << (level > 0 ? ", " : "") << "{\"nodes\": " << l.nodes << ", \"entries\": " << l.entries << ", \"meanOccupancy\": " << l.meanOccupancy
+               << ", \"coveringRadius\": {\"mean\": " << l.coveringRadius.mean << ", \"stddev\": " << l.coveringRadius.stddev
+               << ", \"p50\": " << l.coveringRadius.p50 << ", \"p90\": " << l.coveringRadius.p90 << ", \"p99\": " << l.coveringRadius.p99
+               << ", \"max\": " << l.coveringRadius.max << "}}";
+        }
+        os << "], \"occupancyHistogram\": [";
+        for (size_t i = 0; i < occupancyHistogram.size(); i++)
+        {
+            os << (i > 0 ? ", " : "") << occupancyHistogram[i];
+        }
+        os << "], \"rangeCosts\": [";
+        for (size_t i = 0; i < rangeCosts.size(); i++)
+        {
+            const RangeCostEstimate &cost = rangeCosts[i];
+            os << (i > 0 ? ", " : "") << "{\"radius\": " << cost.radius << ", \"selectivity\": " << cost.selectivity
+               << ", \"nodesAccessed\": " << cost.nodesAccessed << ", \"distanceComputations\": " << cost.distanceComputations << "}";
+        }
+        os << "]}";
+        os.flags(flags);
+        os.precision(precision);
+    }
+};
+
+/**
+ * @brief Computes the TreeQualityReport of an M-Tree.
+ *
+ * The fat factor is the one of the Slim-tree (Traina et al., "Slim-trees: High Performance
+ * Metric Trees Minimizing Overlap Between Nodes"): a point query is run for each object,
+ * counting the nodes whose covering ball contains it, and with Ic the total count, H the
+ * height, N the number of objects and M the number of nodes
+ *     fat = (Ic - H * N) / N * 1 / (M - H)
+ * which is 0 when every point query reads a single path. With a sample of s objects, Ic is
+ * estimated as N / s times the count of the sample.
+ *
+ * The range query costs use the node-based cost model of the M-tree (Ciaccia, Patella and
+ * Zezula, "A Cost Model for Similarity Queries in Metric Spaces"): a node with covering radius
+ * r is read with probability F(r + rQ), F being the distribution of the distances between
+ * objects, estimated from sampled pairs. Every entry of a node that is read counts as a
+ * distance computation, so pruning by the distances to the parent only makes the real
+ * number lower.
+ *
+ * @tparam T The type of elements stored in the M-Tree.
+ * @tparam Metric The distance function of the M-Tree.
+ */
+template <typename T, typename Metric>
+class TreeAnalyzer
+{
+public:
+    /**
+     * @brief Constructs the analyzer of a tree.
+     *
+     * @param storage The nodes and objects of the tree.
+     * @param height The height of the tree.
+     * @param distance The distance function of the tree.
+     */
+    TreeAnalyzer(const MTreeStorage<T> &storage, size_t height, const Metric &distance)
+        : storage(storage), nodes(storage.nodes), height(height), distance(distance) {}
+
+    /**
+     * @brief Runs the analysis.
+     *
+     * @param options The sample sizes and the radii of the range queries.
+     * @return The report.
+     */
+    TreeQualityReport analyze(const TreeAnalysisOptions &options) const
+    {
+        TreeQualityReport report;
+        report.numObjects = storage.objects.size();
+        report.totalNodes = 0;
+        report.height = height;
+        report.nodeCapacity = nodes.getNodeCapacity();
+        report.occupancyHistogram.assign(10, 0);
+        report.fatFactor = 0.0;
+        report.fatFactorSample = 0;
+
+        // Covering radii of each level, and the (radius, entries) of every non-root node for the cost model
+        std::vector<std::vector<double>> radii;
+        std::vector<std::pair<float, size_t>> coveredNodes;
+        collectLevels(storage.root, 0, report, radii, coveredNodes);
+        for (size_t level = 0; level < report.levels.size(); level++)
+        {
+            LevelQuality &l = report.levels[level];
+            l.meanOccupancy = static_cast<double>(l.entries) / (l.nodes * report.nodeCapacity);
+            l.coveringRadius = SearchStatsSummary::distribution(radii[level]);
+        }
+
+        std::mt19937 gen(options.seed);
+        computeFatFactor(options.fatFactorSample, gen, report);
+        estimateRangeCosts(options, gen, coveredNodes, report);
+        return report;
+    }
+
+private:
+    // Visits the subtree of node, which is at the given level
+    void collectLevels(NodeIndex node, size_t level, TreeQualityReport &report, std::vector<std::vector<double>> &radii,
+                       std::vector<std::pair<float, size_t>> &coveredNodes) const
+    {
+        if (level >= report.levels.size())
+        {
+            report.levels.resize(level + 1, LevelQuality{0, 0, 0.0, SearchStatsSummary::Percentiles()});
+            radii.resize(level + 1);
+        }
+
+        const NodeHeader &header = nodes.header(node);
+        const size_t numEntries = header.numEntries;
+        report.totalNodes++;
+        report.levels[level].nodes++;
+        report.levels[level].entries += numEntries;
+        report.occupancyHistogram[std::min<size_t>(9, numEntries * 10 / nodes.getNodeCapacity())]++;
+
+        const float *coveringRadii = nodes.coveringRadii(node);
+        const NodeIndex *children = nodes.children(node);
+        for (size_t i = 0; i < numEntries; i++)
+        {
+            radii[level].push_back(header.isLeaf ? 0.0 : coveringRadii[i]);
+            if (!header.isLeaf)
+            {
+                coveredNodes.push_back(std::make_pair(coveringRadii[i], nodes.header(children[i]).numEntries));
+                collectLevels(children[i], level + 1, report, radii, coveredNodes);
+            }
+        }
+    }
+
+    // Number of nodes whose covering ball contains the object, in the subtree of node
+    size_t pointQueryNodes(NodeIndex node, const T &object) const
+    {
+        const NodeHeader &header = nodes.header(node);
+        size_t count = 1;
+        if (header.isLeaf)
+        {
+            return count;
+        }
+        const ObjectId *objectIds = nodes.objectIds(node);
+        const float *coveringRadii = nodes.coveringRadii(node);
+        const NodeIndex *children = nodes.children(node);
+        for (size_t i = 0; i < header.numEntries; i++)
+        {
+            if (distance(object, storage.objects[objectIds[i]]) <= coveringRadii[i])
+            {
+                count += pointQueryNodes(children[i], object);
+            }
+        }
+        return count;
+    }
+
+    void computeFatFactor(size_t sample, std::mt19937 &gen, TreeQualityReport &report) const
+    {
+        const size_t n = storage.objects.size();
+        if (n == 0)
+        {
+            return;
+        }
+        std::vector<ObjectId> ids(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            ids[i] = static_cast<ObjectId>(i);
+        }
+        size_t s = sample == 0 ? n : std::min(sample, n);
+        if (s < n)
+        {
+            // Partial Fisher-Yates shuffle: the first s ids are a uniform sample
+            for (size_t i = 0; i < s; i++)
+            {
+                std::uniform_int_distribution<size_t> pick(i, n - 1);
+                std::swap(ids[i], ids[pick(gen)]);
+            }
+        }
+
+        double accesses = 0.0;
+        for (size_t i = 0; i < s; i++)
+        {
+            accesses += pointQueryNodes(storage.root, storage.objects[ids[i]]);
+        }
+        double ic = accesses * n / s;
+        double h = static_cast<double>(height);
+        double m = static_cast<double>(report.totalNodes);
+        report.fatFactorSample = s;
+        report.fatFactor = m > h ? std::max(0.0, (ic - h * n) / n / (m - h)) : 0.0;
+    }
+
+    void estimateRangeCosts(const TreeAnalysisOptions &options, std::mt19937 &gen, const std::vector<std::pair<float, size_t>> &coveredNodes,
+                            TreeQualityReport &report) const
+    {
+        const size_t n = storage.objects.size();
+        if (n < 2)
+        {
+            return;
+        }
+
+        // Distance distribution, from random pairs of distinct objects
+        std::vector<double> distances(std::max<size_t>(1, options.distanceSample));
+        std::uniform_int_distribution<size_t> pick(0, n - 1);
+        for (double &d : distances)
+        {
+            size_t a = pick(gen);
+            size_t b = pick(gen);
+            while (b == a)
+            {
+                b = pick(gen);
+            }
+            d = distance(storage.objects[a], storage.objects[b]);
+        }
+        std::sort(distances.begin(), distances.end());
+        auto cdf = [&distances](double x)
+        {
+            return static_cast<double>(std::upper_bound(distances.begin(), distances.end(), x) - distances.begin()) / distances.size();
+        };
+
+        std::vector<double> radii = options.radii;
+        if (radii.empty())
+        {
+            for (double q : options.rangeQuantiles)
+            {
+                size_t index = std::min(distances.size() - 1, static_cast<size_t>(q * distances.size()));
+                radii.push_back(distances[index]);
+            }
+        }
+
+        // The root is always read and all of its entries compared with the query
+        const double rootEntries = nodes.header(storage.root).numEntries;
+        for (double r : radii)
+        {
+            RangeCostEstimate cost{r, cdf(r), 1.0, rootEntries};
+            for (const auto &node : coveredNodes)
+            {
+                double p = cdf(node.first + r);
+                cost.nodesAccessed += p;
+                cost.distanceComputations += p * node.second;
+            }
+            report.rangeCosts.push_back(cost);
+        }
+    }
+
+    const MTreeStorage<T> &storage;
+    const NodeArena &nodes;
+    size_t height;
+    const Metric &distance;
+};
+
+#endif // MTREEANALYSIS_HPP
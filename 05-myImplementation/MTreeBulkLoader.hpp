@@ -0,0 +1,352 @@
+#ifndef MTREEBULKLOADER_HPP
+#define MTREEBULKLOADER_HPP
+
+#include <vector>
+#include <random>
+#include <future>
+#include <atomic>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include "MTreeStorage.hpp"
+#include "MTreeNodes.hpp"
+
+/**
+ * @brief Builds an M-Tree from all its objects at once.
+ *
+ * The objects are recursively clustered top-down: at each node a sample of the
+ * objects is used to pick well spread centers (farthest-first traversal), every
+ * object is assigned to its nearest center with room, and each cluster becomes a
+ * subtree routed by its center. Cluster sizes are capped so that all leaves end at
+ * the same depth and every node holds at most occupancy * nodeCapacity entries.
+ *
+ * The distances computed while assigning objects to the centers are exactly the
+ * distances to the parent routing object, so the covering radii and the distances
+ * to the parent of the whole tree come out of the clustering without extra distance
+ * calls. Clustering runs in parallel across subtrees; the nodes are written to the
+ * arena afterwards, in a single serial pass.
+ *
+ * @tparam T The type of elements stored in the M-Tree.
+ * @tparam Metric The distance function.
+ */
+template <typename T, typename Metric>
+class BulkLoader
+{
+public:
+    /**
+     * @brief Constructs a loader for the objects already in the storage.
+     *
+     * @param storage The (empty) tree storage, with the objects to be indexed.
+     * @param distance The distance function.
+     * @param occupancy Fraction of the node capacity that is filled, in (0, 1].
+     * @param threads Maximum number of threads used to cluster subtrees.
+     * @param seed Seed for the sampling of the centers.
+     */
+    BulkLoader(MTreeStorage<T> &storage, const Metric &distance, double occupancy, size_t threads, unsigned int seed)
+        : storage(storage), distance(distance), seed(seed), freeThreads(static_cast<int>(threads) - 1)
+    {
+        if (occupancy <= 0.0 || occupancy > 1.0)
+        {
+            throw std::invalid_argument("Occupancy must be in (0, 1]");
+        }
+        fill = std::max<size_t>(2, static_cast<size_t>(occupancy * storage.nodes.getNodeCapacity()));
+        fill = std::min(fill, storage.nodes.getNodeCapacity());
+    }
+
+    /**
+     * @brief Builds the tree.
+     *
+     * @return The height of the tree.
+     */
+    size_t load()
+    {
+        size_t n = storage.objects.size();
+
+        // Smallest height whose leaves can hold all objects
+        size_t height = 1;
+        size_t subtreeCapacity = fill;
+        while (subtreeCapacity < n)
+        {
+            subtreeCapacity *= fill;
+            height++;
+        }
+
+        std::vector<ObjectId> ids(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            ids[i] = static_cast<ObjectId>(i);
+        }
+        // The entries of the root have no parent routing object
+        std::vector<float> distances(n, std::numeric_limits<float>::infinity());
+
+        PlannedNode root = build(ids, distances, height, seed);
+        storage.root = write(root);
+        storage.nodes.header(storage.root).isRoot = true;
+        return height;
+    }
+
+private:
+    /**
+     * @brief A node of the tree before it is written to the arena.
+     */
+    struct PlannedNode
+    {
+        bool isLeaf;
+        std::vector<ObjectId> objectIds;
+        std::vector<float> coveringRadii;
+        std::vector<float> distancesToParent;
+        std::vector<PlannedNode> children; ///< Subtrees of the entries (internal nodes only)
+    };
+
+    /// Subtrees smaller than this are always clustered by the calling thread
+    static const size_t PARALLEL_THRESHOLD = 2048;
+
+    /**
+     * @brief Clusters a set of objects into a subtree of the given height.
+     *
+     * @param ids The objects of the subtree.
+     * @param distances The distance between each object and the routing object of the subtree.
+     * @param height The height of the subtree (1 for a leaf).
+     * @param nodeSeed Seed for the sampling of this node.
+     */
+    PlannedNode build(const std::vector<ObjectId> &ids, const std::vector<float> &distances, size_t height, uint64_t nodeSeed)
+    {
+        PlannedNode node;
+        node.isLeaf = height == 1;
+        if (node.isLeaf)
+        {
+            node.objectIds = ids;
+            node.distancesToParent = distances;
+            node.coveringRadii.assign(ids.size(), 0.0f);
+            return node;
+        }
+
+        // Each child subtree holds at most fill^(height - 1) objects
+        size_t childCapacity = 1;
+        for (size_t h = 1; h < height; h++)
+        {
+            childCapacity *= fill;
+        }
+        size_t numClusters = (ids.size() + childCapacity - 1) / childCapacity;
+        numClusters = std::min(std::max<size_t>(numClusters, std::min<size_t>(2, ids.size())), fill);
+
+        std::mt19937_64 gen(nodeSeed);
+        std::vector<size_t> centers = pickCenters(ids, numClusters, gen);
+
+        // Assign every object to the nearest center with room
+        std::vector<std::vector<size_t>> clusters;
+        std::vector<float> distanceToCenter;
+        assign(ids, centers, childCapacity, clusters, distanceToCenter);
+
+        // Cluster the subtrees, in parallel when they are big enough and there are threads available
+        std::vector<std::future<PlannedNode>> pending(centers.size());
+        for (size_t c = 0; c < centers.size(); c++)
+        {
+            if (clusters[c].empty())
+            {
+                continue;
+            }
+
+            std::vector<ObjectId> childIds;
+            std::vector<float> childDistances;
+            childIds.reserve(clusters[c].size());
+            childDistances.reserve(clusters[c].size());
+            for (size_t i : clusters[c])
+            {
+                childIds.push_back(ids[i]);
+                childDistances.push_back(distanceToCenter[i]);
+            }
+
+            node.objectIds.push_back(ids[centers[c]]);
+            node.distancesToParent.push_back(distances[centers[c]]);
+            uint64_t childSeed = nodeSeed * 6364136223846793005ULL + c + 1;
+
+            if (childIds.size() >= PARALLEL_THRESHOLD && freeThreads.fetch_sub(1) > 0)
+            {
+                pending[node.children.size()] = std::async(std::launch::async, [this, childIds, childDistances, height, childSeed]()
+                                                          {
+                    PlannedNode child = build(childIds, childDistances, height - 1, childSeed);
+                    freeThreads.fetch_add(1);
+                    return child; });
+                node.children.emplace_back();
+            }
+            else
+            {
+                if (childIds.size() >= PARALLEL_THRESHOLD)
+                {
+                    freeThreads.fetch_add(1);
+                }
+                node.children.push_back(build(childIds, childDistances, height - 1, childSeed));
+            }
+        }
+
+        // The covering radius of each entry is max{d(routing, e) + r(e)} over the entries e of its subtree
+        node.coveringRadii.resize(node.children.size());
+        for (size_t c = 0; c < node.children.size(); c++)
+        {
+            if (pending[c].valid())
+            {
+                node.children[c] = pending[c].get();
+            }
+
+            const PlannedNode &child = node.children[c];
+            float radius = 0.0f;
+            for (size_t i = 0; i < child.objectIds.size(); i++)
+            {
+                radius = std::max(radius, child.distancesToParent[i] + child.coveringRadii[i]);
+            }
+            node.coveringRadii[c] = radius;
+        }
+
+        return node;
+    }
+
+    /**
+     * @brief Picks well spread centers by farthest-first traversal over a sample of the objects.
+     *
+     * @return The positions (in ids) of the centers.
+     */
+    std::vector<size_t> pickCenters(const std::vector<ObjectId> &ids, size_t numCenters, std::mt19937_64 &gen) const
+    {
+        // Sample a few objects per center
+        size_t sampleSize = std::min(ids.size(), std::max<size_t>(8 * numCenters, 64));
+        std::vector<size_t> sample(ids.size());
+        for (size_t i = 0; i < ids.size(); i++)
+        {
+            sample[i] = i;
+        }
+        for (size_t i = 0; i < sampleSize; i++)
+        {
+            std::uniform_int_distribution<size_t> pick(i, ids.size() - 1);
+            std::swap(sample[i], sample[pick(gen)]);
+        }
+        sample.resize(sampleSize);
+
+        // Start from a random sample and repeatedly take the one farthest from the chosen centers
+        std::vector<size_t> centers;
+        std::vector<float> nearest(sampleSize, std::numeric_limits<float>::infinity());
+        size_t next = 0;
+        while (centers.size() < numCenters)
+        {
+            centers.push_back(sample[next]);
+            const T &center = storage.objects[ids[sample[next]]];
+
+            float farthest = -1.0f;
+            for (size_t s = 0; s < sampleSize; s++)
+            {
+                nearest[s] = std::min(nearest[s], static_cast<float>(distance(center, storage.objects[ids[sample[s]]])));
+                if (nearest[s] > farthest)
+                {
+                    farthest = nearest[s];
+                    next = s;
+                }
+            }
+        }
+        return centers;
+    }
+
+    /**
+     * @brief Assigns every object to its nearest center, without exceeding the capacity of a cluster.
+     *
+     * Objects of overflowing clusters that are farthest from their center move to the
+     * nearest center that still has room.
+     *
+     * @param clusters Output, the positions (in ids) of the objects of each cluster.
+     * @param distanceToCenter Output, the distance between each object and the center of its cluster.
+     */
+    void assign(const std::vector<ObjectId> &ids, const std::vector<size_t> &centers, size_t capacity,
+                std::vector<std::vector<size_t>> &clusters, std::vector<float> &distanceToCenter) const
+    {
+        clusters.assign(centers.size(), std::vector<size_t>());
+        distanceToCenter.assign(ids.size(), 0.0f);
+
+        // Centers always belong to their own cluster
+        std::vector<size_t> centerOf(ids.size(), centers.size());
+        for (size_t c = 0; c < centers.size(); c++)
+        {
+            centerOf[centers[c]] = c;
+        }
+
+        for (size_t i = 0; i < ids.size(); i++)
+        {
+            size_t best = centerOf[i];
+            float bestDistance = 0.0f;
+            if (best == centers.size())
+            {
+                const T &object = storage.objects[ids[i]];
+                bestDistance = std::numeric_limits<float>::infinity();
+                for (size_t c = 0; c < centers.size(); c++)
+                {
+                    float dist = distance(object, storage.objects[ids[centers[c]]]);
+                    if (dist < bestDistance)
+                    {
+                        bestDistance = dist;
+                        best = c;
+                    }
+                }
+            }
+            clusters[best].push_back(i);
+            distanceToCenter[i] = bestDistance;
+        }
+
+        // Take the farthest objects out of the clusters that are over capacity
+        std::vector<size_t> overflow;
+        for (auto &cluster : clusters)
+        {
+            if (cluster.size() <= capacity)
+            {
+                continue;
+            }
+            std::sort(cluster.begin(), cluster.end(), [&distanceToCenter](size_t a, size_t b)
+                      { return distanceToCenter[a] < distanceToCenter[b]; });
+            overflow.insert(overflow.end(), cluster.begin() + capacity, cluster.end());
+            cluster.resize(capacity);
+        }
+
+        for (size_t i : overflow)
+        {
+            const T &object = storage.objects[ids[i]];
+            size_t best = 0;
+            float bestDistance = std::numeric_limits<float>::infinity();
+            for (size_t c = 0; c < centers.size(); c++)
+            {
+                if (clusters[c].size() >= capacity)
+                {
+                    continue;
+                }
+                float dist = distance(object, storage.objects[ids[centers[c]]]);
+                if (dist < bestDistance)
+                {
+                    bestDistance = dist;
+                    best = c;
+                }
+            }
+            clusters[best].push_back(i);
+            distanceToCenter[i] = bestDistance;
+        }
+    }
+
+    /**
+     * @brief Writes a planned subtree into the arena.
+     *
+     * @return The index of the root of the subtree.
+     */
+    NodeIndex write(const PlannedNode &planned)
+    {
+        NodeIndex index = storage.nodes.allocate(planned.isLeaf);
+        for (size_t i = 0; i < planned.objectIds.size(); i++)
+        {
+            NodeIndex subtree = planned.isLeaf ? NULL_NODE : write(planned.children[i]);
+            Node<T>(storage, index).appendEntry(RoutingEntry{planned.objectIds[i], planned.coveringRadii[i], subtree}, planned.distancesToParent[i]);
+        }
+        return index;
+    }
+
+    MTreeStorage<T> &storage;     ///< The storage of the tree being built
+    const Metric &distance;       ///< The distance function
+    size_t fill;                  ///< Number of entries of a full node
+    uint64_t seed;                ///< Seed for the sampling of the centers
+    std::atomic<int> freeThreads; ///< Number of threads that can still be started
+};
+
+#endif // MTREEBULKLOADER_HPP
@@ -0,0 +1,970 @@
+#ifndef MTREECONCURRENT_HPP
+#define MTREECONCURRENT_HPP
+
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include <chrono>
+#include <cmath>
+#include "MTreeStorage.hpp"
+#include "MTreeSplitPolicies.hpp"
+#include "MTreeSearchContext.hpp"
+#include "includes/EpochReclaimer.hpp"
+#include "indexing/NNList.hpp"
+#include "indexing/SearchStats.hpp"
+#include "indexing/DistanceFunction.hpp"
+
+/**
+ * @brief An array that only grows, whose elements never move, and that can be read while it grows.
+ *
+ * Segment s holds FIRST_SEGMENT << s elements and is allocated the first time one of its
+ * elements is reserved, so MAX_SEGMENTS segments hold more than 2^32 elements and an element
+ * is found with a bit scan. The elements are default-constructed with their segment.
+ *
+ * @tparam E The type of the elements.
+ */
+template <typename E>
+class SegmentedArray
+{
+public:
+    static const size_t FIRST_SEGMENT_BITS = 10;                      ///< log2 of the size of the first segment
+    static const size_t FIRST_SEGMENT = size_t(1) << FIRST_SEGMENT_BITS; ///< Size of the first segment
+    static const size_t MAX_SEGMENTS = 32;                            ///< Number of segments
+
+    SegmentedArray()
+    {
+        for (std::atomic<E *> &segment : segments)
+        {
+            segment.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~SegmentedArray()
+    {
+        for (std::atomic<E *> &segment : segments)
+        {
+            delete[] segment.load(std::memory_order_relaxed);
+        }
+    }
+
+    SegmentedArray(const SegmentedArray &) = delete;
+    SegmentedArray &operator=(const SegmentedArray &) = delete;
+
+    /**
+     * @brief Makes an element addressable, allocating its segment if needed. Thread safe.
+     *
+     * @param i The index of the element.
+     */
+    void reserve(size_t i)
+    {
+        std::atomic<E *> &segment = segments[segmentOf(i)];
+        if (!segment.load(std::memory_order_acquire))
+        {
+            E *allocated = new E[segmentSize(segmentOf(i))];
+            E *expected = nullptr;
+            if (!segment.compare_exchange_strong(expected, allocated, std::memory_order_acq_rel))
+            {
+                // Another thread allocated it first
+                delete[] allocated;
+            }
+        }
+    }
+
+    E &operator[](size_t i)
+    {
+        const size_t s = segmentOf(i);
+        return segments[s].load(std::memory_order_acquire)[i - segmentStart(s)];
+    }
+
+    const E &operator[](size_t i) const
+    {
+        const size_t s = segmentOf(i);
+        return segments[s].load(std::memory_order_acquire)[i - segmentStart(s)];
+    }
+
+private:
+    // Segment s starts at FIRST_SEGMENT * (2^s - 1)
+    static size_t segmentOf(size_t i)
+    {
+        unsigned long long v = (i >> FIRST_SEGMENT_BITS) + 1;
+#ifdef __GNUC__
+        return 63 - __builtin_clzll(v);
+#else
+        size_t s = 0;
+        while (v >>= 1)
+        {
+            s++;
+        }
+        return s;
+#endif
+    }
+
+    static size_t segmentStart(size_t s) { return ((size_t(1) << s) - 1) << FIRST_SEGMENT_BITS; }
+    static size_t segmentSize(size_t s) { return FIRST_SEGMENT << s; }
+
+    std::atomic<E *> segments[MAX_SEGMENTS]; ///< The segments, null until reserved
+};
+
+/**
+ * @brief A node of a ConcurrentMTree.
+ *
+ * Writers latch a node to change it. Readers never do: the entries below numEntries are
+ * never rewritten, except for the covering radii, which only grow, and the children, which
+ * are replaced by copies holding the same objects. A node whose entries must change in any
+ * other way is copied, and the copy replaces it with a single store in its parent.
+ */
+struct ConcurrentNode
+{
+    std::mutex latch;                                       ///< Held by the writer that changes the node
+    std::atomic<uint32_t> numEntries{0};                    ///< Number of entries the readers can see
+    std::atomic<bool> obsolete{false};                      ///< Set once a copy replaced the node; a writer that latches it starts over
+    bool isLeaf = true;                                     ///< Whether the node stores objects (leaf) or routing objects (internal)
+    std::unique_ptr<ObjectId[]> objectIds;                  ///< Object of each entry
+    std::unique_ptr<std::atomic<float>[]> coveringRadii;    ///< Covering radius of each entry (0 in a leaf)
+    std::unique_ptr<float[]> distancesToParent;             ///< Distance between each entry and the routing object of the node
+    std::unique_ptr<std::atomic<NodeIndex>[]> children;     ///< Subtree of each entry (NULL_NODE in a leaf)
+};
+
+/**
+ * @brief What the inserts into a ConcurrentMTree did so far.
+ */
+struct ConcurrentInsertStats
+{
+    size_t inserts = 0;            ///< Objects inserted
+    size_t restarts = 0;           ///< Descents started over because a node of the path was replaced
+    size_t pessimisticInserts = 0; ///< Inserts that latched their path from the root because the leaf was full
+    size_t splits = 0;             ///< Nodes split
+    size_t retiredNodes = 0;       ///< Nodes replaced by copies or splits
+    size_t pendingNodes = 0;       ///< Replaced nodes that a reader may still read, not reused yet
+};
+
+/**
+ * @brief An M-Tree that can be searched while several threads insert into it.
+ *
+ * Readers never latch and never wait: they enter through an EpochReclaimer guard and read
+ * the nodes as they are. A node only changes in ways a reader can see at any time (an entry
+ * appended to a leaf, a covering radius that grows, a child replaced by a copy), and any other
+ * change is made on copies, linked with a single store in the parent (or the root). A reader
+ * that already left the parent keeps reading the old nodes, which hold the same objects. The
+ * replaced nodes are reused once no reader can reach them anymore.
+ *
+ * An insert first descends without latching to choose the subtree at each level, latching
+ * each node only to grow the covering radius of the chosen entry and to check that the node
+ * was not replaced meanwhile (otherwise it starts over from the root). A growth is never
+ * wrong, so nothing needs to be undone. If the leaf has room the object is appended to it.
+ * Otherwise the insert starts over with latch coupling: it latches the path from the root,
+ * releasing the latches above the parent of each node that has room, since a split stops
+ * there; the split nodes and the first ancestor with room are replaced by new nodes, up to a
+ * new root if the root splits.
+ *
+ * An object whose insert returned is found by every search that starts afterwards. Unlike
+ * MTree, the tree has no pivots and is not saved, bulk loaded or optimized.
+ *
+ * @tparam T The type of elements stored in the M-Tree.
+ * @tparam Metric The distance function (see indexing/DistanceFunction.hpp), called without virtual dispatch.
+ * @tparam Split The policy used to split overflown nodes (see MTreeSplitPolicies.hpp); its calls are serialized.
+ */
+template <typename T, typename Metric = EuclideanDistance<T>, typename Split = DefaultSplitPolicy>
+class ConcurrentMTree
+{
+public:
+    /**
+     * @brief Constructs an empty tree, whose root is a leaf.
+     *
+     * @param maxNodeCapacity The maximum number of entries of a node.
+     * @param distance The distance function, a metric.
+     * @param splitPolicy The split policy.
+     */
+    ConcurrentMTree(size_t maxNodeCapacity, const Metric &distance = Metric(), const Split &splitPolicy = Split())
+        : capacity(maxNodeCapacity), distance(distance), splitPolicy(splitPolicy), dimension(0), nextObjectId(0), height(1), allocatedNodes(0),
+          inserted(0), restarts(0), pessimisticInserts(0), splits(0), retiredNodes(0)
+    {
+        if (maxNodeCapacity < 2)
+        {
+            throw std::invalid_argument("The node capacity must be at least 2");
+        }
+        root.store(allocateNode(true));
+    }
+
+    ConcurrentMTree(const ConcurrentMTree &) = delete;
+    ConcurrentMTree &operator=(const ConcurrentMTree &) = delete;
+
+    /**
+     * @brief Inserts an element. Can be called by several threads at once, and while others search.
+     *
+     * @param element The element to be inserted.
+     * @return The id of the element (see getObject).
+     */
+    ObjectId insert(const T &element)
+    {
+        // The first insert sets the dimension of the tree
+        size_t unset = 0;
+        dimension.compare_exchange_strong(unset, element.size());
+        checkDimension(element);
+
+        // The object is stored before any node refers to it
+        ObjectId objectId = static_cast<ObjectId>(nextObjectId.fetch_add(1));
+        objects.reserve(objectId);
+        objects[objectId] = element;
+
+        EpochReclaimer::Guard guard = epochs.enter();
+        for (;;)
+        {
+            Outcome outcome = insertOptimistic(objectId);
+            if (outcome == INSERTED || (outcome == LEAF_FULL && insertPessimistic(objectId)))
+            {
+                break;
+            }
+            restarts.fetch_add(1, std::memory_order_relaxed);
+        }
+        inserted.fetch_add(1);
+        return objectId;
+    }
+
+    /**
+     * @brief Searches for the k nearest neighbors of a query element. Never waits for the inserts.
+     *
+     * @param query The query element.
+     * @param k The number of nearest neighbors to search for.
+     * @param stats If not null, receives the SearchStats of the search.
+     * @return The ids of the k nearest neighbors, sorted by distance.
+     */
+    NNList knn(const T &query, size_t k, SearchStats *stats = nullptr) const
+    {
+        return knn(query, k, std::numeric_limits<float>::infinity(), stats);
+    }
+
+    /**
+     * @brief Searches for the k nearest neighbors of a query element within a maximum distance.
+     *
+     * @param query The query element.
+     * @param k The number of nearest neighbors to search for (NNList::UNBOUNDED for a range query).
+     * @param maxDistance Elements farther than it are not returned.
+     * @param stats If not null, receives the SearchStats of the search.
+     * @return The ids of the (at most) k nearest neighbors within maxDistance, sorted by distance.
+     */
+    NNList knn(const T &query, size_t k, float maxDistance, SearchStats *stats = nullptr) const
+    {
+        SearchContext<T> context;
+        NNList nnList = knn(query, k, maxDistance, context);
+        if (stats)
+        {
+            *stats = context.stats;
+        }
+        return nnList;
+    }
+
+    /**
+     * @brief Searches for the k nearest neighbors of a query element within a maximum distance, using a caller-owned search context.
+     *
+     * Sees every element whose insert returned before the search started, and possibly some
+     * of the elements inserted meanwhile.
+     *
+     * @param query The query element.
+     * @param k The number of nearest neighbors to search for (NNList::UNBOUNDED for a range query).
+     * @param maxDistance Elements farther than it are not returned.
+     * @param context The search state, reset at the start of the search.
+     * @return The ids of the (at most) k nearest neighbors within maxDistance, sorted by distance.
+     */
+    NNList knn(const T &query, size_t k, float maxDistance, SearchContext<T> &context) const
+    {
+        checkDimension(query);
+        context.reset(query);
+        SearchStats &stats = context.stats;
+        auto start = std::chrono::steady_clock::now();
+        NNList nnList(k, maxDistance);
+
+        // Nodes replaced from now on stay readable until the guard is released
+        EpochReclaimer::Guard guard = epochs.enter();
+        CandidateQueue &candidates = context.candidates;
+        candidates.push(root.load(), 0.0, 0.0, 0);
+        stats.queueHighWater = 1;
+
+        while (!candidates.empty())
+        {
+            Candidate candidate = candidates.top();
+            // Candidates are popped in ascending order of dmin, see MTree::knn
+            if (candidate.dmin > nnList.getMaxDistance())
+            {
+                break;
+            }
+            candidates.pop();
+
+            stats.visitNode(candidate.level);
+            context.dQueryParent = candidate.dQueryRouting;
+            context.level = candidate.level;
+            const ConcurrentNode &node = nodes[candidate.node];
+            if (node.isLeaf)
+            {
+                searchLeaf(node, nnList, context);
+            }
+            else
+            {
+                searchInternal(node, nnList, context);
+            }
+            stats.queueHighWater = std::max(stats.queueHighWater, candidates.size());
+        }
+
+        nnList.finalize();
+        stats.wallTimeMicros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        return nnList;
+    }
+
+    /**
+     * @brief Searches for all the elements within a distance of a query element.
+     *
+     * @param query The query element.
+     * @param radius The largest distance of an element returned.
+     * @param stats If not null, receives the SearchStats of the search.
+     * @return The ids of the elements within radius, sorted by distance.
+     */
+    NNList rangeQuery(const T &query, float radius, SearchStats *stats = nullptr) const
+    {
+        return knn(query, NNList::UNBOUNDED, radius, stats);
+    }
+
+    /**
+     * @brief Gets the number of elements whose insert returned.
+     */
+    size_t size() const
+    {
+        return inserted.load();
+    }
+
+    /**
+     * @brief Gets an element by its id (returned by insert).
+     */
+    const T &getObject(ObjectId id) const
+    {
+        return objects[id];
+    }
+
+    /**
+     * @brief Gets the height of the tree.
+     */
+    size_t getHeight() const
+    {
+        return height.load();
+    }
+
+    /**
+     * @brief Gets the number of nodes of the tree, including the replaced nodes not reused yet.
+     */
+    size_t getTotalNodes() const
+    {
+        std::lock_guard<std::mutex> lock(freeMutex);
+        return allocatedNodes - freeNodes.size();
+    }
+
+    /**
+     * @brief Gets what the inserts did so far.
+     */
+    ConcurrentInsertStats getInsertStats() const
+    {
+        ConcurrentInsertStats s;
+        s.inserts = inserted.load();
+        s.restarts = restarts.load();
+        s.pessimisticInserts = pessimisticInserts.load();
+        s.splits = splits.load();
+        s.retiredNodes = retiredNodes.load();
+        s.pendingNodes = epochs.pending();
+        return s;
+    }
+
+    /**
+     * @brief Checks the structure of the tree, while no insert runs.
+     *
+     * Every inserted object must be in exactly one leaf, all the leaves at the same depth, each
+     * subtree within the covering radius of its routing object and each distance to the parent
+     * equal to the distance between the entry and the routing object of its node.
+     *
+     * @return The number of violations found (0 for a valid tree).
+     */
+    size_t verify() const
+    {
+        size_t violations = 0;
+        std::vector<ObjectId> found;
+        size_t leafDepth = 0;
+        verifyNode(root.load(), nullptr, 1, found, leafDepth, violations);
+
+        std::vector<char> seen(nextObjectId.load(), 0);
+        for (ObjectId id : found)
+        {
+            if (id >= seen.size() || seen[id]++)
+            {
+                violations++;
+            }
+        }
+        if (found.size() != size() || leafDepth != getHeight())
+        {
+            violations++;
+        }
+        return violations;
+    }
+
+private:
+    enum Outcome
+    {
+        INSERTED,  ///< The object is in the tree
+        RESTART,   ///< A node of the path was replaced, the descent starts over
+        LEAF_FULL  ///< The leaf must be split, the insert starts over with latch coupling
+    };
+
+    /**
+     * @brief Inserts an object into a leaf with room, latching one node at a time.
+     */
+    Outcome insertOptimistic(ObjectId objectId)
+    {
+        const T &element = objects[objectId];
+        std::vector<float> distances;
+        NodeIndex index = root.load();
+        // Distance between the object and the routing object of the node (none for the root)
+        float dParent = std::numeric_limits<float>::infinity();
+        for (;;)
+        {
+            ConcurrentNode &node = nodes[index];
+            if (node.isLeaf)
+            {
+                std::lock_guard<std::mutex> lock(node.latch);
+                uint32_t n = node.numEntries.load(std::memory_order_relaxed);
+                if (node.obsolete.load())
+                {
+                    return RESTART;
+                }
+                if (n == capacity)
+                {
+                    return LEAF_FULL;
+                }
+                writeEntry(node, n, RoutingEntry{objectId, 0.0f, NULL_NODE}, dParent);
+                node.numEntries.store(n + 1, std::memory_order_release);
+                return INSERTED;
+            }
+
+            // The entries of an internal node never change, so the distances are computed
+            // before latching it
+            measureEntries(node, element, distances);
+            std::lock_guard<std::mutex> lock(node.latch);
+            if (node.obsolete.load())
+            {
+                return RESTART;
+            }
+            size_t best = chooseSubtree(node, distances);
+            dParent = distances[best];
+            index = node.children[best].load();
+        }
+    }
+
+    /**
+     * @brief Inserts an object with latch coupling from the root, splitting the full nodes of its path.
+     *
+     * @return False if the root was replaced before it could be latched.
+     */
+    bool insertPessimistic(ObjectId objectId)
+    {
+        pessimisticInserts.fetch_add(1, std::memory_order_relaxed);
+        const T &element = objects[objectId];
+
+        // The latched nodes, the slot of each one in the previous one, and the distance
+        // between the object and the routing object of each one
+        std::vector<NodeIndex> path;
+        std::vector<uint32_t> slots;
+        std::vector<float> dParents;
+        std::vector<float> distances;
+
+        NodeIndex index = root.load();
+        nodes[index].latch.lock();
+        if (nodes[index].obsolete.load())
+        {
+            nodes[index].latch.unlock();
+            return false;
+        }
+        bool topIsRoot = true;
+        path.push_back(index);
+        slots.push_back(0);
+        dParents.push_back(std::numeric_limits<float>::infinity());
+
+        while (!nodes[index].isLeaf)
+        {
+            ConcurrentNode &node = nodes[index];
+            measureEntries(node, element, distances);
+            size_t best = chooseSubtree(node, distances);
+
+            // Replacing the child needs the latch of this node, so it is still the child
+            NodeIndex child = node.children[best].load();
+            nodes[child].latch.lock();
+            path.push_back(child);
+            slots.push_back(static_cast<uint32_t>(best));
+            dParents.push_back(distances[best]);
+
+            if (nodes[child].numEntries.load(std::memory_order_relaxed) < capacity)
+            {
+                // A split below stops at the child, which at most replaces it in this node
+                size_t released = path.size() - 2;
+                for (size_t i = 0; i < released; i++)
+                {
+                    nodes[path[i]].latch.unlock();
+                }
+                path.erase(path.begin(), path.begin() + released);
+                slots.erase(slots.begin(), slots.begin() + released);
+                dParents.erase(dParents.begin(), dParents.begin() + released);
+                topIsRoot = topIsRoot && released == 0;
+            }
+            index = child;
+        }
+
+        ConcurrentNode &leaf = nodes[index];
+        uint32_t n = leaf.numEntries.load(std::memory_order_relaxed);
+        if (n < capacity)
+        {
+            // Another insert split the leaf meanwhile
+            writeEntry(leaf, n, RoutingEntry{objectId, 0.0f, NULL_NODE}, dParents.back());
+            leaf.numEntries.store(n + 1, std::memory_order_release);
+        }
+        else
+        {
+            splitPath(path, slots, dParents.back(), topIsRoot, objectId);
+        }
+
+        for (NodeIndex latched : path)
+        {
+            nodes[latched].latch.unlock();
+        }
+        return true;
+    }
+
+    /**
+     * @brief Splits the full latched leaf at the end of the path, and its full ancestors.
+     *
+     * Each split node is replaced by two new nodes. The first ancestor with room is replaced
+     * by a copy with the new entries, or a new root is created if every node of the path split.
+     *
+     * @param path The latched nodes, from the parent of the first node with room (or the root) to the leaf.
+     * @param slots The slot of each node of the path in the previous one.
+     * @param dLeaf The distance between the object and the routing object of the leaf.
+     * @param topIsRoot Whether the first node of the path is the root.
+     * @param objectId The object to be inserted.
+     */
+    void splitPath(const std::vector<NodeIndex> &path, const std::vector<uint32_t> &slots, float dLeaf, bool topIsRoot, ObjectId objectId)
+    {
+        const float unknown = std::numeric_limits<float>::quiet_NaN();
+
+        // The entry added to the node being split and, above the leaf, the entry that
+        // replaces the node split below it, with their distances to the routing object
+        RoutingEntry added{objectId, 0.0f, NULL_NODE};
+        float addedDistance = dLeaf;
+        bool replacing = false;
+        RoutingEntry replacement{0, 0.0f, NULL_NODE};
+        float replacementDistance = unknown;
+
+        for (size_t i = path.size(); i-- > 0;)
+        {
+            ConcurrentNode &node = nodes[path[i]];
+            const bool isRoot = i == 0 && topIsRoot;
+            // Only the root has no routing object, and the first node of the path only has a child replaced
+            ObjectId routingObject = isRoot ? 0 : nodes[path[i - 1]].objectIds[slots[i]];
+
+            std::vector<RoutingEntry> entries;
+            std::vector<float> distancesToRoutingObject;
+            const uint32_t n = node.numEntries.load(std::memory_order_relaxed);
+            for (uint32_t e = 0; e < n; e++)
+            {
+                entries.push_back(RoutingEntry{node.objectIds[e], node.coveringRadii[e].load(std::memory_order_relaxed), node.children[e].load()});
+                distancesToRoutingObject.push_back(isRoot ? unknown : node.distancesToParent[e]);
+            }
+            if (replacing)
+            {
+                entries[slots[i + 1]] = replacement;
+                distancesToRoutingObject[slots[i + 1]] = replacementDistance;
+            }
+            entries.push_back(added);
+            distancesToRoutingObject.push_back(addedDistance);
+
+            if (entries.size() <= capacity)
+            {
+                // The node has room: a copy with the new entries replaces it
+                NodeIndex copy = allocateNode(node.isLeaf);
+                for (size_t e = 0; e < entries.size(); e++)
+                {
+                    float d = distancesToRoutingObject[e];
+                    if (isRoot)
+                    {
+                        d = std::numeric_limits<float>::infinity();
+                    }
+                    else if (std::isnan(d))
+                    {
+                        d = distance(objects[entries[e].objectId], objects[routingObject]);
+                    }
+                    writeEntry(nodes[copy], e, entries[e], d);
+                }
+                nodes[copy].numEntries.store(static_cast<uint32_t>(entries.size()), std::memory_order_release);
+                link(path, slots, i, isRoot, copy);
+                retirePath(path, i);
+                return;
+            }
+
+            // The node is full: promote two routing objects and partition the entries between them
+            SplitContext<T, Metric, SegmentedArray<T>> ctx(objects, entries, isRoot ? nullptr : &routingObject, distancesToRoutingObject, distance);
+            std::pair<size_t, size_t> promoted;
+            std::vector<size_t> group1, group2;
+            {
+                std::lock_guard<std::mutex> lock(splitMutex);
+                promoted = splitPolicy.promotion.promote(ctx, splitPolicy.partition);
+                splitPolicy.partition.partition(ctx, promoted.first, promoted.second, group1, group2);
+            }
+            RoutingEntry p1 = storeGroup(ctx, promoted.first, group1, allocateNode(node.isLeaf));
+            RoutingEntry p2 = storeGroup(ctx, promoted.second, group2, allocateNode(node.isLeaf));
+            splits.fetch_add(1, std::memory_order_relaxed);
+
+            if (isRoot)
+            {
+                // The split occurred in the root: a new root holds the two halves
+                NodeIndex newRoot = allocateNode(false);
+                writeEntry(nodes[newRoot], 0, p1, std::numeric_limits<float>::infinity());
+                writeEntry(nodes[newRoot], 1, p2, std::numeric_limits<float>::infinity());
+                nodes[newRoot].numEntries.store(2, std::memory_order_release);
+                root.store(newRoot);
+                height.fetch_add(1);
+                retirePath(path, i);
+                return;
+            }
+
+            // p1 replaces the node in its parent and p2 is added to the parent.
+            // If p1 is the old routing object, its distance to the parent is already known
+            replacing = true;
+            replacement = p1;
+            replacementDistance = p1.objectId == routingObject ? nodes[path[i - 1]].distancesToParent[slots[i]] : unknown;
+            added = p2;
+            addedDistance = unknown;
+        }
+    }
+
+    /**
+     * @brief Retires the nodes of the path from path[first] down, once the node that replaces them is linked.
+     *
+     * A node retired earlier, while still linked, could be reached by a reader that enters
+     * after its retirement, and be reused under it.
+     */
+    void retirePath(const std::vector<NodeIndex> &path, size_t first)
+    {
+        for (size_t i = first; i < path.size(); i++)
+        {
+            retireNode(path[i]);
+        }
+    }
+
+    /**
+     * @brief Links a new node in place of the node path[i], in its parent or as the root.
+     */
+    void link(const std::vector<NodeIndex> &path, const std::vector<uint32_t> &slots, size_t i, bool isRoot, NodeIndex replacement)
+    {
+        if (isRoot)
+        {
+            root.store(replacement);
+        }
+        else
+        {
+            nodes[path[i - 1]].children[slots[i]].store(replacement);
+        }
+    }
+
+    /**
+     * @brief Writes a group of a split into a new node, routed by the promoted candidate p.
+     *
+     * @return The routing entry of the node.
+     */
+    template <typename Context>
+    RoutingEntry storeGroup(Context &ctx, size_t p, const std::vector<size_t> &group, NodeIndex index)
+    {
+        ConcurrentNode &node = nodes[index];
+        for (size_t e = 0; e < group.size(); e++)
+        {
+            writeEntry(node, e, ctx.entry(group[e]), ctx.getDistance(p, group[e]));
+        }
+        node.numEntries.store(static_cast<uint32_t>(group.size()), std::memory_order_release);
+        return RoutingEntry{ctx.objectId(p), ctx.coveringRadius(p, group), index};
+    }
+
+    /**
+     * @brief Computes the distance between an object and the routing object of each entry of an internal node.
+     */
+    void measureEntries(const ConcurrentNode &node, const T &element, std::vector<float> &distances) const
+    {
+        const uint32_t n = node.numEntries.load(std::memory_order_acquire);
+        distances.resize(n);
+        for (uint32_t i = 0; i < n; i++)
+        {
+            distances[i] = distance(objects[node.objectIds[i]], element);
+        }
+    }
+
+    /**
+     * @brief Chooses the entry of a latched internal node whose subtree receives an object, as MTree does.
+     *
+     * The entry whose covering ball holds the object and whose routing object is the closest,
+     * or else the entry whose covering radius grows the least, which then grows.
+     *
+     * @param node The node.
+     * @param distances The distance between the object and the routing object of each entry.
+     * @return The slot of the entry.
+     */
+    size_t chooseSubtree(ConcurrentNode &node, const std::vector<float> &distances)
+    {
+        const size_t noEntry = std::numeric_limits<size_t>::max();
+        size_t bestFit = noEntry;
+        size_t bestExpand = noEntry;
+        float minDistance = std::numeric_limits<float>::max();
+        float minRadiusIncrement = std::numeric_limits<float>::max();
+        for (size_t i = 0; i < distances.size(); i++)
+        {
+            float radius = node.coveringRadii[i].load(std::memory_order_relaxed);
+            if (distances[i] <= radius)
+            {
+                if (distances[i] < minDistance)
+                {
+                    minDistance = distances[i];
+                    bestFit = i;
+                }
+            }
+            else if (bestFit == noEntry && distances[i] - radius < minRadiusIncrement)
+            {
+                minRadiusIncrement = distances[i] - radius;
+                bestExpand = i;
+            }
+        }
+        if (bestFit != noEntry)
+        {
+            return bestFit;
+        }
+        // The readers see the old radius or the new one, and the object is only reachable
+        // through the entry after the growth
+        node.coveringRadii[bestExpand].store(distances[bestExpand], std::memory_order_relaxed);
+        return bestExpand;
+    }
+
+    /**
+     * @brief Writes an entry into a slot that the readers cannot see yet.
+     */
+    void writeEntry(ConcurrentNode &node, size_t slot, const RoutingEntry &entry, float distanceToParent)
+    {
+        node.objectIds[slot] = entry.objectId;
+        node.coveringRadii[slot].store(entry.coveringRadius, std::memory_order_relaxed);
+        node.distancesToParent[slot] = distanceToParent;
+        node.children[slot].store(entry.subtree, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Gets an empty node, reusing a node freed by the reclaimer if there is one.
+     */
+    NodeIndex allocateNode(bool isLeaf)
+    {
+        NodeIndex index = NULL_NODE;
+        {
+            std::lock_guard<std::mutex> lock(freeMutex);
+            if (!freeNodes.empty())
+            {
+                index = freeNodes.back();
+                freeNodes.pop_back();
+            }
+            else
+            {
+                index = static_cast<NodeIndex>(allocatedNodes++);
+            }
+        }
+        nodes.reserve(index);
+
+        ConcurrentNode &node = nodes[index];
+        if (!node.objectIds)
+        {
+            node.objectIds.reset(new ObjectId[capacity]);
+            node.coveringRadii.reset(new std::atomic<float>[capacity]);
+            node.distancesToParent.reset(new float[capacity]);
+            node.children.reset(new std::atomic<NodeIndex>[capacity]);
+        }
+        node.isLeaf = isLeaf;
+        node.numEntries.store(0, std::memory_order_relaxed);
+        node.obsolete.store(false, std::memory_order_relaxed);
+        return index;
+    }
+
+    /**
+     * @brief Marks a latched node that was just unlinked as replaced, and frees it once no reader can reach it.
+     */
+    void retireNode(NodeIndex index)
+    {
+        nodes[index].obsolete.store(true);
+        retiredNodes.fetch_add(1, std::memory_order_relaxed);
+        epochs.retire([this, index]()
+                      {
+            std::lock_guard<std::mutex> lock(freeMutex);
+            freeNodes.push_back(index); });
+    }
+
+    /**
+     * @brief Searches a leaf, as LeafNode::search does.
+     */
+    void searchLeaf(const ConcurrentNode &node, NNList &nnList, SearchContext<T> &context) const
+    {
+        const uint32_t numEntries = node.numEntries.load(std::memory_order_acquire);
+        const bool isRoot = context.level == 0;
+        const T &query = *context.query;
+        const double dQueryParent = context.dQueryParent;
+        SearchStats &stats = context.stats;
+        for (uint32_t i = 0; i < numEntries; i++)
+        {
+            double dk = nnList.getMaxDistance();
+            double dEntryParent = isRoot ? 0.0 : node.distancesToParent[i];
+            if (std::fabs(dEntryParent - dQueryParent) > dk)
+            {
+                stats.prunedByParentDistance++;
+                continue;
+            }
+
+            double dEntryQuery = distance.distanceUpTo(objects[node.objectIds[i]], query, dk);
+            stats.distanceEvaluations++;
+            if (std::isinf(dk))
+            {
+                stats.distancesBeforeBound++;
+            }
+            if (dEntryQuery <= dk)
+            {
+                nnList.insert(node.objectIds[i], dEntryQuery);
+            }
+            else
+            {
+                stats.prunedByCoveringRadius++;
+            }
+        }
+    }
+
+    /**
+     * @brief Searches an internal node, as InternalNode::search does.
+     */
+    void searchInternal(const ConcurrentNode &node, NNList &nnList, SearchContext<T> &context) const
+    {
+        const uint32_t numEntries = node.numEntries.load(std::memory_order_acquire);
+        const bool isRoot = context.level == 0;
+        const T &query = *context.query;
+        const double dQueryParent = context.dQueryParent;
+        SearchStats &stats = context.stats;
+        for (uint32_t i = 0; i < numEntries; i++)
+        {
+            double dk = nnList.getMaxDistance();
+            double radius = node.coveringRadii[i].load(std::memory_order_relaxed);
+            double dEntryParent = isRoot ? 0.0 : node.distancesToParent[i];
+            if (std::fabs(dQueryParent - dEntryParent) > dk + radius)
+            {
+                stats.prunedByParentDistance++;
+                continue;
+            }
+
+            double dist = distance.distanceUpTo(query, objects[node.objectIds[i]], dk + radius);
+            stats.distanceEvaluations++;
+            if (std::isinf(dk))
+            {
+                stats.distancesBeforeBound++;
+            }
+            double dminEntry = std::max(0.0, dist - radius);
+            if (dminEntry <= dk)
+            {
+                context.candidates.push(node.children[i].load(), dminEntry, dist, context.level + 1);
+            }
+            else
+            {
+                stats.prunedByCoveringRadius++;
+            }
+        }
+    }
+
+    /**
+     * @brief Checks a subtree and collects its objects (see verify).
+     */
+    void verifyNode(NodeIndex index, const ObjectId *routingObject, size_t depth, std::vector<ObjectId> &found, size_t &leafDepth, size_t &violations) const
+    {
+        const ConcurrentNode &node = nodes[index];
+        const uint32_t n = node.numEntries.load();
+        // Only a root leaf can be empty
+        if ((n == 0 && depth > 1) || n > capacity || node.obsolete.load())
+        {
+            violations++;
+        }
+        for (uint32_t i = 0; i < n; i++)
+        {
+            const ObjectId objectId = node.objectIds[i];
+            if (routingObject && !close(distance(objects[objectId], objects[*routingObject]), node.distancesToParent[i]))
+            {
+                violations++;
+            }
+            if (node.isLeaf)
+            {
+                found.push_back(objectId);
+                continue;
+            }
+
+            size_t first = found.size();
+            verifyNode(node.children[i].load(), &objectId, depth + 1, found, leafDepth, violations);
+            const float radius = node.coveringRadii[i].load();
+            for (size_t o = first; o < found.size(); o++)
+            {
+                float d = distance(objects[found[o]], objects[objectId]);
+                if (d > radius && !close(d, radius))
+                {
+                    violations++;
+                }
+            }
+        }
+        if (node.isLeaf)
+        {
+            if (leafDepth != 0 && leafDepth != depth)
+            {
+                violations++;
+            }
+            leafDepth = depth;
+        }
+    }
+
+    static bool close(float a, float b)
+    {
+        return std::fabs(a - b) <= 1e-4f * std::max(1.0f, std::max(std::fabs(a), std::fabs(b)));
+    }
+
+    /**
+     * @brief Checks that an element has the dimension of the first inserted element, if any.
+     *
+     * @param element The element.
+     * @throws std::invalid_argument if the dimensions differ.
+     */
+    void checkDimension(const T &element) const
+    {
+        size_t expected = dimension.load();
+        if (expected != 0 && element.size() != expected)
+        {
+            throw std::invalid_argument("The element does not have the dimension of the M-Tree");
+        }
+    }
+
+    const size_t capacity;                 ///< The maximum number of entries of a node
+    Metric distance;                       ///< The distance function
+    Split splitPolicy;                     ///< The split policy, guarded by splitMutex
+    std::mutex splitMutex;                 ///< Serializes the calls to the split policy, which may keep state
+    std::atomic<size_t> dimension;         ///< Dimension of the elements (0 before the first insert)
+    SegmentedArray<T> objects;             ///< Objects indexed by the tree, addressed by ObjectId
+    std::atomic<size_t> nextObjectId;      ///< Id of the next inserted object
+    SegmentedArray<ConcurrentNode> nodes;  ///< Nodes of the tree, addressed by NodeIndex
+    std::atomic<NodeIndex> root;           ///< Index of the root node
+    std::atomic<size_t> height;            ///< Height of the tree
+    mutable std::mutex freeMutex;          ///< Guards allocatedNodes and freeNodes
+    size_t allocatedNodes;                 ///< Number of node indices in use or free
+    std::vector<NodeIndex> freeNodes;      ///< Nodes freed by the reclaimer, to be reused
+    std::atomic<size_t> inserted;          ///< Number of inserts that returned
+    std::atomic<size_t> restarts;          ///< See ConcurrentInsertStats
+    std::atomic<size_t> pessimisticInserts; ///< See ConcurrentInsertStats
+    std::atomic<size_t> splits;            ///< See ConcurrentInsertStats
+    std::atomic<size_t> retiredNodes;      ///< See ConcurrentInsertStats
+    mutable EpochReclaimer epochs;         ///< Keeps the replaced nodes until no reader can reach them; destroyed first
+};
+
+#endif // MTREECONCURRENT_HPP
@@ -4,228 +4,161 @@
 #include "MTreeNodes.hpp"
 
 template <typename T>
-InternalNode<T>::InternalNode(size_t maxCapacity, bool isRoot, NodePtr parentNode, TreeObjectPtr parentRoutingObj)
-    : Node<T>(maxCapacity, isRoot, parentNode, parentRoutingObj)
+template <typename Metric, typename SplitPolicy>
+void InternalNode<T>::insert(ObjectId objectId, const Metric &distance, SplitPolicy &policy)
 {
-    this->isLeaf = false;
-}
-
-template <typename T>
-void InternalNode<T>::insert(const T &element, Metric distance)
-{
-    RoutingObject<T> *bestRoutingObject = nullptr;
+    const T &element = this->getObject(objectId);
+    const size_t noEntry = std::numeric_limits<size_t>::max();
 
     // The entry that the new object fits into
-    RoutingObject<T> *bestRoutingObjectFit = nullptr;
+    size_t bestFit = noEntry;
     double minDistance = std::numeric_limits<double>::max();
 
     // The entry that will require the smallest increment in its covering radius
-    RoutingObject<T> *bestRoutingObjectExpand = nullptr;
+    size_t bestExpand = noEntry;
     double minRadiusIncrement = std::numeric_limits<double>::max();
 
     /* Look for entries that the new object fits into
     If there are no such entry, then look for an object with minimal distance from its covering radius's edge to the new object */
-    for (auto &routingObject : this->entries)
+    for (size_t i = 0; i < this->getNumEntries(); i++)
     {
-        double dist = distance(routingObject->getRepresentative(), element);
-        if (dist <= routingObject->getCoveringRadius())
+        double dist = distance(this->getObject(this->getObjectId(i)), element);
+        if (dist <= this->getCoveringRadius(i))
         {
             // Found an entry that the new object fits into
             if (dist < minDistance)
             {
                 // The closest entry
                 minDistance = dist;
-                bestRoutingObjectFit = dynamic_cast<RoutingObject<T> *>(routingObject.get());
+                bestFit = i;
             }
         }
-        else if (!bestRoutingObjectFit)
+        else if (bestFit == noEntry)
         {
             // Still not found an entry that the new object fits into
-            double radiusIncrement = dist - routingObject->getCoveringRadius();
+            double radiusIncrement = dist - this->getCoveringRadius(i);
             if (radiusIncrement < minRadiusIncrement)
             {
                 // This is the entry that will require the smallest increment in its covering radius
                 minRadiusIncrement = radiusIncrement;
-                bestRoutingObjectExpand = dynamic_cast<RoutingObject<T> *>(routingObject.get());
+                bestExpand = i;
             }
         }
     }
 
-    if (bestRoutingObjectFit)
+    size_t best;
+    if (bestFit != noEntry)
     {
         // If it fits into an existing entry, just insert it into the corresponding subtree
-        bestRoutingObject = bestRoutingObjectFit;
+        best = bestFit;
     }
     else
     {
         // If it doesn't fit into any existing entry, upgrade the new radii of the entry
-        bestRoutingObjectExpand->setCoveringRadius(bestRoutingObjectExpand->getCoveringRadius() + minRadiusIncrement);
+        this->setCoveringRadius(bestExpand, this->getCoveringRadius(bestExpand) + minRadiusIncrement);
+        best = bestExpand;
+    }
 
-        bestRoutingObject = bestRoutingObjectExpand;
+    // The rings of the entry must also cover the new object
+    if (this->storage->nodes.numPivots() > 0)
+    {
+        this->storage->nodes.expandRings(this->index, best, this->storage->pivots.buckets(objectId));
     }
 
     // Continue inserting in the next level
-    bestRoutingObject->getSubtree()->insert(element, distance);
-}
-
-template <typename T>
-typename InternalNode<T>::NodePtr InternalNode<T>::createNewNode() const
-{
-    return std::make_shared<InternalNode<T>>(this->maxCapacity, false, nullptr, nullptr);
-}
-
-template <typename T>
-typename InternalNode<T>::NodePtr InternalNode<T>::createNewRootNode() const
-{
-    return std::make_shared<InternalNode<T>>(this->maxCapacity, true, nullptr, nullptr);
+    Node<T>(*this->storage, this->getSubtree(best)).insert(objectId, distance, policy);
 }
 
 template <typename T>
 void InternalNode<T>::getRepr(std::ostream &os) const
 {
-    os << this->getParentNode()->getNodeId();
-    os << "<" << this->getParentRoutingObj() << "> -> ";
+    if (!this->getIsRoot())
+    {
+        os << this->getParentNode() << " -> ";
+    }
     os << this->getNodeId() << " ";
-    for (size_t i = 0; i < this->entries.size(); i++)
+    for (size_t i = 0; i < this->getNumEntries(); i++)
     {
-        
-        os << "(" << this->entries[i]->getRepresentative() << "<" << this->entries[i] << ">:" << this->entries[i]->getCoveringRadius() << ":" << this->entries[i]->getDistanceToParent() << ")";
-        // Check if null
-        if (this->entries[i]->getSubtree() == nullptr)
-        {
-            os << "*";
-        }
-        os << " ";
+        os << "(" << this->getObject(this->getObjectId(i)) << ":" << this->getCoveringRadius(i) << ":" << this->getDistanceToParent(i) << ") ";
     }
 
     // Recurse down the tree
-    for (size_t i = 0; i < this->entries.size(); i++)
+    for (size_t i = 0; i < this->getNumEntries(); i++)
     {
-        if (this->entries[i]->getSubtree() != nullptr)
-        {
-            os << "\n";
-            this->entries[i]->getSubtree()->getRepr(os);
-        }
+        os << "\n";
+        Node<T>(*this->storage, this->getSubtree(i)).getRepr(os);
     }
 }
 
 template <typename T>
-void InternalNode<T>::updateRoutingObject(TreeObjectPtr p, std::vector<TreeObjectPtr> &entries, NodePtr childNode, NodePtr parentNode, Metric distance)
+template <typename Metric>
+void InternalNode<T>::search(NNList &nnList, SearchContext<T> &context, const Metric &distance) const
 {
-    // This is called when a promoted routing object "p" is stored in the new Node "parentNode"
-    // For this to be suceeded
+    // The entries of the node are contiguous arrays in the arena
+    const NodeArena &nodes = this->storage->nodes;
+    const size_t numEntries = this->getNumEntries();
+    const ObjectId *objectIds = nodes.objectIds(this->index);
+    const float *coveringRadii = nodes.coveringRadii(this->index);
+    const float *distancesToParent = nodes.distancesToParent(this->index);
+    const NodeIndex *children = nodes.children(this->index);
+    const bool isRoot = this->getIsRoot();
+    const T &query = *context.query;
+
+    // d(query, parent) is the same for all entries, it was computed when the node became a candidate
+    const double dQueryParent = context.dQueryParent;
+    SearchStats &stats = context.stats;
+
+    // With pivots, the rings of all the entries are tested at once against the current dk,
+    // which can only be larger than the dk of each entry below
+    const uint8_t *ringPass = context.filterByPivots(nodes, this->index, nnList.getMaxDistance());
 
-    // 1. The new covering radius of p is max{d(p, r) + rad(r) | for r in entries}, remembering r is a route object and rad(r) is the covering radius of r
-    // 2. Here we can also update the distance to the parent for all entries
-    double maxDistance = 0.0;
-    for (const auto &entry : entries)
-    {
-        // This overestimates the covering radius of p, but guarantees that it will cover all entries
-        double dist = distance(p->getRepresentative(), entry->getRepresentative());
-        if (dist + entry->getCoveringRadius() > maxDistance)
-        {
-            maxDistance = dist + entry->getCoveringRadius();
-        }
-        // Update the distance to the parent of the entry object
-        entry->setDistanceToParent(dist);
-    }
-    p->setCoveringRadius(maxDistance);
-
-    // 3. childNode is the subtree of p
-    p->setSubtree(childNode);
-    
-    // 4. Update the childNode's parent Node/routingObj
-    childNode->setParentNode(parentNode);
-    childNode->setParentRoutingObj(p);
-
-    // 5. Add p to the parent node
-    parentNode->getEntries().push_back(p);
-    // @TODO: Maybe check if its full?
-
-    
-}
-
-template <typename T>
-void InternalNode<T>::search(const T &query, NNList<T> &nnList, std::vector<std::pair<NodePtr, double>> &candidates, Metric distance) const
-{
     // For all entries in node
-    for (const auto &entry : this->entries)
+    for (size_t i = 0; i < numEntries; i++)
     {
         double dk = nnList.getMaxDistance();
 
-        // Check if is root
-        double dEntryParent;
-        double dQueryParent;
-        if (this->isRoot)
+        // If it is root, set d(entry, parent) = d(query, parent) = 0 to avoid pruning
+        // Otherwise check inequality |d(entry, parent) - d(query, parent)| <= dk + r(entry)
+        // This uses the triangle inequality to prune the search
+        // and avoid calculating the distance between the query and the entry
+        // in case the entry is not a candidate
+        double dEntryParent = isRoot ? 0.0 : distancesToParent[i];
+
+        // Check condition for pruning without calculating the distance
+        if (std::fabs(dQueryParent - dEntryParent) > dk + coveringRadii[i])
         {
-            // If it is root, set d(entry, parent) = 0 to avoid pruning
-            dEntryParent = 0.0;
-            dQueryParent = 0.0;
+            stats.prunedByParentDistance++;
         }
-        else
+        else if (ringPass && !ringPass[i])
         {
-            // If it is check inequality |d(entry, parent) - d(query, parent)| <= dk
-            // This uses the triangle inequality to prune the search
-            // and avoid calculating the distance between the query and the entry
-            // in case the entry is not a candidate
-            dEntryParent = entry->getDistanceToParent();
-            dQueryParent = this->parentRoutingObj->calculateDistanceToQuery(query, distance);
-            //dQueryParent = distance(query, this->parentRoutingObj->getRepresentative()); // @TODO TROCAR ISSO POR UMA METODO DE TREE OBJECT QUE RECEBE A QUERY E VERIFICA SE A QUERY CACHEADA É IGUAL, CASO POSITIVO RETORNA O VALOR CACHEADO
+            // The subtree has no object in the rings that the query ball crosses
+            stats.prunedByPivots++;
         }
-
-        // Check condition for pruning without calculating the distance
-        if (std::fabs(dQueryParent - dEntryParent) <= dk + entry->getCoveringRadius())
+        else
         {
-            // If the entry is a candidate, calculate the distance
-            double dist = distance(query, entry->getRepresentative());
+            // If the entry is a candidate, calculate the distance. Past dk + r(entry) the entry
+            // is pruned whatever the distance is, so the metric may stop as soon as it exceeds it
+            double dist = distance.distanceUpTo(query, this->getObject(objectIds[i]), dk + coveringRadii[i]);
+            stats.distanceEvaluations++;
+            if (std::isinf(dk))
+            {
+                // Nothing could be pruned yet
+                stats.distancesBeforeBound++;
+            }
             // Compute the lower bound for entry
-            double dminEntry = std::max(0.0, dist - entry->getCoveringRadius());
+            double dminEntry = std::max(0.0, dist - coveringRadii[i]);
             // Check if the entry is a candidate using the lower bound
             if (dminEntry <= dk)
             {
-                // Add to the candidate list
-                candidates.emplace_back(entry->getSubtree(), dminEntry);
-
-                // Compute the upper bound for entry
-                double dmaxEntry = dist + entry->getCoveringRadius();
-
-                // Check if there will be (with certainty) a element in the subtree of entry
-                // This happens when the maximum distance in the nearest neighbors 
-                // list is greater than the upper bound
-                if (dmaxEntry < dk)
-                {
-                    // Update the NN list with the new upper bound 
-                    // nothing is really inserted, just the maximum distance is updated
-                    nnList.insert(dmaxEntry);
-                    dk = nnList.getMaxDistance();
-
-// For debugging purposes print erased candidates
-#ifdef KNNDEBUG
-                    bool print = false;
-                    for (auto it = candidates.begin(); it != candidates.end(); ++it)
-                    {
-                        if (it->second > dk)
-                        {
-                            if (!print)
-                            {
-                                std::cout << "Erased candidates: ";
-                                print = true;
-                            }
-                            std::cout << it->first->getNodeId() << " ";
-                        }
-                    }
-                    if (print)
-                        std::cout << std::endl;
-#endif
-
-                    // Prune the candidates for which the lower bound is greater than the new dk
-                    candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [dk](const std::pair<NodePtr, double> &candidate)
-                                                    { return candidate.second > dk; }),
-                                     candidates.end());
-                }
+                // Add to the candidate list. dist is d(query, parent) for the child node
+                context.candidates.push(children[i], dminEntry, dist, context.level + 1);
+            }
+            else
+            {
+                stats.prunedByCoveringRadius++;
             }
         }
     }
 }
 
-#endif // MTREEINTERNALNODE_HPP
\ No newline at end of file
+#endif // MTREEINTERNALNODE_HPP
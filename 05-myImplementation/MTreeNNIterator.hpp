@@ -0,0 +1,304 @@
+#ifndef MTREENNITERATOR_HPP
+#define MTREENNITERATOR_HPP
+
+#include <vector>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <algorithm>  // For std::push_heap, std::pop_heap, std::nth_element
+#include <functional> // For std::greater
+#include "MTreeStorage.hpp"
+#include "MTreePivots.hpp"
+#include "indexing/NNList.hpp"
+#include "indexing/SearchStats.hpp"
+
+/**
+ * @brief A node or an object waiting in the queue of an NNIterator.
+ *
+ * A subtree is queued with the lower bound taken from its parent, without computing the
+ * distance to its routing object; the distance is only computed when the subtree reaches
+ * the top of the queue, and the subtree is queued again with its exact key.
+ */
+struct NNIteratorItem
+{
+    float key;           ///< Lower bound on the distance between the query and the item (the distance itself for an object)
+    float dQueryRouting; ///< Distance between the query and objectId, once it is exact
+    ObjectId objectId;   ///< The object, or the routing object of the subtree
+    NodeIndex node;      ///< The subtree, NULL_NODE for an object
+    float radius;        ///< Covering radius of the subtree (0 for an object)
+    uint16_t level;      ///< Level of the subtree, the root being level 0
+    bool exact;          ///< Whether the distance between the query and objectId was computed
+
+    bool operator>(const NNIteratorItem &other) const { return key > other.key; }
+};
+
+/**
+ * @brief Yields the neighbors of a query in increasing order of distance, as many as asked for.
+ *
+ * This is the incremental nearest neighbor search of Hjaltason and Samet ("Distance Browsing in
+ * Spatial Databases"): subtrees and objects share one priority queue ordered by their lower bound
+ * on the distance to the query, so when an object reaches the top of the queue nothing left can
+ * be closer, and it is the next neighbor. The queue is kept between calls to next(), so asking
+ * for more neighbors only does the extra work, where knn would search again from the root.
+ *
+ * The objects of a visited leaf get their distance at once, as in knn. A subtree is queued with
+ * the bound the k-NN search prunes with, |d(q, parent) - d(e, parent)| - r(e), raised by the
+ * pivot rings of a PM-tree, and the distance to its routing object is only computed if it
+ * reaches the top of the queue.
+ *
+ * Most of the queued items are never returned, so only the items below a threshold are kept in
+ * the heap; the others wait unordered until the heap runs out, and then the smallest of them are
+ * moved to the heap. Pushing a far item is then O(1) and the heap stays small.
+ *
+ * The iterator reads the tree, which must outlive it and must not be modified while it is used.
+ * Several iterators can run on the same tree at once.
+ *
+ * @tparam T The type of elements stored in the M-Tree.
+ * @tparam Metric The distance function.
+ */
+template <typename T, typename Metric>
+class NNIterator
+{
+public:
+    static const size_t REFILL_MIN = 64;     ///< Smallest number of items moved from the overflow to the heap at once
+    static const size_t REFILL_FRACTION = 8; ///< The heap receives this fraction of the overflow when it runs out
+
+    /**
+     * @brief Starts the search of the neighbors of a query.
+     *
+     * @param storage The storage of the tree.
+     * @param distance The distance function of the tree.
+     * @param query The query element (copied; a view must outlive the iterator).
+     */
+    NNIterator(const MTreeStorage<T> &storage, const Metric &distance, const T &query)
+        : storage(&storage), distance(&distance), query(query), threshold(-1.0f), returned(0)
+    {
+        const PivotTable<T> &pivots = storage.pivots;
+        pivotDistances.resize(pivots.size());
+        for (size_t p = 0; p < pivots.size(); p++)
+        {
+            pivotDistances[p] = distance(query, pivots.pivots[p]);
+        }
+        stats.distanceEvaluations += pivots.size();
+
+        if (!storage.objects.empty())
+        {
+            push(NNIteratorItem{0.0f, 0.0f, 0, storage.root, 0.0f, 0, true});
+        }
+    }
+
+    /**
+     * @brief Gets the next nearest neighbor.
+     *
+     * @param entry Receives the id of the neighbor (see MTree::getObject) and its distance to the query.
+     * @return False if every object was already returned.
+     */
+    bool next(NNEntry &entry)
+    {
+        while (!heap.empty() || refill())
+        {
+            NNIteratorItem item = heap.front();
+            std::pop_heap(heap.begin(), heap.end(), std::greater<NNIteratorItem>());
+            heap.pop_back();
+
+            if (!item.exact)
+            {
+                resolve(item);
+                // Visited now if its exact key is still the smallest
+                if (item.key > threshold || (!heap.empty() && item.key > heap.front().key))
+                {
+                    push(item);
+                    continue;
+                }
+            }
+
+            if (item.node == NULL_NODE)
+            {
+                entry = NNEntry{item.objectId, item.key};
+                returned++;
+                return true;
+            }
+            visit(item);
+        }
+        return false;
+    }
+
+    /**
+     * @brief Gets up to count more neighbors.
+     *
+     * @param count The number of neighbors to get.
+     * @param entries The list the neighbors are appended to, in increasing order of distance.
+     * @return The number of neighbors appended (less than count once the tree is exhausted).
+     */
+    size_t next(size_t count, std::vector<NNEntry> &entries)
+    {
+        NNEntry entry;
+        size_t added = 0;
+        while (added < count && next(entry))
+        {
+            entries.push_back(entry);
+            added++;
+        }
+        return added;
+    }
+
+    /**
+     * @brief Gets a lower bound on the distance of the next neighbor (infinity if there is none).
+     *
+     * No distance is computed, so it is the cheap way to know whether the next neighbor could
+     * be tied with the last one.
+     */
+    double nextLowerBound() const
+    {
+        if (!heap.empty())
+        {
+            return heap.front().key;
+        }
+        return overflow.empty() ? std::numeric_limits<double>::infinity() : std::max(threshold, 0.0f);
+    }
+
+    /**
+     * @brief Gets the number of neighbors returned so far.
+     */
+    size_t getReturned() const { return returned; }
+
+    /**
+     * @brief Gets what the search did so far (the queue high water counts subtrees and objects).
+     */
+    const SearchStats &getStats() const { return stats; }
+
+private:
+    /**
+     * @brief Queues an item, in the heap if its key is below the threshold and in the overflow otherwise.
+     */
+    void push(const NNIteratorItem &item)
+    {
+        if (item.key > threshold)
+        {
+            overflow.push_back(item);
+        }
+        else
+        {
+            heap.push_back(item);
+            std::push_heap(heap.begin(), heap.end(), std::greater<NNIteratorItem>());
+        }
+        stats.queueHighWater = std::max(stats.queueHighWater, heap.size() + overflow.size());
+    }
+
+    /**
+     * @brief Moves the smallest items of the overflow to the empty heap and raises the threshold to their largest key.
+     *
+     * @return False if the overflow was empty too.
+     */
+    bool refill()
+    {
+        if (overflow.empty())
+        {
+            return false;
+        }
+        size_t count = std::min(overflow.size(), std::max(REFILL_MIN, overflow.size() / REFILL_FRACTION));
+        std::nth_element(overflow.begin(), overflow.begin() + (count - 1), overflow.end(), [](const NNIteratorItem &a, const NNIteratorItem &b)
+                         { return a.key < b.key; });
+        threshold = overflow[count - 1].key;
+        heap.assign(overflow.begin(), overflow.begin() + count);
+        overflow.erase(overflow.begin(), overflow.begin() + count);
+        std::make_heap(heap.begin(), heap.end(), std::greater<NNIteratorItem>());
+        return true;
+    }
+
+    /**
+     * @brief Computes the distance between the query and the object of an item, and its exact key.
+     */
+    void resolve(NNIteratorItem &item)
+    {
+        float d = (*distance)(query, storage->objects[item.objectId]);
+        stats.distanceEvaluations++;
+        item.key = item.node == NULL_NODE ? d : std::max(d - item.radius, 0.0f);
+        item.dQueryRouting = d;
+        item.exact = true;
+    }
+
+    /**
+     * @brief Queues the entries of a node: the objects of a leaf with their distance, the subtrees with their lower bound.
+     */
+    void visit(const NNIteratorItem &item)
+    {
+        const NodeArena &nodes = storage->nodes;
+        const NodeIndex node = item.node;
+        const NodeHeader &h = nodes.header(node);
+        stats.visitNode(item.level);
+
+        const ObjectId *objectIds = nodes.objectIds(node);
+        const float *coveringRadii = nodes.coveringRadii(node);
+        const float *distancesToParent = nodes.distancesToParent(node);
+        const NodeIndex *children = nodes.children(node);
+        const uint16_t level = static_cast<uint16_t>(item.level + 1);
+        for (uint32_t i = 0; i < h.numEntries; i++)
+        {
+            if (h.isLeaf)
+            {
+                NNIteratorItem object{0.0f, 0.0f, objectIds[i], NULL_NODE, 0.0f, level, false};
+                resolve(object);
+                push(object);
+                continue;
+            }
+
+            float bound = 0.0f;
+            if (!h.isRoot)
+            {
+                bound = std::max(std::fabs(distancesToParent[i] - item.dQueryRouting) - coveringRadii[i], 0.0f);
+            }
+            bound = std::max(bound, static_cast<float>(ringLowerBound(node, i)));
+            push(NNIteratorItem{bound, 0.0f, objectIds[i], children[i], coveringRadii[i], level, false});
+        }
+    }
+
+    /**
+     * @brief Gets the lower bound given by the pivot rings of an entry (0 without pivots).
+     */
+    double ringLowerBound(NodeIndex node, size_t entry) const
+    {
+        if (pivotDistances.empty())
+        {
+            return 0.0;
+        }
+        if (storage->nodes.bucketBytes() == 1)
+        {
+            return ringLowerBoundAs<uint8_t>(node, entry);
+        }
+        return ringLowerBoundAs<uint16_t>(node, entry);
+    }
+
+    template <typename Bucket>
+    double ringLowerBoundAs(NodeIndex node, size_t entry) const
+    {
+        const NodeArena &nodes = storage->nodes;
+        const Bucket *mins = reinterpret_cast<const Bucket *>(nodes.ringMins(node)) + entry;
+        const Bucket *maxs = reinterpret_cast<const Bucket *>(nodes.ringMaxs(node)) + entry;
+        const size_t stride = nodes.ringStride();
+        double bound = 0.0;
+        for (size_t p = 0; p < pivotDistances.size(); p++)
+        {
+            bound = std::max(bound, storage->pivots.lowerBound(pivotDistances[p], mins[p * stride], maxs[p * stride]));
+        }
+        return bound;
+    }
+
+    const MTreeStorage<T> *storage;       ///< The storage of the tree
+    const Metric *distance;               ///< The distance function
+    T query;                              ///< The query element
+    std::vector<double> pivotDistances;   ///< Distance between the query and each pivot of the tree
+    std::vector<NNIteratorItem> heap;     ///< Min-heap of the queued items with a key up to threshold
+    std::vector<NNIteratorItem> overflow; ///< The queued items with a key above threshold, unordered
+    float threshold;                      ///< Largest key of the items moved to the heap by the last refill
+    size_t returned;                      ///< Number of neighbors returned
+    SearchStats stats;                    ///< What the search did so far
+};
+
+template <typename T, typename Metric>
+const size_t NNIterator<T, Metric>::REFILL_MIN;
+
+template <typename T, typename Metric>
+const size_t NNIterator<T, Metric>::REFILL_FRACTION;
+
+#endif // MTREENNITERATOR_HPP
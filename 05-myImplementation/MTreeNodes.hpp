@@ -3,168 +3,127 @@
 
 #include <vector>
 #include <cmath>
-#include <memory>
+#include <algorithm>
 #include <stdexcept>
 #include <iostream> // For std::ostream
 #include <limits>   // For std::numeric_limits
-#include "TreeObject.hpp"
-#include "indexing/DistanceFunction.hpp"
+#include "MTreeStorage.hpp"
+#include "MTreeSplitPolicies.hpp"
+#include "MTreeSearchContext.hpp"
 #include "includes/dbgmsg.hpp"
 #include "indexing/NNList.hpp"
 
-size_t totalNodes = 0;
-
 /**
  * @brief Base class for a node in the M-Tree.
  *
+ * A node is a lightweight handle (storage + index) over a node of the NodeArena,
+ * so it can be created on the fly and passed by value. The leaf/internal behaviour
+ * is selected from the node header.
+ *
  * @tparam T The type of elements stored in the M-Tree.
- * @tparam DistanceFunction The distance function to be used.
  */
 template <typename T>
-class Node : public std::enable_shared_from_this<Node<T>> // For shared_from_this()
+class Node
 {
 public:
-    typedef Node<T> NodeType;
-    typedef std::shared_ptr<TreeObject<T>> TreeObjectPtr;
-    typedef std::shared_ptr<NodeType> NodePtr;
-    typedef DistanceFunction<T>& Metric;
+    typedef MTreeStorage<T> Storage;
 
     /**
-     * @brief Constructs a Node.
+     * @brief Constructs a handle to a node of the arena.
      *
-     * @param maxCapacity The maximum number of elements the node can hold.
-     * @param isRoot Whether the node is the root node.
-     * @param parentNode The parent node.
-     * @param parentRoutingObj The parent routing object.
+     * @param storage The storage of the tree that owns the node.
+     * @param index The index of the node in the arena.
      */
-    Node(size_t maxCapacity, bool isRoot = false, NodePtr parentNode = nullptr, TreeObjectPtr parentRoutingObj = nullptr)
-        : maxCapacity(maxCapacity), isRoot(isRoot), parentNode(parentNode), parentRoutingObj(parentRoutingObj) {
-        nodeId = nextNodeId++;
-        totalNodes++;
-        }
-    virtual ~Node() = default;
+    Node(Storage &storage, NodeIndex index) : storage(&storage), index(index) {}
+
+    /**
+     * @brief Inserts an element into the subtree rooted at this node.
+     *
+     * @param objectId The id of the element (already in the object store).
+     * @param distance The distance function.
+     * @param policy The split policy used when a node overflows.
+     */
+    template <typename Metric, typename SplitPolicy>
+    void insert(ObjectId objectId, const Metric &distance, SplitPolicy &policy);
 
     /**
-     * @brief Inserts an element into the node.
+     * @brief Searches for the nearest neighbors of an element in the node.
      *
-     * @param element The element to be inserted.
+     * @param nnList The list of nearest neighbors.
+     * @param context The search state: the query, d(query, routing object of this node) and the candidate nodes.
      * @param distance The distance function.
      */
-    virtual void insert(const T &element, Metric distance) = 0;
+    template <typename Metric>
+    void search(NNList &nnList, SearchContext<T> &context, const Metric &distance) const;
 
     /**
      * @brief Gets the node ID.
      *
-     * @return The node ID.
+     * @return The node ID (its index in the arena).
      */
-    size_t getNodeId() const { return nodeId; }
+    NodeIndex getNodeId() const { return index; }
 
     /**
      * @brief Checks if the node is the root.
      *
      * @return True if the node is the root, false otherwise.
      */
-    bool getIsRoot() const { return isRoot; }
+    bool getIsRoot() const { return header().isRoot; }
 
     /**
      * @brief Sets the node as root.
      *
      * @param root True to set the node as root, false otherwise.
      */
-    void setIsRoot(bool root) { isRoot = root; }
-
-    /**
-     * @brief Gets the parent node.
-     *
-     * @return The parent node.
-     */
-    NodePtr getParentNode() const { return parentNode; }
-
-    /**
-     * @brief Sets the parent node.
-     *
-     * @param parentNode The parent node.
-     */
-    void setParentNode(NodePtr parentNode) { this->parentNode = parentNode; }
-
-    /**
-     * @brief Gets the parent routing object.
-     *
-     * @return The parent routing object.
-     */
-    TreeObjectPtr getParentRoutingObj() const { return parentRoutingObj; }
-
-    /**
-     * @brief Sets the parent routing object.
-     *
-     * @param parentRoutingObj The parent routing object.
-     */
-    void setParentRoutingObj(TreeObjectPtr parentRoutingObj) { this->parentRoutingObj = parentRoutingObj; }
-
-    /**
-     * @brief Gets the entries in the node.
-     *
-     * @return A reference to the vector of entries.
-     */
-    std::vector<TreeObjectPtr>& getEntries() { return entries; }
-
-    /**
-     * @brief Gets the entries in the node (const version).
-     *
-     * @return A const reference to the vector of entries.
-     */
-    const std::vector<TreeObjectPtr>& getEntries() const { return entries; }
+    void setIsRoot(bool root) { header().isRoot = root; }
 
     /**
      * @brief Checks if the node is a leaf.
      *
      * @return True if the node is a leaf, false otherwise.
      */
-    bool getIsLeaf() const { return isLeaf; }
+    bool getIsLeaf() const { return header().isLeaf; }
 
     /**
-     * @brief Creates a new node based on the type (Leaf/Internal) of the current node.
+     * @brief Gets the parent node.
      *
-     * @param nodeId The unique ID of the new node.
-     * @return A shared pointer to the new node.
+     * @return The index of the parent node (NULL_NODE for the root).
      */
-    virtual NodePtr createNewNode() const = 0;
+    NodeIndex getParentNode() const { return header().parentNode; }
 
     /**
-     * @brief Creates a new root node.
+     * @brief Gets the object of the parent routing entry of this node.
      *
-     * @param nodeId The unique ID of the new root node.
-     * @return A shared pointer to the new root node.
+     * @return The id of the routing object that covers this node.
      */
-    virtual NodePtr createNewRootNode() const = 0;
+    ObjectId getRoutingObjectId() const
+    {
+        return storage->nodes.objectIds(header().parentNode)[header().parentSlot];
+    }
 
     /**
-     * @brief Searches for the nearest neighbors of an element in the node.
-     *
-     * @param element The element to search for.
-     * @param nnList The list of nearest neighbors.
-     * @param candidates The candidate nodes to search in.
-     * @param distance The distance function.
+     * @brief Gets the number of entries in the node.
      */
-    virtual void search(const T &query, NNList<T> &nnList, std::vector<std::pair<NodePtr, double>> &candidates, Metric distance) const = 0;
+    size_t getNumEntries() const { return header().numEntries; }
+
+    ObjectId getObjectId(size_t i) const { return storage->nodes.objectIds(index)[i]; }
+    float getCoveringRadius(size_t i) const { return storage->nodes.coveringRadii(index)[i]; }
+    void setCoveringRadius(size_t i, float radius) { storage->nodes.coveringRadii(index)[i] = radius; }
+    float getDistanceToParent(size_t i) const { return storage->nodes.distancesToParent(index)[i]; }
+    void setDistanceToParent(size_t i, float dist) { storage->nodes.distancesToParent(index)[i] = dist; }
+    NodeIndex getSubtree(size_t i) const { return storage->nodes.children(index)[i]; }
 
     /**
-     * @brief Updates the routing object.
-     *
-     * @param p The routing object to be updated.
-     * @param entries The entries in the node.
-     * @param childNode The child node.
-     * @param parentNode The parent node.
-     * @param distance The distance function.
+     * @brief Gets an object of the tree by its id.
      */
-    virtual void updateRoutingObject(TreeObjectPtr p, std::vector<TreeObjectPtr> &entries, NodePtr childNode, NodePtr parentNode, Metric distance) = 0;
+    const T &getObject(ObjectId id) const { return storage->objects[id]; }
 
     /**
-     * @brief Gets the string representation of the node.
+     * @brief Gets the string representation of the node and its subtree.
      *
      * @param os The output stream.
      */
-    virtual void getRepr(std::ostream &os) const = 0;
+    void getRepr(std::ostream &os) const;
 
     /**
      * @brief Overloads the output stream operator to print the node.
@@ -173,322 +132,118 @@ public:
      * @param node The node to be printed.
      * @return The output stream.
      */
-    friend std::ostream &operator<<(std::ostream &os, const Node<T> &node) {
-        for (size_t i = 0; i < node.entries.size(); i++) {
-            if (node.isRoot && i == 0) {
-                os << "(Root Node" << node.getNodeId() << ") ";
-            }
-            if (node.getIsLeaf()) {
-                // Print parent node
-                if (node.getParentNode() != nullptr) {
-                    os << node.getParentNode()->getNodeId();
-                }
-                os << "[" << node.entries[i]->getRepresentative() << "<" << node.entries[i] << ">]";
-            } else {
-                os << "(routObj " << node.entries[i]->getRepresentative() << "<" << node.entries[i] << ">" << ": covRad " << node.entries[i]->getCoveringRadius() << ")";
-            }
-            if (node.entries[i]->getSubtree() == nullptr) {
-                os << "*";
-            }
-            os << " ";
-        }
-
-        // Recurse down the tree
-        for (size_t i = 0; i < node.entries.size(); i++) {
-            if (node.entries[i]->getSubtree() != nullptr) {
-                os << "\n";
-                node.entries[i]->getSubtree()->getRepr(os);
-            }
-        }
+    friend std::ostream &operator<<(std::ostream &os, const Node<T> &node)
+    {
+        node.getRepr(os);
         return os;
     }
 
     /**
-     * @brief Promotes two entries to routing objects.
+     * @brief Splits the node.
      *
-     * @return A pair of routing objects.
+     * The policy promotes two routing objects and partitions the entries between them.
+     * Both work on a SplitContext, so the distances they compute are also used as the
+     * covering radii and the distances to the parent of the two resulting nodes.
+     *
+     * @param entry The entry that did not fit into the node.
+     * @param distance The distance function.
+     * @param policy The split policy.
      */
-    std::pair<TreeObjectPtr, TreeObjectPtr> promote(std::vector<TreeObjectPtr> &entries) const {
-        // TreeObjectPtr p1 = std::make_shared<RoutingObject<T>>(entries[0]->getRepresentative(), entries[0]->getCoveringRadius(), entries[0]->getSubtree(), entries[0]->getDistanceToParent());
-        // TreeObjectPtr p2 = std::make_shared<RoutingObject<T>>(entries[1]->getRepresentative(), entries[1]->getCoveringRadius(), entries[1]->getSubtree(), entries[1]->getDistanceToParent());
-        // return std::make_pair(p1, p2);
-
-        /* Select two random */
-        size_t p1Index = rand() % entries.size();
-        size_t p2Index = rand() % entries.size();
-        while (p1Index == p2Index) {
-            p2Index = rand() % entries.size();
-        }
-        TreeObjectPtr p1 = std::make_shared<RoutingObject<T>>(entries[p1Index]->getRepresentative(), entries[p1Index]->getCoveringRadius(), entries[p1Index]->getDistanceToParent());
-        TreeObjectPtr p2 = std::make_shared<RoutingObject<T>>(entries[p2Index]->getRepresentative(), entries[p2Index]->getCoveringRadius(), entries[p2Index]->getDistanceToParent());
-        return std::make_pair(p1, p2);
-    }
+    template <typename Metric, typename SplitPolicy>
+    void split(const RoutingEntry &entry, const Metric &distance, SplitPolicy &policy);
+
+protected:
+    template <typename U, typename M>
+    friend class BulkLoader; // Writes the planned nodes with appendEntry
+
+    NodeHeader &header() { return storage->nodes.header(index); }
+    const NodeHeader &header() const { return storage->nodes.header(index); }
 
     /**
-     * @brief Partitions the entries that caused the node to split.
+     * @brief Computes the distance between an object and the routing object of this node.
      *
-     * @param entries The entries to be partitioned.
-     * @param p1 The first routing object.
-     * @param p2 The second routing object.
-     * @return A pair of vectors of entries.
+     * @return The distance, or infinity if the node is the root (it has no routing object).
      */
-    std::pair<std::vector<TreeObjectPtr>, std::vector<TreeObjectPtr>> partition(std::vector<TreeObjectPtr> &entries, TreeObjectPtr p1, TreeObjectPtr p2, Metric distance) const {
-        // // Generalized hyperplane partitioning
-        // // Assign each entry to the closest of the two routing objects
-        // std::vector<TreeObjectPtr> entries1;
-        // std::vector<TreeObjectPtr> entries2;
-        // for (const auto &entry : entries) {
-        //     double dist1 = distance(entry->getRepresentative(), p1->getRepresentative());
-        //     double dist2 = distance(entry->getRepresentative(), p2->getRepresentative());
-        //     if (dist1 < dist2) {
-        //         entries1.push_back(entry);
-        //     } else {
-        //         entries2.push_back(entry);
-        //     }
-        // }
-
-        // Balanced
-
-        // While entries is not empty
-        // For all entries compute distance between entry and p1 and p2
-        // Assign to entries1 the nearest entry to p1
-        // Assign to entries2 the nearest entry to p2
-
-        // std::vector<TreeObjectPtr> entries1;
-        // std::vector<TreeObjectPtr> entries2;
-        // while (!entries.empty()) {
-        //     double maxDist1 = 0.0;
-        //     double maxDist2 = 0.0;
-        //     size_t maxIndex1 = 0;
-        //     size_t maxIndex2 = 0;
-        //     for (size_t i = 0; i < entries.size(); i++) {
-        //         double dist1 = distance(entries[i]->getRepresentative(), p1->getRepresentative());
-        //         double dist2 = distance(entries[i]->getRepresentative(), p2->getRepresentative());
-        //         if (dist1 > maxDist1) {
-        //             maxDist1 = dist1;
-        //             maxIndex1 = i;
-        //         }
-        //         if (dist2 > maxDist2) {
-        //             maxDist2 = dist2;
-        //             maxIndex2 = i;
-        //         }
-        //     }
-        //     if (maxDist1 < maxDist2) {
-        //         entries1.push_back(entries[maxIndex1]);
-        //         entries.erase(entries.begin() + maxIndex1);
-        //     } else {
-        //         entries2.push_back(entries[maxIndex2]);
-        //         entries.erase(entries.begin() + maxIndex2);
-        //     }
-        // }
-
-        // Divide in half
-        std::vector<TreeObjectPtr> entries1(entries.begin(), entries.begin() + entries.size() / 2);
-        std::vector<TreeObjectPtr> entries2(entries.begin() + entries.size() / 2, entries.end());
-
-        return std::make_pair(entries1, entries2);
+    template <typename Metric>
+    float distanceToRoutingObject(ObjectId objectId, const Metric &distance) const
+    {
+        if (getIsRoot())
+        {
+            return std::numeric_limits<float>::infinity();
+        }
+        return distance(getObject(objectId), getObject(getRoutingObjectId()));
     }
 
     /**
-     * @brief Splits the node.
+     * @brief Writes an entry into a slot of the node and links its subtree back to it.
      *
-     * @param entry The entry to be inserted.
-     * @param distance The distance function.
+     * With pivots, the rings of the entry are the buckets of its object for a leaf entry,
+     * and the union of the rings of its subtree for a routing entry.
+     *
+     * @param slot The slot to be written.
+     * @param entry The entry.
+     * @param distanceToParent The distance between the entry and the routing object of this node.
      */
-    void split(const TreeObjectPtr &entry, Metric distance) {
-        
-        // The new routing objects are now all those in the node plus the new routing object
-        std::vector<TreeObjectPtr> allEntries = entries;
-        allEntries.push_back(entry);
-
-        // Create a new node
-        auto newNode = createNewNode();
-
-        // Promote two entries to routing objects
-        std::pair<TreeObjectPtr, TreeObjectPtr> promoted = promote(allEntries);
-        TreeObjectPtr p1 = promoted.first;
-        TreeObjectPtr p2 = promoted.second;
-
-        // Divides entries of the overflown node into two disjoint sets
-        std::pair<std::vector<TreeObjectPtr>, std::vector<TreeObjectPtr>> partEntries = partition(allEntries, p1, p2, distance);
-        std::vector<TreeObjectPtr> entries1 = partEntries.first;
-        std::vector<TreeObjectPtr> entries2 = partEntries.second;
-
-        // Store each partitioned entry in the corresponding node
-        this->entries.clear();
-        storeEntries(entries1, this); //  @TODO: Maybe this can be done faster, by just removing the elements that are in entries 2
-        storeEntries(entries2, newNode);
-
-        #ifdef INSDEBUG
-        INSDEBUG_MSG("New Node" << newNode->getNodeId() << ", Promoted " << p1->getRepresentative() << "<" << p1 << ">" << " and " << p2->getRepresentative() << "<" << p2 << ">");
-
-        INSDEBUG_INLINE("Partition Node" << this->getNodeId() << "[");
-        for (const auto &entry : this->entries) {
-            INSDEBUG_INLINE(entry->getRepresentative() << "<" << entry << "> ");
-        }
-        INSDEBUG_INLINE("]\n");
-        INSDEBUG_INLINE("Partition Node" << newNode->getNodeId() << "[");
-        for (const auto &entry : newNode->entries) {
-            INSDEBUG_INLINE(entry->getRepresentative() << "<" << entry << "> ");
+    void setEntry(size_t slot, const RoutingEntry &entry, float distanceToParent)
+    {
+        NodeArena &nodes = storage->nodes;
+        nodes.objectIds(index)[slot] = entry.objectId;
+        nodes.coveringRadii(index)[slot] = entry.coveringRadius;
+        nodes.distancesToParent(index)[slot] = distanceToParent;
+        nodes.children(index)[slot] = entry.subtree;
+
+        if (entry.subtree != NULL_NODE)
+        {
+            nodes.header(entry.subtree).parentNode = index;
+            nodes.header(entry.subtree).parentSlot = static_cast<uint32_t>(slot);
         }
-        INSDEBUG_INLINE("]\n");
-        #endif
-
-        if (isRoot) {
-            // The split occurred in the root node
-            // In this case, create a new level on the tree with a new root node
-            auto newRoot = createNewRootNode();
-            isRoot = false; // Reset flag of the old root
-            
-            INSDEBUG_MSG("Splitting the root... NewRoot = " << newRoot->getNodeId());
-
-            // Update connections
-            updateRoutingObject(p1, entries1, this->shared_from_this(), newRoot, distance);
-            updateRoutingObject(p2, entries2, newNode, newRoot, distance);
-
-
-            #ifdef INSDEBUG
-            INSDEBUG_MSG("Node" << p1->getSubtree()->getNodeId() << " linked to routing obj " << p1->getRepresentative() << "<" << p1 << "> (id: " << newRoot->getNodeId() << "), covering radius " << p1->getCoveringRadius());
-            
-            INSDEBUG_MSG("Node" << p2->getSubtree()->getNodeId() << " linked to routing obj " << p2->getRepresentative() << "<" << p2 << "> (id: " << newRoot->getNodeId() << "), covering radius " << p2->getCoveringRadius());
-            #endif
-        } else {
-            // The split occurred in an internal or leaf
-
-            // In this case, start by replacing the parent routing object
-            // of this node with the new promoted routing object p1
-            // @TODO: Maybe this can be done faster too. Is std::erase the fastest approach?
-            bool found = false;
-            for (auto &entry : parentNode->entries) {
-    
-                if (entry == parentRoutingObj) {
-                    found = true;
-
-                    INSDEBUG_MSG("Substituting routing object " << parentRoutingObj->getRepresentative() << "<" << parentRoutingObj << "> in node " << parentNode->getNodeId() << " with " << p1->getRepresentative() << "<" << p1 << ">");
-
-                    // Remove the parent routing object from the parent node
-                    parentNode->entries.erase(std::remove(parentNode->entries.begin(), parentNode->entries.end(), parentRoutingObj), parentNode->entries.end());
-
-                    // Update distance to parent for new routing object p1
-                    // Get parentRoutingObj from the parent node
-                    if (parentNode->getParentRoutingObj() != nullptr)
-                    {
-                        p1->setDistanceToParent(distance(p1->getRepresentative(), parentNode->getParentRoutingObj()->getRepresentative()));
-                    }
-
-                    // Update the parent routing object with the new routing object p1
-                    updateRoutingObject(p1, entries1, this->shared_from_this(), parentNode, distance);
-
-                    
-                    INSDEBUG_MSG("Node" << p1->getSubtree()->getNodeId() << " linked to routing obj " << p1->getRepresentative() << "<" << p1 << "> (id: " << parentNode->getNodeId() << "), covering radius " << p1->getCoveringRadius() << ", parentDistance: " << p1->getDistanceToParent());
-                    break;
-                }
-            } 
-
-            if (!found) {
-                std::cerr << "Parent routing object not found in parent node" << std::endl;
-                exit(1);
-            }
 
-            // Now decide what will happen with the new routing object p2
-            // 1. If the parent node has space for the new routing object, insert it
-            // 2. If the parent node is full, split it
-
-
-            if (parentNode->entries.size() < maxCapacity) {
-                // The parent node has space for the new routing object
-                updateRoutingObject(p2, entries2, newNode, parentNode, distance);
-
-                if (parentNode->getParentRoutingObj() != nullptr){
-                    p2->setDistanceToParent(distance(p2->getRepresentative(), parentNode->getParentRoutingObj()->getRepresentative()));
-                }
-
-                INSDEBUG_MSG("Node" << p2->getSubtree()->getNodeId() << " linked to routing obj " << p2->getRepresentative() << "<" << p2 << "> (id: " << parentNode->getNodeId() << "), covering radius " << p2->getCoveringRadius());
-            } else {
-                // The parent node is full. Need to split it
-                // Using the routing object p2 as the new tree entry
-
-                // First, let p2 adopt the remaining entries
-                double maxDistance = 0.0;
-                for (const auto &entry : entries2) {
-                    double dist = distance(p2->getRepresentative(), entry->getRepresentative());
-                    
-                    // Isso me custou um bom tempo :(
-                    if (newNode->getIsLeaf()) {
-                        if (dist > maxDistance)
-                            maxDistance = dist;
-                    } else {
-                        if (dist + entry->getCoveringRadius() > maxDistance)
-                            maxDistance = dist + entry->getCoveringRadius();
-                    }
-                    
-                    // Update parentDistance for each entry
-                    entry->setDistanceToParent(dist);
-                }
-                p2->setCoveringRadius(maxDistance);
-                p2->setSubtree(newNode);
-                newNode->setParentRoutingObj(p2);
-                
-                INSDEBUG_MSG("Node" << p2->getSubtree()->getNodeId() << " linked to routing obj " << p2->getRepresentative() << "<" << p2 << "> (id: tbd), covering radius " << p2->getCoveringRadius());
-
-                // Split the parent node to insert the new routing object p2
-                parentNode->split(p2, distance);
-
-                // Finally, for all entries in the currentNode of p2, update the parent node
-                for (const auto &entry : p2->getCurrentNode()->getEntries()) {
-                    entry->getSubtree()->setParentNode(p2->getCurrentNode());
-                    INSDEBUG_MSG("Node " << entry->getSubtree()->getNodeId() << " finally linked to " << p2->getCurrentNode()->getNodeId());
-                }
-
-                // @ TODO: Maybe remove it
-                if (p2->getCurrentNode()->getParentRoutingObj() != nullptr)
-                {
-                    p2->setDistanceToParent(distance(p2->getRepresentative(), p2->getCurrentNode()->getParentRoutingObj()->getRepresentative()));
-                }
+        if (nodes.numPivots() > 0)
+        {
+            if (entry.subtree == NULL_NODE)
+            {
+                nodes.setRings(index, slot, storage->pivots.buckets(entry.objectId));
+            }
+            else
+            {
+                nodes.uniteRings(index, slot, entry.subtree);
             }
         }
     }
 
-protected:
-    size_t nodeId;
-    size_t maxCapacity;
-    bool isRoot;
-    bool isLeaf;
-    std::vector<TreeObjectPtr> entries;
-    NodePtr parentNode;
-    TreeObjectPtr parentRoutingObj;
-    static size_t nextNodeId;
-
     /**
-     * @brief Stores entries in a node.
-     *
-     * @param newEntries The entries to be stored.
-     * @param node The node in which to store the entries.
+     * @brief Appends an entry to the node. The caller must guarantee that the node is not full.
      */
-    void storeEntries(const std::vector<TreeObjectPtr> &newEntries, NodePtr node) {
-        for (const auto &entry : newEntries) {
-            node->entries.push_back(entry);
-            entry->setCurrentNode(node);
-        }
+    void appendEntry(const RoutingEntry &entry, float distanceToParent)
+    {
+        setEntry(header().numEntries, entry, distanceToParent);
+        header().numEntries++;
     }
 
     /**
-     * @brief Stores entries in a node (non-shared_ptr version).
+     * @brief Replaces the entries of a node with a group of a split, routed by the promoted candidate p.
      *
-     * @param newEntries The entries to be stored.
+     * @param ctx The context of the split.
+     * @param p The promoted candidate.
+     * @param group The entries of the group.
      * @param node The node in which to store the entries.
-     */
-    void storeEntries(const std::vector<TreeObjectPtr> &newEntries, Node<T>* node) {
-        for (const auto &entry : newEntries) {
-            node->entries.push_back(entry);
-            entry->setCurrentNode(node->shared_from_this());
+     * @return The routing entry of the node.
+     */
+    template <typename Context>
+    RoutingEntry storeGroup(Context &ctx, size_t p, const std::vector<size_t> &group, NodeIndex node)
+    {
+        Node<T> target(*storage, node);
+        target.header().numEntries = 0;
+        for (size_t e : group)
+        {
+            target.appendEntry(ctx.entry(e), ctx.getDistance(p, e));
         }
+        return RoutingEntry{ctx.objectId(p), ctx.coveringRadius(p, group), node};
     }
-};
 
-// Static variable initialization to unique node IDs
-template <typename T>
-size_t Node<T>::nextNodeId = 0;
+    Storage *storage; ///< The storage of the tree that owns the node
+    NodeIndex index;  ///< The index of the node in the arena
+};
 
 /**
  * @brief Class for a leaf node in the M-Tree.
@@ -499,66 +254,36 @@ template <typename T>
 class LeafNode : public Node<T>
 {
 public:
-    typedef std::shared_ptr<TreeObject<T>> TreeObjectPtr;
-    typedef std::shared_ptr<Node<T>> NodePtr;
-    typedef DistanceFunction<T>& Metric;
-
+    typedef typename Node<T>::Storage Storage;
 
     /**
-     * @brief Constructs a LeafNode.
+     * @brief Constructs a handle to a leaf node.
      *
-     * @param nodeId The unique ID of the node.
-     * @param maxCapacity The maximum number of elements the node can hold.
-     * @param isRoot Whether the node is the root node.
-     * @param parentNode The parent node.
-     * @param parentRoutingObj The parent routing object.
+     * @param storage The storage of the tree that owns the node.
+     * @param index The index of the node in the arena.
      */
-    LeafNode(size_t maxCapacity, bool isRoot, NodePtr parentNode, TreeObjectPtr parentRoutingObj);
+    LeafNode(Storage &storage, NodeIndex index) : Node<T>(storage, index) {}
 
     /**
      * @brief Inserts an element into the leaf node directly.
      * If the node is full, it will split the node.
      *
-     * @param element The element to be inserted.
-     * @param distance The distance function.
-     */
-    void insert(const T &element, Metric distance) override;
-
-    /**
-     * @brief Creates a new node.
-     *
-     * @param nodeId The unique ID of the new node.
-     * @return A shared pointer to the new node.
-     */
-    NodePtr createNewNode() const override;
-
-    /**
-     * @brief Creates a new root node.
-     *
-     * @param nodeId The unique ID of the new root node.
-     * @return A shared pointer to the new root node.
-     */
-    NodePtr createNewRootNode() const override;
-
-    /**
-     * @brief Updates the routing object.
-     *
-     * @param p The routing object to be updated.
-     * @param entries The partitioned entries.
-     * @param childNode The child node.
-     * @param parentNode The parent node.
+     * @param objectId The id of the element to be inserted.
      * @param distance The distance function.
+     * @param policy The split policy used when a node overflows.
      */
-    void updateRoutingObject(TreeObjectPtr p, std::vector<TreeObjectPtr> &entries, NodePtr childNode, NodePtr parentNode, Metric distance) override;
+    template <typename Metric, typename SplitPolicy>
+    void insert(ObjectId objectId, const Metric &distance, SplitPolicy &policy);
 
-    void search(const T &query, NNList<T> &nnList, std::vector<std::pair<NodePtr, double>> &candidates, Metric distance) const override;
+    template <typename Metric>
+    void search(NNList &nnList, SearchContext<T> &context, const Metric &distance) const;
 
     /**
      * @brief Gets the string representation of the leaf node.
      *
      * @param os The output stream.
      */
-    void getRepr(std::ostream &os) const override;
+    void getRepr(std::ostream &os) const;
 };
 
 /**
@@ -570,22 +295,17 @@ template <typename T>
 class InternalNode : public Node<T>
 {
 public:
-    typedef std::shared_ptr<TreeObject<T>> TreeObjectPtr;
-    typedef std::shared_ptr<Node<T>> NodePtr;
-    typedef DistanceFunction<T>& Metric;
+    typedef typename Node<T>::Storage Storage;
 
     /**
-     * @brief Constructs an InternalNode.
-     * 
+     * @brief Constructs a handle to an internal node.
+     *
      * An internal node is a node that contains routing objects, in contrast to a leaf node that contains non-routing objects (the objects that were inserted into the tree by the user).
      *
-     * @param nodeId The unique ID of the node.
-     * @param maxCapacity The maximum number of elements the node can hold.
-     * @param isRoot Whether the node is the root node.
-     * @param parentNode The parent node.
-     * @param parentRoutingObj The parent routing object.
+     * @param storage The storage of the tree that owns the node.
+     * @param index The index of the node in the arena.
      */
-    InternalNode(size_t maxCapacity, bool isRoot, NodePtr parentNode, TreeObjectPtr parentRoutingObj);
+    InternalNode(Storage &storage, NodeIndex index) : Node<T>(storage, index) {}
 
     /**
      * @brief Inserts an element into the internal node.
@@ -594,49 +314,154 @@ public:
      *      1. If the element fits into an existing entry, insert it into the subtree which minimizes the distance to the routing object.
      *      2. If the element does not fit into any existing entry, insert it into the subtree which minimizes the increase in the covering radius.
      *
-     * @param element The element to be inserted.
+     * @param objectId The id of the element to be inserted.
      * @param distance The distance function.
+     * @param policy The split policy used when a node overflows.
      */
-    void insert(const T &element, Metric distance) override;
+    template <typename Metric, typename SplitPolicy>
+    void insert(ObjectId objectId, const Metric &distance, SplitPolicy &policy);
 
-    /**
-     * @brief Creates a new node.
-     *
-     * @param nodeId The unique ID of the new node.
-     * @return A shared pointer to the new node.
-     */
-    NodePtr createNewNode() const override;
-
-    /**
-     * @brief Creates a new root node.
-     *
-     * @param nodeId The unique ID of the new root node.
-     * @return A shared pointer to the new root node.
-     */
-    NodePtr createNewRootNode() const override;
-
-    /**
-     * @brief Updates the routing object.
-     *
-     * @param p The routing object to be updated.
-     * @param entries The partitioned entries.
-     * @param childNode The child node.
-     * @param parentNode The parent node.
-     * @param distance The distance function.
-     */
-    void updateRoutingObject(TreeObjectPtr p, std::vector<TreeObjectPtr> &entries, NodePtr childNode, NodePtr parentNode, Metric distance) override;
-
-    void search(const T &query, NNList<T> &nnList, std::vector<std::pair<NodePtr, double>> &candidates, Metric distance) const override;
+    template <typename Metric>
+    void search(NNList &nnList, SearchContext<T> &context, const Metric &distance) const;
 
     /**
      * @brief Gets the string representation of the internal node.
      *
      * @param os The output stream.
      */
-    void getRepr(std::ostream &os) const override;
+    void getRepr(std::ostream &os) const;
 };
 
+template <typename T>
+template <typename Metric, typename SplitPolicy>
+void Node<T>::insert(ObjectId objectId, const Metric &distance, SplitPolicy &policy)
+{
+    if (getIsLeaf())
+    {
+        LeafNode<T>(*storage, index).insert(objectId, distance, policy);
+    }
+    else
+    {
+        InternalNode<T>(*storage, index).insert(objectId, distance, policy);
+    }
+}
+
+template <typename T>
+template <typename Metric>
+void Node<T>::search(NNList &nnList, SearchContext<T> &context, const Metric &distance) const
+{
+    if (getIsLeaf())
+    {
+        LeafNode<T>(*storage, index).search(nnList, context, distance);
+    }
+    else
+    {
+        InternalNode<T>(*storage, index).search(nnList, context, distance);
+    }
+}
+
+template <typename T>
+void Node<T>::getRepr(std::ostream &os) const
+{
+    if (getIsLeaf())
+    {
+        LeafNode<T>(*storage, index).getRepr(os);
+    }
+    else
+    {
+        InternalNode<T>(*storage, index).getRepr(os);
+    }
+}
+
+template <typename T>
+template <typename Metric, typename SplitPolicy>
+void Node<T>::split(const RoutingEntry &entry, const Metric &distance, SplitPolicy &policy)
+{
+    NodeArena &nodes = storage->nodes;
+    const bool isRoot = getIsRoot();
+    const float unknown = std::numeric_limits<float>::quiet_NaN();
+
+    // The entries to be distributed are all those in the node plus the new entry,
+    // whose distance to the routing object of the node is not known yet
+    std::vector<RoutingEntry> allEntries;
+    std::vector<float> distancesToRoutingObject;
+    allEntries.reserve(getNumEntries() + 1);
+    distancesToRoutingObject.reserve(getNumEntries() + 1);
+    for (size_t i = 0; i < getNumEntries(); i++)
+    {
+        allEntries.push_back(RoutingEntry{getObjectId(i), getCoveringRadius(i), getSubtree(i)});
+        distancesToRoutingObject.push_back(isRoot ? unknown : getDistanceToParent(i));
+    }
+    allEntries.push_back(entry);
+    distancesToRoutingObject.push_back(unknown);
+
+    ObjectId routingObject = isRoot ? 0 : getRoutingObjectId();
+    SplitContext<T, Metric> ctx(storage->objects, allEntries, isRoot ? nullptr : &routingObject, distancesToRoutingObject, distance);
+
+    // Promote two routing objects and divide the entries of the overflown node into two disjoint sets
+    std::pair<size_t, size_t> promoted = policy.promotion.promote(ctx, policy.partition);
+    std::vector<size_t> group1, group2;
+    policy.partition.partition(ctx, promoted.first, promoted.second, group1, group2);
+
+    // Create a new node and store each group in the corresponding node. The covering radii
+    // and the distances to the parent come from the distances computed by the policy
+    NodeIndex newNode = nodes.allocate(getIsLeaf());
+    RoutingEntry p1 = storeGroup(ctx, promoted.first, group1, index);
+    RoutingEntry p2 = storeGroup(ctx, promoted.second, group2, newNode);
+
+    INSDEBUG_MSG("New Node" << newNode << ", Promoted " << getObject(p1.objectId) << " and " << getObject(p2.objectId));
+
+    if (isRoot)
+    {
+        // The split occurred in the root node
+        // In this case, create a new level on the tree with a new root node
+        NodeIndex newRoot = nodes.allocate(false);
+        nodes.header(newRoot).isRoot = true;
+        setIsRoot(false); // Reset flag of the old root
+        storage->root = newRoot;
+
+        INSDEBUG_MSG("Splitting the root... NewRoot = " << newRoot);
+
+        // The entries of the root have no parent routing object
+        Node<T> root(*storage, newRoot);
+        root.appendEntry(p1, std::numeric_limits<float>::infinity());
+        root.appendEntry(p2, std::numeric_limits<float>::infinity());
+    }
+    else
+    {
+        // The split occurred in an internal or leaf
+
+        // In this case, start by replacing the parent routing object
+        // of this node with the new promoted routing object p1
+        // If p1 is the old routing object, its distance to the parent is already known
+        Node<T> parent(*storage, getParentNode());
+        float p1DistanceToParent = p1.objectId == routingObject ? parent.getDistanceToParent(header().parentSlot)
+                                                                : parent.distanceToRoutingObject(p1.objectId, distance);
+        parent.setEntry(header().parentSlot, p1, p1DistanceToParent);
+
+        INSDEBUG_MSG("Node" << index << " linked to routing obj " << getObject(p1.objectId) << " (id: " << parent.getNodeId() << "), covering radius " << p1.coveringRadius);
+
+        // Now decide what will happen with the new routing object p2
+        // 1. If the parent node has space for the new routing object, insert it
+        // 2. If the parent node is full, split it
+        if (parent.getNumEntries() < nodes.getNodeCapacity())
+        {
+            parent.appendEntry(p2, parent.distanceToRoutingObject(p2.objectId, distance));
+
+            INSDEBUG_MSG("Node" << newNode << " linked to routing obj " << getObject(p2.objectId) << " (id: " << parent.getNodeId() << "), covering radius " << p2.coveringRadius);
+        }
+        else
+        {
+            // The parent node is full. Need to split it
+            // Using the routing object p2 as the new tree entry.
+            // The split links newNode to the node that ends up holding p2
+            // and sets the distances to the parent of both halves.
+            parent.split(p2, distance, policy);
+        }
+    }
+}
+
 #include "MTreeInternalNode.hpp"
 #include "MTreeLeafNode.hpp"
 
-#endif // MTREENODES_HPP
\ No newline at end of file
+#endif // MTREENODES_HPP
@@ -0,0 +1,302 @@
+#ifndef MTREEPIVOTS_HPP
+#define MTREEPIVOTS_HPP
+
+#include <vector>
+#include <random>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include "includes/ThreadPool.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * @brief Global pivots of a PM-tree style M-Tree, and the quantized distances of the objects to them.
+ *
+ * The distances to the pivots are quantized to buckets of width step: bucket v holds the
+ * distances in [v * step, (v + 1) * step), and the last bucket (top) also holds every larger
+ * distance. Each entry of a node keeps a ring per pivot, the range of buckets [min, max] of the
+ * objects of its subtree (a single bucket for an object in a leaf). For a query q at distance
+ * dq from a pivot, an entry can only hold objects closer than dk to q if its ring intersects
+ * [dq - dk, dq + dk], so an entry whose ring misses it for some pivot is pruned without
+ * computing its distance (Skopal et al., "PM-tree: Pivoting Metric Tree for Similarity Search").
+ *
+ * Buckets are 8 or 16 bits in the nodes; the table keeps the buckets of every object as 16 bits.
+ *
+ * @tparam T The type of elements stored in the M-Tree.
+ */
+template <typename T>
+struct PivotTable
+{
+    PivotTable() : bits(8), step(1.0f), top(255) {}
+
+    /**
+     * @brief Chooses pivots among a sample of objects by farthest-first traversal.
+     *
+     * The first pivot is a random object, and each next one is the object farthest from the
+     * pivots already chosen. The bucket width is set so that the largest distance between the
+     * sample and the pivots falls in the last bucket.
+     *
+     * @param sample The objects to choose from (at most MAX_SAMPLE of them, at random, are used).
+     * @param count The number of pivots (0 for none).
+     * @param bits The size of a bucket in the nodes, 8 or 16.
+     * @param distance The distance function.
+     * @param seed Seed of the sampling.
+     * @return The table, without objects.
+     * @throws std::invalid_argument if bits is neither 8 nor 16.
+     */
+    template <typename Metric>
+    static PivotTable choose(const std::vector<T> &sample, size_t count, unsigned int bits, const Metric &distance, unsigned int seed)
+    {
+        if (bits != 8 && bits != 16)
+        {
+            throw std::invalid_argument("Pivot buckets must have 8 or 16 bits");
+        }
+        PivotTable table;
+        table.bits = bits;
+        table.top = static_cast<uint16_t>((1u << bits) - 1);
+
+        std::mt19937 gen(seed);
+        std::vector<size_t> candidates(sample.size());
+        for (size_t i = 0; i < sample.size(); i++)
+        {
+            candidates[i] = i;
+        }
+        std::shuffle(candidates.begin(), candidates.end(), gen);
+        candidates.resize(std::min(candidates.size(), MAX_SAMPLE));
+        count = std::min(count, candidates.size());
+        if (count == 0)
+        {
+            return table;
+        }
+
+        // Distance between each candidate and its nearest pivot
+        std::vector<double> nearest(candidates.size(), std::numeric_limits<double>::infinity());
+        double maxDistance = 0.0;
+        size_t next = 0;
+        for (size_t p = 0; p < count; p++)
+        {
+            const T &pivot = sample[candidates[next]];
+            table.pivots.push_back(pivot);
+            size_t farthest = 0;
+            for (size_t c = 0; c < candidates.size(); c++)
+            {
+                double d = distance(sample[candidates[c]], pivot);
+                maxDistance = std::max(maxDistance, d);
+                nearest[c] = std::min(nearest[c], d);
+                if (nearest[c] > nearest[farthest])
+                {
+                    farthest = c;
+                }
+            }
+            next = farthest;
+        }
+        table.step = maxDistance > 0.0 ? static_cast<float>(maxDistance / table.top) : 1.0f;
+        return table;
+    }
+
+    /**
+     * @brief Gets the number of pivots.
+     */
+    size_t size() const { return pivots.size(); }
+
+    /**
+     * @brief Gets the size in bytes of a bucket in the nodes.
+     */
+    size_t bucketBytes() const { return bits / 8; }
+
+    /**
+     * @brief Gets the bucket of a distance to a pivot.
+     */
+    uint16_t quantize(double d) const
+    {
+        double bucket = std::floor(d / step);
+        return bucket >= top ? top : static_cast<uint16_t>(std::max(bucket, 0.0));
+    }
+
+    /**
+     * @brief Gets the buckets of an object, one per pivot.
+     */
+    const uint16_t *buckets(size_t objectId) const { return objectBuckets.data() + objectId * size(); }
+
+    /**
+     * @brief Computes the buckets of a new object, whose id is the number of objects added before.
+     */
+    template <typename Metric>
+    void addObject(const T &object, const Metric &distance)
+    {
+        for (const T &pivot : pivots)
+        {
+            objectBuckets.push_back(quantize(distance(object, pivot)));
+        }
+    }
+
+    /**
+     * @brief Replaces the buckets of the objects with the ones of a new set of objects, computed in parallel.
+     */
+    template <typename Metric>
+    void setObjects(const std::vector<T> &objects, const Metric &distance, size_t threads)
+    {
+        objectBuckets.assign(objects.size() * size(), 0);
+        if (size() == 0)
+        {
+            return;
+        }
+        ThreadPool pool(std::max<size_t>(1, threads));
+        pool.parallelFor(objects.size(), [this, &objects, &distance](size_t i, size_t)
+                         {
+            for (size_t p = 0; p < size(); p++)
+            {
+                objectBuckets[i * size() + p] = quantize(distance(objects[i], pivots[p]));
+            } });
+    }
+
+    /**
+     * @brief Gets the buckets that a ring must reach for an entry to be kept.
+     *
+     * The ring [min, max] spans the distances [min * step, (max + 1) * step), so it intersects
+     * [dq - dk, dq + dk] if max >= low and min <= high. The bounds are widened by a small
+     * fraction of a bucket against rounding, which only prunes less.
+     *
+     * @param dq The distance between the query and the pivot.
+     * @param dk The radius of the query.
+     * @param low Output, the smallest max a ring can have.
+     * @param high Output, the largest min a ring can have.
+     */
+    void ringBounds(double dq, double dk, uint16_t &low, uint16_t &high) const
+    {
+        const double slack = 1e-3;
+        double lowest = (dq - dk) / step - 1.0 - slack;
+        double highest = (dq + dk) / step + slack;
+        // Rounded after clamping, where the conversion truncates towards 0 like floor
+        lowest = std::min<double>(std::max(lowest, 0.0), top);
+        highest = std::min<double>(std::max(highest, 0.0), top);
+        low = static_cast<uint16_t>(lowest);
+        low += low < lowest ? 1 : 0;
+        high = static_cast<uint16_t>(highest);
+    }
+
+    /**
+     * @brief Gets a lower bound on the distance between a query and the objects of a ring.
+     *
+     * The objects of the ring [min, max] are at distances in [min * step, (max + 1) * step)
+     * from the pivot (unbounded above if max is the last bucket), so by the triangle inequality
+     * they are at least as far from the query as the gap between dq and that range. The bound
+     * is lowered by the same slack as ringBounds.
+     *
+     * @param dq The distance between the query and the pivot.
+     * @param min The first bucket of the ring.
+     * @param max The last bucket of the ring.
+     */
+    double lowerBound(double dq, uint16_t min, uint16_t max) const
+    {
+        const double slack = 1e-3;
+        double below = min * static_cast<double>(step) - dq;
+        double above = max < top ? dq - (max + 1) * static_cast<double>(step) : 0.0;
+        return std::max(0.0, std::max(below, above) - slack * step);
+    }
+
+    static const size_t MAX_SAMPLE = 1000; ///< Largest number of objects the pivots are chosen from
+
+    std::vector<T> pivots;               ///< The pivot objects
+    unsigned int bits;                   ///< Size of a bucket in the nodes, 8 or 16
+    float step;                          ///< Width of a bucket
+    uint16_t top;                        ///< The last bucket, 2^bits - 1
+    std::vector<uint16_t> objectBuckets; ///< size() buckets per object, by ObjectId
+};
+
+template <typename T>
+const size_t PivotTable<T>::MAX_SAMPLE;
+
+/**
+ * @brief Tests the rings of all the entries of a node at once.
+ *
+ * The rings of a node are stored pivot by pivot, in rows padded to whole blocks of 16
+ * buckets, so for each pivot a block of entries is compared with the same two bounds in SIMD
+ * registers (SSE2 when available). Unsigned buckets are compared with saturating
+ * subtractions: max >= low exactly when low - max saturates to 0, and min <= high exactly
+ * when min - high does. The entries after numEntries in the last block are tested too, and
+ * their results are meaningless.
+ *
+ * @tparam Bucket uint8_t or uint16_t.
+ * @param mins The ring minimums of the node, pivot-major (rows of stride buckets).
+ * @param maxs The ring maximums of the node, with the same layout.
+ * @param stride The length of a row, a multiple of 16.
+ * @param numEntries The number of entries of the node.
+ * @param pivots The pivots (rows) to test.
+ * @param numTested The number of pivots to test.
+ * @param low The smallest max of a kept ring, per tested pivot (see PivotTable::ringBounds).
+ * @param high The largest min of a kept ring, per tested pivot.
+ * @param pass Output of stride bytes, non-zero for each entry that is kept and 0 for each entry that can be pruned.
+ */
+template <typename Bucket>
+void filterRings(const Bucket *mins, const Bucket *maxs, size_t stride, size_t numEntries, const size_t *pivots, size_t numTested,
+                 const uint16_t *low, const uint16_t *high, uint8_t *pass)
+{
+    static_assert(sizeof(Bucket) == 1 || sizeof(Bucket) == 2, "Buckets have 8 or 16 bits");
+    const size_t BLOCK = 16;
+    for (size_t block = 0; block < numEntries; block += BLOCK)
+    {
+#ifdef __SSE2__
+        // One register of 16 buckets of 8 bits, or two of 8 buckets of 16 bits
+        const size_t lanes = 16 / sizeof(Bucket);
+        __m128i rejected[BLOCK / lanes];
+        for (size_t r = 0; r < BLOCK / lanes; r++)
+        {
+            rejected[r] = _mm_setzero_si128();
+        }
+        for (size_t t = 0; t < numTested; t++)
+        {
+            const Bucket *rowMin = mins + pivots[t] * stride + block;
+            const Bucket *rowMax = maxs + pivots[t] * stride + block;
+            for (size_t r = 0; r < BLOCK / lanes; r++)
+            {
+                __m128i min = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rowMin + r * lanes));
+                __m128i max = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rowMax + r * lanes));
+                if (sizeof(Bucket) == 1)
+                {
+                    __m128i lo = _mm_set1_epi8(static_cast<char>(low[t]));
+                    __m128i hi = _mm_set1_epi8(static_cast<char>(high[t]));
+                    rejected[r] = _mm_or_si128(rejected[r], _mm_or_si128(_mm_subs_epu8(lo, max), _mm_subs_epu8(min, hi)));
+                }
+                else
+                {
+                    __m128i lo = _mm_set1_epi16(static_cast<short>(low[t]));
+                    __m128i hi = _mm_set1_epi16(static_cast<short>(high[t]));
+                    rejected[r] = _mm_or_si128(rejected[r], _mm_or_si128(_mm_subs_epu16(lo, max), _mm_subs_epu16(min, hi)));
+                }
+            }
+        }
+        if (sizeof(Bucket) == 1)
+        {
+            __m128i keep = _mm_cmpeq_epi8(rejected[0], _mm_setzero_si128());
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(pass + block), keep);
+        }
+        else
+        {
+            __m128i keep0 = _mm_cmpeq_epi16(rejected[0], _mm_setzero_si128());
+            __m128i keep1 = _mm_cmpeq_epi16(rejected[BLOCK / lanes - 1], _mm_setzero_si128());
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(pass + block), _mm_packs_epi16(keep0, keep1));
+        }
+#else
+        uint8_t keep[BLOCK];
+        std::fill(keep, keep + BLOCK, 1);
+        for (size_t t = 0; t < numTested; t++)
+        {
+            const Bucket *rowMin = mins + pivots[t] * stride + block;
+            const Bucket *rowMax = maxs + pivots[t] * stride + block;
+            for (size_t i = 0; i < BLOCK; i++)
+            {
+                keep[i] &= static_cast<uint8_t>((rowMax[i] >= low[t]) & (rowMin[i] <= high[t]));
+            }
+        }
+        std::copy(keep, keep + BLOCK, pass + block);
+#endif
+    }
+}
+
+#endif // MTREEPIVOTS_HPP
@@ -0,0 +1,203 @@
+#ifndef MTREESEARCHCONTEXT_HPP
+#define MTREESEARCHCONTEXT_HPP
+
+#include <vector>
+#include <cstddef>
+#include <algorithm>  // For std::push_heap, std::pop_heap
+#include <functional> // For std::greater
+#include <limits>
+#include "MTreeStorage.hpp"
+#include "MTreePivots.hpp"
+#include "indexing/SearchStats.hpp"
+
+/**
+ * @brief A node waiting to be visited by the k-NN search.
+ */
+struct Candidate
+{
+    NodeIndex node;       ///< The node to be visited
+    uint32_t level;       ///< Level of node, the root being level 0
+    double dmin;          ///< Lower bound on the distance between the query and any object in the subtree of node
+    double dQueryRouting; ///< Distance between the query and the routing object of node (0 for the root)
+
+    bool operator>(const Candidate &other) const { return dmin > other.dmin; }
+};
+
+/**
+ * @brief Min-heap of candidate nodes, ordered by their lower bound dmin.
+ *
+ * Candidates are never removed when dk shrinks; the search stops as soon as the
+ * smallest dmin in the queue is greater than dk, which discards all of them at once.
+ */
+class CandidateQueue
+{
+public:
+    /**
+     * @brief Adds a candidate node.
+     *
+     * @param node The node.
+     * @param dmin The lower bound on the distance between the query and the subtree of node.
+     * @param dQueryRouting The distance between the query and the routing object of node.
+     * @param level The level of node, the root being level 0.
+     */
+    void push(NodeIndex node, double dmin, double dQueryRouting, uint32_t level)
+    {
+        heap.push_back(Candidate{node, level, dmin, dQueryRouting});
+        std::push_heap(heap.begin(), heap.end(), std::greater<Candidate>());
+    }
+
+    /**
+     * @brief Gets the candidate with the smallest lower bound.
+     */
+    const Candidate &top() const { return heap.front(); }
+
+    /**
+     * @brief Removes the candidate with the smallest lower bound.
+     */
+    void pop()
+    {
+        std::pop_heap(heap.begin(), heap.end(), std::greater<Candidate>());
+        heap.pop_back();
+    }
+
+    /**
+     * @brief Removes all candidates, keeping the allocated memory.
+     */
+    void clear() { heap.clear(); }
+
+    bool empty() const { return heap.empty(); }
+    size_t size() const { return heap.size(); }
+
+    /**
+     * @brief Iterators over the candidates, in heap (not sorted) order.
+     */
+    std::vector<Candidate>::const_iterator begin() const { return heap.begin(); }
+    std::vector<Candidate>::const_iterator end() const { return heap.end(); }
+
+private:
+    std::vector<Candidate> heap;
+};
+
+/**
+ * @brief The state of one k-NN search.
+ *
+ * The tree is never modified by a search: everything that depends on the query lives
+ * here, so several threads can search the same tree at once, each with its own context.
+ * A context can be reused for many queries, in which case the candidate queue keeps its
+ * memory and the searches allocate nothing per node. The context also collects the
+ * SearchStats of the search.
+ *
+ * @tparam T The type of elements stored in the M-Tree.
+ */
+template <typename T>
+class SearchContext
+{
+public:
+    SearchContext() : query(nullptr), dQueryParent(0.0), level(0), pivots(nullptr), boundsRadius(0.0), testedPivots(0) {}
+
+    /**
+     * @brief Starts a new search, keeping the memory of the previous one.
+     *
+     * @param q The query element. It must outlive the search.
+     */
+    void reset(const T &q)
+    {
+        query = &q;
+        dQueryParent = 0.0;
+        level = 0;
+        candidates.clear();
+        stats.reset();
+        pivots = nullptr;
+    }
+
+    /**
+     * @brief Computes the distances between the query and the pivots of the tree, once per search.
+     *
+     * @param table The pivots of the tree (possibly none).
+     * @param distance The distance function.
+     */
+    template <typename Metric>
+    void measurePivots(const PivotTable<T> &table, const Metric &distance)
+    {
+        pivots = table.size() > 0 ? &table : nullptr;
+        pivotDistances.resize(table.size());
+        for (size_t p = 0; p < table.size(); p++)
+        {
+            pivotDistances[p] = distance(*query, table.pivots[p]);
+        }
+        stats.distanceEvaluations += table.size();
+        boundsRadius = std::numeric_limits<double>::quiet_NaN();
+    }
+
+    /**
+     * @brief Tests the rings of all the entries of a node against the ball of radius dk around the query.
+     *
+     * @param nodes The arena of the tree.
+     * @param node The node.
+     * @param dk The radius of the ball.
+     * @return For each entry, 0 if it can be pruned and non-zero otherwise; null if the tree has no pivots.
+     */
+    const uint8_t *filterByPivots(const NodeArena &nodes, NodeIndex node, double dk)
+    {
+        if (!pivots)
+        {
+            return nullptr;
+        }
+
+        // The bounds only change with dk, which changes far less often than the node.
+        // Only the pivots whose bounds can reject a ring are tested
+        if (dk != boundsRadius)
+        {
+            const size_t numPivots = pivots->size();
+            ringLow.resize(numPivots);
+            ringHigh.resize(numPivots);
+            testedRows.resize(numPivots);
+            testedPivots = 0;
+            for (size_t p = 0; p < numPivots; p++)
+            {
+                pivots->ringBounds(pivotDistances[p], dk, ringLow[testedPivots], ringHigh[testedPivots]);
+                if (ringLow[testedPivots] > 0 || ringHigh[testedPivots] < pivots->top)
+                {
+                    testedRows[testedPivots++] = p;
+                }
+            }
+            boundsRadius = dk;
+        }
+        if (testedPivots == 0)
+        {
+            return nullptr;
+        }
+
+        const size_t stride = nodes.ringStride();
+        const size_t numEntries = nodes.header(node).numEntries;
+        ringPass.resize(stride);
+        if (nodes.bucketBytes() == 1)
+        {
+            filterRings(nodes.ringMins(node), nodes.ringMaxs(node), stride, numEntries, testedRows.data(), testedPivots, ringLow.data(), ringHigh.data(), ringPass.data());
+        }
+        else
+        {
+            filterRings(reinterpret_cast<const uint16_t *>(nodes.ringMins(node)), reinterpret_cast<const uint16_t *>(nodes.ringMaxs(node)),
+                        stride, numEntries, testedRows.data(), testedPivots, ringLow.data(), ringHigh.data(), ringPass.data());
+        }
+        return ringPass.data();
+    }
+
+    const T *query;            ///< The query element
+    double dQueryParent;       ///< Distance between the query and the routing object of the node being searched
+    uint32_t level;            ///< Level of the node being searched, the root being level 0
+    CandidateQueue candidates; ///< The nodes still to be visited
+    SearchStats stats;         ///< What the search did so far
+
+private:
+    const PivotTable<T> *pivots;       ///< The pivots of the tree, null if it has none
+    std::vector<double> pivotDistances; ///< Distance between the query and each pivot
+    double boundsRadius;                ///< The dk of the current bounds (NaN if there are none yet)
+    size_t testedPivots;                ///< Number of pivots whose bounds can reject a ring at boundsRadius
+    std::vector<size_t> testedRows;     ///< The pivots whose bounds can reject a ring at the current dk
+    std::vector<uint16_t> ringLow;      ///< Per tested pivot, the smallest ring max kept at the current dk
+    std::vector<uint16_t> ringHigh;     ///< Per tested pivot, the largest ring min kept at the current dk
+    std::vector<uint8_t> ringPass;      ///< Result of the last filterByPivots
+};
+
+#endif // MTREESEARCHCONTEXT_HPP
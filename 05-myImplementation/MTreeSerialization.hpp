@@ -0,0 +1,330 @@
+#ifndef MTREESERIALIZATION_HPP
+#define MTREESERIALIZATION_HPP
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <fstream>
+#include <cstring>   // For std::memcmp, std::memcpy
+#include <cstdint>
+#include <stdexcept>
+#include "MTreeStorage.hpp"
+#include "includes/MappedFile.hpp"
+#include "objectTypes/Feature.hpp"
+#include "objectTypes/FeatureView.hpp"
+#include "objectTypes/FloatNumber.hpp"
+
+/**
+ * @brief How the objects of a tree are written to (and rebuilt from) a row of a matrix of scalars.
+ *
+ * Only types with a specialization can be saved.
+ *
+ * @tparam T The type of elements stored in the M-Tree.
+ */
+template <typename T>
+struct ObjectCodec;
+
+template <typename NumT>
+struct ObjectCodec<Feature<NumT>>
+{
+    typedef NumT Scalar;
+
+    static size_t dimension(const Feature<NumT> &object) { return object.size(); }
+    static uint32_t id(const Feature<NumT> &object) { return object.id; }
+    static void copyRow(const Feature<NumT> &object, Scalar *row) { std::memcpy(row, object.values.data(), object.size() * sizeof(Scalar)); }
+
+    static Feature<NumT> make(uint32_t id, const Scalar *row, size_t dimension)
+    {
+        // Set the id directly, the loaded ids may be below the next automatic id
+        Feature<NumT> object;
+        object.id = id;
+        object.values.assign(row, row + dimension);
+        return object;
+    }
+};
+
+// Loaded views point into the mapped file, which the node arena keeps alive
+template <typename NumT>
+struct ObjectCodec<FeatureView<NumT>>
+{
+    typedef NumT Scalar;
+
+    static size_t dimension(const FeatureView<NumT> &object) { return object.size(); }
+    static uint32_t id(const FeatureView<NumT> &object) { return object.id; }
+    static void copyRow(const FeatureView<NumT> &object, Scalar *row) { std::memcpy(row, object.data(), object.size() * sizeof(Scalar)); }
+    static FeatureView<NumT> make(uint32_t id, const Scalar *row, size_t dimension) { return FeatureView<NumT>(id, row, dimension); }
+};
+
+template <>
+struct ObjectCodec<FloatNumber>
+{
+    typedef float Scalar;
+
+    static size_t dimension(const FloatNumber &) { return 1; }
+    static uint32_t id(const FloatNumber &object) { return static_cast<uint32_t>(object.getOid()); }
+    static void copyRow(const FloatNumber &object, Scalar *row) { row[0] = object.getValue(); }
+    static FloatNumber make(uint32_t, const Scalar *row, size_t) { return FloatNumber(row[0]); }
+};
+
+/**
+ * @brief Header of an M-Tree file.
+ *
+ * The file holds the pages of the NodeArena exactly as they are in memory, followed by the
+ * object ids and the feature matrix (row-major, one row per ObjectId), and then by the ids
+ * and the rows of the pivots and the buckets of the objects (see PivotTable). Nodes refer to each
+ * other and to objects by index only, so nothing depends on where the file is mapped.
+ * Sections start at offsets aligned to FILE_ALIGNMENT.
+ */
+struct MTreeFileHeader
+{
+    char magic[8];            ///< "MTREE" padded with zeros
+    uint32_t version;         ///< MTREE_FILE_VERSION
+    uint32_t byteOrder;       ///< MTREE_BYTE_ORDER as written by the saving machine
+    uint32_t nodeHeaderBytes; ///< sizeof(NodeHeader) of the saving build
+    uint32_t scalarBytes;     ///< Size of a scalar of the feature matrix
+    uint64_t nodeCapacity;    ///< Maximum number of entries of each node
+    uint64_t nodesPerPage;    ///< Number of nodes in each page
+    uint64_t pageBytes;       ///< Size of each page
+    uint64_t numNodes;        ///< Number of nodes
+    uint64_t root;            ///< Index of the root node
+    uint64_t height;          ///< Height of the tree
+    uint64_t numObjects;      ///< Number of rows of the feature matrix
+    uint64_t dimension;       ///< Number of columns of the feature matrix
+    uint64_t numPivots;       ///< Number of pivots
+    uint64_t pivotBits;       ///< Size of a bucket in the nodes, 8 or 16
+    double pivotStep;         ///< Width of a bucket
+    uint64_t nodesOffset;     ///< Offset of the first page
+    uint64_t idsOffset;       ///< Offset of the object ids (uint32_t each)
+    uint64_t valuesOffset;    ///< Offset of the feature matrix
+    uint64_t pivotIdsOffset;  ///< Offset of the pivot ids (uint32_t each)
+    uint64_t pivotValuesOffset; ///< Offset of the rows of the pivots
+    uint64_t bucketsOffset;   ///< Offset of the buckets of the objects (numPivots uint16_t per object)
+    uint64_t fileBytes;       ///< Size of the whole file
+};
+
+const char MTREE_FILE_MAGIC[8] = {'M', 'T', 'R', 'E', 'E', 0, 0, 0};
+const uint32_t MTREE_FILE_VERSION = 2;
+const uint32_t MTREE_BYTE_ORDER = 0x01020304;
+const uint64_t FILE_ALIGNMENT = 4096; ///< Sections start on OS pages, so they can be shared as whole pages
+
+inline uint64_t alignFileOffset(uint64_t offset) { return (offset + FILE_ALIGNMENT - 1) / FILE_ALIGNMENT * FILE_ALIGNMENT; }
+
+/**
+ * @brief Writes the nodes and the objects of an M-Tree to a file.
+ *
+ * @param path The path of the file.
+ * @param storage The storage of the tree.
+ * @param height The height of the tree.
+ * @throws std::invalid_argument if the objects do not all have the same dimension.
+ * @throws std::runtime_error if the file cannot be written.
+ */
+template <typename T>
+void saveStorage(const std::string &path, const MTreeStorage<T> &storage, size_t height)
+{
+    typedef ObjectCodec<T> Codec;
+    typedef typename Codec::Scalar Scalar;
+
+    const NodeArena &nodes = storage.nodes;
+    const PivotTable<T> &pivots = storage.pivots;
+    size_t dimension = storage.objects.empty() ? 0 : Codec::dimension(storage.objects[0]);
+    for (const T &object : storage.objects)
+    {
+        if (Codec::dimension(object) != dimension)
+        {
+            throw std::invalid_argument("All objects must have the same dimension to be saved");
+        }
+    }
+
+    MTreeFileHeader header = {};
+    std::memcpy(header.magic, MTREE_FILE_MAGIC, sizeof(header.magic));
+    header.version = MTREE_FILE_VERSION;
+    header.byteOrder = MTREE_BYTE_ORDER;
+    header.nodeHeaderBytes = sizeof(NodeHeader);
+    header.scalarBytes = sizeof(Scalar);
+    header.nodeCapacity = nodes.getNodeCapacity();
+    header.nodesPerPage = nodes.getNodesPerPage();
+    header.pageBytes = nodes.pageBytes();
+    header.numNodes = nodes.size();
+    header.root = storage.root;
+    header.height = height;
+    header.numObjects = storage.objects.size();
+    header.dimension = dimension;
+    header.numPivots = pivots.size();
+    header.pivotBits = pivots.bits;
+    header.pivotStep = pivots.step;
+    header.nodesOffset = alignFileOffset(sizeof(MTreeFileHeader));
+    header.idsOffset = alignFileOffset(header.nodesOffset + nodes.numPages() * header.pageBytes);
+    header.valuesOffset = alignFileOffset(header.idsOffset + header.numObjects * sizeof(uint32_t));
+    header.pivotIdsOffset = alignFileOffset(header.valuesOffset + header.numObjects * dimension * sizeof(Scalar));
+    header.pivotValuesOffset = alignFileOffset(header.pivotIdsOffset + header.numPivots * sizeof(uint32_t));
+    header.bucketsOffset = alignFileOffset(header.pivotValuesOffset + header.numPivots * dimension * sizeof(Scalar));
+    header.fileBytes = header.bucketsOffset + pivots.objectBuckets.size() * sizeof(uint16_t);
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+        throw std::runtime_error("Cannot create " + path);
+    }
+
+    // Zeros up to the start of the next section
+    auto padTo = [&file](uint64_t offset)
+    {
+        static const char zeros[FILE_ALIGNMENT] = {};
+        uint64_t position = static_cast<uint64_t>(file.tellp());
+        file.write(zeros, static_cast<std::streamsize>(offset - position));
+    };
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    padTo(header.nodesOffset);
+    for (size_t p = 0; p < nodes.numPages(); p++)
+    {
+        file.write(reinterpret_cast<const char *>(nodes.pageData(p)), static_cast<std::streamsize>(header.pageBytes));
+    }
+
+    std::vector<Scalar> row(dimension);
+    auto writeObjects = [&file, &row, &padTo, dimension](const std::vector<T> &objects, uint64_t idsOffset, uint64_t valuesOffset)
+    {
+        padTo(idsOffset);
+        for (const T &object : objects)
+        {
+            uint32_t id = Codec::id(object);
+            file.write(reinterpret_cast<const char *>(&id), sizeof(id));
+        }
+
+        padTo(valuesOffset);
+        for (const T &object : objects)
+        {
+            Codec::copyRow(object, row.data());
+            file.write(reinterpret_cast<const char *>(row.data()), static_cast<std::streamsize>(dimension * sizeof(Scalar)));
+        }
+    };
+    writeObjects(storage.objects, header.idsOffset, header.valuesOffset);
+    writeObjects(pivots.pivots, header.pivotIdsOffset, header.pivotValuesOffset);
+
+    padTo(header.bucketsOffset);
+    file.write(reinterpret_cast<const char *>(pivots.objectBuckets.data()), static_cast<std::streamsize>(pivots.objectBuckets.size() * sizeof(uint16_t)));
+
+    if (!file.flush())
+    {
+        throw std::runtime_error("Cannot write " + path);
+    }
+}
+
+/**
+ * @brief Loads the nodes and the objects of an M-Tree from a file written by saveStorage.
+ *
+ * The file is memory mapped and the node pages are used in place: loading does not
+ * read or copy the nodes, and processes that load the same file share their pages. The
+ * objects are rebuilt by ObjectCodec::make: FeatureViews point into the mapping too, but a
+ * Feature copies its row into its own vector, so loading Features takes O(N * d) and one
+ * allocation per object, and their values are not shared between processes.
+ *
+ * The header is checked before anything else is read: every section must lie inside the
+ * file, in the order saveStorage writes them, and the root must be one of the nodes. The
+ * contents of the nodes are trusted.
+ *
+ * @param path The path of the file.
+ * @param height Output, the height of the tree.
+ * @return The storage of the tree.
+ * @throws std::runtime_error if the file is not a valid M-Tree file for this build, or its header is corrupt.
+ */
+template <typename T>
+MTreeStorage<T> loadStorage(const std::string &path, size_t &height)
+{
+    typedef ObjectCodec<T> Codec;
+    typedef typename Codec::Scalar Scalar;
+
+    std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>(path);
+    if (file->size() < sizeof(MTreeFileHeader))
+    {
+        throw std::runtime_error(path + " is not an M-Tree file");
+    }
+    MTreeFileHeader header;
+    std::memcpy(&header, file->getData(), sizeof(header));
+
+    if (std::memcmp(header.magic, MTREE_FILE_MAGIC, sizeof(header.magic)) != 0)
+    {
+        throw std::runtime_error(path + " is not an M-Tree file");
+    }
+    if (header.version != MTREE_FILE_VERSION)
+    {
+        throw std::runtime_error(path + " has an unsupported M-Tree file version " + std::to_string(header.version));
+    }
+    if (header.byteOrder != MTREE_BYTE_ORDER || header.nodeHeaderBytes != sizeof(NodeHeader) || header.scalarBytes != sizeof(Scalar))
+    {
+        throw std::runtime_error(path + " was written by an incompatible build");
+    }
+    if (header.fileBytes != file->size())
+    {
+        throw std::runtime_error(path + " is truncated");
+    }
+
+    if (header.numPivots > 0 && header.pivotBits != 8 && header.pivotBits != 16)
+    {
+        throw std::runtime_error(path + " has pivot buckets of an unsupported size");
+    }
+
+    // Every section must lie inside the file, after the previous one, before anything is read from it
+    uint64_t sectionsEnd = sizeof(MTreeFileHeader);
+    auto checkSection = [&path, &header, &sectionsEnd](uint64_t offset, uint64_t count, uint64_t bytesEach)
+    {
+        if (offset < sectionsEnd || offset % FILE_ALIGNMENT != 0 || offset > header.fileBytes ||
+            (bytesEach != 0 && count > (header.fileBytes - offset) / bytesEach))
+        {
+            throw std::runtime_error(path + " has a section outside of the file");
+        }
+        sectionsEnd = offset + count * bytesEach;
+    };
+    if (header.nodesPerPage == 0 || header.dimension > header.fileBytes / sizeof(Scalar) || header.numPivots > header.fileBytes / sizeof(uint32_t))
+    {
+        throw std::runtime_error(path + " has an invalid header");
+    }
+    checkSection(header.nodesOffset, (header.numNodes + header.nodesPerPage - 1) / header.nodesPerPage, header.pageBytes);
+    checkSection(header.idsOffset, header.numObjects, sizeof(uint32_t));
+    checkSection(header.valuesOffset, header.numObjects, header.dimension * sizeof(Scalar));
+    checkSection(header.pivotIdsOffset, header.numPivots, sizeof(uint32_t));
+    checkSection(header.pivotValuesOffset, header.numPivots, header.dimension * sizeof(Scalar));
+    checkSection(header.bucketsOffset, header.numObjects, header.numPivots * sizeof(uint16_t));
+    if (header.numNodes == 0 ? header.root != NULL_NODE : header.root >= header.numNodes)
+    {
+        throw std::runtime_error(path + " has an invalid root");
+    }
+
+    // The rows of the objects and of the pivots are rebuilt in the same way
+    auto readObjects = [&file, &header](uint64_t count, uint64_t idsOffset, uint64_t valuesOffset)
+    {
+        const uint32_t *ids = reinterpret_cast<const uint32_t *>(file->getData() + idsOffset);
+        const Scalar *values = reinterpret_cast<const Scalar *>(file->getData() + valuesOffset);
+        std::vector<T> objects;
+        objects.reserve(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            objects.push_back(Codec::make(ids[i], values + i * header.dimension, header.dimension));
+        }
+        return objects;
+    };
+
+    PivotTable<T> pivots;
+    pivots.pivots = readObjects(header.numPivots, header.pivotIdsOffset, header.pivotValuesOffset);
+    pivots.bits = static_cast<unsigned int>(header.pivotBits);
+    pivots.top = static_cast<uint16_t>((1u << pivots.bits) - 1);
+    pivots.step = static_cast<float>(header.pivotStep);
+    const uint16_t *buckets = reinterpret_cast<const uint16_t *>(file->getData() + header.bucketsOffset);
+    pivots.objectBuckets.assign(buckets, buckets + header.numObjects * header.numPivots);
+
+    MTreeStorage<T> storage(header.nodeCapacity, std::move(pivots));
+    if (storage.nodes.getNodesPerPage() != header.nodesPerPage || storage.nodes.pageBytes() != header.pageBytes)
+    {
+        throw std::runtime_error(path + " was written by an incompatible build");
+    }
+    storage.nodes.attach(file->getData() + header.nodesOffset, header.numNodes, file);
+    storage.root = static_cast<NodeIndex>(header.root);
+
+    storage.objects = readObjects(header.numObjects, header.idsOffset, header.valuesOffset);
+
+    height = header.height;
+    return storage;
+}
+
+#endif // MTREESERIALIZATION_HPP
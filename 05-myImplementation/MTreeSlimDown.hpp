@@ -0,0 +1,302 @@
+#ifndef MTREESLIMDOWN_HPP
+#define MTREESLIMDOWN_HPP
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include "MTreeStorage.hpp"
+#include "includes/ThreadPool.hpp"
+
+/**
+ * @brief What a Slim-Down pass did to an M-Tree.
+ */
+struct SlimDownResult
+{
+    size_t groups;        ///< Number of sibling groups of leaves (one per parent of leaves)
+    size_t entriesMoved;  ///< Number of leaf entries moved to a sibling leaf
+    size_t leavesRemoved; ///< Number of leaves emptied by the moves and freed
+};
+
+/**
+ * @brief Reorganizes the leaves of a built M-Tree to reduce the overlap between them.
+ *
+ * This is the Slim-Down algorithm of the Slim-tree (Traina et al., "Slim-trees: High
+ * Performance Metric Trees Minimizing Overlap Between Nodes"), as in arboretum: within each
+ * group of sibling leaves, the farthest entry from the routing object of a leaf is moved to
+ * the nearest sibling that has room and whose ball already covers it, which shrinks the
+ * covering radius of the source without growing the one of the destination. Rounds over the
+ * group repeat until none moves an entry, or until 3 times the entries of the group were moved.
+ *
+ * Leaves then get their tight covering radius (the distance to their farthest entry) and pivot
+ * rings, leaves left empty are unlinked and freed, and the tighter radii are propagated up to
+ * the root. The objects of a subtree above the leaves do not change, so an ancestor keeps its
+ * radius (and its rings) when it is already tighter than the one derived from its children.
+ *
+ * Groups of siblings are disjoint, so they are processed in parallel; the only distances
+ * computed are between the moved entries and the routing objects of their siblings.
+ *
+ * @tparam T The type of elements stored in the M-Tree.
+ * @tparam Metric The distance function.
+ */
+template <typename T, typename Metric>
+class SlimDown
+{
+public:
+    /**
+     * @brief Constructs the pass for a tree.
+     *
+     * @param storage The storage of the tree.
+     * @param distance The distance function.
+     */
+    SlimDown(MTreeStorage<T> &storage, const Metric &distance) : storage(storage), distance(distance) {}
+
+    /**
+     * @brief Runs the pass.
+     *
+     * @param threads Maximum number of threads used to process the groups of siblings.
+     * @return What the pass did.
+     */
+    SlimDownResult run(size_t threads)
+    {
+        NodeArena &nodes = storage.nodes;
+        SlimDownResult result{0, 0, 0};
+
+        std::vector<NodeIndex> parents;
+        collectParentsOfLeaves(storage.root, parents);
+        result.groups = parents.size();
+
+        std::vector<size_t> moved(parents.size(), 0);
+        std::vector<std::vector<NodeIndex>> emptied(parents.size());
+        ThreadPool pool(std::max<size_t>(1, std::min(threads, parents.size())));
+        pool.parallelFor(parents.size(), [this, &parents, &moved, &emptied](size_t i, size_t)
+                         { moved[i] = slimDownGroup(parents[i], emptied[i]); });
+
+        // Free the emptied leaves from the highest index down, so no pending leaf is moved
+        std::vector<NodeIndex> released;
+        for (size_t i = 0; i < parents.size(); i++)
+        {
+            result.entriesMoved += moved[i];
+            released.insert(released.end(), emptied[i].begin(), emptied[i].end());
+        }
+        std::sort(released.begin(), released.end(), [](NodeIndex a, NodeIndex b)
+                  { return a > b; });
+        for (NodeIndex leaf : released)
+        {
+            if (nodes.release(leaf) == storage.root)
+            {
+                storage.root = leaf;
+            }
+        }
+        result.leavesRemoved = released.size();
+
+        tightenRadii(storage.root);
+        return result;
+    }
+
+private:
+    /**
+     * @brief Collects the internal nodes whose entries point to leaves.
+     */
+    void collectParentsOfLeaves(NodeIndex node, std::vector<NodeIndex> &parents) const
+    {
+        const NodeArena &nodes = storage.nodes;
+        const NodeHeader &h = nodes.header(node);
+        if (h.isLeaf || h.numEntries == 0)
+        {
+            return;
+        }
+        if (nodes.header(nodes.children(node)[0]).isLeaf)
+        {
+            parents.push_back(node);
+            return;
+        }
+        for (uint32_t i = 0; i < h.numEntries; i++)
+        {
+            collectParentsOfLeaves(nodes.children(node)[i], parents);
+        }
+    }
+
+    /**
+     * @brief Gets the slot of the entry of a leaf that is the farthest from its routing object.
+     */
+    size_t farthestEntry(NodeIndex leaf) const
+    {
+        const NodeArena &nodes = storage.nodes;
+        const float *distances = nodes.distancesToParent(leaf);
+        return std::max_element(distances, distances + nodes.header(leaf).numEntries) - distances;
+    }
+
+    /**
+     * @brief Gets the tight covering radius of a leaf (0 if it is empty).
+     */
+    float leafRadius(NodeIndex leaf) const
+    {
+        const NodeArena &nodes = storage.nodes;
+        if (nodes.header(leaf).numEntries == 0)
+        {
+            return 0.0f;
+        }
+        return nodes.distancesToParent(leaf)[farthestEntry(leaf)];
+    }
+
+    /**
+     * @brief Runs the Slim-Down on the leaves of one parent and unlinks the leaves it empties.
+     *
+     * @param parent The parent of the leaves.
+     * @param emptied Receives the leaves that were unlinked from the parent.
+     * @return The number of entries moved.
+     */
+    size_t slimDownGroup(NodeIndex parent, std::vector<NodeIndex> &emptied)
+    {
+        NodeArena &nodes = storage.nodes;
+        const size_t capacity = nodes.getNodeCapacity();
+        const size_t numLeaves = nodes.header(parent).numEntries;
+        const ObjectId *routing = nodes.objectIds(parent);
+        const NodeIndex *leaves = nodes.children(parent);
+
+        std::vector<float> radius(numLeaves);
+        size_t totalEntries = 0;
+        for (size_t j = 0; j < numLeaves; j++)
+        {
+            radius[j] = leafRadius(leaves[j]);
+            totalEntries += nodes.header(leaves[j]).numEntries;
+        }
+
+        // Radii only shrink and leaves only get room when a full leaf loses an entry, so an entry
+        // that found no destination is not tried again until then (a new epoch)
+        std::vector<ObjectId> stuck(numLeaves, std::numeric_limits<ObjectId>::max());
+        std::vector<size_t> stuckEpoch(numLeaves, 0);
+        size_t epoch = 0;
+
+        const size_t maxMoves = 3 * totalEntries;
+        size_t moves = 0;
+        bool movedInRound = true;
+        while (movedInRound && moves < maxMoves)
+        {
+            movedInRound = false;
+            for (size_t src = 0; src < numLeaves && moves < maxMoves; src++)
+            {
+                NodeIndex source = leaves[src];
+                NodeHeader &sourceHeader = nodes.header(source);
+                if (sourceHeader.numEntries == 0)
+                {
+                    continue;
+                }
+
+                size_t e = farthestEntry(source);
+                ObjectId objectId = nodes.objectIds(source)[e];
+                if (stuck[src] == objectId && stuckEpoch[src] == epoch)
+                {
+                    continue;
+                }
+
+                // The nearest sibling with room that already covers the entry
+                size_t dst = numLeaves;
+                float dstDistance = std::numeric_limits<float>::infinity();
+                for (size_t j = 0; j < numLeaves; j++)
+                {
+                    size_t entries = nodes.header(leaves[j]).numEntries;
+                    if (j == src || entries == 0 || entries >= capacity)
+                    {
+                        continue;
+                    }
+                    float d = distance(storage.objects[objectId], storage.objects[routing[j]]);
+                    if (d <= radius[j] && d < dstDistance)
+                    {
+                        dst = j;
+                        dstDistance = d;
+                    }
+                }
+                if (dst == numLeaves)
+                {
+                    stuck[src] = objectId;
+                    stuckEpoch[src] = epoch;
+                    continue;
+                }
+
+                if (sourceHeader.numEntries == capacity)
+                {
+                    epoch++;
+                }
+                NodeIndex target = leaves[dst];
+                uint32_t slot = nodes.header(target).numEntries++;
+                nodes.copyEntry(source, e, target, slot);
+                nodes.distancesToParent(target)[slot] = dstDistance;
+                removeEntry(source, e);
+
+                radius[src] = leafRadius(source);
+                moves++;
+                movedInRound = true;
+            }
+        }
+
+        for (size_t j = 0; j < numLeaves; j++)
+        {
+            nodes.coveringRadii(parent)[j] = radius[j];
+            if (nodes.numPivots() > 0)
+            {
+                nodes.uniteRings(parent, j, leaves[j]);
+            }
+        }
+        for (size_t j = numLeaves; j-- > 0;)
+        {
+            NodeIndex leaf = leaves[j];
+            if (nodes.header(leaf).numEntries == 0)
+            {
+                removeEntry(parent, j);
+                emptied.push_back(leaf);
+            }
+        }
+        return moves;
+    }
+
+    /**
+     * @brief Removes an entry from a node, moving the last entry into its slot.
+     */
+    void removeEntry(NodeIndex node, size_t slot)
+    {
+        NodeArena &nodes = storage.nodes;
+        size_t last = --nodes.header(node).numEntries;
+        if (slot != last)
+        {
+            nodes.copyEntry(node, last, node, slot);
+            if (nodes.children(node)[slot] != NULL_NODE)
+            {
+                nodes.header(nodes.children(node)[slot]).parentSlot = static_cast<uint32_t>(slot);
+            }
+        }
+    }
+
+    /**
+     * @brief Propagates the radii of the parents of leaves up to the root.
+     *
+     * The covering radius of an entry is bounded by max{d(routing, e) + r(e)} over the entries e
+     * of its subtree; it is lowered to that bound when the bound is tighter.
+     */
+    void tightenRadii(NodeIndex node)
+    {
+        NodeArena &nodes = storage.nodes;
+        const NodeHeader &h = nodes.header(node);
+        if (h.isLeaf || h.numEntries == 0 || nodes.header(nodes.children(node)[0]).isLeaf)
+        {
+            return;
+        }
+        for (uint32_t i = 0; i < h.numEntries; i++)
+        {
+            NodeIndex child = nodes.children(node)[i];
+            tightenRadii(child);
+
+            float bound = 0.0f;
+            for (uint32_t j = 0; j < nodes.header(child).numEntries; j++)
+            {
+                bound = std::max(bound, nodes.distancesToParent(child)[j] + nodes.coveringRadii(child)[j]);
+            }
+            nodes.coveringRadii(node)[i] = std::min(nodes.coveringRadii(node)[i], bound);
+        }
+    }
+
+    MTreeStorage<T> &storage; ///< The storage of the tree
+    const Metric &distance;   ///< The distance function
+};
+
+#endif // MTREESLIMDOWN_HPP
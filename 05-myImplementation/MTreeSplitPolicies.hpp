@@ -0,0 +1,397 @@
+#ifndef MTREESPLITPOLICIES_HPP
+#define MTREESPLITPOLICIES_HPP
+
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <algorithm>
+#include <numeric> // For std::iota
+#include "MTreeStorage.hpp"
+
+/**
+ * @brief An entry that is being moved between nodes during a split.
+ *
+ * Inside a node the entries are stored as structure-of-arrays, this struct is only
+ * used to carry one entry (or a promoted routing object) around.
+ */
+struct RoutingEntry
+{
+    ObjectId objectId;    ///< The representative object of the entry
+    float coveringRadius; ///< The covering radius (0 for leaf entries)
+    NodeIndex subtree;    ///< The subtree of the entry (NULL_NODE for leaf entries)
+};
+
+/**
+ * @brief The entries of an overflown node and the distances computed while splitting it.
+ *
+ * Candidates 0..n-1 are the entries of the node (including the one that caused the
+ * overflow). When the node is not the root, candidate n is its current routing object,
+ * whose distances to the entries are already stored in the node. Distances are
+ * computed lazily and cached, so promotion and partition share every distance call.
+ *
+ * @tparam T The type of elements stored in the M-Tree.
+ * @tparam Metric The distance function.
+ * @tparam Objects The object store, indexed by ObjectId.
+ */
+template <typename T, typename Metric, typename Objects = std::vector<T>>
+class SplitContext
+{
+public:
+    /**
+     * @brief Constructs the context of a split.
+     *
+     * @param objects The object store of the tree.
+     * @param entries The entries to be split.
+     * @param routingObject The routing object of the node, or nullptr for the root.
+     * @param distancesToRoutingObject Known distances between the entries and the routing object (NaN if unknown).
+     * @param distance The distance function.
+     */
+    SplitContext(const Objects &objects, const std::vector<RoutingEntry> &entries, const ObjectId *routingObject,
+                 const std::vector<float> &distancesToRoutingObject, const Metric &distance)
+        : objects(objects), entries(entries), distance(distance), n(entries.size()),
+          numCandidates(entries.size() + (routingObject ? 1 : 0)),
+          routingObject(routingObject ? *routingObject : 0),
+          distances(numCandidates * numCandidates, std::numeric_limits<float>::quiet_NaN())
+    {
+        for (size_t i = 0; i < numCandidates; i++)
+        {
+            distances[i * numCandidates + i] = 0.0f;
+        }
+        if (hasRoutingObject())
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                distances[i * numCandidates + n] = distances[n * numCandidates + i] = distancesToRoutingObject[i];
+            }
+        }
+    }
+
+    /**
+     * @brief Gets the number of entries being split.
+     */
+    size_t size() const { return n; }
+
+    /**
+     * @brief Checks if the node has a routing object (i.e. it is not the root).
+     */
+    bool hasRoutingObject() const { return numCandidates > n; }
+
+    /**
+     * @brief Gets the candidate index of the routing object of the node.
+     */
+    size_t routingObjectIndex() const { return n; }
+
+    /**
+     * @brief Gets an entry being split.
+     */
+    const RoutingEntry &entry(size_t i) const { return entries[i]; }
+
+    /**
+     * @brief Gets the object of a candidate (an entry or the routing object).
+     */
+    ObjectId objectId(size_t candidate) const
+    {
+        return candidate < n ? entries[candidate].objectId : routingObject;
+    }
+
+    /**
+     * @brief Gets the distance between two candidates, computing it only once.
+     */
+    float getDistance(size_t a, size_t b)
+    {
+        float &cached = distances[a * numCandidates + b];
+        if (std::isnan(cached))
+        {
+            cached = distance(objects[objectId(a)], objects[objectId(b)]);
+            distances[b * numCandidates + a] = cached;
+        }
+        return cached;
+    }
+
+    /**
+     * @brief Computes the covering radius of a candidate over a group of entries.
+     *
+     * @param p The candidate that routes the group.
+     * @param group The entries of the group.
+     * @return max{d(p, e) + r(e) | e in group}.
+     */
+    float coveringRadius(size_t p, const std::vector<size_t> &group)
+    {
+        float radius = 0.0f;
+        for (size_t e : group)
+        {
+            radius = std::max(radius, getDistance(p, e) + entries[e].coveringRadius);
+        }
+        return radius;
+    }
+
+private:
+    const Objects &objects;
+    const std::vector<RoutingEntry> &entries;
+    const Metric &distance;
+    size_t n;                     ///< Number of entries
+    size_t numCandidates;         ///< Number of entries plus the routing object, if any
+    ObjectId routingObject;       ///< The routing object of the node (if numCandidates > n)
+    std::vector<float> distances; ///< Cached distances between candidates (NaN if not computed yet)
+};
+
+/* ------------------------------------------------------------------------------------------------
+ * Partition policies
+ *
+ * partition(ctx, p1, p2, group1, group2) distributes the entries of the split between the
+ * promoted candidates p1 and p2. Promoted entries always stay with themselves, both groups end
+ * non-empty and, as there are nodeCapacity + 1 entries, neither group exceeds the node capacity.
+ * ------------------------------------------------------------------------------------------------ */
+
+/**
+ * @brief Generalized hyperplane: each entry goes to the nearest promoted object.
+ */
+struct GeneralizedHyperplanePartition
+{
+    template <typename Context>
+    void partition(Context &ctx, size_t p1, size_t p2, std::vector<size_t> &group1, std::vector<size_t> &group2) const
+    {
+        group1.clear();
+        group2.clear();
+        for (size_t e = 0; e < ctx.size(); e++)
+        {
+            if (e == p1 || e == p2)
+            {
+                (e == p1 ? group1 : group2).push_back(e);
+                continue;
+            }
+            float d1 = ctx.getDistance(e, p1);
+            float d2 = ctx.getDistance(e, p2);
+            if (d1 < d2 || (d1 == d2 && group1.size() <= group2.size()))
+            {
+                group1.push_back(e);
+            }
+            else
+            {
+                group2.push_back(e);
+            }
+        }
+
+        // The routing object of the node (M_LB_DIST) is not an entry, so its group may be empty
+        fillEmptyGroup(ctx, p1, group1, group2);
+        fillEmptyGroup(ctx, p2, group2, group1);
+    }
+
+private:
+    template <typename Context>
+    static void fillEmptyGroup(Context &ctx, size_t p, std::vector<size_t> &group, std::vector<size_t> &other)
+    {
+        if (!group.empty())
+        {
+            return;
+        }
+        auto nearest = std::min_element(other.begin(), other.end(), [&ctx, p](size_t a, size_t b)
+                                        { return ctx.getDistance(a, p) < ctx.getDistance(b, p); });
+        group.push_back(*nearest);
+        other.erase(nearest);
+    }
+};
+
+/**
+ * @brief Balanced: p1 and p2 alternately take their nearest remaining entry.
+ */
+struct BalancedPartition
+{
+    template <typename Context>
+    void partition(Context &ctx, size_t p1, size_t p2, std::vector<size_t> &group1, std::vector<size_t> &group2) const
+    {
+        group1.clear();
+        group2.clear();
+
+        std::vector<bool> assigned(ctx.size(), false);
+        if (p1 < ctx.size())
+        {
+            group1.push_back(p1);
+            assigned[p1] = true;
+        }
+        if (p2 < ctx.size())
+        {
+            group2.push_back(p2);
+            assigned[p2] = true;
+        }
+
+        // Entries by increasing distance to each promoted object
+        std::vector<size_t> byP1(ctx.size()), byP2(ctx.size());
+        std::iota(byP1.begin(), byP1.end(), 0);
+        std::iota(byP2.begin(), byP2.end(), 0);
+        std::sort(byP1.begin(), byP1.end(), [&ctx, p1](size_t a, size_t b)
+                  { return ctx.getDistance(a, p1) < ctx.getDistance(b, p1); });
+        std::sort(byP2.begin(), byP2.end(), [&ctx, p2](size_t a, size_t b)
+                  { return ctx.getDistance(a, p2) < ctx.getDistance(b, p2); });
+
+        size_t next1 = 0, next2 = 0;
+        size_t remaining = ctx.size() - group1.size() - group2.size();
+        bool turn1 = group1.size() <= group2.size();
+        while (remaining > 0)
+        {
+            std::vector<size_t> &order = turn1 ? byP1 : byP2;
+            size_t &next = turn1 ? next1 : next2;
+            while (assigned[order[next]])
+            {
+                next++;
+            }
+            assigned[order[next]] = true;
+            (turn1 ? group1 : group2).push_back(order[next]);
+            remaining--;
+            turn1 = !turn1;
+        }
+    }
+};
+
+/* ------------------------------------------------------------------------------------------------
+ * Promotion policies
+ *
+ * promote(ctx, partition) returns the candidates (entry indices, or ctx.routingObjectIndex())
+ * that become the routing objects of the two new nodes.
+ * ------------------------------------------------------------------------------------------------ */
+
+/**
+ * @brief Two random entries (the original behaviour of the tree).
+ */
+struct RandomPromotion
+{
+    template <typename Context, typename Partition>
+    std::pair<size_t, size_t> promote(Context &ctx, const Partition &) const
+    {
+        size_t p1 = rand() % ctx.size();
+        size_t p2 = rand() % ctx.size();
+        while (p1 == p2)
+        {
+            p2 = rand() % ctx.size();
+        }
+        return std::make_pair(p1, p2);
+    }
+};
+
+/**
+ * @brief M_LB_DIST (confirmed): keeps the current routing object and promotes the entry farthest from it.
+ *
+ * Only uses the distances to the parent already stored in the node. The root has no routing
+ * object, so there the first entry and the entry farthest from it are promoted.
+ */
+struct MLBDistPromotion
+{
+    template <typename Context, typename Partition>
+    std::pair<size_t, size_t> promote(Context &ctx, const Partition &) const
+    {
+        size_t p1 = ctx.hasRoutingObject() ? ctx.routingObjectIndex() : 0;
+        size_t p2 = p1 == 0 ? 1 : 0;
+        for (size_t e = 0; e < ctx.size(); e++)
+        {
+            if (e != p1 && ctx.getDistance(e, p1) > ctx.getDistance(p2, p1))
+            {
+                p2 = e;
+            }
+        }
+        return std::make_pair(p1, p2);
+    }
+};
+
+/**
+ * @brief Tries every pair of candidates and keeps the one whose partition minimizes a cost of the two radii.
+ *
+ * @tparam Cost Functor that combines the two covering radii (sum for m_RAD, max for mM_RAD).
+ */
+template <typename Cost>
+struct ExhaustivePromotion
+{
+    template <typename Context, typename Partition>
+    std::pair<size_t, size_t> promote(Context &ctx, const Partition &partition) const
+    {
+        std::vector<size_t> candidates(ctx.size());
+        std::iota(candidates.begin(), candidates.end(), 0);
+        return bestPair(ctx, partition, candidates);
+    }
+
+protected:
+    template <typename Context, typename Partition>
+    static std::pair<size_t, size_t> bestPair(Context &ctx, const Partition &partition, const std::vector<size_t> &candidates)
+    {
+        Cost cost;
+        std::pair<size_t, size_t> best(candidates[0], candidates[1]);
+        float bestCost = std::numeric_limits<float>::infinity();
+        std::vector<size_t> group1, group2;
+        for (size_t i = 0; i < candidates.size(); i++)
+        {
+            for (size_t j = i + 1; j < candidates.size(); j++)
+            {
+                partition.partition(ctx, candidates[i], candidates[j], group1, group2);
+                float c = cost(ctx.coveringRadius(candidates[i], group1), ctx.coveringRadius(candidates[j], group2));
+                if (c < bestCost)
+                {
+                    bestCost = c;
+                    best = std::make_pair(candidates[i], candidates[j]);
+                }
+            }
+        }
+        return best;
+    }
+};
+
+struct SumOfRadii
+{
+    float operator()(float r1, float r2) const { return r1 + r2; }
+};
+
+struct MaxOfRadii
+{
+    float operator()(float r1, float r2) const { return std::max(r1, r2); }
+};
+
+/// m_RAD: minimizes the sum of the two covering radii (computes all pairwise distances of the node)
+typedef ExhaustivePromotion<SumOfRadii> MRadPromotion;
+
+/// mM_RAD: minimizes the larger of the two covering radii (computes all pairwise distances of the node)
+typedef ExhaustivePromotion<MaxOfRadii> MMRadPromotion;
+
+/**
+ * @brief Runs mM_RAD over a random sample of the entries only.
+ *
+ * Costs about sampleSize * nodeCapacity distance calls per split, instead of nodeCapacity^2.
+ */
+struct SamplingPromotion : public ExhaustivePromotion<MaxOfRadii>
+{
+    explicit SamplingPromotion(size_t sampleSize = 10, unsigned int seed = 42) : sampleSize(std::max<size_t>(2, sampleSize)), gen(seed) {}
+
+    template <typename Context, typename Partition>
+    std::pair<size_t, size_t> promote(Context &ctx, const Partition &partition)
+    {
+        std::vector<size_t> candidates(ctx.size());
+        std::iota(candidates.begin(), candidates.end(), 0);
+        size_t s = std::min(sampleSize, candidates.size());
+        for (size_t i = 0; i < s; i++)
+        {
+            std::uniform_int_distribution<size_t> pick(i, candidates.size() - 1);
+            std::swap(candidates[i], candidates[pick(gen)]);
+        }
+        candidates.resize(s);
+        return bestPair(ctx, partition, candidates);
+    }
+
+    size_t sampleSize;
+    std::mt19937 gen;
+};
+
+/**
+ * @brief Split policy of an M-Tree: how to promote two routing objects and how to partition the entries.
+ *
+ * @tparam Promotion RandomPromotion, MLBDistPromotion, MRadPromotion, MMRadPromotion or SamplingPromotion.
+ * @tparam Partition GeneralizedHyperplanePartition or BalancedPartition.
+ */
+template <typename Promotion, typename Partition>
+struct SplitPolicy
+{
+    Promotion promotion;
+    Partition partition;
+};
+
+/// M_LB_DIST needs no extra distance calls to promote and, on uniform data, gives the fewest nodes accessed
+typedef SplitPolicy<MLBDistPromotion, GeneralizedHyperplanePartition> DefaultSplitPolicy;
+
+#endif // MTREESPLITPOLICIES_HPP
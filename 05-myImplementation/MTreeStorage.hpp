@@ -0,0 +1,455 @@
+#ifndef MTREESTORAGE_HPP
+#define MTREESTORAGE_HPP
+
+#include <vector>
+#include <memory>
+#include <algorithm> // For std::max, std::copy
+#include <limits>
+#include <cstdint>
+#include <cstdlib>   // For std::aligned_alloc, std::free
+#include <new>       // For std::bad_alloc
+#include <cstring>   // For std::memcpy, std::memset
+#include "MTreePivots.hpp"
+
+typedef uint32_t NodeIndex; ///< Index of a node inside the NodeArena
+typedef uint32_t ObjectId;  ///< Index of an object inside the tree object store
+
+/// Sentinel used for "no node" (e.g. the subtree of a leaf entry or the parent of the root)
+const NodeIndex NULL_NODE = std::numeric_limits<NodeIndex>::max();
+
+/**
+ * @brief Per-node bookkeeping stored next to the entry arrays of the node.
+ */
+struct NodeHeader
+{
+    uint32_t numEntries;  ///< Number of entries currently stored in the node
+    NodeIndex parentNode; ///< Node that holds the routing entry of this node (NULL_NODE for the root)
+    uint32_t parentSlot;  ///< Slot of the routing entry inside the parent node
+    bool isLeaf;          ///< Whether the node stores objects (leaf) or routing objects (internal)
+    bool isRoot;          ///< Whether the node is the root of the tree
+};
+
+/**
+ * @brief Arena that stores the nodes of an M-Tree in contiguous pages.
+ *
+ * Nodes are addressed by a NodeIndex instead of a pointer. Each page holds a fixed
+ * number of nodes and lays their entries out as structure-of-arrays: all object ids
+ * of a node are contiguous, followed (in separate arrays) by the covering radii, the
+ * distances to the parent routing object and the child indices. A node search then
+ * only walks a few small linear arrays.
+ *
+ * Pages are never reallocated, so a reference to the entries of a node stays valid
+ * while new nodes are allocated.
+ *
+ * With P pivots (see PivotTable), each entry also has P rings of buckets of 1 or 2 bytes,
+ * in two more arrays (the minimums and the maximums). The rings of a node are stored pivot
+ * by pivot: the buckets of all the entries for a pivot are contiguous, so a search compares
+ * a whole node against one pivot at a time (see filterRings). A row is padded to a multiple of
+ * RING_BLOCK buckets, so it is compared in whole SIMD registers.
+ */
+class NodeArena
+{
+public:
+    static const size_t ALIGNMENT = 64;         ///< Alignment (in bytes) of every array inside a page
+    static const size_t TARGET_PAGE_BYTES = 1 << 20; ///< Approximate size of a page
+    static const size_t RING_BLOCK = 16;        ///< The rows of ring buckets hold a multiple of this many buckets
+
+    /**
+     * @brief Constructs an empty arena.
+     *
+     * @param nodeCapacity The maximum number of entries of each node.
+     * @param numPivots The number of pivot rings of each entry.
+     * @param bucketBytes The size of a bucket of a ring, 1 or 2.
+     */
+    explicit NodeArena(size_t nodeCapacity, size_t numPivots = 0, size_t bucketBytes = 1)
+        : nodeCapacity(nodeCapacity), pivotCount(numPivots), ringBucketBytes(bucketBytes), numNodes(0)
+    {
+        size_t bytesPerNode = sizeof(NodeHeader) + nodeCapacity * (sizeof(ObjectId) + 2 * sizeof(float) + sizeof(NodeIndex)) + 2 * ringBytesPerNode();
+        nodesPerPage = std::max<size_t>(1, TARGET_PAGE_BYTES / bytesPerNode);
+    }
+
+    /**
+     * @brief Allocates a new empty node.
+     *
+     * @param isLeaf Whether the new node is a leaf.
+     * @return The index of the new node.
+     */
+    NodeIndex allocate(bool isLeaf)
+    {
+        if (numNodes == pages.size() * nodesPerPage)
+        {
+            addPage();
+        }
+
+        NodeIndex index = static_cast<NodeIndex>(numNodes++);
+        NodeHeader &h = header(index);
+        h.numEntries = 0;
+        h.parentNode = NULL_NODE;
+        h.parentSlot = 0;
+        h.isLeaf = isLeaf;
+        h.isRoot = false;
+        return index;
+    }
+
+    /**
+     * @brief Frees a node that is no longer linked to the tree.
+     *
+     * The last node of the arena is moved into the index of the freed node, and the entry
+     * of its parent and the headers of its children are relinked to the new index. Releasing
+     * several nodes in decreasing order of index never moves a node that is still to be released.
+     *
+     * @param n The node to be freed.
+     * @return The former index of the moved node (n itself if it was the last node), so the
+     *         caller can update any other reference to it (e.g. the root of the tree).
+     */
+    NodeIndex release(NodeIndex n)
+    {
+        NodeIndex last = static_cast<NodeIndex>(numNodes - 1);
+        if (n != last)
+        {
+            NodeHeader &h = header(n);
+            h = header(last);
+            std::copy(objectIds(last), objectIds(last) + h.numEntries, objectIds(n));
+            std::copy(coveringRadii(last), coveringRadii(last) + h.numEntries, coveringRadii(n));
+            std::copy(distancesToParent(last), distancesToParent(last) + h.numEntries, distancesToParent(n));
+            std::copy(children(last), children(last) + h.numEntries, children(n));
+            std::memcpy(ringMins(n), ringMins(last), ringBytesPerNode());
+            std::memcpy(ringMaxs(n), ringMaxs(last), ringBytesPerNode());
+
+            if (h.parentNode != NULL_NODE)
+            {
+                children(h.parentNode)[h.parentSlot] = n;
+            }
+            for (uint32_t i = 0; i < h.numEntries && !h.isLeaf; i++)
+            {
+                header(children(n)[i]).parentNode = n;
+            }
+        }
+        numNodes--;
+        return last;
+    }
+
+    /**
+     * @brief Copies an entry (object, covering radius, distance to the parent, subtree and rings) to another slot.
+     *
+     * The header of the subtree is not relinked.
+     */
+    void copyEntry(NodeIndex from, size_t fromSlot, NodeIndex to, size_t toSlot)
+    {
+        objectIds(to)[toSlot] = objectIds(from)[fromSlot];
+        coveringRadii(to)[toSlot] = coveringRadii(from)[fromSlot];
+        distancesToParent(to)[toSlot] = distancesToParent(from)[fromSlot];
+        children(to)[toSlot] = children(from)[fromSlot];
+        for (size_t p = 0; p < pivotCount; p++)
+        {
+            size_t fromBucket = (p * ringStride() + fromSlot) * ringBucketBytes;
+            size_t toBucket = (p * ringStride() + toSlot) * ringBucketBytes;
+            std::memcpy(ringMins(to) + toBucket, ringMins(from) + fromBucket, ringBucketBytes);
+            std::memcpy(ringMaxs(to) + toBucket, ringMaxs(from) + fromBucket, ringBucketBytes);
+        }
+    }
+
+    /**
+     * @brief Sets the rings of an entry to the buckets of a single object (an entry of a leaf).
+     *
+     * @param n The node.
+     * @param entry The slot of the entry.
+     * @param buckets The buckets of the object, one per pivot.
+     */
+    void setRings(NodeIndex n, size_t entry, const uint16_t *buckets)
+    {
+        if (ringBucketBytes == 1)
+        {
+            updateRings<uint8_t>(n, entry, buckets, false);
+        }
+        else
+        {
+            updateRings<uint16_t>(n, entry, buckets, false);
+        }
+    }
+
+    /**
+     * @brief Widens the rings of an entry so that they hold the buckets of an object.
+     *
+     * @param n The node.
+     * @param entry The slot of the entry.
+     * @param buckets The buckets of the object, one per pivot.
+     */
+    void expandRings(NodeIndex n, size_t entry, const uint16_t *buckets)
+    {
+        if (ringBucketBytes == 1)
+        {
+            updateRings<uint8_t>(n, entry, buckets, true);
+        }
+        else
+        {
+            updateRings<uint16_t>(n, entry, buckets, true);
+        }
+    }
+
+    /**
+     * @brief Sets the rings of a routing entry to the union of the rings of the entries of its subtree.
+     *
+     * @param n The node.
+     * @param entry The slot of the entry.
+     * @param child The root of the subtree of the entry.
+     */
+    void uniteRings(NodeIndex n, size_t entry, NodeIndex child)
+    {
+        if (ringBucketBytes == 1)
+        {
+            uniteRingsAs<uint8_t>(n, entry, child);
+        }
+        else
+        {
+            uniteRingsAs<uint16_t>(n, entry, child);
+        }
+    }
+
+    /**
+     * @brief Gets the number of pivot rings of each entry.
+     */
+    size_t numPivots() const { return pivotCount; }
+
+    /**
+     * @brief Gets the size in bytes of a bucket of a ring.
+     */
+    size_t bucketBytes() const { return ringBucketBytes; }
+
+    /**
+     * @brief Gets the number of buckets of a row of rings (the node capacity rounded up to RING_BLOCK).
+     */
+    size_t ringStride() const { return (nodeCapacity + RING_BLOCK - 1) / RING_BLOCK * RING_BLOCK; }
+
+    /**
+     * @brief Gets the number of allocated nodes.
+     */
+    size_t size() const { return numNodes; }
+
+    /**
+     * @brief Gets the maximum number of entries of each node.
+     */
+    size_t getNodeCapacity() const { return nodeCapacity; }
+
+    /**
+     * @brief Gets the number of nodes stored in each page.
+     */
+    size_t getNodesPerPage() const { return nodesPerPage; }
+
+    /**
+     * @brief Gets the number of pages in use.
+     */
+    size_t numPages() const { return pages.size(); }
+
+    /**
+     * @brief Gets the size in bytes of a page (the same for all pages of the arena).
+     */
+    size_t pageBytes() const
+    {
+        PageLayout layout = pageLayout();
+        return layout.total;
+    }
+
+    /**
+     * @brief Gets the raw memory of a page, e.g. to write it to a file.
+     */
+    const unsigned char *pageData(size_t p) const { return reinterpret_cast<const unsigned char *>(pages[p].headers); }
+
+    /**
+     * @brief Replaces the contents of the arena with pages that live in external memory (e.g. a mapped file).
+     *
+     * The memory must hold ceil(numNodes / getNodesPerPage()) consecutive pages of pageBytes()
+     * bytes each, written from an arena with the same node capacity. Nodes allocated later go
+     * to new pages owned by the arena.
+     *
+     * @param memory The first page, aligned to ALIGNMENT.
+     * @param count The number of nodes in the pages.
+     * @param owner Keeps the memory alive for as long as the arena uses it.
+     */
+    void attach(unsigned char *memory, size_t count, std::shared_ptr<void> owner)
+    {
+        pages.clear();
+        external = std::move(owner);
+        numNodes = count;
+        size_t attachedPages = (count + nodesPerPage - 1) / nodesPerPage;
+        for (size_t p = 0; p < attachedPages; p++)
+        {
+            pages.push_back(layoutPage(memory + p * pageBytes()));
+        }
+    }
+
+    NodeHeader &header(NodeIndex n) { return page(n).headers[slot(n)]; }
+    const NodeHeader &header(NodeIndex n) const { return page(n).headers[slot(n)]; }
+
+    ObjectId *objectIds(NodeIndex n) { return page(n).objectIds + slot(n) * nodeCapacity; }
+    const ObjectId *objectIds(NodeIndex n) const { return page(n).objectIds + slot(n) * nodeCapacity; }
+
+    float *coveringRadii(NodeIndex n) { return page(n).coveringRadii + slot(n) * nodeCapacity; }
+    const float *coveringRadii(NodeIndex n) const { return page(n).coveringRadii + slot(n) * nodeCapacity; }
+
+    float *distancesToParent(NodeIndex n) { return page(n).distancesToParent + slot(n) * nodeCapacity; }
+    const float *distancesToParent(NodeIndex n) const { return page(n).distancesToParent + slot(n) * nodeCapacity; }
+
+    NodeIndex *children(NodeIndex n) { return page(n).children + slot(n) * nodeCapacity; }
+    const NodeIndex *children(NodeIndex n) const { return page(n).children + slot(n) * nodeCapacity; }
+
+    /**
+     * @brief The raw ring buckets of a node, numPivots() rows of ringStride() buckets of bucketBytes() bytes.
+     */
+    unsigned char *ringMins(NodeIndex n) { return page(n).ringMins + slot(n) * ringBytesPerNode(); }
+    const unsigned char *ringMins(NodeIndex n) const { return page(n).ringMins + slot(n) * ringBytesPerNode(); }
+
+    unsigned char *ringMaxs(NodeIndex n) { return page(n).ringMaxs + slot(n) * ringBytesPerNode(); }
+    const unsigned char *ringMaxs(NodeIndex n) const { return page(n).ringMaxs + slot(n) * ringBytesPerNode(); }
+
+private:
+    struct AlignedFree
+    {
+        void operator()(unsigned char *p) const { std::free(p); }
+    };
+
+    struct Page
+    {
+        std::unique_ptr<unsigned char, AlignedFree> memory; ///< Null for pages in external memory
+        NodeHeader *headers;
+        ObjectId *objectIds;
+        float *coveringRadii;
+        float *distancesToParent;
+        NodeIndex *children;
+        unsigned char *ringMins;
+        unsigned char *ringMaxs;
+    };
+
+    static size_t alignUp(size_t bytes) { return (bytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT; }
+
+    /**
+     * @brief Offsets (in bytes) of the arrays inside a page.
+     */
+    struct PageLayout
+    {
+        size_t objectIds;
+        size_t coveringRadii;
+        size_t distancesToParent;
+        size_t children;
+        size_t ringMins;
+        size_t ringMaxs;
+        size_t total;
+    };
+
+    PageLayout pageLayout() const
+    {
+        size_t entries = nodesPerPage * nodeCapacity;
+        PageLayout layout;
+        layout.objectIds = alignUp(nodesPerPage * sizeof(NodeHeader));
+        layout.coveringRadii = layout.objectIds + alignUp(entries * sizeof(ObjectId));
+        layout.distancesToParent = layout.coveringRadii + alignUp(entries * sizeof(float));
+        layout.children = layout.distancesToParent + alignUp(entries * sizeof(float));
+        layout.ringMins = layout.children + alignUp(entries * sizeof(NodeIndex));
+        layout.ringMaxs = layout.ringMins + alignUp(nodesPerPage * ringBytesPerNode());
+        layout.total = layout.ringMaxs + alignUp(nodesPerPage * ringBytesPerNode());
+        return layout;
+    }
+
+    Page layoutPage(unsigned char *raw) const
+    {
+        PageLayout layout = pageLayout();
+        Page p;
+        p.headers = reinterpret_cast<NodeHeader *>(raw);
+        p.objectIds = reinterpret_cast<ObjectId *>(raw + layout.objectIds);
+        p.coveringRadii = reinterpret_cast<float *>(raw + layout.coveringRadii);
+        p.distancesToParent = reinterpret_cast<float *>(raw + layout.distancesToParent);
+        p.children = reinterpret_cast<NodeIndex *>(raw + layout.children);
+        p.ringMins = raw + layout.ringMins;
+        p.ringMaxs = raw + layout.ringMaxs;
+        return p;
+    }
+
+    void addPage()
+    {
+        unsigned char *raw = static_cast<unsigned char *>(std::aligned_alloc(ALIGNMENT, pageBytes()));
+        if (!raw)
+        {
+            throw std::bad_alloc();
+        }
+        // Pages are saved whole: unused slots and header padding must not carry heap contents
+        std::memset(raw, 0, pageBytes());
+
+        Page p = layoutPage(raw);
+        p.memory.reset(raw);
+        pages.push_back(std::move(p));
+    }
+
+    size_t ringBytesPerNode() const { return ringStride() * pivotCount * ringBucketBytes; }
+
+    template <typename Bucket>
+    void updateRings(NodeIndex n, size_t entry, const uint16_t *buckets, bool expand)
+    {
+        Bucket *mins = reinterpret_cast<Bucket *>(ringMins(n)) + entry;
+        Bucket *maxs = reinterpret_cast<Bucket *>(ringMaxs(n)) + entry;
+        for (size_t p = 0; p < pivotCount; p++)
+        {
+            Bucket bucket = static_cast<Bucket>(buckets[p]);
+            Bucket &min = mins[p * ringStride()];
+            Bucket &max = maxs[p * ringStride()];
+            min = expand ? std::min(min, bucket) : bucket;
+            max = expand ? std::max(max, bucket) : bucket;
+        }
+    }
+
+    template <typename Bucket>
+    void uniteRingsAs(NodeIndex n, size_t entry, NodeIndex child)
+    {
+        Bucket *mins = reinterpret_cast<Bucket *>(ringMins(n)) + entry;
+        Bucket *maxs = reinterpret_cast<Bucket *>(ringMaxs(n)) + entry;
+        const Bucket *childMins = reinterpret_cast<const Bucket *>(ringMins(child));
+        const Bucket *childMaxs = reinterpret_cast<const Bucket *>(ringMaxs(child));
+        const size_t childEntries = header(child).numEntries;
+        for (size_t p = 0; p < pivotCount; p++)
+        {
+            const Bucket *rowMin = childMins + p * ringStride();
+            const Bucket *rowMax = childMaxs + p * ringStride();
+            mins[p * ringStride()] = childEntries == 0 ? 0 : *std::min_element(rowMin, rowMin + childEntries);
+            maxs[p * ringStride()] = childEntries == 0 ? 0 : *std::max_element(rowMax, rowMax + childEntries);
+        }
+    }
+
+    Page &page(NodeIndex n) { return pages[n / nodesPerPage]; }
+    const Page &page(NodeIndex n) const { return pages[n / nodesPerPage]; }
+    size_t slot(NodeIndex n) const { return n % nodesPerPage; }
+
+    size_t nodeCapacity;      ///< Maximum number of entries of each node
+    size_t pivotCount;        ///< Number of pivot rings of each entry
+    size_t ringBucketBytes;   ///< Size of a bucket of a ring, 1 or 2
+    size_t nodesPerPage;      ///< Number of nodes stored in each page
+    size_t numNodes;          ///< Number of allocated nodes
+    std::vector<Page> pages;  ///< The pages of the arena
+    std::shared_ptr<void> external; ///< Owner of the attached external pages, if any
+};
+
+/**
+ * @brief Everything an M-Tree owns: the node arena, the indexed objects and the pivots.
+ *
+ * Objects are copied into the store on insertion and are referenced by the
+ * entries of the tree through their ObjectId (the insertion order).
+ *
+ * @tparam T The type of elements stored in the M-Tree.
+ */
+template <typename T>
+struct MTreeStorage
+{
+    /**
+     * @brief Constructs an empty storage.
+     *
+     * @param nodeCapacity The maximum number of entries of each node.
+     * @param pivotTable The pivots whose rings are kept in the nodes (none by default).
+     */
+    explicit MTreeStorage(size_t nodeCapacity, PivotTable<T> pivotTable = PivotTable<T>())
+        : nodes(nodeCapacity, pivotTable.size(), pivotTable.bucketBytes()), pivots(std::move(pivotTable)), root(NULL_NODE) {}
+
+    NodeArena nodes;        ///< Nodes of the tree
+    std::vector<T> objects; ///< Objects indexed by the tree, addressed by ObjectId
+    PivotTable<T> pivots;   ///< Pivots and the buckets of the objects (see PivotTable)
+    NodeIndex root;         ///< Index of the root node
+};
+
+#endif // MTREESTORAGE_HPP
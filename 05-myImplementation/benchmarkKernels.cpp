@@ -0,0 +1,211 @@
+#include "indexing/SimdKernels.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+ * Checks the SIMD distance kernels against the scalar reference and times them.
+ *
+ * Compile with g++ -std=c++17 -O3 benchmarkKernels.cpp -o benchmarkKernels (no -m flags are
+ * needed, every kernel is compiled for its own instruction set). Exits with 1 if any kernel
+ * supported by this CPU disagrees with the scalar kernel.
+ */
+
+// Kernels of the dot product family return three sums, these pick one of them
+float cosineAB(const SimdKernels& kernels, const float* a, const float* b, size_t n) {
+    float ab, aa, bb;
+    kernels.cosineTerms(a, b, n, &ab, &aa, &bb);
+    return ab;
+}
+
+float cosineAA(const SimdKernels& kernels, const float* a, const float* b, size_t n) {
+    float ab, aa, bb;
+    kernels.cosineTerms(a, b, n, &ab, &aa, &bb);
+    return aa;
+}
+
+float cosineBB(const SimdKernels& kernels, const float* a, const float* b, size_t n) {
+    float ab, aa, bb;
+    kernels.cosineTerms(a, b, n, &ab, &aa, &bb);
+    return bb;
+}
+
+// The bounded kernels with an infinite bound must read everything and match the full kernels
+float l2SquaredUpToAll(const SimdKernels& kernels, const float* a, const float* b, size_t n) {
+    size_t evaluated;
+    float sum = kernels.l2SquaredUpTo(a, b, n, std::numeric_limits<float>::infinity(), &evaluated);
+    return evaluated == n ? sum : std::numeric_limits<float>::quiet_NaN();
+}
+
+float l1UpToAll(const SimdKernels& kernels, const float* a, const float* b, size_t n) {
+    size_t evaluated;
+    float sum = kernels.l1UpTo(a, b, n, std::numeric_limits<float>::infinity(), &evaluated);
+    return evaluated == n ? sum : std::numeric_limits<float>::quiet_NaN();
+}
+
+float lInfUpToAll(const SimdKernels& kernels, const float* a, const float* b, size_t n) {
+    size_t evaluated;
+    float sum = kernels.lInfUpTo(a, b, n, std::numeric_limits<float>::infinity(), &evaluated);
+    return evaluated == n ? sum : std::numeric_limits<float>::quiet_NaN();
+}
+
+struct Family {
+    const char* name;
+    float (*run)(const SimdKernels&, const float*, const float*, size_t);
+};
+
+const Family families[] = {
+    {"l2Squared", [](const SimdKernels& k, const float* a, const float* b, size_t n) { return k.l2Squared(a, b, n); }},
+    {"l1", [](const SimdKernels& k, const float* a, const float* b, size_t n) { return k.l1(a, b, n); }},
+    {"lInf", [](const SimdKernels& k, const float* a, const float* b, size_t n) { return k.lInf(a, b, n); }},
+    {"dot", [](const SimdKernels& k, const float* a, const float* b, size_t n) { return k.dot(a, b, n); }},
+    {"cosine.ab", cosineAB},
+    {"cosine.aa", cosineAA},
+    {"cosine.bb", cosineBB},
+    {"l2SquaredUpTo", l2SquaredUpToAll},
+    {"l1UpTo", l1UpToAll},
+    {"lInfUpTo", lInfUpToAll},
+};
+
+std::vector<float> randomVector(size_t n, std::mt19937& gen) {
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    std::vector<float> v(n);
+    for (auto& x : v) {
+        x = dist(gen);
+    }
+    return v;
+}
+
+/**
+ * @brief Compares every kernel with the scalar kernel for all dimensions up to 600, so that
+ * every combination of unrolled body, single-register loop and tail is exercised.
+ *
+ * The vector kernels add in a different order, so the sums are compared with a tolerance
+ * relative to the sum of the magnitudes of the terms.
+ */
+bool checkKernels(const std::vector<SimdLevel>& levels) {
+    std::mt19937 gen(42);
+    const SimdKernels& scalar = simdKernelsFor(SimdLevel::Scalar);
+    bool ok = true;
+
+    for (size_t n = 0; n <= 600; n++) {
+        // Offset by one float, so the loads are not aligned
+        std::vector<float> a = randomVector(n + 1, gen), b = randomVector(n + 1, gen);
+        const float* pa = a.data() + 1;
+        const float* pb = b.data() + 1;
+
+        for (SimdLevel level : levels) {
+            const SimdKernels& kernels = simdKernelsFor(level);
+            for (const Family& family : families) {
+                float expected = family.run(scalar, pa, pb, n);
+                float actual = family.run(kernels, pa, pb, n);
+                float tolerance = 1e-5f * (static_cast<float>(n) + 1.0f) * (std::fabs(expected) + 1.0f);
+                if (!(std::fabs(expected - actual) <= tolerance)) {
+                    std::cerr << "Mismatch: " << kernels.name << " " << family.name << " n=" << n
+                              << " expected " << expected << " got " << actual << std::endl;
+                    ok = false;
+                }
+            }
+        }
+    }
+    return ok;
+}
+
+/**
+ * @brief Checks that the bounded kernels stop at the first check point where the partial sum exceeds the
+ * bound, and read everything when the bound is never exceeded.
+ */
+bool checkBoundedKernels(const std::vector<SimdLevel>& levels) {
+    std::mt19937 gen(43);
+    bool ok = true;
+
+    for (size_t n : {0, 5, 31, 32, 33, 64, 100, 128, 257}) {
+        std::vector<float> a = randomVector(n, gen), b = randomVector(n, gen);
+        for (SimdLevel level : levels) {
+            const SimdKernels& kernels = simdKernelsFor(level);
+            for (float bound : {0.0f, 0.5f, 2.0f, 10.0f, 1e9f}) {
+                size_t evaluated;
+                float sum = kernels.l2SquaredUpTo(a.data(), b.data(), n, bound, &evaluated);
+
+                // The first check point (or n) where the scalar prefix sum exceeds the bound
+                size_t expected = n;
+                for (size_t end = UPTO_FIRST_CHECK; end < n; end *= 2) {
+                    if (simdKernelsFor(SimdLevel::Scalar).l2Squared(a.data(), b.data(), end) > bound * 1.0001f) {
+                        expected = end;
+                        break;
+                    }
+                }
+                bool stoppedEarly = evaluated < n;
+                if (evaluated > expected || (stoppedEarly && (evaluated % UPTO_FIRST_CHECK != 0 || !(sum > bound)))) {
+                    std::cerr << "Bounded mismatch: " << kernels.name << " n=" << n << " bound=" << bound
+                              << " evaluated " << evaluated << " expected " << expected << std::endl;
+                    ok = false;
+                }
+            }
+        }
+    }
+    return ok;
+}
+
+/**
+ * @brief Times one kernel over a set of vector pairs, returns nanoseconds per call.
+ */
+double timeKernel(const SimdKernels& kernels, const Family& family, const std::vector<float>& data, size_t n, size_t pairs) {
+    const size_t repetitions = 200;
+    volatile float sink = 0.0f;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t r = 0; r < repetitions; r++) {
+        for (size_t p = 0; p < pairs; p++) {
+            sink = sink + family.run(kernels, data.data() + 2 * p * n, data.data() + (2 * p + 1) * n, n);
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / (repetitions * pairs);
+}
+
+int main() {
+    std::vector<SimdLevel> levels = supportedSimdLevels();
+    std::cout << "Supported:";
+    for (SimdLevel level : levels) {
+        std::cout << " " << simdKernelsFor(level).name;
+    }
+    std::cout << std::endl << "Dispatched: " << simdKernels().name << std::endl;
+
+    bool ok = checkKernels(levels);
+    ok = checkBoundedKernels(levels) && ok;
+    std::cout << "Check against scalar: " << (ok ? "ok" : "FAILED") << std::endl << std::endl;
+
+    // Enough pairs to leave L1 but stay in L2, as in a leaf scan
+    const size_t pairs = 256;
+    std::mt19937 gen(7);
+    const Family timed[] = {families[0], families[1], families[2], families[3], {"cosine", cosineAB}, families[7], families[8], families[9]};
+
+    for (size_t n : {128, 256, 512}) {
+        std::vector<float> data = randomVector(2 * pairs * n, gen);
+        std::cout << "d = " << n << " (ns per call, speedup over scalar)" << std::endl;
+        for (const Family& family : timed) {
+            std::cout << "  " << std::setw(10) << std::left << family.name << std::right;
+            double scalarTime = 0.0;
+            for (SimdLevel level : levels) {
+                const SimdKernels& kernels = simdKernelsFor(level);
+                double t = timeKernel(kernels, family, data, n, pairs);
+                if (level == SimdLevel::Scalar) {
+                    scalarTime = t;
+                }
+                std::cout << "  " << kernels.name << " " << std::fixed << std::setprecision(1) << t
+                          << " (" << std::setprecision(2) << scalarTime / t << "x)";
+            }
+            std::cout << std::endl;
+        }
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
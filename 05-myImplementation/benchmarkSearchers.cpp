@@ -0,0 +1,464 @@
+#include "MTree.hpp"
+#include "indexing/SequentialSearcher.hpp"
+#include "indexing/DistanceFunction.hpp"
+#include "indexing/SearchStats.hpp"
+#include "objectTypes/Feature.hpp"
+#include "objectTypes/FeatureMatrix.hpp"
+#include "data/randomUnitVectors.hpp"
+#include "data/randomUniformVectors.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+ * Benchmarks the searchers in a single process: the dataset, the searcher, the split policy
+ * of the M-Tree and the sizes are runtime parameters, so a parameter sweep needs one build.
+ *
+ * Compile with g++ -std=c++17 -O3 -pthread benchmarkSearchers.cpp -o benchmarkSearchers.
+ *
+ * Every list parameter takes comma separated values and the benchmark runs all their
+ * combinations. Each combination is built and queried warmup times, discarded, then repeat
+ * times. The build and optimize times are summarized over the repeats, the query latency,
+ * distance calls and nodes visited over every query of every repeat. One CSV line or JSON
+ * object is written per combination.
+ */
+
+typedef FeatureView<float> Obj;
+typedef EuclideanDistance<Obj, CountCalls> Metric;
+
+struct Config {
+    std::string dataset;
+    std::string searcher;
+    std::string promotion;
+    std::string partition;
+    std::string build;
+    bool optimize;
+    size_t pivots;
+    unsigned int pivotBits;
+    size_t N;
+    size_t dimension;
+    size_t querySize;
+    size_t k;
+    float radius;
+    size_t nodeSize;
+    size_t threads;
+    int seed;
+    float maxf;
+};
+
+struct Dataset {
+    FeatureMatrix<float> data;
+    FeatureMatrix<float> queries;
+    std::vector<Obj> dataViews;
+    std::vector<Obj> queryViews;
+};
+
+// What one build and batch of queries did
+struct Run {
+    double buildSeconds;
+    double optimizeSeconds;
+    double queriesPerSecond;
+    size_t height;
+    size_t totalNodes;
+    SearchStatsSummary stats;
+};
+
+// All the runs of a combination
+struct Result {
+    Config config;
+    size_t height;
+    size_t totalNodes;
+    std::vector<double> buildSeconds;
+    std::vector<double> optimizeSeconds;
+    std::vector<double> queriesPerSecond;
+    SearchStatsSummary stats;
+};
+
+std::vector<std::string> splitList(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+std::vector<size_t> splitSizes(const std::string& list) {
+    std::vector<size_t> sizes;
+    for (const std::string& item : splitList(list)) {
+        sizes.push_back(std::stoul(item));
+    }
+    return sizes;
+}
+
+std::vector<float> splitFloats(const std::string& list) {
+    std::vector<float> values;
+    for (const std::string& item : splitList(list)) {
+        values.push_back(std::stof(item));
+    }
+    return values;
+}
+
+template <typename Vector>
+FeatureMatrix<float> toMatrix(const std::vector<Vector>& features, size_t dimension) {
+    FeatureMatrix<float> matrix(features.size(), dimension);
+    for (size_t i = 0; i < features.size(); i++) {
+        for (size_t j = 0; j < dimension; j++) {
+            matrix.row(i)[j] = features[i][j];
+        }
+    }
+    return matrix;
+}
+
+// unit and uniform are generated; any other name is the prefix of <name>_data.npy and <name>_queries.npy
+Dataset makeDataset(const std::string& name, size_t N, size_t dimension, size_t querySize, int seed, float maxf) {
+    Dataset d;
+    if (name == "unit") {
+        d.data = toMatrix(generateUnitVectors<Feature<float>, float>(N, dimension, seed), dimension);
+        d.queries = toMatrix(generateUnitVectors<Feature<float>, float>(querySize, dimension, seed + 1), dimension);
+    } else if (name == "uniform") {
+        d.data = toMatrix(generateUniformVectors<Feature<float>, float>(N, dimension, seed, -maxf, maxf), dimension);
+        d.queries = toMatrix(generateUniformVectors<Feature<float>, float>(querySize, dimension, seed + 1, -maxf, maxf), dimension);
+    } else {
+        d.data = FeatureMatrix<float>::fromNpy(name + "_data.npy", N);
+        d.queries = FeatureMatrix<float>::fromNpy(name + "_queries.npy", querySize);
+    }
+    d.dataViews = d.data.views();
+    d.queryViews = d.queries.views();
+    return d;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+template <typename Split>
+Run runTree(const Config& c, const Dataset& d) {
+    Run run;
+    // RandomPromotion uses rand()
+    std::srand(c.seed);
+
+    auto start = std::chrono::steady_clock::now();
+    MTree<Obj, Metric, Split> tree(c.nodeSize);
+    if (c.pivots > 0) {
+        tree.usePivots(d.dataViews, c.pivots, c.pivotBits, c.seed);
+    }
+    if (c.build == "bulk") {
+        tree.bulkLoad(d.dataViews, 0.8, c.threads, c.seed);
+    } else {
+        for (const Obj& element : d.dataViews) {
+            tree.insert(element);
+        }
+    }
+    run.buildSeconds = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    if (c.optimize) {
+        tree.optimize(c.threads);
+    }
+    run.optimizeSeconds = secondsSince(start);
+    run.height = tree.getHeight();
+    run.totalNodes = tree.getTotalNodes();
+
+    start = std::chrono::steady_clock::now();
+    KNNBatchResult batch = tree.knnBatch(d.queryViews, c.k, c.threads, c.radius);
+    run.queriesPerSecond = d.queryViews.size() / secondsSince(start);
+    run.stats = std::move(batch.stats);
+    return run;
+}
+
+template <typename Promotion>
+Run runTreeWithPromotion(const Config& c, const Dataset& d) {
+    if (c.partition == "hyperplane") {
+        return runTree<SplitPolicy<Promotion, GeneralizedHyperplanePartition>>(c, d);
+    } else if (c.partition == "balanced") {
+        return runTree<SplitPolicy<Promotion, BalancedPartition>>(c, d);
+    }
+    throw std::invalid_argument("Unknown partition " + c.partition);
+}
+
+Run runSequential(const Config& c, const Dataset& d) {
+    Run run;
+    Metric distance;
+    auto start = std::chrono::steady_clock::now();
+    SequentialSearcher<Obj, Metric> searcher(distance);
+    searcher.addAll(d.dataViews);
+    run.buildSeconds = secondsSince(start);
+    run.optimizeSeconds = 0.0;
+    run.height = 0;
+    run.totalNodes = 0;
+
+    start = std::chrono::steady_clock::now();
+    KNNBatchResult batch = searcher.knnBatch(d.queryViews, c.k, c.threads, c.radius);
+    run.queriesPerSecond = d.queryViews.size() / secondsSince(start);
+    run.stats = std::move(batch.stats);
+    return run;
+}
+
+Run runOnce(const Config& c, const Dataset& d) {
+    if (c.searcher == "sequential") {
+        return runSequential(c, d);
+    } else if (c.searcher != "mtree") {
+        throw std::invalid_argument("Unknown searcher " + c.searcher);
+    }
+
+    if (c.promotion == "mlbdist") {
+        return runTreeWithPromotion<MLBDistPromotion>(c, d);
+    } else if (c.promotion == "random") {
+        return runTreeWithPromotion<RandomPromotion>(c, d);
+    } else if (c.promotion == "mrad") {
+        return runTreeWithPromotion<MRadPromotion>(c, d);
+    } else if (c.promotion == "mmrad") {
+        return runTreeWithPromotion<MMRadPromotion>(c, d);
+    } else if (c.promotion == "sampling") {
+        return runTreeWithPromotion<SamplingPromotion>(c, d);
+    }
+    throw std::invalid_argument("Unknown promotion " + c.promotion);
+}
+
+Result benchmark(const Config& c, const Dataset& d, size_t warmup, size_t repeat) {
+    for (size_t i = 0; i < warmup; i++) {
+        runOnce(c, d);
+    }
+
+    Result result{c, 0, 0, {}, {}, {}, SearchStatsSummary()};
+    for (size_t i = 0; i < repeat; i++) {
+        Run run = runOnce(c, d);
+        result.height = run.height;
+        result.totalNodes = run.totalNodes;
+        result.buildSeconds.push_back(run.buildSeconds);
+        result.optimizeSeconds.push_back(run.optimizeSeconds);
+        result.queriesPerSecond.push_back(run.queriesPerSecond);
+        result.stats.merge(run.stats);
+    }
+    return result;
+}
+
+// The distributions written for each result, by column prefix
+std::vector<std::pair<std::string, SearchStatsSummary::Percentiles>> distributions(const Result& r) {
+    typedef SearchStatsSummary S;
+    return {
+        {"buildSeconds", S::distribution(r.buildSeconds)},
+        {"optimizeSeconds", S::distribution(r.optimizeSeconds)},
+        {"queriesPerSecond", S::distribution(r.queriesPerSecond)},
+        {"latencyMicros", r.stats.percentiles(S::WALL_TIME_MICROS)},
+        {"distanceCalls", r.stats.percentiles(S::DISTANCE_EVALUATIONS)},
+        {"nodesVisited", r.stats.percentiles(S::NODES_VISITED)},
+        {"prunedByPivots", r.stats.percentiles(S::PRUNED_BY_PIVOTS)},
+        {"distancesBeforeBound", r.stats.percentiles(S::DISTANCES_BEFORE_BOUND)},
+        {"queueHighWater", r.stats.percentiles(S::QUEUE_HIGH_WATER)},
+    };
+}
+
+const char* statNames[] = {"mean", "stddev", "p50", "p90", "p99", "max"};
+
+std::vector<double> statValues(const SearchStatsSummary::Percentiles& p) {
+    return {p.mean, p.stddev, p.p50, p.p90, p.p99, p.max};
+}
+
+void writeCsvHeader(std::ostream& os, const Result& r) {
+    os << "dataset,searcher,promotion,partition,build,optimize,pivots,pivotBits,N,dimension,querySize,k,radius,nodeSize,threads,runs,height,totalNodes";
+    for (const auto& d : distributions(r)) {
+        for (const char* stat : statNames) {
+            os << "," << d.first << "_" << stat;
+        }
+    }
+    os << "\n";
+}
+
+void writeCsv(std::ostream& os, const Result& r) {
+    const Config& c = r.config;
+    os << c.dataset << "," << c.searcher << "," << c.promotion << "," << c.partition << "," << c.build << "," << c.optimize << ","
+       << c.pivots << "," << c.pivotBits << "," << c.N << "," << c.dimension << "," << c.querySize << "," << c.k << "," << c.radius << "," << c.nodeSize << "," << c.threads << ","
+       << r.buildSeconds.size() << "," << r.height << "," << r.totalNodes;
+    for (const auto& d : distributions(r)) {
+        for (double value : statValues(d.second)) {
+            os << "," << value;
+        }
+    }
+    os << "\n";
+}
+
+// JSON has no infinity, an unbounded radius is written as null
+std::string jsonNumber(float value) {
+    if (std::isinf(value)) {
+        return "null";
+    }
+    std::ostringstream ss;
+    ss << value;
+    return ss.str();
+}
+
+void writeJson(std::ostream& os, const Result& r) {
+    const Config& c = r.config;
+    os << "{\"dataset\": \"" << c.dataset << "\", \"searcher\": \"" << c.searcher << "\", \"promotion\": \"" << c.promotion
+       << "\", \"partition\": \"" << c.partition << "\", \"build\": \"" << c.build << "\", \"optimize\": " << (c.optimize ? "true" : "false")
+       << ", \"pivots\": " << c.pivots << ", \"pivotBits\": " << c.pivotBits << ", \"N\": " << c.N << ", \"dimension\": " << c.dimension << ", \"querySize\": " << c.querySize << ", \"k\": " << c.k
+       << ", \"radius\": " << jsonNumber(c.radius) << ", \"nodeSize\": " << c.nodeSize << ", \"threads\": " << c.threads << ", \"runs\": " << r.buildSeconds.size()
+       << ", \"height\": " << r.height << ", \"totalNodes\": " << r.totalNodes;
+    for (const auto& d : distributions(r)) {
+        os << ", \"" << d.first << "\": {";
+        std::vector<double> values = statValues(d.second);
+        for (size_t i = 0; i < values.size(); i++) {
+            os << (i > 0 ? ", " : "") << "\"" << statNames[i] << "\": " << values[i];
+        }
+        os << "}";
+    }
+    os << ", \"nodesPerLevel\": [";
+    std::vector<double> levels = r.stats.meanNodesPerLevel();
+    for (size_t i = 0; i < levels.size(); i++) {
+        os << (i > 0 ? ", " : "") << levels[i];
+    }
+    os << "]}";
+}
+
+// Every combination of the searcher parameters. The sequential searcher has no tree, so it
+// only varies with k, the radius and the number of threads
+std::vector<Config> combinations(const Config& base, std::map<std::string, std::string>& args) {
+    std::vector<Config> configs;
+    for (const std::string& searcher : splitList(args["-searcher"])) {
+        bool flat = searcher == "sequential";
+        for (const std::string& promotion : flat ? std::vector<std::string>{"-"} : splitList(args["-promotion"])) {
+            for (const std::string& partition : flat ? std::vector<std::string>{"-"} : splitList(args["-partition"])) {
+                for (const std::string& build : flat ? std::vector<std::string>{"-"} : splitList(args["-build"])) {
+                    for (size_t optimize : flat ? std::vector<size_t>{0} : splitSizes(args["-optimize"])) {
+                        for (size_t pivots : flat ? std::vector<size_t>{0} : splitSizes(args["-pivots"])) {
+                            for (size_t nodeSize : flat ? std::vector<size_t>{0} : splitSizes(args["-nodeSize"])) {
+                                for (size_t k : splitSizes(args["-k"])) {
+                                    for (float radius : splitFloats(args["-radius"])) {
+                                        for (size_t threads : splitSizes(args["-threads"])) {
+                                            Config c = base;
+                                            c.searcher = searcher;
+                                            c.promotion = promotion;
+                                            c.partition = partition;
+                                            c.build = build;
+                                            c.optimize = optimize != 0;
+                                            c.pivots = pivots;
+                                            c.nodeSize = nodeSize;
+                                            c.k = k;
+                                            c.radius = radius;
+                                            c.threads = std::max<size_t>(1, threads);
+                                            configs.push_back(c);
+                                        }
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return configs;
+}
+
+void usage(const char* program) {
+    std::cout << "Usage: " << program << " [options]\n"
+              << "Lists are comma separated, every combination is run.\n"
+              << "  -dataset list     unit, uniform or <prefix> of <prefix>_data.npy and <prefix>_queries.npy (unit)\n"
+              << "  -searcher list    sequential, mtree (mtree)\n"
+              << "  -promotion list   mlbdist, random, mrad, mmrad, sampling (mlbdist)\n"
+              << "  -partition list   hyperplane, balanced (hyperplane)\n"
+              << "  -build list       insert, bulk (insert)\n"
+              << "  -optimize list    0, 1 to run the Slim-Down of the M-Tree after the build (0)\n"
+              << "  -pivots list      number of pivots of the M-Tree, 0 for none (0)\n"
+              << "  -pivotBits n      size of a quantized pivot distance, 8 or 16 (8)\n"
+              << "  -N list           number of data objects (10000)\n"
+              << "  -dimension list   dimension of the generated objects (16)\n"
+              << "  -k list           number of neighbors (10)\n"
+              << "  -radius list      largest distance of a neighbor, inf for none (inf)\n"
+              << "  -nodeSize list    node capacity of the M-Tree (32)\n"
+              << "  -threads list     threads of the build and of the queries (1)\n"
+              << "  -querySize n      number of queries (500)\n"
+              << "  -s seed           seed of the generators (42)\n"
+              << "  -maxf x           bound of the uniform dataset (1)\n"
+              << "  -warmup n         discarded runs per combination (1)\n"
+              << "  -repeat n         measured runs per combination (5)\n"
+              << "  -format csv|json  output format (csv)\n"
+              << "  -o path           output file (standard output)\n";
+}
+
+int main(int argc, char* argv[]) {
+    std::map<std::string, std::string> args = {
+        {"-dataset", "unit"}, {"-searcher", "mtree"}, {"-promotion", "mlbdist"}, {"-partition", "hyperplane"},
+        {"-build", "insert"}, {"-optimize", "0"}, {"-pivots", "0"}, {"-pivotBits", "8"}, {"-N", "10000"}, {"-dimension", "16"}, {"-k", "10"}, {"-radius", "inf"}, {"-nodeSize", "32"},
+        {"-threads", "1"}, {"-querySize", "500"}, {"-s", "42"}, {"-maxf", "1"}, {"-warmup", "1"},
+        {"-repeat", "5"}, {"-format", "csv"}, {"-o", ""}};
+
+    for (int i = 1; i < argc; i += 2) {
+        std::string name = argv[i];
+        if (name == "-h" || args.find(name) == args.end() || i + 1 >= argc) {
+            usage(argv[0]);
+            return name == "-h" ? 0 : 1;
+        }
+        args[name] = argv[i + 1];
+    }
+
+    const size_t warmup = std::stoul(args["-warmup"]);
+    const size_t repeat = std::max<size_t>(1, std::stoul(args["-repeat"]));
+    const bool json = args["-format"] == "json";
+    std::ofstream file;
+    if (!args["-o"].empty()) {
+        file.open(args["-o"]);
+    }
+    std::ostream& out = args["-o"].empty() ? std::cout : file;
+
+    Config base;
+    base.querySize = std::stoul(args["-querySize"]);
+    base.seed = std::stoi(args["-s"]);
+    base.maxf = std::stof(args["-maxf"]);
+    base.pivotBits = static_cast<unsigned int>(std::stoul(args["-pivotBits"]));
+
+    bool first = true;
+    if (json) {
+        out << "[";
+    }
+    // The dataset is the outermost loop, so it is generated once for all the searchers
+    for (const std::string& dataset : splitList(args["-dataset"])) {
+        for (size_t N : splitSizes(args["-N"])) {
+            for (size_t dimension : splitSizes(args["-dimension"])) {
+                Dataset d = makeDataset(dataset, N, dimension, base.querySize, base.seed, base.maxf);
+                for (Config c : combinations(base, args)) {
+                    c.dataset = dataset;
+                    c.N = d.data.rows();
+                    c.dimension = d.data.dimension();
+                    c.querySize = d.queries.rows();
+
+                    std::cerr << c.dataset << " " << c.searcher << " " << c.promotion << " " << c.partition << " " << c.build << (c.optimize ? "+optimize" : "")
+                              << " pivots=" << c.pivots
+                              << " N=" << c.N << " d=" << c.dimension << " k=" << c.k << " radius=" << c.radius << " nodeSize=" << c.nodeSize
+                              << " threads=" << c.threads << std::endl;
+                    Result r = benchmark(c, d, warmup, repeat);
+
+                    if (json) {
+                        out << (first ? "\n" : ",\n");
+                        writeJson(out, r);
+                    } else {
+                        if (first) {
+                            writeCsvHeader(out, r);
+                        }
+                        writeCsv(out, r);
+                    }
+                    out.flush();
+                    first = false;
+                }
+            }
+        }
+    }
+    if (json) {
+        out << "\n]\n";
+    }
+    return 0;
+}
@@ -0,0 +1,160 @@
+#ifndef EPOCH_RECLAIMER_HPP
+#define EPOCH_RECLAIMER_HPP
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <utility>
+#include <limits>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * @brief Epoch-based reclamation: frees memory unlinked from a shared structure once no reader can still hold it.
+ *
+ * A thread enters the structure through a Guard, which publishes the global epoch in a slot
+ * of the reclaimer. A writer that unlinks something retires it with the callback that frees
+ * it; the retirement is tagged with the global epoch, which then advances. A reader only
+ * reaches what is linked after it entered, so anything retired at an epoch older than the
+ * oldest epoch still published in a slot is unreachable, and its callback runs (Fraser,
+ * "Practical Lock-Freedom").
+ *
+ * Entering and leaving only write the slot of the thread, so readers never wait for writers.
+ * Callbacks run in the thread that retires, or that calls reclaim().
+ */
+class EpochReclaimer
+{
+public:
+    static const size_t MAX_THREADS = 256; ///< Number of threads that can hold a Guard at once (more wait for a free slot)
+
+    /**
+     * @brief Keeps what a thread can reach alive, from its construction to its destruction.
+     */
+    class Guard
+    {
+    public:
+        Guard(Guard &&other) : slot(other.slot) { other.slot = nullptr; }
+        Guard(const Guard &) = delete;
+        Guard &operator=(const Guard &) = delete;
+        Guard &operator=(Guard &&) = delete;
+
+        ~Guard()
+        {
+            if (slot)
+            {
+                slot->store(0);
+            }
+        }
+
+    private:
+        friend class EpochReclaimer;
+        explicit Guard(std::atomic<uint64_t> *slot) : slot(slot) {}
+
+        std::atomic<uint64_t> *slot; ///< The slot that holds the epoch of the thread (0 when free)
+    };
+
+    EpochReclaimer() : globalEpoch(1) {}
+
+    /**
+     * @brief Runs the callbacks still pending; no thread may hold a Guard anymore.
+     */
+    ~EpochReclaimer()
+    {
+        for (auto &item : retired)
+        {
+            item.second();
+        }
+    }
+
+    EpochReclaimer(const EpochReclaimer &) = delete;
+    EpochReclaimer &operator=(const EpochReclaimer &) = delete;
+
+    /**
+     * @brief Enters the structure. Guards do not nest: a thread holds at most one.
+     *
+     * @return The guard, to be kept while the thread reads the structure.
+     */
+    Guard enter()
+    {
+        const size_t start = std::hash<std::thread::id>()(std::this_thread::get_id()) % MAX_THREADS;
+        for (;;)
+        {
+            // The epoch may be stale by the time it is published, which only delays reclamation
+            uint64_t epoch = globalEpoch.load();
+            for (size_t i = 0; i < MAX_THREADS; i++)
+            {
+                std::atomic<uint64_t> &slot = slots[(start + i) % MAX_THREADS].epoch;
+                uint64_t expected = 0;
+                if (slot.load(std::memory_order_relaxed) == 0 && slot.compare_exchange_strong(expected, epoch))
+                {
+                    return Guard(&slot);
+                }
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    /**
+     * @brief Retires something that was just unlinked, and frees what is no longer reachable.
+     *
+     * @param reclaim Frees it, once no thread can reach it.
+     */
+    void retire(std::function<void()> reclaim)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        retired.emplace_back(globalEpoch.fetch_add(1), std::move(reclaim));
+        reclaimLocked();
+    }
+
+    /**
+     * @brief Frees what is no longer reachable, without retiring anything.
+     */
+    void reclaim()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        reclaimLocked();
+    }
+
+    /**
+     * @brief Gets the number of retirements whose callback has not run yet.
+     */
+    size_t pending()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return retired.size();
+    }
+
+private:
+    struct alignas(64) Slot
+    {
+        std::atomic<uint64_t> epoch{0}; ///< Epoch of the thread that holds the slot, 0 if it is free
+    };
+
+    void reclaimLocked()
+    {
+        uint64_t oldest = std::numeric_limits<uint64_t>::max();
+        for (const Slot &slot : slots)
+        {
+            uint64_t epoch = slot.epoch.load();
+            if (epoch != 0 && epoch < oldest)
+            {
+                oldest = epoch;
+            }
+        }
+        // Retirements are tagged in increasing order
+        while (!retired.empty() && retired.front().first < oldest)
+        {
+            retired.front().second();
+            retired.pop_front();
+        }
+    }
+
+    Slot slots[MAX_THREADS];                                    ///< Epochs of the threads inside the structure
+    std::atomic<uint64_t> globalEpoch;                          ///< Advanced by every retirement
+    std::mutex mutex;                                           ///< Guards retired
+    std::deque<std::pair<uint64_t, std::function<void()>>> retired; ///< Callbacks by epoch of retirement
+};
+
+#endif // EPOCH_RECLAIMER_HPP
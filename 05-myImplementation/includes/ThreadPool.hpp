@@ -0,0 +1,252 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <algorithm>
+#include <cstddef>
+
+/**
+ * @brief A fixed set of worker threads that run parallel loops with work stealing.
+ *
+ * parallelFor splits the iterations into small chunks and deals them out to one
+ * queue per worker. Each worker takes chunks from the back of its own queue and,
+ * once it runs dry, steals from the front of the others, so a worker that got slow
+ * iterations (e.g. queries that visit many nodes) does not hold the whole loop back.
+ *
+ * The thread that calls parallelFor works as worker 0, so a pool of one thread runs
+ * the loop inline.
+ */
+class ThreadPool
+{
+public:
+    /**
+     * @brief Starts the workers.
+     *
+     * @param numThreads Total number of threads, including the caller of parallelFor (at least 1).
+     */
+    explicit ThreadPool(size_t numThreads)
+        : queues(std::max<size_t>(1, numThreads)), generation(0), busyWorkers(0), stopping(false)
+    {
+        for (size_t w = 1; w < queues.size(); w++)
+        {
+            workers.emplace_back([this, w]()
+                                 { workerLoop(w); });
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    /**
+     * @brief Gets the number of threads of the pool (including the caller).
+     */
+    size_t size() const { return queues.size(); }
+
+    /**
+     * @brief Runs body(i, worker) for every i in [0, n) and waits for all of them.
+     *
+     * worker is in [0, size()) and identifies the thread that runs the iteration, so
+     * the body can keep per-thread state without locking. If an iteration throws, the
+     * remaining chunks are skipped and the first exception is rethrown here.
+     *
+     * @param n The number of iterations.
+     * @param body The loop body.
+     */
+    void parallelFor(size_t n, const std::function<void(size_t, size_t)> &body)
+    {
+        if (n == 0)
+        {
+            return;
+        }
+
+        // A few chunks per worker, so there is something left to steal
+        size_t chunkSize = std::max<size_t>(1, n / (size() * 8));
+        size_t q = 0;
+        for (size_t begin = 0; begin < n; begin += chunkSize)
+        {
+            queues[q].push(Range{begin, std::min(n, begin + chunkSize)});
+            q = (q + 1) % size();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &body;
+            error = nullptr;
+            busyWorkers = size() - 1;
+            generation++;
+        }
+        wake.notify_all();
+
+        runChunks(0);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]()
+                  { return busyWorkers == 0; });
+        job = nullptr;
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    /**
+     * @brief A chunk of consecutive iterations.
+     */
+    struct Range
+    {
+        size_t begin;
+        size_t end;
+    };
+
+    /**
+     * @brief The chunks dealt to one worker. Its owner pops from the back, thieves from the front.
+     */
+    class WorkQueue
+    {
+    public:
+        void push(const Range &range)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ranges.push_back(range);
+        }
+
+        bool pop(Range &range)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (ranges.empty())
+            {
+                return false;
+            }
+            range = ranges.back();
+            ranges.pop_back();
+            return true;
+        }
+
+        bool steal(Range &range)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (ranges.empty())
+            {
+                return false;
+            }
+            range = ranges.front();
+            ranges.pop_front();
+            return true;
+        }
+
+        void clear()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ranges.clear();
+        }
+
+    private:
+        std::mutex mutex;
+        std::deque<Range> ranges;
+    };
+
+    void workerLoop(size_t worker)
+    {
+        size_t seen = 0;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this, seen]()
+                          { return stopping || generation != seen; });
+                if (stopping)
+                {
+                    return;
+                }
+                seen = generation;
+            }
+
+            runChunks(worker);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busyWorkers == 0)
+            {
+                done.notify_one();
+            }
+        }
+    }
+
+    /**
+     * @brief Runs chunks of the current loop until there are none left in any queue.
+     */
+    void runChunks(size_t worker)
+    {
+        Range range;
+        while (nextRange(worker, range))
+        {
+            try
+            {
+                for (size_t i = range.begin; i < range.end; i++)
+                {
+                    (*job)(i, worker);
+                }
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error)
+                {
+                    error = std::current_exception();
+                }
+                for (auto &queue : queues)
+                {
+                    queue.clear();
+                }
+            }
+        }
+    }
+
+    bool nextRange(size_t worker, Range &range)
+    {
+        if (queues[worker].pop(range))
+        {
+            return true;
+        }
+        for (size_t i = 1; i < size(); i++)
+        {
+            if (queues[(worker + i) % size()].steal(range))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::vector<WorkQueue> queues;                          ///< One queue of chunks per thread
+    std::vector<std::thread> workers;                       ///< Workers 1..size()-1 (worker 0 is the caller)
+    const std::function<void(size_t, size_t)> *job = nullptr; ///< Body of the running loop
+    std::exception_ptr error;                               ///< First exception thrown by the running loop
+    size_t generation;                                      ///< Number of loops started, wakes the workers
+    size_t busyWorkers;                                     ///< Workers still running the current loop
+    bool stopping;                                          ///< Set by the destructor
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+};
+
+#endif // THREAD_POOL_HPP
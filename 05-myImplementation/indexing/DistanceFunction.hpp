@@ -4,69 +4,280 @@
 #include <iostream> // For std::cerr
 #include <vector> // For std::vector
 #include <cmath> // For std::sqrt, std::abs
-#include <numeric> // For std::inner_product
-#include <stdexcept> // For std::invalid_argument
+#include <limits> // For std::numeric_limits
+#include <algorithm> // For std::min, std::max
+#include "SimdKernels.hpp"
+#include "../objectTypes/Feature.hpp"
+#include "../objectTypes/FeatureView.hpp"
 
 /**
- * @brief Base class for distance functions.
- * 
- * @tparam T The type of the elements in the vectors.
+ * @brief Per-thread count of the distance computations made by metrics with the CountCalls policy.
+ *
+ * Each thread has its own counter, so counting needs no synchronization.
  */
-template <typename T>
-class DistanceFunction {
-public:
-    static unsigned long int distanceFunctionCalls;
+struct DistanceCalls {
+    static inline thread_local unsigned long int count = 0;
+    static inline thread_local unsigned long long skippedDimensions = 0; ///< Dimensions not read by distanceUpTo
 
     /**
-     * @brief Computes the distance between two vectors.
-     * 
-     * @param a The first vector.
-     * @param b The second vector.
-     * @return The distance.
-     * @throws std::invalid_argument if the vectors are not of the same size.
+     * @brief Resets the counters of the calling thread.
      */
-    virtual float operator()(const T& a, const T& b) const = 0;
-
-    /**
-     * @brief Resets the distance function call counter.
-     */
-    static void resetCounter() {
-        distanceFunctionCalls = 0;
+    static void reset() {
+        count = 0;
+        skippedDimensions = 0;
     }
 };
 
+/**
+ * @brief Counting policy of a metric: distance computations are not counted.
+ */
+struct NoCallCounting {
+    static void add() {}
+    static void skip(size_t) {}
+};
 
 /**
- * @brief Static member initialization for distance function calls.
- * 
- * @tparam T The type of the elements in the vectors.
+ * @brief Counting policy of a metric: every distance computation increments DistanceCalls::count.
  */
+struct CountCalls {
+    static void add() {
+        DistanceCalls::count++;
+    }
+
+    static void skip(size_t dimensions) {
+        DistanceCalls::skippedDimensions += dimensions;
+    }
+};
+
+/*
+ * The sums behind the metrics. The templates work on any type with size() and operator[];
+ * the Feature<float> and FeatureView<float> overloads are picked instead for float features
+ * and run the SIMD kernels chosen for this CPU (see SimdKernels.hpp).
+ */
+namespace distance_sums {
+
+template <typename T>
+float l2Squared(const T& a, const T& b) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < a.size(); ++i) {
+        float diff = a[i] - b[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+template <typename T>
+float l1(const T& a, const T& b) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < a.size(); ++i) {
+        sum += std::abs(a[i] - b[i]);
+    }
+    return sum;
+}
+
+template <typename T>
+float lInf(const T& a, const T& b) {
+    float maxDiff = 0.0f;
+    for (size_t i = 0; i < a.size(); ++i) {
+        float diff = std::abs(a[i] - b[i]);
+        if (diff > maxDiff) {
+            maxDiff = diff;
+        }
+    }
+    return maxDiff;
+}
+
+template <typename T>
+float dot(const T& a, const T& b) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < a.size(); ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+template <typename T>
+void cosineTerms(const T& a, const T& b, float& ab, float& aa, float& bb) {
+    ab = aa = bb = 0.0f;
+    for (size_t i = 0; i < a.size(); ++i) {
+        ab += a[i] * b[i];
+        aa += a[i] * a[i];
+        bb += b[i] * b[i];
+    }
+}
+
+inline float l2Squared(const Feature<float>& a, const Feature<float>& b) {
+    return simdKernels().l2Squared(a.values.data(), b.values.data(), a.size());
+}
+
+inline float l1(const Feature<float>& a, const Feature<float>& b) {
+    return simdKernels().l1(a.values.data(), b.values.data(), a.size());
+}
+
+inline float lInf(const Feature<float>& a, const Feature<float>& b) {
+    return simdKernels().lInf(a.values.data(), b.values.data(), a.size());
+}
+
+inline float dot(const Feature<float>& a, const Feature<float>& b) {
+    return simdKernels().dot(a.values.data(), b.values.data(), a.size());
+}
+
+inline void cosineTerms(const Feature<float>& a, const Feature<float>& b, float& ab, float& aa, float& bb) {
+    simdKernels().cosineTerms(a.values.data(), b.values.data(), a.size(), &ab, &aa, &bb);
+}
+
+inline float l2Squared(const FeatureView<float>& a, const FeatureView<float>& b) {
+    return simdKernels().l2Squared(a.data(), b.data(), a.size());
+}
+
+inline float l1(const FeatureView<float>& a, const FeatureView<float>& b) {
+    return simdKernels().l1(a.data(), b.data(), a.size());
+}
+
+inline float lInf(const FeatureView<float>& a, const FeatureView<float>& b) {
+    return simdKernels().lInf(a.data(), b.data(), a.size());
+}
+
+inline float dot(const FeatureView<float>& a, const FeatureView<float>& b) {
+    return simdKernels().dot(a.data(), b.data(), a.size());
+}
+
+inline void cosineTerms(const FeatureView<float>& a, const FeatureView<float>& b, float& ab, float& aa, float& bb) {
+    simdKernels().cosineTerms(a.data(), b.data(), a.size(), &ab, &aa, &bb);
+}
+
+/*
+ * Bounded sums, used by distanceUpTo. The sum is checked against the bound after
+ * UPTO_FIRST_CHECK dimensions, then after twice as many, and so on (see SimdKernels.hpp), and
+ * the remaining dimensions are not read once it is exceeded. evaluated is set to the number
+ * of dimensions read.
+ */
+
+template <typename Block, typename Combine>
+float accumulateUpTo(size_t n, float bound, size_t& evaluated, Block block, Combine combine) {
+    float sum = 0.0f;
+    size_t i = 0;
+    for (size_t check = UPTO_FIRST_CHECK; check < n; check *= 2) {
+        sum = combine(sum, block(i, check));
+        i = check;
+        if (sum > bound) {
+            evaluated = i;
+            return sum;
+        }
+    }
+    evaluated = n;
+    return combine(sum, block(i, n));
+}
+
+inline float addBlock(float sum, float block) { return sum + block; }
+inline float maxBlock(float sum, float block) { return std::max(sum, block); }
+
+template <typename T>
+float l2SquaredUpTo(const T& a, const T& b, float bound, size_t& evaluated) {
+    return accumulateUpTo(a.size(), bound, evaluated, [&](size_t begin, size_t end) {
+        float sum = 0.0f;
+        for (size_t i = begin; i < end; ++i) {
+            float diff = a[i] - b[i];
+            sum += diff * diff;
+        }
+        return sum;
+    }, addBlock);
+}
+
+template <typename T>
+float l1UpTo(const T& a, const T& b, float bound, size_t& evaluated) {
+    return accumulateUpTo(a.size(), bound, evaluated, [&](size_t begin, size_t end) {
+        float sum = 0.0f;
+        for (size_t i = begin; i < end; ++i) {
+            sum += std::abs(a[i] - b[i]);
+        }
+        return sum;
+    }, addBlock);
+}
+
 template <typename T>
-unsigned long int DistanceFunction<T>::distanceFunctionCalls = 0;
+float lInfUpTo(const T& a, const T& b, float bound, size_t& evaluated) {
+    return accumulateUpTo(a.size(), bound, evaluated, [&](size_t begin, size_t end) {
+        float maxDiff = 0.0f;
+        for (size_t i = begin; i < end; ++i) {
+            maxDiff = std::max(maxDiff, std::abs(a[i] - b[i]));
+        }
+        return maxDiff;
+    }, maxBlock);
+}
+
+inline float l2SquaredUpTo(const Feature<float>& a, const Feature<float>& b, float bound, size_t& evaluated) {
+    return simdKernels().l2SquaredUpTo(a.values.data(), b.values.data(), a.size(), bound, &evaluated);
+}
+
+inline float l1UpTo(const Feature<float>& a, const Feature<float>& b, float bound, size_t& evaluated) {
+    return simdKernels().l1UpTo(a.values.data(), b.values.data(), a.size(), bound, &evaluated);
+}
+
+inline float lInfUpTo(const Feature<float>& a, const Feature<float>& b, float bound, size_t& evaluated) {
+    return simdKernels().lInfUpTo(a.values.data(), b.values.data(), a.size(), bound, &evaluated);
+}
+
+inline float l2SquaredUpTo(const FeatureView<float>& a, const FeatureView<float>& b, float bound, size_t& evaluated) {
+    return simdKernels().l2SquaredUpTo(a.data(), b.data(), a.size(), bound, &evaluated);
+}
+
+inline float l1UpTo(const FeatureView<float>& a, const FeatureView<float>& b, float bound, size_t& evaluated) {
+    return simdKernels().l1UpTo(a.data(), b.data(), a.size(), bound, &evaluated);
+}
+
+inline float lInfUpTo(const FeatureView<float>& a, const FeatureView<float>& b, float bound, size_t& evaluated) {
+    return simdKernels().lInfUpTo(a.data(), b.data(), a.size(), bound, &evaluated);
+}
+
+} // namespace distance_sums
+
+/*
+ * The metrics below are plain functors, passed to the searchers as a template parameter so
+ * that each comparison can be inlined into the search loops. They do not check the sizes of
+ * their arguments: the searchers check the dimension of every object when it is indexed and
+ * of every query when the search starts. Pass CountCalls as the Counting parameter to
+ * count the distance computations (e.g. EuclideanDistance<T, CountCalls>).
+ *
+ * The k-NN searches call distanceUpTo(a, b, bound) with the current k-th distance (or the
+ * bound derived from it), since only whether the distance exceeds it matters past that
+ * point. The Lp metrics stop reading dimensions once their partial sum exceeds the bound;
+ * the cosine metrics always compute the whole distance.
+ */
 
 /**
  * @brief Class for computing Euclidean distance.
  * 
  * @tparam T The type of the elements in the vectors.
+ * @tparam Counting The counting policy.
  * 
  * The Euclidean distance between two vectors a and b is defined as:
  * \f[
  * d(a, b) = \sqrt{\sum_{i=1}^{n} (a_i - b_i)^2}
  * \f]
  */
-template <typename T>
-class EuclideanDistance : public DistanceFunction<T> {
+template <typename T, typename Counting = NoCallCounting>
+class EuclideanDistance {
 public:
-    float operator()(const T& a, const T& b) const override {
-        DistanceFunction<T>::distanceFunctionCalls++;
-        if (a.size() != b.size()) {
-            throw std::invalid_argument("Vectors must be of the same size");
-        }
+    float operator()(const T& a, const T& b) const {
+        Counting::add();
+        return std::sqrt(distance_sums::l2Squared(a, b));
+    }
 
-        float sum = 0.0f;
-        for (size_t i = 0; i < a.size(); ++i) {
-            float diff = a[i] - b[i];
-            sum += diff * diff;
+    /**
+     * @brief Computes the distance, stopping early once it exceeds a bound.
+     *
+     * @return The distance if it is less than or equal to bound, otherwise a value greater than bound
+     *         (infinity if it stopped early).
+     */
+    float distanceUpTo(const T& a, const T& b, float bound) const {
+        Counting::add();
+
+        size_t evaluated;
+        float sum = distance_sums::l2SquaredUpTo(a, b, bound * bound, evaluated);
+        if (evaluated < a.size()) {
+            Counting::skip(a.size() - evaluated);
+            return std::numeric_limits<float>::infinity();
         }
         return std::sqrt(sum);
     }
@@ -76,24 +287,35 @@ public:
  * @brief Class for computing Manhattan distance.
  * 
  * @tparam T The type of the elements in the vectors.
+ * @tparam Counting The counting policy.
  * 
  * The Manhattan distance between two vectors a and b is defined as:
  * \f[
  * d(a, b) = \sum_{i=1}^{n} |a_i - b_i|
  * \f]
  */
-template <typename T>
-class ManhattanDistance : public DistanceFunction<T> {
+template <typename T, typename Counting = NoCallCounting>
+class ManhattanDistance {
 public:
-    float operator()(const T& a, const T& b) const override {
-        DistanceFunction<T>::distanceFunctionCalls++;
-        if (a.size() != b.size()) {
-            throw std::invalid_argument("Vectors must be of the same size");
-        }
+    float operator()(const T& a, const T& b) const {
+        Counting::add();
+        return distance_sums::l1(a, b);
+    }
 
-        float sum = 0.0f;
-        for (size_t i = 0; i < a.size(); ++i) {
-            sum += std::abs(a[i] - b[i]);
+    /**
+     * @brief Computes the distance, stopping early once it exceeds a bound.
+     *
+     * @return The distance if it is less than or equal to bound, otherwise a value greater than bound
+     *         (infinity if it stopped early).
+     */
+    float distanceUpTo(const T& a, const T& b, float bound) const {
+        Counting::add();
+
+        size_t evaluated;
+        float sum = distance_sums::l1UpTo(a, b, bound, evaluated);
+        if (evaluated < a.size()) {
+            Counting::skip(a.size() - evaluated);
+            return std::numeric_limits<float>::infinity();
         }
         return sum;
     }
@@ -103,29 +325,37 @@ public:
  * @brief Class for computing Chebyshev distance.
  * 
  * @tparam T The type of the elements in the vectors.
+ * @tparam Counting The counting policy.
  * 
  * The Chebyshev distance between two vectors a and b is defined as:
  * \f[
  * d(a, b) = \max_{i=1}^{n} |a_i - b_i|
  * \f]
  */
-template <typename T>
-class ChebyshevDistance : public DistanceFunction<T> {
+template <typename T, typename Counting = NoCallCounting>
+class ChebyshevDistance {
 public:
-    float operator()(const T& a, const T& b) const override {
-        DistanceFunction<T>::distanceFunctionCalls++;
-        if (a.size() != b.size()) {
-            throw std::invalid_argument("Vectors must be of the same size");
-        }
+    float operator()(const T& a, const T& b) const {
+        Counting::add();
+        return distance_sums::lInf(a, b);
+    }
 
-        float maxDiff = 0.0f;
-        for (size_t i = 0; i < a.size(); ++i) {
-            float diff = std::abs(a[i] - b[i]);
-            if (diff > maxDiff) {
-                maxDiff = diff;
-            }
+    /**
+     * @brief Computes the distance, stopping early once it exceeds a bound.
+     *
+     * @return The distance if it is less than or equal to bound, otherwise a value greater than bound
+     *         (infinity if it stopped early).
+     */
+    float distanceUpTo(const T& a, const T& b, float bound) const {
+        Counting::add();
+
+        size_t evaluated;
+        float sum = distance_sums::lInfUpTo(a, b, bound, evaluated);
+        if (evaluated < a.size()) {
+            Counting::skip(a.size() - evaluated);
+            return std::numeric_limits<float>::infinity();
         }
-        return maxDiff;
+        return sum;
     }
 };
 
@@ -133,24 +363,24 @@ public:
  * @brief Class for computing Cosine distance.
  * 
  * @tparam T The type of the elements in the vectors.
+ * @tparam Counting The counting policy.
  * 
  * The Cosine distance between two vectors a and b is defined as:
  * \f[
  * d(a, b) = 1 - \frac{\sum_{i=1}^{n} a_i b_i}{\sqrt{\sum_{i=1}^{n} a_i^2} \sqrt{\sum_{i=1}^{n} b_i^2}}
  * \f]
  */
-template <typename T>
-class CosineDistance : public DistanceFunction<T> {
+template <typename T, typename Counting = NoCallCounting>
+class CosineDistance {
 public:
-    float operator()(const T& a, const T& b) const override {
-        DistanceFunction<T>::distanceFunctionCalls++;
-        if (a.size() != b.size()) {
-            throw std::invalid_argument("Vectors must be of the same size");
-        }
+    float operator()(const T& a, const T& b) const {
+        Counting::add();
 
-        float dotProduct = std::inner_product(a.begin(), a.end(), b.begin(), 0.0f);
-        float normA = std::sqrt(std::inner_product(a.begin(), a.end(), a.begin(), 0.0f));
-        float normB = std::sqrt(std::inner_product(b.begin(), b.end(), b.begin(), 0.0f));
+        // Dot product and both squared norms in a single pass
+        float dotProduct, normA2, normB2;
+        distance_sums::cosineTerms(a, b, dotProduct, normA2, normB2);
+        float normA = std::sqrt(normA2);
+        float normB = std::sqrt(normB2);
 
         // Division by 0 check
         if (normA == 0.0f || normB == 0.0f) {
@@ -159,30 +389,42 @@ public:
         }
         return 1.0f - (dotProduct / (normA * normB));
     }
+
+    /**
+     * @brief Computes the whole distance, the cosine distance cannot be bounded from a partial sum.
+     */
+    float distanceUpTo(const T& a, const T& b, float) const {
+        return (*this)(a, b);
+    }
 };
 
 /**
  * @brief Class for computing Normalized Cosine distance.
  * 
  * @tparam T The type of the elements in the vectors.
+ * @tparam Counting The counting policy.
  * 
  * The Normalized Cosine distance between two normalized vectors a and b is defined as:
  * \f[
  * d(a, b) = 1 - \sum_{i=1}^{n} a_i b_i
  * \f]
  */
-template <typename T>
-class NormalizedCosineDistance : public DistanceFunction<T> {
+template <typename T, typename Counting = NoCallCounting>
+class NormalizedCosineDistance {
 public:
-    float operator()(const T& a, const T& b) const override {
-        DistanceFunction<T>::distanceFunctionCalls++;
-        if (a.size() != b.size()) {
-            throw std::invalid_argument("Vectors must be of the same size");
-        }
+    float operator()(const T& a, const T& b) const {
+        Counting::add();
 
-        float dotProduct = std::inner_product(a.begin(), a.end(), b.begin(), 0.0f);
+        float dotProduct = distance_sums::dot(a, b);
         return 1.0f - dotProduct; // Norms are 1, so we only need the dot product
     }
+
+    /**
+     * @brief Computes the whole distance, the cosine distance cannot be bounded from a partial sum.
+     */
+    float distanceUpTo(const T& a, const T& b, float) const {
+        return (*this)(a, b);
+    }
 };
 
 #endif // DISTANCES_HPP
\ No newline at end of file
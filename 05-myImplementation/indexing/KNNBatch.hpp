@@ -0,0 +1,71 @@
+#ifndef KNN_BATCH_HPP
+#define KNN_BATCH_HPP
+
+#include <vector>
+#include <cstddef>
+#include "NNList.hpp"
+#include "DistanceFunction.hpp"
+#include "SearchStats.hpp"
+#include "../includes/ThreadPool.hpp"
+
+/**
+ * @brief The answers to a batch of k-NN queries.
+ */
+struct KNNBatchResult {
+    std::vector<NNList> results;         ///< The nearest neighbors of each query, in query order
+    SearchStatsSummary stats;            ///< The SearchStats of all queries
+    unsigned long distanceFunctionCalls; ///< Total number of distance computations made by all queries (counting metrics only)
+    unsigned long long skippedDimensions; ///< Total number of dimensions skipped by distanceUpTo (counting metrics only)
+};
+
+/**
+ * @brief Runs a batch of k-NN queries on a thread pool.
+ *
+ * Each worker counts its own distance computations and skipped dimensions (DistanceCalls
+ * is per thread) and summarizes the SearchStats of its queries, and the totals and summaries
+ * are merged once all queries finished. The calling thread's DistanceCalls counters are then
+ * advanced by the whole batch, as if it had run all the queries itself.
+ *
+ * @tparam T The type of the queries.
+ * @tparam Search Callable search(query, worker, stats) -> NNList, safe to call concurrently.
+ * @param queries The query elements.
+ * @param threads The number of threads (including the calling thread).
+ * @param search Searches one query; worker is in [0, threads) and stats, owned by the worker, is filled by the search.
+ * @return The results in query order, with the aggregate counters and stats.
+ */
+template <typename T, typename Search>
+KNNBatchResult runKnnBatch(const std::vector<T>& queries, size_t threads, Search search) {
+    // Per-worker counters, each on its own cache line
+    struct alignas(64) WorkerCounters {
+        unsigned long distanceFunctionCalls = 0;
+        unsigned long long skippedDimensions = 0;
+        SearchStats stats;
+        SearchStatsSummary summary;
+    };
+
+    KNNBatchResult batch{std::vector<NNList>(queries.size()), SearchStatsSummary(), 0, 0};
+    unsigned long callerCalls = DistanceCalls::count;
+    unsigned long long callerSkipped = DistanceCalls::skippedDimensions;
+
+    ThreadPool pool(std::max<size_t>(1, std::min(threads, queries.size())));
+    std::vector<WorkerCounters> counters(pool.size());
+    pool.parallelFor(queries.size(), [&](size_t i, size_t worker) {
+        unsigned long before = DistanceCalls::count;
+        unsigned long long skippedBefore = DistanceCalls::skippedDimensions;
+        batch.results[i] = search(queries[i], worker, counters[worker].stats);
+        counters[worker].summary.add(counters[worker].stats);
+        counters[worker].distanceFunctionCalls += DistanceCalls::count - before;
+        counters[worker].skippedDimensions += DistanceCalls::skippedDimensions - skippedBefore;
+    });
+
+    for (const auto& counter : counters) {
+        batch.stats.merge(counter.summary);
+        batch.distanceFunctionCalls += counter.distanceFunctionCalls;
+        batch.skippedDimensions += counter.skippedDimensions;
+    }
+    DistanceCalls::count = callerCalls + batch.distanceFunctionCalls;
+    DistanceCalls::skippedDimensions = callerSkipped + batch.skippedDimensions;
+    return batch;
+}
+
+#endif // KNN_BATCH_HPP
@@ -5,113 +5,102 @@
 #include <limits>  // For std::numeric_limits
 #include <ostream> // For std::ostream
 #include <cstddef> // For std::size_t
+#include <cstdint> // For uint32_t
 
 /**
  * @brief Represents an entry in the nearest neighbors list.
- * 
- * @tparam T The type of the elements in the list.
+ *
+ * The entry refers to the object by the id it has in the searcher that produced it
+ * (see MTree::getObject and SequentialSearcher::getObject), so it is 8 bytes whatever
+ * the type of the objects.
  */
-template <typename T>
 struct NNEntry {
-    T element;
-    double distance;
+    uint32_t id;
+    float distance;
 
     /**
-     * @brief Constructs an NNEntry with the given element and distance.
-     * 
-     * @param elem The element to store in the entry.
-     * @param dist The distance associated with the element.
-     */
-    NNEntry(const T& elem, double dist) : element(elem), distance(dist) {}
-
-    /**
-     * @brief Compares two NNEntry objects by their distance.
-     * 
+     * @brief Compares two NNEntry objects by their distance, ties broken by id.
+     *
      * @param other The other NNEntry object to compare with.
-     * @return True if this object's distance is less than the other's distance, false otherwise.
+     * @return True if this entry comes before the other one in the sorted list, false otherwise.
      */
     bool operator<(const NNEntry& other) const {
-        return distance < other.distance;
+        return distance < other.distance || (distance == other.distance && id < other.id);
     }
 
     /**
-     * @brief Overload of the output operator to format the output as (element, distance).
+     * @brief Overload of the output operator to format the output as (id, distance).
      * @param os Output stream.
      * @param entry NNEntry object to be printed.
      * @return Output stream.
      */
     friend std::ostream& operator<<(std::ostream& os, const NNEntry& entry) {
-        os << "(" << entry.element << ", " << entry.distance << ")";
+        os << "(" << entry.id << ", " << entry.distance << ")";
         return os;
     }
 };
 
 /**
- * @brief A class to manage a list of nearest neighbors.
- * 
- * @tparam T The type of the elements in the list.
+ * @brief The k nearest neighbors found so far, as a bounded max-heap of (id, distance).
+ *
+ * The buffer for the k entries is allocated once, when the list is constructed (or by
+ * reset() with a larger k), so inserting never allocates. While the search runs the
+ * entries are kept in heap order, with the farthest one first; finalize() sorts them in
+ * ascending order of distance.
+ *
+ * A list can also have a maximum distance: entries farther than it are never inserted, so a
+ * search starts pruning with it instead of an infinite dk. With k = UNBOUNDED, the list keeps
+ * every entry within the maximum distance (a range query); its buffer then grows as needed.
  */
-template <typename T>
 class NNList {
 public:
-    /**
-     * @brief Constructs an empty NNList, just allocating memory for the list.
-     * 
-     * @param k The number of empty elements to initialize the list with. Default is 0.
-     */
-    NNList(size_t k);
+    static constexpr size_t UNBOUNDED = static_cast<size_t>(-1); ///< k of a list that keeps every entry within its maximum distance
 
     /**
-     * @brief Constructs an NNList with the given number of empty elements, with the default distance set to the specified value.
-     * 
-     * @param k The number of empty elements to initialize the list with.
-     * @param dist The default distance to set for the elements.
+     * @brief Constructs an empty NNList with room for k entries.
+     *
+     * @param k The number of nearest neighbors to keep. Default is 0.
+     * @param maxDistance Entries farther than it are not inserted. Default is infinity.
      */
-    NNList(size_t k, double dist);
+    explicit NNList(size_t k = 0, float maxDistance = std::numeric_limits<float>::infinity());
 
     /**
-     * @brief Destructor for NNList.
+     * @brief Empties the list and sets the number of neighbors to keep.
+     *
+     * Only allocates if k is larger than any k the list was used with before.
+     *
+     * @param k The number of nearest neighbors to keep.
+     * @param maxDistance Entries farther than it are not inserted.
      */
-    ~NNList();
+    void reset(size_t k, float maxDistance = std::numeric_limits<float>::infinity());
 
     /**
-     * @brief Inserts an entry into the nearest neighbors list in a smart way.
-     * 
-     * This function inserts an entry into the list if there is available capacity
-     * or if the list is full but the new entry is closer than the farthest entry in the list.
-     * In the latter case, the farthest entry is removed to maintain the correct size of the list.
-     * 
-     * @tparam T The type of the elements in the list.
-     * @param element The element to insert.
-     * @param distance The distance associated with the element.
+     * @brief Inserts an entry if the list is not full or if it is closer than the farthest entry,
+     * which is then removed. Takes O(log k). Entries farther than the maximum distance are ignored.
+     *
+     * @param id The id of the object.
+     * @param distance The distance between the object and the query.
      */
-    void insert(const T& element, double distance);
+    void insert(uint32_t id, float distance);
 
     /**
-     * @brief This is a virtual insertion, only changes the maximum distance.
-     * 
-     * @param distance The distance to insert.
+     * @brief Sorts the entries in ascending order of distance (ties by id).
+     *
+     * The searchers call it before returning the list. Inserting after finalize() is
+     * allowed, the heap order is then restored first.
      */
-    void insert(double distance);
+    void finalize();
 
     /**
-     * @brief Forces the insertion of an entry into the list, even if it is full.
-     * 
-     * @param entry The entry to insert.
-     */
-    void forceInsert(const NNEntry<T>& entry);
-
-    /**
-     * @brief Returns the maximum distance in the nearest neighbors list.
-     * @return The maximum distance in the nearest neighbors list.
+     * @brief Returns the distance the next entry must be below to be inserted.
+     * @return The distance of the farthest entry if the list is full, the maximum distance otherwise.
      */
     float getMaxDistance() const;
 
     /**
-     * @brief Sets the maximum distance in the nearest neighbors list.
-     * @param distance The new maximum distance.
+     * @brief Returns the maximum distance the list was created with (infinity if it has none).
      */
-    void setMaxDistance(double distance);
+    float getRadius() const;
 
     /**
      * @brief Returns the number of elements in the nearest neighbors list.
@@ -119,17 +108,23 @@ public:
      */
     size_t size() const;
 
+    /**
+     * @brief Returns the number of nearest neighbors the list keeps.
+     * @return k.
+     */
+    size_t getK() const;
+
     /**
      * @brief Returns iterator to the beginning of the nearest neighbors list.
      * @return Iterator to the beginning of the nearest neighbors list.
      */
-    typename std::vector<NNEntry<T>>::const_iterator begin() const;
+    std::vector<NNEntry>::const_iterator begin() const;
 
     /**
      * @brief Returns iterator to the end of the nearest neighbors list.
      * @return Iterator to the end of the nearest neighbors list.
      */
-    typename std::vector<NNEntry<T>>::const_iterator end() const;
+    std::vector<NNEntry>::const_iterator end() const;
 
     /**
      * @brief Overload of the output operator to format the output as [NNEntry1, NNEntry2, ...].
@@ -140,41 +135,37 @@ public:
     friend std::ostream& operator<<(std::ostream& os, const NNList& list) {
         os << "[";
         for (size_t i = 0; i < list.entries.size(); ++i) {
-            os << list.entries[i];
-            if (i == list.entries.size() - 1 || list.entries[i + 1].distance == std::numeric_limits<float>::infinity()) {
-                break;
+            if (i > 0) {
+                os << ", ";
             }
-            os << ", ";
+            os << list.entries[i];
         }
         os << "]";
         return os;
     }
 
     /**
-     * @brief Overload of the [] operator to access entries by index.
+     * @brief Overload of the [] operator to access entries by index (in sorted order after finalize()).
      * @param index Index of the entry to access.
-     * @return Reference to the NNEntry at the specified index.
+     * @return Const reference to the NNEntry at the specified index.
      */
-    NNEntry<T>& operator[](size_t index) {
+    const NNEntry& operator[](size_t index) const {
         return entries[index];
     }
 
+private:
     /**
-     * @brief Overload of the [] operator to access entries by index (const version).
-     * @param index Index of the entry to access.
-     * @return Const reference to the NNEntry at the specified index.
+     * @brief Moves the entry at index down the heap until both of its children are not greater.
+     * @param index Index of the entry.
      */
-    const NNEntry<T>& operator[](size_t index) const {
-        return entries[index];
-    }
+    void siftDown(size_t index);
 
-private:
-    std::vector<NNEntry<T>> entries;
-    double maxDistance;
-    size_t currentSize;
-    size_t maxSize;
+    std::vector<NNEntry> entries; ///< Max-heap by (distance, id), or sorted once finalized
+    size_t k;                     ///< The number of nearest neighbors to keep
+    float maxDistance;            ///< Entries farther than it are not inserted
+    bool sorted;                  ///< True if finalize() was called after the last insertion
 };
 
 #include "NNList.tpp"
 
-#endif // NNLIST_HPP
\ No newline at end of file
+#endif // NNLIST_HPP
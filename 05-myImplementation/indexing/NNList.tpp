@@ -1,78 +1,98 @@
 #include "NNList.hpp"
 
-template <typename T>
-NNList<T>::NNList(size_t k) : currentSize(0), maxSize(k) {
-    entries.reserve(k);
+#include <algorithm> // For std::push_heap, std::make_heap, std::sort
+
+inline NNList::NNList(size_t k, float maxDistance) : k(k), maxDistance(maxDistance), sorted(false) {
+    if (k != UNBOUNDED) {
+        entries.reserve(k);
+    }
 }
 
-template <typename T>
-NNList<T>::NNList(size_t k, double dist) : currentSize(k), maxSize(k) {
-    // Fill k entries with default element and distance given by dist
-    entries.reserve(k);
-    for (size_t i = 0; i < k; ++i) {
-        entries.emplace_back(NNEntry<T>{T(), dist});
+inline void NNList::reset(size_t newK, float newMaxDistance) {
+    k = newK;
+    maxDistance = newMaxDistance;
+    sorted = false;
+    entries.clear();
+    if (k != UNBOUNDED) {
+        entries.reserve(k);
     }
 }
 
-template <typename T>
-NNList<T>::~NNList() {}
+inline void NNList::insert(uint32_t id, float distance) {
+    if (distance > maxDistance) {
+        return;
+    }
+    NNEntry entry{id, distance};
+    if (sorted) {
+        std::make_heap(entries.begin(), entries.end());
+        sorted = false;
+    }
 
-template <typename T>
-void NNList<T>::forceInsert(const NNEntry<T>& entry) {
-    // Insert the entry in the correct position
-    // The list is always sorted by distance
-    auto it = std::lower_bound(entries.begin(), entries.end(), entry);
-    entries.insert(it, entry);
-    
-    // Check if needs to update maxDistance
-    if (entries.back().distance < maxDistance) {
-        maxDistance = entries.back().distance;
+    if (entries.size() < k) {
+        entries.push_back(entry);
+        std::push_heap(entries.begin(), entries.end());
+    } else if (k > 0 && entry < entries[0]) {
+        // Replace the farthest entry
+        entries[0] = entry;
+        siftDown(0);
     }
-    ++currentSize;
 }
 
-template <typename T>
-void NNList<T>::insert(const T& value, double distance) {
-    if (currentSize < maxSize || distance < getMaxDistance()) {
-        forceInsert(NNEntry<T>{value, distance});
-        
-        // If the inserted item exceeds the maximum size, remove the last element
-        if (currentSize > maxSize) {
-            entries.pop_back();
+inline void NNList::siftDown(size_t index) {
+    const size_t n = entries.size();
+    NNEntry entry = entries[index];
+    while (true) {
+        size_t child = 2 * index + 1;
+        if (child >= n) {
+            break;
+        }
+        if (child + 1 < n && entries[child] < entries[child + 1]) {
+            ++child;
+        }
+        if (!(entry < entries[child])) {
+            break;
         }
+        entries[index] = entries[child];
+        index = child;
     }
+    entries[index] = entry;
 }
 
-template <typename T>
-void NNList<T>::insert(double distance) {
-    setMaxDistance(distance);
+inline void NNList::finalize() {
+    if (!sorted) {
+        std::sort(entries.begin(), entries.end());
+        sorted = true;
+    }
 }
 
-template <typename T>
-float NNList<T>::getMaxDistance() const {
-    if (entries.empty()) {
-        // Return infinity if the list is empty
-        return std::numeric_limits<float>::infinity();
+inline float NNList::getMaxDistance() const {
+    if (entries.size() < k) {
+        return maxDistance;
+    }
+    if (k == 0) {
+        // Nothing can be inserted
+        return -std::numeric_limits<float>::infinity();
     }
-    return entries.back().distance;
+    // The farthest entry is the top of the heap, or the last one once sorted
+    return sorted ? entries.back().distance : entries[0].distance;
 }
 
-template <typename T>
-void NNList<T>::setMaxDistance(double distance) {
-    maxDistance = distance;
+inline float NNList::getRadius() const {
+    return maxDistance;
 }
 
-template <typename T>
-size_t NNList<T>::size() const {
-    return currentSize;
+inline size_t NNList::size() const {
+    return entries.size();
 }
 
-template <typename T>
-typename std::vector<NNEntry<T>>::const_iterator NNList<T>::begin() const {
+inline size_t NNList::getK() const {
+    return k;
+}
+
+inline std::vector<NNEntry>::const_iterator NNList::begin() const {
     return entries.begin();
 }
 
-template <typename T>
-typename std::vector<NNEntry<T>>::const_iterator NNList<T>::end() const {
+inline std::vector<NNEntry>::const_iterator NNList::end() const {
     return entries.end();
-}
\ No newline at end of file
+}
@@ -0,0 +1,264 @@
+#ifndef SEARCH_STATS_HPP
+#define SEARCH_STATS_HPP
+
+#include <vector>
+#include <cstddef>   // For std::size_t
+#include <cmath>     // For std::ceil, std::sqrt
+#include <algorithm> // For std::sort, std::max
+#include <ostream>   // For std::ostream
+#include <ios>       // For std::streamsize
+
+/**
+ * @brief What one k-NN search did.
+ *
+ * The searchers fill it per query when asked to (see MTree::knn and SequentialSearcher::knn),
+ * so the numbers stay meaningful when several searches run at once. Searchers without nodes
+ * leave nodesPerLevel empty.
+ */
+struct SearchStats {
+    std::vector<size_t> nodesPerLevel; ///< Nodes visited at each level, the root being level 0
+    size_t distanceEvaluations = 0;    ///< Distances computed between the query and an object
+    size_t prunedByParentDistance = 0; ///< Entries skipped by |d(q, parent) - d(e, parent)|, without computing d(q, e)
+    size_t prunedByCoveringRadius = 0; ///< Entries skipped after computing d(q, e), since d(q, e) - r(e) > dk (r = 0 in leaves)
+    size_t prunedByPivots = 0;         ///< Entries skipped by the pivot rings of a PM-tree, without computing d(q, e)
+    size_t distancesBeforeBound = 0;   ///< Entries whose distance was computed while dk was still infinite, so nothing could be pruned (0 when the search starts with a maximum distance)
+    size_t queueHighWater = 0;         ///< Largest number of candidate nodes waiting at once
+    double wallTimeMicros = 0.0;       ///< Duration of the search, in microseconds
+
+    /**
+     * @brief Clears the statistics, keeping the memory of nodesPerLevel.
+     */
+    void reset() {
+        nodesPerLevel.clear();
+        distanceEvaluations = 0;
+        prunedByParentDistance = 0;
+        prunedByCoveringRadius = 0;
+        prunedByPivots = 0;
+        distancesBeforeBound = 0;
+        queueHighWater = 0;
+        wallTimeMicros = 0.0;
+    }
+
+    /**
+     * @brief Counts a visit to a node.
+     * @param level The level of the node, the root being level 0.
+     */
+    void visitNode(size_t level) {
+        if (level >= nodesPerLevel.size()) {
+            nodesPerLevel.resize(level + 1, 0);
+        }
+        nodesPerLevel[level]++;
+    }
+
+    /**
+     * @brief Returns the number of nodes visited, at all levels.
+     */
+    size_t nodesVisited() const {
+        size_t total = 0;
+        for (size_t nodes : nodesPerLevel) {
+            total += nodes;
+        }
+        return total;
+    }
+};
+
+/**
+ * @brief The distribution of the SearchStats of many queries.
+ *
+ * Each thread of a batch adds the stats of its queries to its own summary, and the summaries
+ * are merged once the batch is over. Percentiles use the nearest-rank method.
+ */
+class SearchStatsSummary {
+public:
+    /**
+     * @brief The statistics summarized, one value per query.
+     */
+    enum Field {
+        NODES_VISITED,
+        DISTANCE_EVALUATIONS,
+        PRUNED_BY_PARENT_DISTANCE,
+        PRUNED_BY_COVERING_RADIUS,
+        PRUNED_BY_PIVOTS,
+        DISTANCES_BEFORE_BOUND,
+        QUEUE_HIGH_WATER,
+        WALL_TIME_MICROS,
+        NUM_FIELDS
+    };
+
+    /**
+     * @brief Distribution of one field over the queries.
+     */
+    struct Percentiles {
+        double mean;
+        double stddev; ///< Population standard deviation
+        double p50;
+        double p90;
+        double p99;
+        double max;
+        double total;
+    };
+
+    /**
+     * @brief Adds the stats of one query.
+     * @param stats The stats of the query.
+     */
+    void add(const SearchStats& stats) {
+        samples[NODES_VISITED].push_back(static_cast<double>(stats.nodesVisited()));
+        samples[DISTANCE_EVALUATIONS].push_back(static_cast<double>(stats.distanceEvaluations));
+        samples[PRUNED_BY_PARENT_DISTANCE].push_back(static_cast<double>(stats.prunedByParentDistance));
+        samples[PRUNED_BY_COVERING_RADIUS].push_back(static_cast<double>(stats.prunedByCoveringRadius));
+        samples[PRUNED_BY_PIVOTS].push_back(static_cast<double>(stats.prunedByPivots));
+        samples[DISTANCES_BEFORE_BOUND].push_back(static_cast<double>(stats.distancesBeforeBound));
+        samples[QUEUE_HIGH_WATER].push_back(static_cast<double>(stats.queueHighWater));
+        samples[WALL_TIME_MICROS].push_back(stats.wallTimeMicros);
+
+        if (stats.nodesPerLevel.size() > levelTotals.size()) {
+            levelTotals.resize(stats.nodesPerLevel.size(), 0);
+        }
+        for (size_t level = 0; level < stats.nodesPerLevel.size(); level++) {
+            levelTotals[level] += stats.nodesPerLevel[level];
+        }
+    }
+
+    /**
+     * @brief Adds the queries of another summary.
+     * @param other The other summary.
+     */
+    void merge(const SearchStatsSummary& other) {
+        for (int field = 0; field < NUM_FIELDS; field++) {
+            samples[field].insert(samples[field].end(), other.samples[field].begin(), other.samples[field].end());
+        }
+        if (other.levelTotals.size() > levelTotals.size()) {
+            levelTotals.resize(other.levelTotals.size(), 0);
+        }
+        for (size_t level = 0; level < other.levelTotals.size(); level++) {
+            levelTotals[level] += other.levelTotals[level];
+        }
+    }
+
+    /**
+     * @brief Returns the number of queries summarized.
+     */
+    size_t count() const {
+        return samples[NODES_VISITED].size();
+    }
+
+    /**
+     * @brief Returns the distribution of a field (all zeros if there are no queries).
+     * @param field The field.
+     */
+    Percentiles percentiles(Field field) const {
+        return distribution(samples[field]);
+    }
+
+    /**
+     * @brief Returns the values of a field, one per query, in the order they were added.
+     * @param field The field.
+     */
+    const std::vector<double>& values(Field field) const {
+        return samples[field];
+    }
+
+    /**
+     * @brief Returns the distribution of any set of values (all zeros if it is empty).
+     * @param sorted The values, sorted by the function (hence the copy).
+     */
+    static Percentiles distribution(std::vector<double> sorted) {
+        Percentiles result{0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+        if (sorted.empty()) {
+            return result;
+        }
+        std::sort(sorted.begin(), sorted.end());
+        for (double value : sorted) {
+            result.total += value;
+        }
+        result.mean = result.total / sorted.size();
+        double squares = 0.0;
+        for (double value : sorted) {
+            squares += (value - result.mean) * (value - result.mean);
+        }
+        result.stddev = std::sqrt(squares / sorted.size());
+        result.p50 = rank(sorted, 50.0);
+        result.p90 = rank(sorted, 90.0);
+        result.p99 = rank(sorted, 99.0);
+        result.max = sorted.back();
+        return result;
+    }
+
+    /**
+     * @brief Returns the mean number of nodes visited per query at each level, the root being level 0.
+     */
+    std::vector<double> meanNodesPerLevel() const {
+        std::vector<double> means(levelTotals.size(), 0.0);
+        for (size_t level = 0; level < levelTotals.size() && count() > 0; level++) {
+            means[level] = static_cast<double>(levelTotals[level]) / count();
+        }
+        return means;
+    }
+
+    /**
+     * @brief Returns the name of a field, as used in the JSON output.
+     * @param field The field.
+     */
+    static const char* fieldName(Field field) {
+        static const char* names[NUM_FIELDS] = {
+            "nodesVisited", "distanceEvaluations", "prunedByParentDistance",
+            "prunedByCoveringRadius", "prunedByPivots", "distancesBeforeBound", "queueHighWater", "wallTimeMicros"};
+        return names[field];
+    }
+
+    /**
+     * @brief Prints one line per field (mean, percentiles and max), and the nodes visited per level.
+     * @param os Output stream.
+     */
+    void print(std::ostream& os) const {
+        os << "Search stats over " << count() << " queries (mean / p50 / p90 / p99 / max):\n";
+        for (int field = 0; field < NUM_FIELDS; field++) {
+            Percentiles p = percentiles(static_cast<Field>(field));
+            os << "  " << fieldName(static_cast<Field>(field)) << ": " << p.mean << " / " << p.p50 << " / "
+               << p.p90 << " / " << p.p99 << " / " << p.max << "\n";
+        }
+        if (!levelTotals.empty()) {
+            os << "  nodesPerLevel (mean):";
+            for (double mean : meanNodesPerLevel()) {
+                os << " " << mean;
+            }
+            os << "\n";
+        }
+    }
+
+    /**
+     * @brief Writes the summary as a JSON object.
+     * @param os Output stream.
+     */
+    void writeJson(std::ostream& os) const {
+        std::ios_base::fmtflags flags = os.flags(std::ios_base::fmtflags());
+        std::streamsize precision = os.precision(15);
+        os << "{\"queries\": " << count();
+        for (int field = 0; field < NUM_FIELDS; field++) {
+            Percentiles p = percentiles(static_cast<Field>(field));
+            os << ", \"" << fieldName(static_cast<Field>(field)) << "\": {\"mean\": " << p.mean << ", \"stddev\": " << p.stddev << ", \"p50\": " << p.p50
+               << ", \"p90\": " << p.p90 << ", \"p99\": " << p.p99 << ", \"max\": " << p.max << ", \"total\": " << p.total << "}";
+        }
+        os << ", \"nodesPerLevel\": [";
+        std::vector<double> means = meanNodesPerLevel();
+        for (size_t level = 0; level < means.size(); level++) {
+            os << (level > 0 ? ", " : "") << means[level];
+        }
+        os << "]}";
+        os.flags(flags);
+        os.precision(precision);
+    }
+
+private:
+    // Nearest-rank percentile of sorted, non-empty values
+    static double rank(const std::vector<double>& sorted, double percentile) {
+        size_t r = static_cast<size_t>(std::ceil(percentile / 100.0 * sorted.size()));
+        return sorted[std::max<size_t>(r, 1) - 1];
+    }
+
+    std::vector<double> samples[NUM_FIELDS]; ///< One value per query, for each field
+    std::vector<size_t> levelTotals;         ///< Nodes visited at each level, summed over the queries
+};
+
+#endif // SEARCH_STATS_HPP
@@ -2,15 +2,19 @@
 #define SEQUENTIAL_SEARCHER_HPP
 
 #include <vector>
+#include <stdexcept>    // For std::invalid_argument
 #include <functional>   // For std::function
 #include <typeinfo>     // For typeid
+#include <cstdint>      // For uint32_t
 #include "NNList.hpp"
+#include "KNNBatch.hpp"
+#include "SearchStats.hpp"
 
 /**
  * @brief A class for performing sequential k-nearest neighbors search.
  * 
  * @tparam T The type of the objects stored in dataObjects.
- * @tparam DistanceFunc The type of the distance function.
+ * @tparam DistanceFunc The type of the distance function (a functor from DistanceFunction.hpp, called without virtual dispatch).
  */
 template <typename T, typename DistanceFunc>
 class SequentialSearcher {
@@ -27,9 +31,33 @@ public:
      * 
      * @param query The query object.
      * @param k The number of nearest neighbors to find.
-     * @return NNList<T> The list of k-nearest neighbors.
+     * @param stats If not null, receives the SearchStats of the search (no nodes are visited).
+     * @return NNList The ids of the k-nearest neighbors (see getObject), sorted by distance.
      */
-    NNList<T> knn(const T& query, size_t k) const;
+    NNList knn(const T& query, size_t k, SearchStats* stats = nullptr) const;
+
+    /**
+     * @brief Performs k-nearest neighbors search within a maximum distance.
+     * 
+     * @param query The query object.
+     * @param k The number of nearest neighbors to find (NNList::UNBOUNDED for a range query).
+     * @param maxDistance Objects farther than it are not returned.
+     * @param stats If not null, receives the SearchStats of the search (no nodes are visited).
+     * @return NNList The ids of the (at most) k nearest neighbors within maxDistance, sorted by distance.
+     */
+    NNList knn(const T& query, size_t k, float maxDistance, SearchStats* stats = nullptr) const;
+
+    /**
+     * @brief Performs k-nearest neighbors search for many queries in parallel.
+     * 
+     * @param queries The query objects.
+     * @param k The number of nearest neighbors to find.
+     * @param threads The number of threads to use (including the calling thread).
+     * @param maxDistance Objects farther than it are not returned (infinity by default).
+     * @return KNNBatchResult The k-nearest neighbors of each query, in query order, with the summary of their SearchStats.
+     */
+    KNNBatchResult knnBatch(const std::vector<T>& queries, size_t k, size_t threads,
+                            float maxDistance = std::numeric_limits<float>::infinity()) const;
 
     /**
      * @brief Adds a single object to the dataObjects.
@@ -45,6 +73,14 @@ public:
      */
     void addAll(const std::vector<T>& objs);
 
+    /**
+     * @brief Gets an object by its id, the position at which it was added.
+     * 
+     * @param id The id of the object, as in the NNList returned by knn.
+     * @return The object.
+     */
+    const T& getObject(uint32_t id) const;
+
     /**
      * @brief Returns the number of objects in the search structure.
      * 
@@ -63,6 +99,17 @@ public:
     friend std::ostream& operator<<(std::ostream& os, const SequentialSearcher<U, V>& searcher);
 
 private:
+    /**
+     * @brief Checks that an object has the dimension of the data objects.
+     * 
+     * The distance function does not check the sizes of its arguments, so this is done
+     * once per added object and per query instead of once per distance computation.
+     * 
+     * @param obj The object.
+     * @throws std::invalid_argument if the dimensions differ.
+     */
+    void checkDimension(const T& obj) const;
+
     std::vector<T> dataObjects; ///< The data objects to be searched.
     DistanceFunc &distanceFunc; ///< The distance function to evaluate distance between objects.
 };
@@ -1,5 +1,8 @@
 #include "SequentialSearcher.hpp"
 
+#include <chrono> // For std::chrono::steady_clock
+#include <cmath>  // For std::isinf
+
 // Constructor
 template <typename T, typename DistanceFunc>
 SequentialSearcher<T, DistanceFunc>::SequentialSearcher(DistanceFunc &distFunc)
@@ -7,26 +10,70 @@ SequentialSearcher<T, DistanceFunc>::SequentialSearcher(DistanceFunc &distFunc)
 
 // Method to perform k-nearest neighbors search
 template <typename T, typename DistanceFunc>
-NNList<T> SequentialSearcher<T, DistanceFunc>::knn(const T &query, size_t k) const
+NNList SequentialSearcher<T, DistanceFunc>::knn(const T &query, size_t k, SearchStats *stats) const
+{
+    return knn(query, k, std::numeric_limits<float>::infinity(), stats);
+}
+
+// Method to perform k-nearest neighbors search within a maximum distance
+template <typename T, typename DistanceFunc>
+NNList SequentialSearcher<T, DistanceFunc>::knn(const T &query, size_t k, float maxDistance, SearchStats *stats) const
 {
-    NNList<T> nnList(k);
+    checkDimension(query);
+    auto start = std::chrono::steady_clock::now();
+    NNList nnList(k, maxDistance);
+    size_t pruned = 0;
+    size_t beforeBound = 0;
 
     // Sequentially calculate the distance between the query object and all objects in dataObjects
     // Takes O(n) distance calculations
-    for (const auto &obj : dataObjects)
+    for (size_t i = 0; i < dataObjects.size(); i++)
     {
-        double dist = distanceFunc(query, obj);
+        // Once the list is full, objects farther than its last entry are not inserted,
+        // so the distance only needs to be computed up to there
+        float dk = nnList.getMaxDistance();
+        float dist = distanceFunc.distanceUpTo(query, dataObjects[i], dk);
+        if (std::isinf(dk))
+        {
+            beforeBound++;
+        }
 
-        nnList.insert(obj, dist);
+        if (dist <= dk)
+        {
+            nnList.insert(static_cast<uint32_t>(i), dist);
+        }
+        else
+        {
+            pruned++;
+        }
     }
 
+    nnList.finalize();
+    if (stats)
+    {
+        stats->reset();
+        stats->distanceEvaluations = dataObjects.size();
+        stats->prunedByCoveringRadius = pruned;
+        stats->distancesBeforeBound = beforeBound;
+        stats->wallTimeMicros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    }
     return nnList;
 }
 
+// Method to perform k-nearest neighbors search for a batch of queries
+template <typename T, typename DistanceFunc>
+KNNBatchResult SequentialSearcher<T, DistanceFunc>::knnBatch(const std::vector<T> &queries, size_t k, size_t threads, float maxDistance) const
+{
+    // knn only reads dataObjects, so the queries can run concurrently
+    return runKnnBatch(queries, threads, [this, k, maxDistance](const T &query, size_t, SearchStats &stats)
+                       { return knn(query, k, maxDistance, &stats); });
+}
+
 // Method to add a single object to the dataObjects
 template <typename T, typename DistanceFunc>
 void SequentialSearcher<T, DistanceFunc>::add(const T &obj)
 {
+    checkDimension(obj);
     dataObjects.push_back(obj);
 }
 
@@ -34,9 +81,34 @@ void SequentialSearcher<T, DistanceFunc>::add(const T &obj)
 template <typename T, typename DistanceFunc>
 void SequentialSearcher<T, DistanceFunc>::addAll(const std::vector<T> &objs)
 {
+    for (const auto &obj : objs)
+    {
+        checkDimension(obj);
+        if (obj.size() != objs[0].size())
+        {
+            throw std::invalid_argument("Object dimension differs from the dimension of the data objects");
+        }
+    }
     dataObjects.insert(dataObjects.end(), objs.begin(), objs.end());
 }
 
+// Method to check the dimension of an object against the data objects
+template <typename T, typename DistanceFunc>
+void SequentialSearcher<T, DistanceFunc>::checkDimension(const T &obj) const
+{
+    if (!dataObjects.empty() && obj.size() != dataObjects[0].size())
+    {
+        throw std::invalid_argument("Object dimension differs from the dimension of the data objects");
+    }
+}
+
+// Method to get an object by its id
+template <typename T, typename DistanceFunc>
+const T &SequentialSearcher<T, DistanceFunc>::getObject(uint32_t id) const
+{
+    return dataObjects[id];
+}
+
 // Method to get size of dataObjects
 template <typename T, typename DistanceFunc>
 size_t SequentialSearcher<T, DistanceFunc>::size() const
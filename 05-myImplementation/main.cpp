@@ -3,6 +3,7 @@
 #include "indexing/DistanceFunction.hpp"
 #include "objectTypes/FloatNumber.hpp"
 #include "objectTypes/Feature.hpp"
+#include "objectTypes/FeatureMatrix.hpp"
 #include "MTree.hpp"
 #include "includes/npy.hpp"
 #include "data/randomUnitVectors.hpp"
@@ -18,11 +19,17 @@
 #include <random>
 #include <string>
 #include <iomanip>
+#include <fstream>
 
-#if defined(UNIT) || defined(UNIFORM) || defined(NPY)
+#if defined(UNIT) || defined(UNIFORM)
 typedef Feature<float> Obj;
 #endif
 
+#ifdef NPY
+// The features are rows of a FeatureMatrix, read in place from the .npy files
+typedef FeatureView<float> Obj;
+#endif
+
 #ifdef FLOAT
 typedef FloatNumber Obj;
 #endif
@@ -39,7 +46,10 @@ std::string format_time(uint64_t microseconds) {
     }
 }
 
-typedef SequentialSearcher<Obj, DistanceFunction<Obj>> mySeqSearcher;
+// Distance calls are counted for the benchmark output
+typedef EuclideanDistance<Obj, CountCalls> Metric;
+
+typedef SequentialSearcher<Obj, Metric> mySeqSearcher;
 
 // Get time stamp in microseconds.
 uint64_t micros()
@@ -50,6 +60,18 @@ uint64_t micros()
     return us;
 }
 
+// Dump the search stats as JSON, if a path was given
+void writeStatsJson(const SearchStatsSummary &stats, const std::string &jsonPath)
+{
+    if (jsonPath.empty())
+    {
+        return;
+    }
+    std::ofstream out(jsonPath);
+    stats.writeJson(out);
+    out << "\n";
+}
+
 #ifdef ANNOY
 void testAnnoy(std::vector<Obj> &dataObjects, std::vector<Obj> &queryObjects, int k, int f)
 {
@@ -96,38 +118,79 @@ void testAnnoy(std::vector<Obj> &dataObjects, std::vector<Obj> &queryObjects, in
 #endif
 
 #ifdef TREE
-void testMTree(std::vector<Obj> &dataObjects, std::vector<Obj> &queryObjects, int k, DistanceFunction<Obj> &distanceFunction, int nodeSize)
+void testMTree(std::vector<Obj> &dataObjects, std::vector<Obj> &queryObjects, int k, Metric &distanceFunction, int nodeSize, bool bulk, bool optimize, int pivots, int pivotBits, int threads, const std::string &loadPath, const std::string &savePath, const std::string &jsonPath, bool report)
 {
     // Create a tree which element is float and distance function is manhattanDistance
-    MTree<Obj> mtree(nodeSize, distanceFunction);
-    NNList<Obj> nnList(0);
+    MTree<Obj, Metric> mtree(nodeSize, distanceFunction);
+    NNList nnList;
 
-    int i = 0;
     auto start = std::chrono::high_resolution_clock::now();
-    for (const auto &element : dataObjects)
+    if (!loadPath.empty())
     {
-        mtree.insert(element);
-        i++;
+        mtree.load(loadPath);
+    }
+    else
+    {
+        // The pivots are chosen before building, the saved trees already carry theirs
+        if (pivots > 0)
+        {
+            mtree.usePivots(dataObjects, pivots, pivotBits);
+        }
+        if (bulk)
+        {
+            mtree.bulkLoad(dataObjects);
+        }
+        else
+        {
+            for (const auto &element : dataObjects)
+            {
+                mtree.insert(element);
+            }
+        }
     }
     auto end = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double> duration = (end - start);
-    std::cout << "Time taken to build tree: " << duration.count() << " s" << "\n\n";
+    std::cout << "Time taken to " << (loadPath.empty() ? "build" : "load") << " tree: " << duration.count() << " s" << "\n\n";
 
-    distanceFunction.resetCounter();
-    // Reset the distance function calls
-    auto startU = micros();
-    for (const auto &query : queryObjects)
+    if (optimize)
+    {
+        start = std::chrono::high_resolution_clock::now();
+        SlimDownResult slimDown = mtree.optimize(threads);
+        duration = std::chrono::high_resolution_clock::now() - start;
+        std::cout << "Time taken to optimize tree: " << duration.count() << " s (" << slimDown.entriesMoved << " entries moved, "
+                  << slimDown.leavesRemoved << " leaves removed, " << mtree.getTotalNodes() << " nodes left)" << "\n\n";
+    }
+
+    if (!savePath.empty())
+    {
+        mtree.save(savePath);
+    }
+
+    if (report)
     {
-        nnList = mtree.knn(query, k);
+        mtree.analyze().print(std::cout);
+        std::cout << "\n";
     }
+
+    DistanceCalls::reset();
+    // Reset the distance function calls
+    auto startU = micros();
+    KNNBatchResult batch = mtree.knnBatch(queryObjects, k, threads);
     auto endU = micros();
+    nnList = batch.results.back();
+    size_t nodesAccessed = static_cast<size_t>(batch.stats.percentiles(SearchStatsSummary::NODES_VISITED).mean);
 
     std::cout << "Number of elements: " << mtree.size() << ", Number of queries: " << queryObjects.size() << std::endl;
     std::cout << "Dimension: " << dataObjects[0].size() << ", k: " << k << "\n\n";
     std::cout << "Total Time: " << format_time(endU - startU) << std::endl;
     std::cout << "Average Time: " << format_time((endU - startU) / queryObjects.size()) << "\n";
-    std::cout << "Height: " << mtree.getHeight() << ", Nodes accessed: " << mtree.getNodesAccessed() << "/" << mtree.getTotalNodes() << "(= " << (double)mtree.getNodesAccessed() / mtree.getTotalNodes() * 100 << "%)" << "\n";
-    std::cout << "Distance function calls: " << distanceFunction.distanceFunctionCalls << "\n\n";
+    std::cout << "Threads: " << threads << "\n";
+    std::cout << "Height: " << mtree.getHeight() << ", Nodes accessed: " << nodesAccessed << "/" << mtree.getTotalNodes() << "(= " << (double)nodesAccessed / mtree.getTotalNodes() * 100 << "%)" << "\n";
+    std::cout << "Distance function calls: " << DistanceCalls::count << "\n";
+    std::cout << "Dimensions skipped: " << DistanceCalls::skippedDimensions << "/" << DistanceCalls::count * dataObjects[0].size() << "(= " << (double)DistanceCalls::skippedDimensions / (DistanceCalls::count * dataObjects[0].size()) * 100 << "%)" << "\n\n";
+    batch.stats.print(std::cout);
+    std::cout << "\n";
+    writeStatsJson(batch.stats, jsonPath);
     // Change fixed point to 4 places
     std::cout << std::fixed << std::setprecision(2);
 
@@ -137,29 +200,32 @@ void testMTree(std::vector<Obj> &dataObjects, std::vector<Obj> &queryObjects, in
 #endif
 
 #ifdef SEQUENTIAL
-void testSequentialSearcher(std::vector<Obj> &dataObjects, std::vector<Obj> &queryObjects, int k, DistanceFunction<Obj> &distanceFunction)
+void testSequentialSearcher(std::vector<Obj> &dataObjects, std::vector<Obj> &queryObjects, int k, Metric &distanceFunction, int threads, const std::string &jsonPath)
 {
-    NNList<Obj> nnList(0);
+    NNList nnList;
     // Create a sequential searcher with the distance function manhattanDistance
     mySeqSearcher seqSearcher(distanceFunction);
 
     seqSearcher.addAll(dataObjects);
 
     // Reset the distance function calls
-    distanceFunction.resetCounter();
+    DistanceCalls::reset();
 
     auto startU = micros();
     // Go through all the query objects
-    for (const auto &query : queryObjects)
-    {
-        nnList = seqSearcher.knn(query, k);
-    }
+    KNNBatchResult batch = seqSearcher.knnBatch(queryObjects, k, threads);
     auto endU = micros();
+    nnList = batch.results.back();
     std::cout << "Number of elements: " << seqSearcher.size() << ", Number of queries: " << queryObjects.size() << std::endl;
     std::cout << "Dimension: " << dataObjects[0].size() << ", k: " << k << "\n\n";
     std::cout << "Total Time: " << format_time(endU - startU) << std::endl;
     std::cout << "Average Time: " << format_time((endU - startU) / queryObjects.size()) << "\n";
-    std::cout << "Distance function calls: " << distanceFunction.distanceFunctionCalls << "\n\n";
+    std::cout << "Threads: " << threads << "\n";
+    std::cout << "Distance function calls: " << DistanceCalls::count << "\n";
+    std::cout << "Dimensions skipped: " << DistanceCalls::skippedDimensions << "/" << DistanceCalls::count * dataObjects[0].size() << "(= " << (double)DistanceCalls::skippedDimensions / (DistanceCalls::count * dataObjects[0].size()) * 100 << "%)" << "\n\n";
+    batch.stats.print(std::cout);
+    std::cout << "\n";
+    writeStatsJson(batch.stats, jsonPath);
     // Change fixed point to 4 places
     std::cout << std::fixed << std::setprecision(2);
 
@@ -176,6 +242,19 @@ int main(int argc, char *argv[])
     double maxf = 100.;
     int nodeSize = 64;
     int dimension = 10;
+#ifdef TREE
+    bool bulk = false;
+    bool optimize = false;
+    int pivots = 0;
+    int pivotBits = 8;
+#endif
+    int threads = 1;
+    std::string jsonPath;
+#ifdef TREE
+    std::string loadPath;
+    std::string savePath;
+    bool report = false;
+#endif
 
     for (int i = 1; i < argc; i += 2)
     {
@@ -207,9 +286,49 @@ int main(int argc, char *argv[])
         {
             maxf = std::stod(argv[i + 1]);
         }
+#ifdef TREE
+        else if (std::string(argv[i]) == "-bulk")
+        {
+            bulk = std::stoi(argv[i + 1]) != 0;
+        }
+        else if (std::string(argv[i]) == "-optimize")
+        {
+            optimize = std::stoi(argv[i + 1]) != 0;
+        }
+        else if (std::string(argv[i]) == "-pivots")
+        {
+            pivots = std::stoi(argv[i + 1]);
+        }
+        else if (std::string(argv[i]) == "-pivotBits")
+        {
+            pivotBits = std::stoi(argv[i + 1]);
+        }
+#endif
+        else if (std::string(argv[i]) == "-threads")
+        {
+            threads = std::stoi(argv[i + 1]);
+        }
+#ifdef TREE
+        else if (std::string(argv[i]) == "-load")
+        {
+            loadPath = argv[i + 1];
+        }
+        else if (std::string(argv[i]) == "-save")
+        {
+            savePath = argv[i + 1];
+        }
+        else if (std::string(argv[i]) == "-report")
+        {
+            report = std::stoi(argv[i + 1]) != 0;
+        }
+#endif
+        else if (std::string(argv[i]) == "-json")
+        {
+            jsonPath = argv[i + 1];
+        }
         else if (std::string(argv[i]) == "-h")
         {
-            std::cout << "Usage: " << argv[0] << " [-s seed] [-k k] [-N N] [-nodeSize nodeSize] [-querySize querySize] [-dimension dimension] [-maxf maxf]" << std::endl;
+            std::cout << "Usage: " << argv[0] << " [-s seed] [-k k] [-N N] [-nodeSize nodeSize] [-querySize querySize] [-dimension dimension] [-maxf maxf] [-bulk 0|1] [-optimize 0|1] [-pivots P] [-pivotBits 8|16] [-threads threads] [-load tree.mtree] [-save tree.mtree] [-json stats.json] [-report 0|1]" << std::endl;
             return 0;
         }
     }
@@ -231,18 +350,20 @@ int main(int argc, char *argv[])
 #endif
 
 #ifdef NPY
-    std::vector<Obj> dataObjects = loadData(N, "UNIT_100000_128d.npy");
-    std::vector<Obj> queryObjects = loadData(querySize, "UNIT_100_128d.npy");
+    FeatureMatrix<float> dataMatrix = FeatureMatrix<float>::fromNpy("UNIT_100000_128d.npy", N);
+    FeatureMatrix<float> queryMatrix = FeatureMatrix<float>::fromNpy("UNIT_100_128d.npy", querySize);
+    std::vector<Obj> dataObjects = dataMatrix.views();
+    std::vector<Obj> queryObjects = queryMatrix.views();
 #endif
 
-    EuclideanDistance<Obj> euclideanDistance;
+    Metric euclideanDistance;
 
 #ifdef SEQUENTIAL
-    testSequentialSearcher(dataObjects, queryObjects, k, euclideanDistance);
+    testSequentialSearcher(dataObjects, queryObjects, k, euclideanDistance, threads, jsonPath);
 #endif
 
 #ifdef TREE
-    testMTree(dataObjects, queryObjects, k, euclideanDistance, nodeSize);
+    testMTree(dataObjects, queryObjects, k, euclideanDistance, nodeSize, bulk, optimize, pivots, pivotBits, threads, loadPath, savePath, jsonPath, report);
 #endif
 
 #ifdef ANNOY
@@ -0,0 +1,106 @@
+#ifndef FEATURE_VIEW_HPP
+#define FEATURE_VIEW_HPP
+
+#include <cstddef>  // For std::size_t
+#include <cstdint>  // For uint32_t
+#include <iostream> // For std::ostream
+
+/**
+ * @brief A row of a FeatureMatrix (or any other contiguous array of values), seen as a feature.
+ *
+ * The view does not own its values, it is a pointer, a size and an id, so it is cheap to
+ * copy and the searchers can index views instead of Features. The values must outlive the
+ * view (and every searcher that holds it).
+ *
+ * @tparam NumT Type of the values of the feature.
+ */
+template <typename NumT>
+class FeatureView {
+public:
+    /**
+     * @brief Default constructor that initializes an empty view.
+     */
+    FeatureView() : id(0), values(nullptr), dimension(0) {}
+
+    /**
+     * @brief Constructor that initializes a view over an array of values.
+     * @param id Identifier of the feature.
+     * @param values The first value of the feature.
+     * @param dimension Number of values of the feature.
+     */
+    FeatureView(uint32_t id, const NumT* values, size_t dimension) : id(id), values(values), dimension(dimension) {}
+
+    /**
+     * @brief Returns the number of values of the feature.
+     * @return The number of values.
+     */
+    size_t size() const {
+        return dimension;
+    }
+
+    /**
+     * @brief Overload of the [] operator to access the values of the feature.
+     * @param index Index of the value to be accessed.
+     * @return The value at the specified index.
+     */
+    const NumT& operator[](size_t index) const {
+        return values[index];
+    }
+
+    /**
+     * @brief Returns the values of the feature, contiguous in memory.
+     * @return Pointer to the first value.
+     */
+    const NumT* data() const {
+        return values;
+    }
+
+    /**
+     * @brief Returns a pointer to the first value, for range-based for loops.
+     */
+    const NumT* begin() const {
+        return values;
+    }
+
+    /**
+     * @brief Returns a pointer past the last value, for range-based for loops.
+     */
+    const NumT* end() const {
+        return values + dimension;
+    }
+
+    /**
+     * @brief Returns the identifier of the feature.
+     * @return The identifier of the feature.
+     */
+    uint32_t getId() const {
+        return id;
+    }
+
+    /**
+     * @brief Overload of the equality operator to compare views by their ID.
+     * @param other View to be compared.
+     * @return True if the views have the same ID, false otherwise.
+     */
+    bool operator==(const FeatureView& other) const {
+        return id == other.id;
+    }
+
+    /**
+     * @brief Overload of the output operator to format the output as id:<idval>, as Feature does.
+     * @param os Output stream.
+     * @param f View to be printed.
+     * @return Output stream.
+     */
+    friend std::ostream& operator<<(std::ostream& os, const FeatureView& f) {
+        os << "id:" << f.id;
+        return os;
+    }
+
+    uint32_t id;          ///< Identifier (the row of the matrix for views made by FeatureMatrix)
+private:
+    const NumT* values;   ///< The values, owned by someone else
+    size_t dimension;     ///< Number of values
+};
+
+#endif // FEATURE_VIEW_HPP
@@ -0,0 +1,153 @@
+#include "MTreeConcurrent.hpp"
+#include "indexing/DistanceFunction.hpp"
+#include "objectTypes/Feature.hpp"
+#include "data/randomUnitVectors.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Stress test of the ConcurrentMTree: inserter threads insert a dataset while query threads
+ * search the tree at the same time.
+ *
+ * Compile with g++ -std=c++17 -O3 -pthread stressConcurrentMTree.cpp -o stressConcurrentMTree
+ * (add -fsanitize=thread to look for data races, and run with TSAN_OPTIONS=detect_deadlocks=0:
+ * latches are always taken from the root down, but a reused node takes its latch to another
+ * place of the tree, which the lock order checker reports).
+ *
+ * A prefix of the dataset is inserted first. Then each inserter thread inserts its share of
+ * the rest, and marks each object once its insert returned. The query threads pick marked
+ * objects at random and search for the objects at distance 0, which must include the object
+ * itself (the dataset may hold duplicates): an object whose insert returned must be reachable
+ * by every later search. Once the threads stop, the structure of the tree is checked, which
+ * finds every object in a leaf, and a sample of the objects is searched for again. The
+ * program returns 1 if any check failed.
+ */
+
+typedef Feature<float> Obj;
+typedef EuclideanDistance<Obj> Metric;
+
+void usage(const char* program) {
+    std::cout << "Usage: " << program << " [options]\n"
+              << "  -N n            number of objects (100000)\n"
+              << "  -dimension n    dimension of the objects (16)\n"
+              << "  -prefill n      objects inserted before the threads start (1000)\n"
+              << "  -inserters n    inserter threads (4)\n"
+              << "  -readers n      query threads (4)\n"
+              << "  -checks n       objects searched for again once the threads stop (10000)\n"
+              << "  -nodeSize n     node capacity of the tree (32)\n"
+              << "  -s seed         seed of the generators (42)\n";
+}
+
+int main(int argc, char* argv[]) {
+    std::map<std::string, std::string> args = {
+        {"-N", "100000"}, {"-dimension", "16"}, {"-prefill", "1000"}, {"-inserters", "4"},
+        {"-readers", "4"}, {"-checks", "10000"}, {"-nodeSize", "32"}, {"-s", "42"}};
+
+    for (int i = 1; i < argc; i += 2) {
+        std::string name = argv[i];
+        if (name == "-h" || args.find(name) == args.end() || i + 1 >= argc) {
+            usage(argv[0]);
+            return name == "-h" ? 0 : 1;
+        }
+        args[name] = argv[i + 1];
+    }
+
+    const size_t N = std::stoul(args["-N"]);
+    const size_t prefill = std::min(N, static_cast<size_t>(std::stoul(args["-prefill"])));
+    const size_t inserters = std::max<size_t>(1, std::stoul(args["-inserters"]));
+    const size_t readers = std::stoul(args["-readers"]);
+    const size_t checks = std::min(N, static_cast<size_t>(std::stoul(args["-checks"])));
+    const int seed = std::stoi(args["-s"]);
+
+    std::vector<Obj> data = generateUnitVectors<Obj, float>(N, std::stoul(args["-dimension"]), seed);
+    ConcurrentMTree<Obj, Metric> tree(std::stoul(args["-nodeSize"]));
+
+    // ids[i] is the id of data[i] in the tree, valid once inserted[i] is set
+    std::vector<ObjectId> ids(N);
+    std::unique_ptr<std::atomic<bool>[]> inserted(new std::atomic<bool>[N]);
+    for (size_t i = 0; i < N; i++) {
+        inserted[i].store(i < prefill);
+        if (i < prefill) {
+            ids[i] = tree.insert(data[i]);
+        }
+    }
+
+    // Whether data[i] is among the objects at distance 0 from itself
+    auto reachable = [&](size_t i, SearchContext<Obj> &context) {
+        NNList matches = tree.knn(data[i], NNList::UNBOUNDED, 0.0f, context);
+        for (const NNEntry &entry : matches) {
+            if (entry.id == ids[i]) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    std::atomic<size_t> insertersLeft(inserters);
+    std::atomic<size_t> queries(0);
+    std::atomic<size_t> failures(0);
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (size_t w = 0; w < inserters; w++) {
+        threads.emplace_back([&, w]() {
+            for (size_t i = prefill + w; i < N; i += inserters) {
+                ids[i] = tree.insert(data[i]);
+                inserted[i].store(true, std::memory_order_release);
+            }
+            insertersLeft--;
+        });
+    }
+    for (size_t r = 0; r < readers; r++) {
+        threads.emplace_back([&, r]() {
+            std::mt19937 gen(seed + 1 + r);
+            std::uniform_int_distribution<size_t> pick(0, N - 1);
+            SearchContext<Obj> context;
+            while (insertersLeft.load() > 0) {
+                size_t i = pick(gen);
+                if (!inserted[i].load(std::memory_order_acquire)) {
+                    continue;
+                }
+                if (!reachable(i, context)) {
+                    failures++;
+                }
+                queries++;
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // verify finds every object in a leaf; a sample checks that the searches reach them
+    size_t violations = tree.verify();
+    size_t missing = 0;
+    SearchContext<Obj> context;
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<size_t> pick(0, N - 1);
+    for (size_t c = 0; c < checks; c++) {
+        if (!reachable(checks == N ? c : pick(gen), context)) {
+            missing++;
+        }
+    }
+
+    ConcurrentInsertStats stats = tree.getInsertStats();
+    std::cout << "inserted " << tree.size() << " objects (" << N - prefill << " by " << inserters << " threads) in " << seconds << " s, "
+              << (N - prefill) / seconds << " inserts/s\n"
+              << "ran " << queries << " queries with " << readers << " threads, " << queries / seconds << " queries/s\n"
+              << "height " << tree.getHeight() << ", nodes " << tree.getTotalNodes() << ", splits " << stats.splits
+              << ", restarts " << stats.restarts << ", pessimistic inserts " << stats.pessimisticInserts
+              << ", retired nodes " << stats.retiredNodes << " (" << stats.pendingNodes << " not reused yet)\n"
+              << "failed queries " << failures << ", objects not found afterwards " << missing << "/" << checks << ", structure violations " << violations << std::endl;
+
+    return failures == 0 && missing == 0 && violations == 0 && tree.size() == N ? 0 : 1;
+}
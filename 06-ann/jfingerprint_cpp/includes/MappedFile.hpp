@@ -0,0 +1,102 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <string>
+#include <cstddef>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <fstream>
+#include <cstdlib>
+#else
+#include <fcntl.h>    // For open
+#include <unistd.h>   // For close
+#include <sys/mman.h> // For mmap, munmap
+#include <sys/stat.h> // For fstat
+#endif
+
+/**
+ * @brief A whole file mapped into memory.
+ *
+ * The mapping is private and copy-on-write: pages are read from the page cache, so
+ * processes that map the same file share the physical memory of every page they do
+ * not write to. Written pages are copied for this process and never reach the file.
+ *
+ * Without mmap (Windows) the file is read into an aligned buffer instead.
+ */
+class MappedFile
+{
+public:
+    /**
+     * @brief Maps a file.
+     *
+     * @param path The path of the file.
+     * @throws std::runtime_error if the file cannot be opened or mapped.
+     */
+    explicit MappedFile(const std::string &path) : data(nullptr), bytes(0)
+    {
+#ifdef _WIN32
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file)
+        {
+            throw std::runtime_error("Cannot open " + path);
+        }
+        bytes = static_cast<size_t>(file.tellg());
+        data = static_cast<unsigned char *>(_aligned_malloc(bytes == 0 ? 1 : bytes, 4096));
+        file.seekg(0);
+        if (!data || !file.read(reinterpret_cast<char *>(data), bytes))
+        {
+            _aligned_free(data);
+            throw std::runtime_error("Cannot read " + path);
+        }
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Cannot open " + path);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size == 0)
+        {
+            ::close(fd);
+            throw std::runtime_error("Cannot map " + path);
+        }
+        bytes = static_cast<size_t>(st.st_size);
+        void *mapped = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        ::close(fd); // The mapping keeps its own reference to the file
+        if (mapped == MAP_FAILED)
+        {
+            throw std::runtime_error("Cannot map " + path);
+        }
+        data = static_cast<unsigned char *>(mapped);
+#endif
+    }
+
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        _aligned_free(data);
+#else
+        ::munmap(data, bytes);
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    /**
+     * @brief Gets the first byte of the file (aligned to the OS page size).
+     */
+    unsigned char *getData() const { return data; }
+
+    /**
+     * @brief Gets the size of the file in bytes.
+     */
+    size_t size() const { return bytes; }
+
+private:
+    unsigned char *data; ///< The mapped memory
+    size_t bytes;        ///< The size of the file
+};
+
+#endif // MAPPED_FILE_HPP
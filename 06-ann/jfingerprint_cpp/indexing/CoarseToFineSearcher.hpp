@@ -0,0 +1,281 @@
+#ifndef COARSE_TO_FINE_SEARCHER_HPP
+#define COARSE_TO_FINE_SEARCHER_HPP
+
+#include <vector>
+#include <cstdint>       // For uint32_t
+#include <algorithm>     // For std::nth_element, std::sort, std::min
+#include <utility>       // For std::pair
+#include <chrono>        // For std::chrono::steady_clock
+#include <unordered_set> // For std::unordered_set
+#include "NNList.hpp"
+#include "ShiftSequentialSearcher.hpp"
+
+/**
+ * @brief Recall of a CoarseToFineSearcher against the exhaustive search, over a set of queries.
+ */
+struct ShortlistRecall
+{
+    double neighbors = 0.0;        ///< Fraction of the exhaustive k nearest neighbors also found through the shortlist
+    double individuals = 0.0;      ///< Fraction of the exhaustive k nearest neighbors whose individual was shortlisted
+    double exhaustiveSeconds = 0.0; ///< Time taken by the exhaustive searches
+    double shortlistSeconds = 0.0;  ///< Time taken by the shortlist searches, both stages
+};
+
+/**
+ * @brief A two-stage k-nearest neighbors search: shortlists the individuals likely to hold
+ * the neighbors of the query, and searches the objects of those individuals only.
+ *
+ * The question asked of the gallery is which individual the query comes from, so the first
+ * stage ranks the individuals of a ShiftSequentialSearcher and keeps the shortlistSize first.
+ * The mean of an individual cannot rank it alone: the query shifted for an individual is
+ * mean + query * std, so its distance to the mean is ||query * std|| for the Euclidean
+ * distance, whatever the mean and the objects. The individuals are instead ranked by an
+ * estimate of the distance to their closest object, from a summary of their objects: a few
+ * representative objects, and for the Euclidean distance the moments of the normalized
+ * objects (see ShiftSequentialSearcher::summarize and estimateDistances). The second stage
+ * is the search of the ShiftSequentialSearcher restricted to the objects of the shortlisted
+ * individuals (see ShiftSequentialSearcher::knnWithin).
+ *
+ * The first stage reads one summary per individual, about representatives + 4 distances
+ * (the moments are two dot products of length 2d), and the second one the objects of
+ * shortlistSize individuals, instead of the size() objects of the exhaustive search. The result
+ * is approximate: a neighbor whose individual is not shortlisted is missed. recall()
+ * measures how much is lost against the exhaustive search, to choose shortlistSize and
+ * the number of representatives.
+ *
+ * A query set, as the features of one fingerprint, can share one shortlist: the individuals
+ * are then ranked by the sum of their estimates for all the queries.
+ *
+ * The searcher reads the ShiftSequentialSearcher, which must outlive it; the ids of the
+ * neighbors are those of the ShiftSequentialSearcher. Objects added to it afterwards drop
+ * the summaries, which summarize must rebuild.
+ *
+ * @tparam T The type of the objects, a Feature with a representative.
+ * @tparam DistanceFunc The type of the distance function.
+ */
+template <typename T, typename DistanceFunc>
+class CoarseToFineSearcher
+{
+public:
+    /**
+     * @brief Constructs a CoarseToFineSearcher over the objects of a ShiftSequentialSearcher.
+     *
+     * Summarizes the individuals of fine (see ShiftSequentialSearcher::summarize), whose
+     * objects must all be added.
+     *
+     * @param fine The searcher holding the objects, searched in the second stage.
+     * @param shortlistSize The number of individuals kept by the first stage.
+     * @param representatives The number of objects per individual the first stage compares with the query.
+     */
+    CoarseToFineSearcher(ShiftSequentialSearcher<T, DistanceFunc> &fine, size_t shortlistSize, size_t representatives = 1)
+        : fine(fine), shortlistSize(shortlistSize)
+    {
+        fine.summarize(representatives);
+    }
+
+    /**
+     * @brief Sets the number of individuals kept by the first stage.
+     */
+    void setShortlistSize(size_t size)
+    {
+        shortlistSize = size;
+    }
+
+    /**
+     * @brief Gets the number of individuals kept by the first stage.
+     */
+    size_t getShortlistSize() const
+    {
+        return shortlistSize;
+    }
+
+    /**
+     * @brief Shortlists the individuals whose estimated distance to the query is the smallest.
+     *
+     * @param query The query object.
+     * @return The positions of up to shortlistSize individuals (see
+     *         ShiftSequentialSearcher::getIndividual), the closest first.
+     */
+    std::vector<uint32_t> shortlist(const T &query) const
+    {
+        std::vector<float> distances;
+        fine.estimateDistances(query, distances);
+        return closest(distances);
+    }
+
+    /**
+     * @brief Shortlists the individuals closest to a query set, by the sum of their estimated distances to the queries.
+     *
+     * @param queries The query set.
+     * @return The positions of up to shortlistSize individuals, the closest first.
+     */
+    std::vector<uint32_t> shortlist(const std::vector<T> &queries) const
+    {
+        std::vector<float> sums(fine.numIndividuals(), 0.0f);
+        std::vector<float> distances;
+        for (const T &query : queries)
+        {
+            fine.estimateDistances(query, distances);
+            for (size_t g = 0; g < sums.size(); g++)
+            {
+                sums[g] += distances[g];
+            }
+        }
+        return closest(sums);
+    }
+
+    /**
+     * @brief Performs k-nearest neighbors search among the objects of the individuals shortlisted for the query.
+     *
+     * @param query The query object.
+     * @param k The number of nearest neighbors to find.
+     * @return NNList The ids of the k-nearest neighbors (see getObject), sorted by distance.
+     */
+    NNList knn(const T &query, size_t k) const
+    {
+        return fine.knnWithin(query, k, shortlist(query));
+    }
+
+    /**
+     * @brief Performs k-nearest neighbors search for each query of a set, among the objects of
+     * the individuals shortlisted for the whole set.
+     *
+     * @param queries The query set.
+     * @param k The number of nearest neighbors to find per query.
+     * @return One NNList per query, in the order of the queries.
+     */
+    std::vector<NNList> knnSet(const std::vector<T> &queries, size_t k) const
+    {
+        const std::vector<uint32_t> individuals = shortlist(queries);
+        std::vector<NNList> results;
+        results.reserve(queries.size());
+        for (const T &query : queries)
+        {
+            results.push_back(fine.knnWithin(query, k, individuals));
+        }
+        return results;
+    }
+
+    /**
+     * @brief Measures what the shortlist loses against the exhaustive ShiftSequentialSearcher::knn.
+     *
+     * Each query is searched both ways, and the times of the two searches are reported too.
+     *
+     * @param queries The queries.
+     * @param k The number of nearest neighbors to find per query.
+     * @param shared Whether the queries share one shortlist, as in knnSet, or get one each, as in knn.
+     * @return The recall, over all the exhaustive neighbors of all the queries.
+     */
+    ShortlistRecall recall(const std::vector<T> &queries, size_t k, bool shared = false) const
+    {
+        typedef std::chrono::steady_clock Clock;
+        ShortlistRecall result;
+
+        Clock::time_point start = Clock::now();
+        std::vector<NNList> exact;
+        exact.reserve(queries.size());
+        for (const T &query : queries)
+        {
+            exact.push_back(fine.knn(query, k));
+        }
+        result.exhaustiveSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        start = Clock::now();
+        std::vector<NNList> approximate;
+        std::vector<std::vector<uint32_t>> shortlists;
+        if (shared)
+        {
+            shortlists.push_back(shortlist(queries));
+            for (const T &query : queries)
+            {
+                approximate.push_back(fine.knnWithin(query, k, shortlists[0]));
+            }
+        }
+        else
+        {
+            for (const T &query : queries)
+            {
+                shortlists.push_back(shortlist(query));
+                approximate.push_back(fine.knnWithin(query, k, shortlists.back()));
+            }
+        }
+        result.shortlistSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        size_t total = 0;
+        size_t foundNeighbors = 0;
+        size_t foundIndividuals = 0;
+        for (size_t q = 0; q < queries.size(); q++)
+        {
+            std::unordered_set<uint32_t> ids;
+            for (const NNEntry &entry : approximate[q])
+            {
+                ids.insert(entry.id);
+            }
+            std::unordered_set<const void *> individuals;
+            for (uint32_t g : shortlists[shared ? 0 : q])
+            {
+                individuals.insert(fine.getIndividual(g));
+            }
+            for (const NNEntry &entry : exact[q])
+            {
+                total++;
+                foundNeighbors += ids.count(entry.id);
+                foundIndividuals += individuals.count(fine.getObject(entry.id).representative);
+            }
+        }
+        if (total > 0)
+        {
+            result.neighbors = static_cast<double>(foundNeighbors) / total;
+            result.individuals = static_cast<double>(foundIndividuals) / total;
+        }
+        return result;
+    }
+
+    /**
+     * @brief Gets an object by its id, as in the NNList returned by knn.
+     */
+    const T &getObject(uint32_t id) const
+    {
+        return fine.getObject(id);
+    }
+
+    /**
+     * @brief Returns the number of objects in the search structure.
+     */
+    size_t size() const
+    {
+        return fine.size();
+    }
+
+private:
+    /**
+     * @brief Gets the positions of the shortlistSize smallest scores, the smallest first.
+     */
+    std::vector<uint32_t> closest(const std::vector<float> &scores) const
+    {
+        const size_t count = std::min(shortlistSize, scores.size());
+        std::vector<std::pair<float, uint32_t>> order(scores.size());
+        for (size_t g = 0; g < scores.size(); g++)
+        {
+            order[g] = std::make_pair(scores[g], static_cast<uint32_t>(g));
+        }
+        std::vector<uint32_t> individuals;
+        if (count == 0)
+        {
+            return individuals;
+        }
+        std::nth_element(order.begin(), order.begin() + (count - 1), order.end());
+        std::sort(order.begin(), order.begin() + count);
+        individuals.reserve(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            individuals.push_back(order[i].second);
+        }
+        return individuals;
+    }
+
+    const ShiftSequentialSearcher<T, DistanceFunc> &fine; ///< The searcher holding the objects
+    size_t shortlistSize;                                 ///< Number of individuals kept by the first stage
+};
+
+#endif // COARSE_TO_FINE_SEARCHER_HPP
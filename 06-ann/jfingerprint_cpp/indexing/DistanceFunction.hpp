@@ -4,8 +4,214 @@
 #include <iostream> // For std::cerr
 #include <vector> // For std::vector
 #include <cmath> // For std::sqrt, std::abs
-#include <numeric> // For std::inner_product
+#include <limits> // For std::numeric_limits
+#include <algorithm> // For std::min, std::max
 #include <stdexcept> // For std::invalid_argument
+#include "SimdKernels.hpp"
+#include "../objectTypes/Feature.hpp"
+#include "../objectTypes/FeatureView.hpp"
+
+/*
+ * The sums behind the metrics. The templates work on any type with size() and operator[];
+ * the Feature<float> and FeatureView<float> overloads are picked instead for float features
+ * and run the SIMD kernels chosen for this CPU (see SimdKernels.hpp).
+ */
+namespace distance_sums {
+
+template <typename T>
+float l2Squared(const T& a, const T& b) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < a.size(); ++i) {
+        float diff = a[i] - b[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+template <typename T>
+float l1(const T& a, const T& b) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < a.size(); ++i) {
+        sum += std::abs(a[i] - b[i]);
+    }
+    return sum;
+}
+
+template <typename T>
+float lInf(const T& a, const T& b) {
+    float maxDiff = 0.0f;
+    for (size_t i = 0; i < a.size(); ++i) {
+        float diff = std::abs(a[i] - b[i]);
+        if (diff > maxDiff) {
+            maxDiff = diff;
+        }
+    }
+    return maxDiff;
+}
+
+template <typename T>
+float dot(const T& a, const T& b) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < a.size(); ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+template <typename T>
+void cosineTerms(const T& a, const T& b, float& ab, float& aa, float& bb) {
+    ab = aa = bb = 0.0f;
+    for (size_t i = 0; i < a.size(); ++i) {
+        ab += a[i] * b[i];
+        aa += a[i] * a[i];
+        bb += b[i] * b[i];
+    }
+}
+
+inline float l2Squared(const Feature<float>& a, const Feature<float>& b) {
+    return simdKernels().l2Squared(a.values.data(), b.values.data(), a.size());
+}
+
+inline float l1(const Feature<float>& a, const Feature<float>& b) {
+    return simdKernels().l1(a.values.data(), b.values.data(), a.size());
+}
+
+inline float lInf(const Feature<float>& a, const Feature<float>& b) {
+    return simdKernels().lInf(a.values.data(), b.values.data(), a.size());
+}
+
+inline float dot(const Feature<float>& a, const Feature<float>& b) {
+    return simdKernels().dot(a.values.data(), b.values.data(), a.size());
+}
+
+inline void cosineTerms(const Feature<float>& a, const Feature<float>& b, float& ab, float& aa, float& bb) {
+    simdKernels().cosineTerms(a.values.data(), b.values.data(), a.size(), &ab, &aa, &bb);
+}
+
+inline float l2Squared(const FeatureView<float>& a, const FeatureView<float>& b) {
+    return simdKernels().l2Squared(a.data(), b.data(), a.size());
+}
+
+inline float l1(const FeatureView<float>& a, const FeatureView<float>& b) {
+    return simdKernels().l1(a.data(), b.data(), a.size());
+}
+
+inline float lInf(const FeatureView<float>& a, const FeatureView<float>& b) {
+    return simdKernels().lInf(a.data(), b.data(), a.size());
+}
+
+inline float dot(const FeatureView<float>& a, const FeatureView<float>& b) {
+    return simdKernels().dot(a.data(), b.data(), a.size());
+}
+
+inline void cosineTerms(const FeatureView<float>& a, const FeatureView<float>& b, float& ab, float& aa, float& bb) {
+    simdKernels().cosineTerms(a.data(), b.data(), a.size(), &ab, &aa, &bb);
+}
+
+/*
+ * Bounded sums, used by distanceUpTo. The sum is checked against the bound after
+ * UPTO_FIRST_CHECK dimensions, then after twice as many, and so on (see SimdKernels.hpp), and
+ * the remaining dimensions are not read once it is exceeded. evaluated is set to the number
+ * of dimensions read.
+ */
+
+template <typename Block, typename Combine>
+float accumulateUpTo(size_t n, float bound, size_t& evaluated, Block block, Combine combine) {
+    float sum = 0.0f;
+    size_t i = 0;
+    for (size_t check = UPTO_FIRST_CHECK; check < n; check *= 2) {
+        sum = combine(sum, block(i, check));
+        i = check;
+        if (sum > bound) {
+            evaluated = i;
+            return sum;
+        }
+    }
+    evaluated = n;
+    return combine(sum, block(i, n));
+}
+
+inline float addBlock(float sum, float block) { return sum + block; }
+inline float maxBlock(float sum, float block) { return std::max(sum, block); }
+
+template <typename T>
+float l2SquaredUpTo(const T& a, const T& b, float bound, size_t& evaluated) {
+    return accumulateUpTo(a.size(), bound, evaluated, [&](size_t begin, size_t end) {
+        float sum = 0.0f;
+        for (size_t i = begin; i < end; ++i) {
+            float diff = a[i] - b[i];
+            sum += diff * diff;
+        }
+        return sum;
+    }, addBlock);
+}
+
+template <typename T>
+float l1UpTo(const T& a, const T& b, float bound, size_t& evaluated) {
+    return accumulateUpTo(a.size(), bound, evaluated, [&](size_t begin, size_t end) {
+        float sum = 0.0f;
+        for (size_t i = begin; i < end; ++i) {
+            sum += std::abs(a[i] - b[i]);
+        }
+        return sum;
+    }, addBlock);
+}
+
+template <typename T>
+float lInfUpTo(const T& a, const T& b, float bound, size_t& evaluated) {
+    return accumulateUpTo(a.size(), bound, evaluated, [&](size_t begin, size_t end) {
+        float maxDiff = 0.0f;
+        for (size_t i = begin; i < end; ++i) {
+            maxDiff = std::max(maxDiff, std::abs(a[i] - b[i]));
+        }
+        return maxDiff;
+    }, maxBlock);
+}
+
+/*
+ * Weighted squared L2, sum w_i (a_i - b_i)^2, with the weights in a third vector.
+ */
+template <typename T>
+float weightedL2SquaredUpTo(const T& w, const T& a, const T& b, float bound, size_t& evaluated) {
+    return accumulateUpTo(a.size(), bound, evaluated, [&](size_t begin, size_t end) {
+        float sum = 0.0f;
+        for (size_t i = begin; i < end; ++i) {
+            float diff = a[i] - b[i];
+            sum += w[i] * diff * diff;
+        }
+        return sum;
+    }, addBlock);
+}
+
+inline float l2SquaredUpTo(const Feature<float>& a, const Feature<float>& b, float bound, size_t& evaluated) {
+    return simdKernels().l2SquaredUpTo(a.values.data(), b.values.data(), a.size(), bound, &evaluated);
+}
+
+inline float l1UpTo(const Feature<float>& a, const Feature<float>& b, float bound, size_t& evaluated) {
+    return simdKernels().l1UpTo(a.values.data(), b.values.data(), a.size(), bound, &evaluated);
+}
+
+inline float lInfUpTo(const Feature<float>& a, const Feature<float>& b, float bound, size_t& evaluated) {
+    return simdKernels().lInfUpTo(a.values.data(), b.values.data(), a.size(), bound, &evaluated);
+}
+
+inline float l2SquaredUpTo(const FeatureView<float>& a, const FeatureView<float>& b, float bound, size_t& evaluated) {
+    return simdKernels().l2SquaredUpTo(a.data(), b.data(), a.size(), bound, &evaluated);
+}
+
+inline float l1UpTo(const FeatureView<float>& a, const FeatureView<float>& b, float bound, size_t& evaluated) {
+    return simdKernels().l1UpTo(a.data(), b.data(), a.size(), bound, &evaluated);
+}
+
+inline float lInfUpTo(const FeatureView<float>& a, const FeatureView<float>& b, float bound, size_t& evaluated) {
+    return simdKernels().lInfUpTo(a.data(), b.data(), a.size(), bound, &evaluated);
+}
+
+inline float weightedL2SquaredUpTo(const FeatureView<float>& w, const FeatureView<float>& a, const FeatureView<float>& b, float bound, size_t& evaluated) {
+    return simdKernels().weightedL2SquaredUpTo(w.data(), a.data(), b.data(), a.size(), bound, &evaluated);
+}
+
+} // namespace distance_sums
 
 /**
  * @brief Base class for distance functions.
@@ -16,6 +222,7 @@ template <typename T>
 class DistanceFunction {
 public:
     static unsigned long int distanceFunctionCalls;
+    static unsigned long long skippedDimensions; ///< Dimensions not read by distanceUpTo
 
     /**
      * @brief Computes the distance between two vectors.
@@ -28,10 +235,28 @@ public:
     virtual float operator()(const T& a, const T& b) const = 0;
 
     /**
-     * @brief Resets the distance function call counter.
+     * @brief Computes the distance between two vectors, stopping early once it exceeds a bound.
+     *
+     * The k-NN searches call it with the current k-th distance, since only whether the
+     * distance exceeds it matters past that point. By default the whole distance is computed.
+     *
+     * @param a The first vector.
+     * @param b The second vector.
+     * @param bound The bound.
+     * @return The distance if it is less than or equal to bound, otherwise a value greater than bound.
+     * @throws std::invalid_argument if the vectors are not of the same size.
+     */
+    virtual float distanceUpTo(const T& a, const T& b, float bound) const {
+        (void)bound;
+        return (*this)(a, b);
+    }
+
+    /**
+     * @brief Resets the distance function call counter and the skipped dimensions.
      */
     static void resetCounter() {
         distanceFunctionCalls = 0;
+        skippedDimensions = 0;
     }
 };
 
@@ -44,6 +269,36 @@ public:
 template <typename T>
 unsigned long int DistanceFunction<T>::distanceFunctionCalls = 0;
 
+template <typename T>
+unsigned long long DistanceFunction<T>::skippedDimensions = 0;
+
+/**
+ * @brief The same metric over another type of elements.
+ *
+ * A searcher given, say, EuclideanDistance<Feature<float>> can compute its distances over
+ * FeatureViews of contiguous rows with RebindDistance<EuclideanDistance<Feature<float>>,
+ * FeatureView<float>>::type, which runs the same kernels. The calls are then counted in
+ * DistanceFunction<U>.
+ *
+ * rebind() builds the new metric from an instance of the old one. The metrics of this file
+ * have no state, so it default-constructs it; a metric with parameters specializes
+ * RebindDistance to carry them over.
+ *
+ * @tparam DistanceFunc A metric, a class template instantiated on the type of its elements.
+ * @tparam U The new type of the elements.
+ */
+template <typename DistanceFunc, typename U>
+struct RebindDistance;
+
+template <template <typename> class Metric, typename T, typename U>
+struct RebindDistance<Metric<T>, U> {
+    typedef Metric<U> type;
+
+    static type rebind(const Metric<T>&) {
+        return type();
+    }
+};
+
 /**
  * @brief Class for computing Euclidean distance.
  * 
@@ -63,10 +318,26 @@ public:
             throw std::invalid_argument("Vectors must be of the same size");
         }
 
-        float sum = 0.0f;
-        for (size_t i = 0; i < a.size(); ++i) {
-            float diff = a[i] - b[i];
-            sum += diff * diff;
+        return std::sqrt(distance_sums::l2Squared(a, b));
+    }
+
+    /**
+     * @brief Computes the distance, stopping early once it exceeds a bound.
+     *
+     * @return The distance if it is less than or equal to bound, otherwise a value greater than bound
+     *         (infinity if it stopped early).
+     */
+    float distanceUpTo(const T& a, const T& b, float bound) const override {
+        DistanceFunction<T>::distanceFunctionCalls++;
+        if (a.size() != b.size()) {
+            throw std::invalid_argument("Vectors must be of the same size");
+        }
+
+        size_t evaluated;
+        float sum = distance_sums::l2SquaredUpTo(a, b, bound * bound, evaluated);
+        if (evaluated < a.size()) {
+            DistanceFunction<T>::skippedDimensions += a.size() - evaluated;
+            return std::numeric_limits<float>::infinity();
         }
         return std::sqrt(sum);
     }
@@ -91,9 +362,26 @@ public:
             throw std::invalid_argument("Vectors must be of the same size");
         }
 
-        float sum = 0.0f;
-        for (size_t i = 0; i < a.size(); ++i) {
-            sum += std::abs(a[i] - b[i]);
+        return distance_sums::l1(a, b);
+    }
+
+    /**
+     * @brief Computes the distance, stopping early once it exceeds a bound.
+     *
+     * @return The distance if it is less than or equal to bound, otherwise a value greater than bound
+     *         (infinity if it stopped early).
+     */
+    float distanceUpTo(const T& a, const T& b, float bound) const override {
+        DistanceFunction<T>::distanceFunctionCalls++;
+        if (a.size() != b.size()) {
+            throw std::invalid_argument("Vectors must be of the same size");
+        }
+
+        size_t evaluated;
+        float sum = distance_sums::l1UpTo(a, b, bound, evaluated);
+        if (evaluated < a.size()) {
+            DistanceFunction<T>::skippedDimensions += a.size() - evaluated;
+            return std::numeric_limits<float>::infinity();
         }
         return sum;
     }
@@ -118,14 +406,28 @@ public:
             throw std::invalid_argument("Vectors must be of the same size");
         }
 
-        float maxDiff = 0.0f;
-        for (size_t i = 0; i < a.size(); ++i) {
-            float diff = std::abs(a[i] - b[i]);
-            if (diff > maxDiff) {
-                maxDiff = diff;
-            }
+        return distance_sums::lInf(a, b);
+    }
+
+    /**
+     * @brief Computes the distance, stopping early once it exceeds a bound.
+     *
+     * @return The distance if it is less than or equal to bound, otherwise a value greater than bound
+     *         (infinity if it stopped early).
+     */
+    float distanceUpTo(const T& a, const T& b, float bound) const override {
+        DistanceFunction<T>::distanceFunctionCalls++;
+        if (a.size() != b.size()) {
+            throw std::invalid_argument("Vectors must be of the same size");
         }
-        return maxDiff;
+
+        size_t evaluated;
+        float sum = distance_sums::lInfUpTo(a, b, bound, evaluated);
+        if (evaluated < a.size()) {
+            DistanceFunction<T>::skippedDimensions += a.size() - evaluated;
+            return std::numeric_limits<float>::infinity();
+        }
+        return sum;
     }
 };
 
@@ -148,9 +450,11 @@ public:
             throw std::invalid_argument("Vectors must be of the same size");
         }
 
-        float dotProduct = std::inner_product(a.begin(), a.end(), b.begin(), 0.0f);
-        float normA = std::sqrt(std::inner_product(a.begin(), a.end(), a.begin(), 0.0f));
-        float normB = std::sqrt(std::inner_product(b.begin(), b.end(), b.begin(), 0.0f));
+        // Dot product and both squared norms in a single pass
+        float dotProduct, normA2, normB2;
+        distance_sums::cosineTerms(a, b, dotProduct, normA2, normB2);
+        float normA = std::sqrt(normA2);
+        float normB = std::sqrt(normB2);
 
         // Division by 0 check
         if (normA == 0.0f || normB == 0.0f) {
@@ -180,7 +484,7 @@ public:
             throw std::invalid_argument("Vectors must be of the same size");
         }
 
-        float dotProduct = std::inner_product(a.begin(), a.end(), b.begin(), 0.0f);
+        float dotProduct = distance_sums::dot(a, b);
         return 1.0f - dotProduct; // Norms are 1, so we only need the dot product
     }
 };
@@ -10,11 +10,18 @@
 template <typename T>
 class KNNResult {
 public:
-    KNNResult(const std::vector<NNList<T>>& knn_lists) {
+    /**
+     * @brief Gathers the neighbors of several queries.
+     *
+     * @param knn_lists The lists returned by the searcher, one per query.
+     * @param searcher The searcher that produced the lists, used to resolve their ids (getObject).
+     */
+    template <typename Searcher>
+    KNNResult(const std::vector<NNList>& knn_lists, const Searcher& searcher) {
         // Flatten the list
         for (const auto& knn_list : knn_lists) {
             for (const auto& entry : knn_list) {
-                knn_list_.emplace_back(entry);
+                knn_list_.push_back(Neighbor{&searcher.getObject(entry.id), entry.distance});
             }
         }
     }
@@ -33,7 +40,7 @@ private:
     std::vector<std::pair<uint32_t, double>> pickBestFrequency(size_t k) {
         std::unordered_map<uint32_t, size_t> freq;
         for (const auto& entry : knn_list_) {
-            freq[entry.element.representative->getId()]++;
+            freq[entry.element->representative->getId()]++;
         }
 
         // Convert to vector of pairs and sort by frequency
@@ -60,9 +67,9 @@ private:
         std::vector<std::pair<uint32_t, double>> best;
         std::unordered_set<uint32_t> seen;
         for (const auto& entry : knn_list_) {
-            if (seen.find(entry.element.representative->getId()) == seen.end()) {
-                best.emplace_back(entry.element.representative->getId(), entry.distance);
-                seen.insert(entry.element.representative->getId());
+            if (seen.find(entry.element->representative->getId()) == seen.end()) {
+                best.emplace_back(entry.element->representative->getId(), entry.distance);
+                seen.insert(entry.element->representative->getId());
             }
             if (best.size() == k) {
                 break;
@@ -74,12 +81,18 @@ private:
     // Cout
     friend std::ostream& operator<<(std::ostream& os, const KNNResult<T>& knn_result) {
         for (const auto& entry : knn_result.knn_list_) {
-            os << entry.element << " " << entry.distance << "; ";
+            os << *entry.element << " " << entry.distance << "; ";
         }
         return os;
     }
 
-    std::vector<NNEntry<T>> knn_list_;
+    // A neighbor resolved to the object, which stays owned by the searcher
+    struct Neighbor {
+        const T* element;
+        float distance;
+    };
+
+    std::vector<Neighbor> knn_list_;
 };
 
 #endif // KNNRESULT_HPP
\ No newline at end of file
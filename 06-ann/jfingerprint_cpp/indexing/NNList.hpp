@@ -1,170 +1,129 @@
 #ifndef NNLIST_HPP
 #define NNLIST_HPP
 
-#include <vector>  // For std::vector
-#include <limits>  // For std::numeric_limits
-#include <ostream> // For std::ostream
-#include <cstddef> // For std::size_t
+#include <vector>    // For std::vector
+#include <limits>    // For std::numeric_limits
+#include <ostream>   // For std::ostream
+#include <cstddef>   // For std::size_t
+#include <cstdint>   // For uint32_t
+#include <algorithm> // For std::push_heap, std::make_heap, std::sort
 
 /**
  * @brief Represents an entry in the nearest neighbors list.
  *
- * @tparam T The type of the elements in the list.
+ * The entry refers to the object by its position in the searcher that produced it
+ * (see SequentialSearcher::getObject), so it is 8 bytes whatever the type of the objects.
  */
-template <typename T>
 struct NNEntry
 {
-    T element;
-    double distance;
+    uint32_t id;
+    float distance;
 
     /**
-     * @brief Constructs an NNEntry with the given element and distance.
-     *
-     * @param elem The element to store in the entry.
-     * @param dist The distance associated with the element.
-     */
-    NNEntry(const T &elem, double dist) : element(elem), distance(dist) {}
-
-    /**
-     * @brief Compares two NNEntry objects by their distance.
+     * @brief Compares two NNEntry objects by their distance, ties broken by id.
      *
      * @param other The other NNEntry object to compare with.
-     * @return True if this object's distance is less than the other's distance, false otherwise.
+     * @return True if this entry comes before the other one in the sorted list, false otherwise.
      */
     bool operator<(const NNEntry &other) const
     {
-        return distance < other.distance;
+        return distance < other.distance || (distance == other.distance && id < other.id);
     }
 
     /**
-     * @brief Overload of the output operator to format the output as (element, distance).
+     * @brief Overload of the output operator to format the output as (id, distance).
      * @param os Output stream.
      * @param entry NNEntry object to be printed.
      * @return Output stream.
      */
     friend std::ostream &operator<<(std::ostream &os, const NNEntry &entry)
     {
-        os << "(" << entry.element << ", " << entry.distance << ")";
+        os << "(" << entry.id << ", " << entry.distance << ")";
         return os;
     }
 };
 
 /**
- * @brief A class to manage a list of nearest neighbors.
+ * @brief The k nearest neighbors found so far, as a bounded max-heap of (id, distance).
  *
- * @tparam T The type of the elements in the list.
+ * The buffer for the k entries is allocated once, when the list is constructed, so
+ * inserting never allocates. While the search runs the entries are kept in heap order,
+ * with the farthest one first; finalize() sorts them in ascending order of distance.
  */
-template <typename T>
 class NNList
 {
 public:
     /**
-     * @brief Constructs an empty NNList, just allocating memory for the list.
+     * @brief Constructs an empty NNList with room for k entries.
      *
-     * @param k The number of empty elements to initialize the list with. Default is 0.
+     * @param k The number of nearest neighbors to keep. Default is 0.
      */
-    NNList(size_t k) : currentSize(0), maxSize(k)
+    explicit NNList(size_t k = 0) : k(k), sorted(false)
     {
         entries.reserve(k);
     }
 
     /**
-     * @brief Constructs an NNList with the given number of empty elements, with the default distance set to the specified value.
+     * @brief Inserts an entry if the list is not full or if it is closer than the farthest entry,
+     * which is then removed. Takes O(log k).
      *
-     * @param k The number of empty elements to initialize the list with.
-     * @param dist The default distance to set for the elements.
+     * @param id The id of the object.
+     * @param distance The distance between the object and the query.
      */
-    NNList(size_t k, double dist) : currentSize(k), maxSize(k)
+    void insert(uint32_t id, float distance)
     {
-        // Fill k entries with default element and distance given by dist
-        entries.reserve(k);
-        for (size_t i = 0; i < k; ++i)
+        NNEntry entry{id, distance};
+        if (sorted)
         {
-            entries.emplace_back(NNEntry<T>{T(), dist});
+            std::make_heap(entries.begin(), entries.end());
+            sorted = false;
         }
-    }
 
-    /**
-     * @brief Destructor for NNList.
-     */
-    ~NNList() {}
-
-    /**
-     * @brief Inserts an entry into the nearest neighbors list in a smart way.
-     *
-     * This function inserts an entry into the list if there is available capacity
-     * or if the list is full but the new entry is closer than the farthest entry in the list.
-     * In the latter case, the farthest entry is removed to maintain the correct size of the list.
-     *
-     * @tparam T The type of the elements in the list.
-     * @param element The element to insert.
-     * @param distance The distance associated with the element.
-     */
-    void insert(const T &element, double distance)
-    {
-        if (currentSize < maxSize || distance < getMaxDistance())
+        if (entries.size() < k)
         {
-            forceInsert(NNEntry<T>{element, distance});
-
-            // If the inserted item exceeds the maximum size, remove the last element
-            if (currentSize > maxSize)
-            {
-                entries.pop_back();
-            }
+            entries.push_back(entry);
+            std::push_heap(entries.begin(), entries.end());
+        }
+        else if (k > 0 && entry < entries[0])
+        {
+            // Replace the farthest entry
+            entries[0] = entry;
+            siftDown(0);
         }
     }
 
     /**
-     * @brief This is a virtual insertion, only changes the maximum distance.
-     *
-     * @param distance The distance to insert.
-     */
-    void insert(double distance)
-    {
-        setMaxDistance(distance);
-    }
-
-    /**
-     * @brief Forces the insertion of an entry into the list, even if it is full.
+     * @brief Sorts the entries in ascending order of distance (ties by id).
      *
-     * @param entry The entry to insert.
+     * The searchers call it before returning the list. Inserting after finalize() is
+     * allowed, the heap order is then restored first.
      */
-    void forceInsert(const NNEntry<T> &entry)
+    void finalize()
     {
-        // Insert the entry in the correct position
-        // The list is always sorted by distance
-        auto it = std::lower_bound(entries.begin(), entries.end(), entry);
-        entries.insert(it, entry);
-
-        // Check if needs to update maxDistance
-        if (entries.back().distance < maxDistance)
+        if (!sorted)
         {
-            maxDistance = entries.back().distance;
+            std::sort(entries.begin(), entries.end());
+            sorted = true;
         }
-        ++currentSize;
     }
 
     /**
-     * @brief Returns the maximum distance in the nearest neighbors list.
-     * @return The maximum distance in the nearest neighbors list.
+     * @brief Returns the distance the next entry must be below to be inserted.
+     * @return The distance of the farthest entry if the list is full, infinity otherwise.
      */
     float getMaxDistance() const
     {
-        if (entries.empty())
+        if (entries.size() < k)
         {
-            // Return infinity if the list is empty
             return std::numeric_limits<float>::infinity();
         }
-        return entries.back().distance;
-    }
-
-    /**
-     * @brief Sets the maximum distance in the nearest neighbors list.
-     * @param distance The new maximum distance.
-     */
-    void setMaxDistance(double distance)
-    {
-        maxDistance = distance;
+        if (k == 0)
+        {
+            // Nothing can be inserted
+            return -std::numeric_limits<float>::infinity();
+        }
+        // The farthest entry is the top of the heap, or the last one once sorted
+        return sorted ? entries.back().distance : entries[0].distance;
     }
 
     /**
@@ -173,14 +132,14 @@ public:
      */
     size_t size() const
     {
-        return currentSize;
+        return entries.size();
     }
 
     /**
      * @brief Returns iterator to the beginning of the nearest neighbors list.
      * @return Iterator to the beginning of the nearest neighbors list.
      */
-    typename std::vector<NNEntry<T>>::const_iterator begin() const
+    std::vector<NNEntry>::const_iterator begin() const
     {
         return entries.begin();
     }
@@ -189,7 +148,7 @@ public:
      * @brief Returns iterator to the end of the nearest neighbors list.
      * @return Iterator to the end of the nearest neighbors list.
      */
-    typename std::vector<NNEntry<T>>::const_iterator end() const
+    std::vector<NNEntry>::const_iterator end() const
     {
         return entries.end();
     }
@@ -205,42 +164,59 @@ public:
         os << "[";
         for (size_t i = 0; i < list.entries.size(); ++i)
         {
-            os << list.entries[i];
-            if (i == list.entries.size() - 1 || list.entries[i + 1].distance == std::numeric_limits<float>::infinity())
+            if (i > 0)
             {
-                break;
+                os << ", ";
             }
-            os << ", ";
+            os << list.entries[i];
         }
         os << "]";
         return os;
     }
 
     /**
-     * @brief Overload of the [] operator to access entries by index.
+     * @brief Overload of the [] operator to access entries by index (in sorted order after finalize()).
      * @param index Index of the entry to access.
-     * @return Reference to the NNEntry at the specified index.
+     * @return Const reference to the NNEntry at the specified index.
      */
-    NNEntry<T> &operator[](size_t index)
+    const NNEntry &operator[](size_t index) const
     {
         return entries[index];
     }
 
+private:
     /**
-     * @brief Overload of the [] operator to access entries by index (const version).
-     * @param index Index of the entry to access.
-     * @return Const reference to the NNEntry at the specified index.
+     * @brief Moves the entry at index down the heap until both of its children are not greater.
+     * @param index Index of the entry.
      */
-    const NNEntry<T> &operator[](size_t index) const
+    void siftDown(size_t index)
     {
-        return entries[index];
+        const size_t n = entries.size();
+        NNEntry entry = entries[index];
+        while (true)
+        {
+            size_t child = 2 * index + 1;
+            if (child >= n)
+            {
+                break;
+            }
+            if (child + 1 < n && entries[child] < entries[child + 1])
+            {
+                ++child;
+            }
+            if (!(entry < entries[child]))
+            {
+                break;
+            }
+            entries[index] = entries[child];
+            index = child;
+        }
+        entries[index] = entry;
     }
 
-private:
-    std::vector<NNEntry<T>> entries;
-    double maxDistance;
-    size_t currentSize;
-    size_t maxSize;
+    std::vector<NNEntry> entries; ///< Max-heap by (distance, id), or sorted once finalized
+    size_t k;                     ///< The number of nearest neighbors to keep
+    bool sorted;                  ///< True if finalize() was called after the last insertion
 };
 
-#endif // NNLIST_HPP
\ No newline at end of file
+#endif // NNLIST_HPP
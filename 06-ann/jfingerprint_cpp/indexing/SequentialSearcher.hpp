@@ -4,6 +4,7 @@
 #include <vector>
 #include <functional> // For std::function
 #include <typeinfo>   // For typeid
+#include <cstdint>    // For uint32_t
 #include "NNList.hpp"
 
 /**
@@ -28,21 +29,29 @@ public:
      *
      * @param query The query object.
      * @param k The number of nearest neighbors to find.
-     * @return NNList<T> The list of k-nearest neighbors.
+     * @return NNList The ids of the k-nearest neighbors (see getObject), sorted by distance.
      */
-    NNList<T> knn(const T &query, size_t k) const
+    NNList knn(const T &query, size_t k) const
     {
-        NNList<T> nnList(k);
+        NNList nnList(k);
 
         // Sequentially calculate the distance between the query object and all objects in dataObjects
         // Takes O(n) distance calculations
-        for (const auto &obj : dataObjects)
+        for (size_t id = 0; id < dataObjects.size(); id++)
         {
-            double dist = distanceFunc(query, obj);
+            const T &obj = dataObjects[id];
+            // Once the list is full, objects farther than its last entry are not inserted,
+            // so the distance only needs to be computed up to there
+            float dk = nnList.getMaxDistance();
+            float dist = distanceFunc.distanceUpTo(query, obj, dk);
 
-            nnList.insert(obj, dist);
+            if (dist < dk)
+            {
+                nnList.insert(static_cast<uint32_t>(id), dist);
+            }
         }
 
+        nnList.finalize();
         return nnList;
     }
 
@@ -66,6 +75,17 @@ public:
         dataObjects.insert(dataObjects.end(), objs.begin(), objs.end());
     }
 
+    /**
+     * @brief Gets an object by its id, the position at which it was added.
+     *
+     * @param id The id of the object, as in the NNList returned by knn.
+     * @return The object.
+     */
+    const T &getObject(uint32_t id) const
+    {
+        return dataObjects[id];
+    }
+
     /**
      * @brief Returns the number of objects in the search structure.
      *
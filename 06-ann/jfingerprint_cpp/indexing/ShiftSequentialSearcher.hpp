@@ -2,67 +2,364 @@
 #define SHIFT_SEQUENTIAL_SEARCHER_HPP
 
 #include <vector>
-#include <functional> // For std::function
-#include <typeinfo>   // For typeid
+#include <functional>    // For std::function
+#include <typeinfo>      // For typeid
+#include <cstdint>       // For uint32_t
+#include <cmath>         // For std::sqrt
+#include <algorithm>     // For std::sort, std::max, std::min_element, std::max_element
+#include <utility>       // For std::pair
+#include <limits>        // For std::numeric_limits
+#include <stdexcept>     // For std::invalid_argument, std::out_of_range, std::logic_error
+#include <type_traits>   // For std::decay, std::is_same
+#include <unordered_map> // For std::unordered_map
 #include "NNList.hpp"
+#include "DistanceFunction.hpp"
+#include "../objectTypes/FeatureView.hpp"
+#include "../objectTypes/Individual.hpp"
 
 /**
  * @brief A class for performing sequential k-nearest neighbors search, with shift by the mean and
  * scaling by std for each individual.
  *
- * @tparam T The type of the objects stored in dataObjects.
- * @tparam DistanceFunc The type of the distance function.
+ * The query is compared with each object o as mean + query * std, with the mean and std of the
+ * individual of o (its representative). That shifted query only depends on the individual, so
+ * the objects are also stored grouped by individual, their values copied into one contiguous
+ * block per individual: the query is shifted once per individual, into a buffer reused for
+ * every individual, and then compared with the rows of the block through FeatureViews, without
+ * allocating.
+ *
+ * With the Euclidean distance the search is a weighted L2 instead. With x' = (x - mean) / std,
+ *
+ *     ||(mean + q * std) - x||^2 = sum std^2 (q - x')^2,
+ *
+ * so the blocks hold the normalized rows x', computed at enrollment, and each individual keeps
+ * the weights std^2. The query is then used as it is, with no work per individual, and each
+ * row is one pass of the weighted L2 kernel, which stops early as distanceUpTo does. A
+ * dimension where std is 0 only adds the constant (mean - x)^2 to a row: it gets weight 0 and
+ * x' = 0, and the sum of those constants is kept per row. The mean and std of an individual
+ * must not change once its objects were added. The distances match the direct computation up
+ * to float rounding.
+ *
+ * Each individual also keeps the radius of its objects around its mean, the largest
+ * d(mean, x). The shifted query s = mean + q * std is then at least d(s, mean) - radius from
+ * every object of the individual, by the triangle inequality, and d(s, mean) is ||q * std||
+ * for the Euclidean distance. knn computes that bound for every individual and skips the
+ * individuals whose bound reaches the k-th distance: the result is the same, and the
+ * individuals far from the query are never read. The bound only holds for the metrics
+ * (Euclidean, Manhattan, Chebyshev); with the cosine distances, which break the triangle
+ * inequality, it is 0 and every individual is searched. The individuals with the smallest bounds
+ * are visited first, in increasing order of bound, so that the k-th distance falls early;
+ * the others are visited in no particular order, since sorting every bound costs more than
+ * it saves when few individuals can be skipped.
+ *
+ * summarize and estimateDistances rank the individuals without reading their objects, for a
+ * first stage that shortlists individuals (see CoarseToFineSearcher).
+ *
+ * @tparam T The type of the objects stored in dataObjects, a Feature with a representative.
+ * @tparam DistanceFunc The type of the distance function (see RebindDistance).
  */
 template <typename T, typename DistanceFunc>
 class ShiftSequentialSearcher
 {
+    typedef typename std::decay<decltype(std::declval<const T &>()[0])>::type NumT;
+    typedef FeatureView<NumT> Row;
+    typedef typename RebindDistance<DistanceFunc, Row>::type RowDistance;
+    static constexpr bool WEIGHTED = std::is_same<RowDistance, EuclideanDistance<Row>>::value;
+    static constexpr bool IS_METRIC = WEIGHTED ||
+                                      std::is_same<RowDistance, ManhattanDistance<Row>>::value ||
+                                      std::is_same<RowDistance, ChebyshevDistance<Row>>::value;
+    static constexpr size_t FIRST_VISITS_MIN = 16;     ///< Smallest number of individuals visited in order of bound
+    static constexpr size_t FIRST_VISITS_FRACTION = 16; ///< Fraction of the individuals visited in order of bound
+    static constexpr float BOUND_SLACK = 1e-4f; ///< Relative rounding error allowed for in the bounds of the individuals
+
 public:
     /**
      * @brief Constructs a ShiftSequentialSearcher with the given distance function.
      *
+     * The rows are compared with the same metric over FeatureViews, built from distFunc by
+     * RebindDistance::rebind, so distFunc is not used after the constructor returns.
+     *
      * @param distFunc The distance function to evaluate distance between objects.
      */
-    ShiftSequentialSearcher(DistanceFunc &distFunc) : distanceFunc(distFunc) {}
+    ShiftSequentialSearcher(DistanceFunc &distFunc) : rowDistance(RebindDistance<DistanceFunc, Row>::rebind(distFunc)), dimension(0), summarized(false) {}
 
     /**
      * @brief Performs k-nearest neighbors search.
      *
+     * The distances are computed over the rows of the individuals, so they are counted in
+     * DistanceFunction<FeatureView<NumT>>.
+     *
      * @param query The query object.
      * @param k The number of nearest neighbors to find.
-     * @return NNList<T> The list of k-nearest neighbors.
+     * @param visited If not null, receives the number of individuals whose objects were compared with the query.
+     * @return NNList The ids of the k-nearest neighbors (see getObject), sorted by distance.
      */
-    NNList<T> knn(const T &query, size_t k) const
+    NNList knn(const T &query, size_t k, size_t *visited = nullptr) const
     {
-        NNList<T> nnList(k);
+        NNList nnList(k);
+        if (visited)
+        {
+            *visited = 0;
+        }
+        if (dataObjects.empty())
+        {
+            nnList.finalize();
+            return nnList;
+        }
+        if (query.size() != dimension)
+        {
+            throw std::invalid_argument("Vectors must be of the same size");
+        }
 
-        // Sequentially calculate the distance between the query object and all objects in dataObjects
-        // Takes O(n) distance calculations
-        for (const auto &obj : dataObjects)
+        // Lower bound of the distance between the query and the objects of each individual.
+        // Takes O(d) work per individual
+        std::vector<NumT> shiftQuery(dimension);
+        squares(query, shiftQuery);
+        std::vector<float> bounds(groups.size());
+        for (size_t g = 0; g < groups.size(); g++)
         {
-            // Initialize vector with size query.size()
-            std::vector<float> shiftQuery(query.size());
-            // Shift and scale the query object based on the object's individual mean and std
-            T mean = obj.representative->mean;
-            T std = obj.representative->std;
-            for (size_t i = 0; i < query.size(); i++){
-                shiftQuery[i] = mean[i] + query[i] * std[i];
+            bounds[g] = lowerBound(query, groups[g], shiftQuery);
+        }
+
+        // Calculates the distance between the query object and the objects of an individual
+        auto visit = [&](size_t g)
+        {
+            if (WEIGHTED)
+            {
+                searchWeighted(query, groups[g], nnList);
+            }
+            else
+            {
+                shift(query, groups[g], shiftQuery);
+                searchShifted(groups[g], shiftQuery, nnList);
+            }
+            if (visited)
+            {
+                (*visited)++;
             }
-            double dist = distanceFunc(Feature(shiftQuery), obj);
+        };
+
+        // The individuals with the smallest bounds are visited first, in order, to bring the
+        // k-th distance down early. If one of them cannot hold a closer object, no other can
+        const size_t first = std::min(groups.size(), std::max(FIRST_VISITS_MIN, groups.size() / FIRST_VISITS_FRACTION));
+        std::vector<std::pair<float, uint32_t>> order(groups.size());
+        for (size_t g = 0; g < groups.size(); g++)
+        {
+            order[g] = std::make_pair(bounds[g], static_cast<uint32_t>(g));
+        }
+        std::nth_element(order.begin(), order.begin() + (first - 1), order.end());
+        std::sort(order.begin(), order.begin() + first);
+        for (size_t i = 0; i < first; i++)
+        {
+            if (order[i].first >= nnList.getMaxDistance())
+            {
+                nnList.finalize();
+                return nnList;
+            }
+            visit(order[i].second);
+            bounds[order[i].second] = std::numeric_limits<float>::infinity();
+        }
+
+        // Sorting the other bounds is not worth it: they are checked in the order of the groups
+        for (size_t g = 0; g < groups.size(); g++)
+        {
+            if (bounds[g] < nnList.getMaxDistance())
+            {
+                visit(g);
+            }
+        }
+
+        nnList.finalize();
+        return nnList;
+    }
 
-            nnList.insert(obj, dist);
+    /**
+     * @brief Performs k-nearest neighbors search among the objects of some individuals only.
+     *
+     * The individuals are visited in the given order, each one skipped if its bound reaches
+     * the k-th distance, as in knn: the result is the k nearest neighbors among their objects.
+     *
+     * @param query The query object.
+     * @param k The number of nearest neighbors to find.
+     * @param individuals The positions of the individuals to search (see getIndividual).
+     * @return NNList The ids of the k-nearest neighbors (see getObject), sorted by distance.
+     * @throws std::out_of_range if a position is not below numIndividuals().
+     */
+    NNList knnWithin(const T &query, size_t k, const std::vector<uint32_t> &individuals) const
+    {
+        NNList nnList(k);
+        if (dataObjects.empty())
+        {
+            nnList.finalize();
+            return nnList;
+        }
+        if (query.size() != dimension)
+        {
+            throw std::invalid_argument("Vectors must be of the same size");
         }
 
+        std::vector<NumT> shiftQuery(dimension);
+        squares(query, shiftQuery);
+        for (uint32_t g : individuals)
+        {
+            const Group &group = groups.at(g);
+            if (lowerBound(query, group, shiftQuery) >= nnList.getMaxDistance())
+            {
+                continue;
+            }
+            if (WEIGHTED)
+            {
+                searchWeighted(query, group, nnList);
+            }
+            else
+            {
+                shift(query, group, shiftQuery);
+                searchShifted(group, shiftQuery, nnList);
+            }
+        }
+
+        nnList.finalize();
         return nnList;
     }
 
+    /**
+     * @brief Summarizes the objects of each individual, for estimateDistances.
+     *
+     * Each individual keeps up to representatives of its objects, chosen farthest first from
+     * the one closest to its mean, so that they spread over the individual. For the
+     * Euclidean distance it also keeps the first four moments of its normalized rows in each
+     * dimension, which give the mean and the variance of the squared distance between a
+     * query and one of its objects. The summaries are dropped by add, and must be rebuilt
+     * once the objects are all added.
+     *
+     * @param representatives The number of objects kept per individual.
+     */
+    void summarize(size_t representatives)
+    {
+        for (Group &group : groups)
+        {
+            chooseRepresentatives(group, representatives);
+            if (WEIGHTED)
+            {
+                setMoments(group);
+            }
+        }
+        summarized = true;
+    }
+
+    /**
+     * @brief Estimates the distance between the query and the closest object of each individual.
+     *
+     * The mean of an individual says nothing about the query by itself: the query shifted
+     * for the individual is mean + query * std, so its distance to the mean is ||query * std||
+     * for the Euclidean distance, and the mean cancels. The estimate is the distance to the
+     * closest representative of the individual (see summarize). For the Euclidean distance
+     * the other objects also count: their squared distance to the query has mean mu and
+     * deviation sigma, given by the moments of the individual, and the smallest of n of them
+     * is estimated as mu - sqrt(2 ln n) * sigma, as for the minimum of n normal values. The
+     * estimate is the smaller of the two. With no representative and another distance, it is
+     * the distance to the mean.
+     *
+     * Takes O(d) per individual and per representative, with no other object read.
+     *
+     * @param query The query object.
+     * @param estimates Receives one distance per individual, by position (see getIndividual).
+     * @throws std::logic_error if objects were added since the last call to summarize.
+     */
+    void estimateDistances(const T &query, std::vector<float> &estimates) const
+    {
+        estimates.resize(groups.size());
+        if (groups.empty())
+        {
+            return;
+        }
+        if (!summarized)
+        {
+            throw std::logic_error("summarize must be called after the objects are added");
+        }
+        if (query.size() != dimension)
+        {
+            throw std::invalid_argument("Vectors must be of the same size");
+        }
+
+        // The squares and the values of the query, against the moments (see setMoments)
+        std::vector<NumT> terms(2 * dimension);
+        std::vector<NumT> shiftQuery(dimension);
+        for (size_t i = 0; i < dimension; i++)
+        {
+            terms[i] = query[i] * query[i];
+            terms[dimension + i] = query[i];
+        }
+        for (size_t g = 0; g < groups.size(); g++)
+        {
+            const Group &group = groups[g];
+            if (WEIGHTED)
+            {
+                estimates[g] = estimateWeighted(query, group, terms);
+            }
+            else
+            {
+                shift(query, group, shiftQuery);
+                const Row shifted(0, shiftQuery.data(), dimension);
+                float best = group.representatives.empty() ? rowDistance(shifted, Row(0, group.individual->mean.values.data(), dimension))
+                                                           : std::numeric_limits<float>::infinity();
+                for (uint32_t r : group.representatives)
+                {
+                    best = std::min(best, rowDistance(shifted, Row(0, &group.values[r * dimension], dimension)));
+                }
+                estimates[g] = best;
+            }
+        }
+    }
+
     /**
      * @brief Adds a single object to the dataObjects.
      *
      * @param obj The object to add.
+     * @throws std::invalid_argument if the object has no representative, or if its size, or the
+     *         size of the mean or std of its representative, differs from the objects already added.
      */
     void add(const T &obj)
     {
+        const Individual<NumT> *individual = obj.representative;
+        if (!individual)
+        {
+            throw std::invalid_argument("The object has no representative to shift the query with");
+        }
+        if (dataObjects.empty())
+        {
+            dimension = obj.size();
+        }
+        if (obj.size() != dimension || individual->mean.size() != dimension || individual->std.size() != dimension)
+        {
+            throw std::invalid_argument("Vectors must be of the same size");
+        }
+
+        auto found = groupOf.find(individual);
+        if (found == groupOf.end())
+        {
+            found = groupOf.emplace(individual, groups.size()).first;
+            groups.push_back(Group{individual, {}, {}, {}, {}, 0.0f, {}, {}, 0.0f, 0.0f, 0.0f});
+            if (WEIGHTED)
+            {
+                setWeights(groups.back());
+            }
+        }
+        Group &group = groups[found->second];
+        if (WEIGHTED)
+        {
+            addNormalized(group, obj);
+        }
+        else
+        {
+            group.values.insert(group.values.end(), obj.begin(), obj.end());
+        }
+        group.ids.push_back(static_cast<uint32_t>(dataObjects.size()));
+        const Row mean(0, individual->mean.values.data(), dimension);
+        group.radius = std::max(group.radius, rowDistance(Row(0, &obj[0], dimension), mean));
+
         dataObjects.push_back(obj);
+        summarized = false;
     }
 
     /**
@@ -72,7 +369,22 @@ public:
      */
     void addAll(const std::vector<T> &objs)
     {
-        dataObjects.insert(dataObjects.end(), objs.begin(), objs.end());
+        dataObjects.reserve(dataObjects.size() + objs.size());
+        for (const T &obj : objs)
+        {
+            add(obj);
+        }
+    }
+
+    /**
+     * @brief Gets an object by its id, the position at which it was added.
+     *
+     * @param id The id of the object, as in the NNList returned by knn.
+     * @return The object.
+     */
+    const T &getObject(uint32_t id) const
+    {
+        return dataObjects[id];
     }
 
     /**
@@ -85,6 +397,35 @@ public:
         return dataObjects.size();
     }
 
+    /**
+     * @brief Returns the number of individuals the objects belong to.
+     */
+    size_t numIndividuals() const
+    {
+        return groups.size();
+    }
+
+    /**
+     * @brief Gets an individual by its position, the order in which its first object was added.
+     *
+     * @param index The position of the individual, below numIndividuals().
+     * @return The representative shared by the objects of the individual.
+     */
+    const Individual<NumT> *getIndividual(size_t index) const
+    {
+        return groups[index].individual;
+    }
+
+    /**
+     * @brief Returns the number of objects of an individual.
+     *
+     * @param index The position of the individual, below numIndividuals().
+     */
+    size_t individualSize(size_t index) const
+    {
+        return groups[index].ids.size();
+    }
+
     /**
      * @brief Overloads the << operator for printing the SequentialSearcher.
      *
@@ -106,8 +447,336 @@ public:
     }
 
 private:
+    /**
+     * @brief The objects of one individual, as contiguous rows.
+     */
+    struct Group
+    {
+        const Individual<NumT> *individual; ///< The representative of the objects
+        std::vector<NumT> values;           ///< One row of dimension values per object, x' if WEIGHTED
+        std::vector<NumT> weights;          ///< std^2, 0 where std is 0, if WEIGHTED
+        std::vector<float> constants;       ///< Sum of (mean - x)^2 where std is 0, per row, if WEIGHTED
+        std::vector<uint32_t> ids;          ///< The id of each row (its position in dataObjects)
+        float radius;                       ///< Largest distance between the mean and an object of the individual
+        std::vector<uint32_t> representatives; ///< Rows kept by summarize
+        std::vector<NumT> moments;          ///< If WEIGHTED, the terms of mu then of sigma^2 against the query (see setMoments)
+        float expectedBase;                 ///< If WEIGHTED, the constant term of mu
+        float varianceBase;                 ///< If WEIGHTED, the constant term of sigma^2
+        float spread;                       ///< sqrt(2 ln n), n the rows that are not representatives (0 if n < 2)
+    };
+
+    /**
+     * @brief Shifts and scales the query object based on the individual's mean and std.
+     *
+     * @param query The query object.
+     * @param group The individual.
+     * @param shiftQuery Receives the dimension values of mean + query * std.
+     */
+    void shift(const T &query, const Group &group, std::vector<NumT> &shiftQuery) const
+    {
+        const NumT *mean = group.individual->mean.values.data();
+        const NumT *std = group.individual->std.values.data();
+        const NumT *q = &query[0];
+        for (size_t i = 0; i < dimension; i++)
+        {
+            shiftQuery[i] = mean[i] + q[i] * std[i];
+        }
+    }
+
+    /**
+     * @brief Puts the squares of the query in the buffer if WEIGHTED, as distanceToMean expects.
+     */
+    void squares(const T &query, std::vector<NumT> &buffer) const
+    {
+        if (WEIGHTED)
+        {
+            for (size_t i = 0; i < dimension; i++)
+            {
+                buffer[i] = query[i] * query[i];
+            }
+        }
+    }
+
+    /**
+     * @brief Gets the distance between the shifted query s and the mean of an individual.
+     *
+     * @param query The query object.
+     * @param group The individual.
+     * @param buffer dimension values: the squares of the query if WEIGHTED, otherwise overwritten.
+     */
+    float distanceToMean(const T &query, const Group &group, std::vector<NumT> &buffer) const
+    {
+        if (WEIGHTED)
+        {
+            // d(s, mean) = ||q * std||, with the squares of the query in the buffer
+            return std::sqrt(distance_sums::dot(Row(0, group.weights.data(), dimension), Row(0, buffer.data(), dimension)));
+        }
+        shift(query, group, buffer);
+        return rowDistance(Row(0, buffer.data(), dimension), Row(0, group.individual->mean.values.data(), dimension));
+    }
+
+    /**
+     * @brief Gets a lower bound on the distance between the query and the objects of an individual.
+     *
+     * The bound is d(s, mean) - radius, lowered by BOUND_SLACK times the two terms against
+     * rounding, which only prunes less. It is 0 unless IS_METRIC, since it relies on the
+     * triangle inequality.
+     *
+     * @param query The query object.
+     * @param group The individual.
+     * @param buffer dimension values: the squares of the query if WEIGHTED, otherwise overwritten.
+     */
+    float lowerBound(const T &query, const Group &group, std::vector<NumT> &buffer) const
+    {
+        if (!IS_METRIC)
+        {
+            return 0.0f;
+        }
+        float toMean = distanceToMean(query, group, buffer);
+        return std::max(toMean - group.radius - BOUND_SLACK * (toMean + group.radius), 0.0f);
+    }
+
+    /**
+     * @brief Searches the rows of one individual with the shifted query.
+     *
+     * @param group The individual.
+     * @param shiftQuery The query shifted for the individual (see shift).
+     * @param nnList The neighbors found so far.
+     */
+    void searchShifted(const Group &group, const std::vector<NumT> &shiftQuery, NNList &nnList) const
+    {
+        const Row shifted(0, shiftQuery.data(), dimension);
+        const NumT *row = group.values.data();
+        for (size_t r = 0; r < group.ids.size(); r++, row += dimension)
+        {
+            // Once the list is full, only whether the distance exceeds its last entry matters
+            float dk = nnList.getMaxDistance();
+            float dist = rowDistance.distanceUpTo(shifted, Row(group.ids[r], row, dimension), dk);
+
+            if (dist < dk)
+            {
+                nnList.insert(group.ids[r], dist);
+            }
+        }
+    }
+
+    /**
+     * @brief Sets the weights of a new group from the std of its individual.
+     */
+    void setWeights(Group &group)
+    {
+        const NumT *std = group.individual->std.values.data();
+        group.weights.resize(dimension);
+        for (size_t i = 0; i < dimension; i++)
+        {
+            group.weights[i] = std[i] * std[i];
+        }
+    }
+
+    /**
+     * @brief Appends the normalized row x' = (x - mean) / std of an object, and its constant term, to its group.
+     */
+    void addNormalized(Group &group, const T &obj)
+    {
+        const NumT *mean = group.individual->mean.values.data();
+        const NumT *std = group.individual->std.values.data();
+        float constant = 0.0f;
+        for (size_t i = 0; i < dimension; i++)
+        {
+            NumT centered = obj[i] - mean[i];
+            if (std[i] != 0)
+            {
+                group.values.push_back(centered / std[i]);
+            }
+            else
+            {
+                group.values.push_back(NumT(0));
+                constant += centered * centered;
+            }
+        }
+        group.constants.push_back(constant);
+    }
+
+    /**
+     * @brief Searches the rows of one individual with the weighted L2 (see the class description).
+     *
+     * @param query The query object.
+     * @param group The individual.
+     * @param nnList The neighbors found so far.
+     */
+    void searchWeighted(const T &query, const Group &group, NNList &nnList) const
+    {
+        const Row weights(0, group.weights.data(), dimension);
+        const Row q(0, &query[0], dimension);
+        const NumT *row = group.values.data();
+        for (size_t r = 0; r < group.ids.size(); r++, row += dimension)
+        {
+            // As EuclideanDistance::distanceUpTo, with the constant of the row taken out of the bound
+            float dk = nnList.getMaxDistance();
+            float constant = group.constants[r];
+            size_t evaluated;
+            float sum = distance_sums::weightedL2SquaredUpTo(weights, q, Row(group.ids[r], row, dimension), dk * dk - constant, evaluated);
+            DistanceFunction<Row>::distanceFunctionCalls++;
+            if (evaluated < dimension)
+            {
+                DistanceFunction<Row>::skippedDimensions += dimension - evaluated;
+                continue;
+            }
+
+            float dist = std::sqrt(sum + constant);
+            if (dist < dk)
+            {
+                nnList.insert(group.ids[r], dist);
+            }
+        }
+    }
+
+    /**
+     * @brief Gets the gap between two rows of an individual, the squared weighted L2 if WEIGHTED.
+     *
+     * Only the order of the gaps matters. The dimensions where std is 0 are left out if WEIGHTED.
+     */
+    float rowGap(const Group &group, const NumT *a, const NumT *b) const
+    {
+        if (WEIGHTED)
+        {
+            size_t evaluated;
+            return distance_sums::weightedL2SquaredUpTo(Row(0, group.weights.data(), dimension), Row(0, a, dimension), Row(0, b, dimension),
+                                                        std::numeric_limits<float>::infinity(), evaluated);
+        }
+        return rowDistance(Row(0, a, dimension), Row(0, b, dimension));
+    }
+
+    /**
+     * @brief Chooses the representatives of an individual: the row closest to the mean, then
+     * repeatedly the row farthest from those already chosen.
+     */
+    void chooseRepresentatives(Group &group, size_t count)
+    {
+        const size_t rows = group.ids.size();
+        group.representatives.clear();
+        count = std::min(count, rows);
+        if (count == 0)
+        {
+            return;
+        }
+
+        // The mean is the origin of the normalized rows
+        std::vector<NumT> origin(dimension, NumT(0));
+        const NumT *mean = WEIGHTED ? origin.data() : group.individual->mean.values.data();
+        std::vector<float> gaps(rows);
+        for (size_t r = 0; r < rows; r++)
+        {
+            gaps[r] = rowGap(group, mean, &group.values[r * dimension]) + (WEIGHTED ? group.constants[r] : 0.0f);
+        }
+        size_t next = std::min_element(gaps.begin(), gaps.end()) - gaps.begin();
+
+        std::fill(gaps.begin(), gaps.end(), std::numeric_limits<float>::infinity());
+        while (group.representatives.size() < count)
+        {
+            group.representatives.push_back(static_cast<uint32_t>(next));
+            const NumT *chosen = &group.values[next * dimension];
+            for (size_t r = 0; r < rows; r++)
+            {
+                gaps[r] = std::min(gaps[r], rowGap(group, chosen, &group.values[r * dimension]));
+            }
+            next = std::max_element(gaps.begin(), gaps.end()) - gaps.begin();
+        }
+
+        const size_t others = rows - count;
+        group.spread = others > 1 ? static_cast<float>(std::sqrt(2.0 * std::log(static_cast<double>(others)))) : 0.0f;
+    }
+
+    /**
+     * @brief Sets the moments of an individual, from its normalized rows.
+     *
+     * With m1..m4 the raw moments of x' in a dimension, the squared distance between q and
+     * a row has, in that dimension, mean w (q^2 - 2 q m1 + m2) and variance
+     * w^2 (4 (m2 - m1^2) q^2 + 4 (m1 m2 - m3) q + m4 - m2^2). Summed over the dimensions,
+     * with the dimensions taken as independent, mu and sigma^2 are then each one dot product
+     * of a row of moments with [q^2, q], plus a constant, which also holds the mean and
+     * the variance of the constants of the rows.
+     */
+    void setMoments(Group &group)
+    {
+        const size_t rows = group.ids.size();
+        group.moments.assign(4 * dimension, NumT(0));
+        double expected = 0.0;
+        double variance = 0.0;
+        for (size_t i = 0; i < dimension; i++)
+        {
+            double m1 = 0.0, m2 = 0.0, m3 = 0.0, m4 = 0.0;
+            for (size_t r = 0; r < rows; r++)
+            {
+                double x = group.values[r * dimension + i];
+                double x2 = x * x;
+                m1 += x;
+                m2 += x2;
+                m3 += x2 * x;
+                m4 += x2 * x2;
+            }
+            m1 /= rows;
+            m2 /= rows;
+            m3 /= rows;
+            m4 /= rows;
+
+            double w = group.weights[i];
+            group.moments[i] = static_cast<NumT>(w);
+            group.moments[dimension + i] = static_cast<NumT>(-2.0 * w * m1);
+            group.moments[2 * dimension + i] = static_cast<NumT>(4.0 * w * w * (m2 - m1 * m1));
+            group.moments[3 * dimension + i] = static_cast<NumT>(4.0 * w * w * (m1 * m2 - m3));
+            expected += w * m2;
+            variance += w * w * (m4 - m2 * m2);
+        }
+
+        double c1 = 0.0, c2 = 0.0;
+        for (float c : group.constants)
+        {
+            c1 += c;
+            c2 += static_cast<double>(c) * c;
+        }
+        c1 /= rows;
+        c2 /= rows;
+        group.expectedBase = static_cast<float>(expected + c1);
+        group.varianceBase = static_cast<float>(variance + c2 - c1 * c1);
+    }
+
+    /**
+     * @brief Estimates the distance between the query and the closest object of an individual, if WEIGHTED.
+     *
+     * @param query The query object.
+     * @param group The individual.
+     * @param terms The squares of the query, then the query.
+     */
+    float estimateWeighted(const T &query, const Group &group, const std::vector<NumT> &terms) const
+    {
+        const Row weights(0, group.weights.data(), dimension);
+        const Row q(0, &query[0], dimension);
+        float best = std::numeric_limits<float>::infinity();
+        for (uint32_t r : group.representatives)
+        {
+            size_t evaluated;
+            float sum = distance_sums::weightedL2SquaredUpTo(weights, q, Row(0, &group.values[r * dimension], dimension),
+                                                             std::numeric_limits<float>::infinity(), evaluated);
+            best = std::min(best, sum + group.constants[r]);
+        }
+
+        if (group.representatives.size() < group.ids.size())
+        {
+            const Row all(0, terms.data(), 2 * dimension);
+            float mu = distance_sums::dot(Row(0, group.moments.data(), 2 * dimension), all) + group.expectedBase;
+            float variance = distance_sums::dot(Row(0, group.moments.data() + 2 * dimension, 2 * dimension), all) + group.varianceBase;
+            best = std::min(best, mu - group.spread * std::sqrt(std::max(variance, 0.0f)));
+        }
+        return std::sqrt(std::max(best, 0.0f));
+    }
+
     std::vector<T> dataObjects; ///< The data objects to be searched.
-    DistanceFunc &distanceFunc; ///< The distance function to evaluate distance between objects.
+    RowDistance rowDistance;    ///< The distance function, over the rows of the groups (see RebindDistance)
+    size_t dimension;           ///< The size of the objects, set by the first one added
+    std::vector<Group> groups;  ///< The objects grouped by individual, in order of first appearance
+    std::unordered_map<const Individual<NumT> *, size_t> groupOf; ///< Position of the group of each individual
+    bool summarized;            ///< Whether the summaries of the groups are up to date (see summarize)
 };
 
-#endif // SHIFT_SEQUENTIAL_SEARCHER_HPP
\ No newline at end of file
+#endif // SHIFT_SEQUENTIAL_SEARCHER_HPP
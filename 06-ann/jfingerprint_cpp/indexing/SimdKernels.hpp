@@ -0,0 +1,1046 @@
+#ifndef SIMD_KERNELS_HPP
+#define SIMD_KERNELS_HPP
+
+#include <cmath>   // For std::fabs, std::sqrt
+#include <cstddef> // For std::size_t
+#include <vector>  // For std::vector
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SIMD_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief Number of dimensions read by the bounded (UpTo) kernels before they first check the bound.
+ *
+ * The next checks come after 2, 4, 8, ... times as many dimensions. Each check costs a
+ * horizontal sum, so checking at a fixed interval slows down the distances that are not
+ * abandoned; doubling the interval keeps the early checks, which save the most, and makes
+ * the number of checks logarithmic in the dimension.
+ */
+const size_t UPTO_FIRST_CHECK = 64;
+
+/**
+ * @brief Instruction set used by a table of kernels.
+ */
+enum class SimdLevel {
+    Scalar,
+    SSE,
+    AVX2,
+    AVX512
+};
+
+/**
+ * @brief Distance kernels over two contiguous float arrays of length n.
+ *
+ * Every instruction set fills the same table, so the metrics call the kernels through
+ * simdKernels() and the choice of instruction set is made only once.
+ *
+ * The UpTo kernels compare the partial result with bound after UPTO_FIRST_CHECK dimensions,
+ * then after twice as many, and so on, and return it as soon as it exceeds bound. They set
+ * evaluated to the number of dimensions read (n if they did not stop early).
+ */
+struct SimdKernels {
+    SimdLevel level;
+    const char* name;
+    float (*l2Squared)(const float* a, const float* b, size_t n);   ///< sum (a_i - b_i)^2
+    float (*l1)(const float* a, const float* b, size_t n);          ///< sum |a_i - b_i|
+    float (*lInf)(const float* a, const float* b, size_t n);        ///< max |a_i - b_i|
+    float (*dot)(const float* a, const float* b, size_t n);         ///< sum a_i b_i
+    void (*cosineTerms)(const float* a, const float* b, size_t n,
+                        float* ab, float* aa, float* bb);           ///< sum a_i b_i, sum a_i^2 and sum b_i^2 in one pass
+    float (*l2SquaredUpTo)(const float* a, const float* b, size_t n, float bound, size_t* evaluated);
+    float (*l1UpTo)(const float* a, const float* b, size_t n, float bound, size_t* evaluated);
+    float (*lInfUpTo)(const float* a, const float* b, size_t n, float bound, size_t* evaluated);
+    float (*weightedL2Squared)(const float* w, const float* a, const float* b, size_t n);  ///< sum w_i (a_i - b_i)^2
+    float (*weightedL2SquaredUpTo)(const float* w, const float* a, const float* b, size_t n, float bound, size_t* evaluated);
+};
+
+namespace simd_detail {
+
+/* ------------------------------------------------------------------------------------------------
+ * Scalar reference
+ * ------------------------------------------------------------------------------------------------ */
+
+inline float l2SquaredScalar(const float* a, const float* b, size_t n) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        float diff = a[i] - b[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+inline float l1Scalar(const float* a, const float* b, size_t n) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        sum += std::fabs(a[i] - b[i]);
+    }
+    return sum;
+}
+
+inline float lInfScalar(const float* a, const float* b, size_t n) {
+    float maxDiff = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        float diff = std::fabs(a[i] - b[i]);
+        if (diff > maxDiff) {
+            maxDiff = diff;
+        }
+    }
+    return maxDiff;
+}
+
+inline float dotScalar(const float* a, const float* b, size_t n) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+inline void cosineTermsScalar(const float* a, const float* b, size_t n, float* ab, float* aa, float* bb) {
+    float sumAB = 0.0f, sumAA = 0.0f, sumBB = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        sumAB += a[i] * b[i];
+        sumAA += a[i] * a[i];
+        sumBB += b[i] * b[i];
+    }
+    *ab = sumAB;
+    *aa = sumAA;
+    *bb = sumBB;
+}
+
+/*
+ * Bounded scalar kernels. The checks come after 64, 128, 256, ... dimensions (see UPTO_FIRST_CHECK).
+ */
+
+inline float l2SquaredUpToScalar(const float* a, const float* b, size_t n, float bound, size_t* evaluated) {
+    float sum = 0.0f;
+    size_t i = 0;
+    for (size_t check = UPTO_FIRST_CHECK; check < n; check *= 2) {
+        sum += l2SquaredScalar(a + i, b + i, check - i);
+        i = check;
+        if (sum > bound) {
+            *evaluated = i;
+            return sum;
+        }
+    }
+    *evaluated = n;
+    return sum + l2SquaredScalar(a + i, b + i, n - i);
+}
+
+inline float l1UpToScalar(const float* a, const float* b, size_t n, float bound, size_t* evaluated) {
+    float sum = 0.0f;
+    size_t i = 0;
+    for (size_t check = UPTO_FIRST_CHECK; check < n; check *= 2) {
+        sum += l1Scalar(a + i, b + i, check - i);
+        i = check;
+        if (sum > bound) {
+            *evaluated = i;
+            return sum;
+        }
+    }
+    *evaluated = n;
+    return sum + l1Scalar(a + i, b + i, n - i);
+}
+
+inline float lInfUpToScalar(const float* a, const float* b, size_t n, float bound, size_t* evaluated) {
+    float maxDiff = 0.0f;
+    size_t i = 0;
+    for (size_t check = UPTO_FIRST_CHECK; check < n; check *= 2) {
+        float blockMax = lInfScalar(a + i, b + i, check - i);
+        maxDiff = blockMax > maxDiff ? blockMax : maxDiff;
+        i = check;
+        if (maxDiff > bound) {
+            *evaluated = i;
+            return maxDiff;
+        }
+    }
+    *evaluated = n;
+    float tail = lInfScalar(a + i, b + i, n - i);
+    return tail > maxDiff ? tail : maxDiff;
+}
+
+inline float weightedL2SquaredScalar(const float* w, const float* a, const float* b, size_t n) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        float diff = a[i] - b[i];
+        sum += w[i] * diff * diff;
+    }
+    return sum;
+}
+
+inline float weightedL2SquaredUpToScalar(const float* w, const float* a, const float* b, size_t n, float bound, size_t* evaluated) {
+    float sum = 0.0f;
+    size_t i = 0;
+    for (size_t check = UPTO_FIRST_CHECK; check < n; check *= 2) {
+        sum += weightedL2SquaredScalar(w + i, a + i, b + i, check - i);
+        i = check;
+        if (sum > bound) {
+            *evaluated = i;
+            return sum;
+        }
+    }
+    *evaluated = n;
+    return sum + weightedL2SquaredScalar(w + i, a + i, b + i, n - i);
+}
+
+#ifdef SIMD_KERNELS_X86
+
+/* ------------------------------------------------------------------------------------------------
+ * SSE: 4 floats per register, 4 accumulators, scalar tail
+ * ------------------------------------------------------------------------------------------------ */
+
+__attribute__((target("sse2"))) inline float hsumSSE(__m128 v) {
+    __m128 shuf = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+    __m128 sums = _mm_add_ps(v, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    return _mm_cvtss_f32(_mm_add_ss(sums, shuf));
+}
+
+__attribute__((target("sse2"))) inline float hmaxSSE(__m128 v) {
+    __m128 shuf = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+    __m128 maxs = _mm_max_ps(v, shuf);
+    shuf = _mm_movehl_ps(shuf, maxs);
+    return _mm_cvtss_f32(_mm_max_ss(maxs, shuf));
+}
+
+__attribute__((target("sse2"))) inline __m128 absSSE(__m128 v) {
+    return _mm_andnot_ps(_mm_set1_ps(-0.0f), v);
+}
+
+__attribute__((target("sse2"))) inline float l2SquaredSSE(const float* a, const float* b, size_t n) {
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps(), acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128 d0 = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+        __m128 d1 = _mm_sub_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4));
+        __m128 d2 = _mm_sub_ps(_mm_loadu_ps(a + i + 8), _mm_loadu_ps(b + i + 8));
+        __m128 d3 = _mm_sub_ps(_mm_loadu_ps(a + i + 12), _mm_loadu_ps(b + i + 12));
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(d0, d0));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(d1, d1));
+        acc2 = _mm_add_ps(acc2, _mm_mul_ps(d2, d2));
+        acc3 = _mm_add_ps(acc3, _mm_mul_ps(d3, d3));
+    }
+    for (; i + 4 <= n; i += 4) {
+        __m128 d = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(d, d));
+    }
+    float sum = hsumSSE(_mm_add_ps(_mm_add_ps(acc0, acc1), _mm_add_ps(acc2, acc3)));
+    return sum + l2SquaredScalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("sse2"))) inline float l1SSE(const float* a, const float* b, size_t n) {
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps(), acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm_add_ps(acc0, absSSE(_mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i))));
+        acc1 = _mm_add_ps(acc1, absSSE(_mm_sub_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4))));
+        acc2 = _mm_add_ps(acc2, absSSE(_mm_sub_ps(_mm_loadu_ps(a + i + 8), _mm_loadu_ps(b + i + 8))));
+        acc3 = _mm_add_ps(acc3, absSSE(_mm_sub_ps(_mm_loadu_ps(a + i + 12), _mm_loadu_ps(b + i + 12))));
+    }
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm_add_ps(acc0, absSSE(_mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i))));
+    }
+    float sum = hsumSSE(_mm_add_ps(_mm_add_ps(acc0, acc1), _mm_add_ps(acc2, acc3)));
+    return sum + l1Scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("sse2"))) inline float lInfSSE(const float* a, const float* b, size_t n) {
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps(), acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm_max_ps(acc0, absSSE(_mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i))));
+        acc1 = _mm_max_ps(acc1, absSSE(_mm_sub_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4))));
+        acc2 = _mm_max_ps(acc2, absSSE(_mm_sub_ps(_mm_loadu_ps(a + i + 8), _mm_loadu_ps(b + i + 8))));
+        acc3 = _mm_max_ps(acc3, absSSE(_mm_sub_ps(_mm_loadu_ps(a + i + 12), _mm_loadu_ps(b + i + 12))));
+    }
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm_max_ps(acc0, absSSE(_mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i))));
+    }
+    float maxDiff = hmaxSSE(_mm_max_ps(_mm_max_ps(acc0, acc1), _mm_max_ps(acc2, acc3)));
+    float tail = lInfScalar(a + i, b + i, n - i);
+    return tail > maxDiff ? tail : maxDiff;
+}
+
+__attribute__((target("sse2"))) inline float dotSSE(const float* a, const float* b, size_t n) {
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps(), acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+        acc2 = _mm_add_ps(acc2, _mm_mul_ps(_mm_loadu_ps(a + i + 8), _mm_loadu_ps(b + i + 8)));
+        acc3 = _mm_add_ps(acc3, _mm_mul_ps(_mm_loadu_ps(a + i + 12), _mm_loadu_ps(b + i + 12)));
+    }
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+    float sum = hsumSSE(_mm_add_ps(_mm_add_ps(acc0, acc1), _mm_add_ps(acc2, acc3)));
+    return sum + dotScalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("sse2"))) inline void cosineTermsSSE(const float* a, const float* b, size_t n, float* ab, float* aa, float* bb) {
+    __m128 accAB0 = _mm_setzero_ps(), accAA0 = _mm_setzero_ps(), accBB0 = _mm_setzero_ps();
+    __m128 accAB1 = _mm_setzero_ps(), accAA1 = _mm_setzero_ps(), accBB1 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128 a0 = _mm_loadu_ps(a + i), b0 = _mm_loadu_ps(b + i);
+        __m128 a1 = _mm_loadu_ps(a + i + 4), b1 = _mm_loadu_ps(b + i + 4);
+        accAB0 = _mm_add_ps(accAB0, _mm_mul_ps(a0, b0));
+        accAA0 = _mm_add_ps(accAA0, _mm_mul_ps(a0, a0));
+        accBB0 = _mm_add_ps(accBB0, _mm_mul_ps(b0, b0));
+        accAB1 = _mm_add_ps(accAB1, _mm_mul_ps(a1, b1));
+        accAA1 = _mm_add_ps(accAA1, _mm_mul_ps(a1, a1));
+        accBB1 = _mm_add_ps(accBB1, _mm_mul_ps(b1, b1));
+    }
+    float tailAB, tailAA, tailBB;
+    cosineTermsScalar(a + i, b + i, n - i, &tailAB, &tailAA, &tailBB);
+    *ab = hsumSSE(_mm_add_ps(accAB0, accAB1)) + tailAB;
+    *aa = hsumSSE(_mm_add_ps(accAA0, accAA1)) + tailAA;
+    *bb = hsumSSE(_mm_add_ps(accBB0, accBB1)) + tailBB;
+}
+
+/*
+ * Bounded SSE kernels: 32 floats per iteration. The check points (64, 128, 256, ...) are all
+ * multiples of 32, so they fall at the end of an iteration. What is left after the last
+ * whole iteration goes to the full kernel.
+ */
+static_assert(UPTO_FIRST_CHECK % 64 == 0, "The bounded SIMD kernels check at the end of whole iterations");
+
+__attribute__((target("sse2"))) inline float l2SquaredUpToSSE(const float* a, const float* b, size_t n, float bound, size_t* evaluated) {
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps(), acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+    size_t i = 0;
+    size_t check = UPTO_FIRST_CHECK;
+    for (; i + 32 <= n; i += 32) {
+        for (size_t j = i; j < i + 32; j += 16) {
+            __m128 d0 = _mm_sub_ps(_mm_loadu_ps(a + j), _mm_loadu_ps(b + j));
+            __m128 d1 = _mm_sub_ps(_mm_loadu_ps(a + j + 4), _mm_loadu_ps(b + j + 4));
+            __m128 d2 = _mm_sub_ps(_mm_loadu_ps(a + j + 8), _mm_loadu_ps(b + j + 8));
+            __m128 d3 = _mm_sub_ps(_mm_loadu_ps(a + j + 12), _mm_loadu_ps(b + j + 12));
+            acc0 = _mm_add_ps(acc0, _mm_mul_ps(d0, d0));
+            acc1 = _mm_add_ps(acc1, _mm_mul_ps(d1, d1));
+            acc2 = _mm_add_ps(acc2, _mm_mul_ps(d2, d2));
+            acc3 = _mm_add_ps(acc3, _mm_mul_ps(d3, d3));
+        }
+        if (i + 32 == check && check < n) {
+            check *= 2;
+            float sum = hsumSSE(_mm_add_ps(_mm_add_ps(acc0, acc1), _mm_add_ps(acc2, acc3)));
+            if (sum > bound) {
+                *evaluated = i + 32;
+                return sum;
+            }
+        }
+    }
+    *evaluated = n;
+    float sum = hsumSSE(_mm_add_ps(_mm_add_ps(acc0, acc1), _mm_add_ps(acc2, acc3)));
+    return i < n ? sum + l2SquaredSSE(a + i, b + i, n - i) : sum;
+}
+
+__attribute__((target("sse2"))) inline float l1UpToSSE(const float* a, const float* b, size_t n, float bound, size_t* evaluated) {
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps(), acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+    size_t i = 0;
+    size_t check = UPTO_FIRST_CHECK;
+    for (; i + 32 <= n; i += 32) {
+        for (size_t j = i; j < i + 32; j += 16) {
+            acc0 = _mm_add_ps(acc0, absSSE(_mm_sub_ps(_mm_loadu_ps(a + j), _mm_loadu_ps(b + j))));
+            acc1 = _mm_add_ps(acc1, absSSE(_mm_sub_ps(_mm_loadu_ps(a + j + 4), _mm_loadu_ps(b + j + 4))));
+            acc2 = _mm_add_ps(acc2, absSSE(_mm_sub_ps(_mm_loadu_ps(a + j + 8), _mm_loadu_ps(b + j + 8))));
+            acc3 = _mm_add_ps(acc3, absSSE(_mm_sub_ps(_mm_loadu_ps(a + j + 12), _mm_loadu_ps(b + j + 12))));
+        }
+        if (i + 32 == check && check < n) {
+            check *= 2;
+            float sum = hsumSSE(_mm_add_ps(_mm_add_ps(acc0, acc1), _mm_add_ps(acc2, acc3)));
+            if (sum > bound) {
+                *evaluated = i + 32;
+                return sum;
+            }
+        }
+    }
+    *evaluated = n;
+    float sum = hsumSSE(_mm_add_ps(_mm_add_ps(acc0, acc1), _mm_add_ps(acc2, acc3)));
+    return i < n ? sum + l1SSE(a + i, b + i, n - i) : sum;
+}
+
+__attribute__((target("sse2"))) inline float lInfUpToSSE(const float* a, const float* b, size_t n, float bound, size_t* evaluated) {
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps(), acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+    size_t i = 0;
+    size_t check = UPTO_FIRST_CHECK;
+    for (; i + 32 <= n; i += 32) {
+        for (size_t j = i; j < i + 32; j += 16) {
+            acc0 = _mm_max_ps(acc0, absSSE(_mm_sub_ps(_mm_loadu_ps(a + j), _mm_loadu_ps(b + j))));
+            acc1 = _mm_max_ps(acc1, absSSE(_mm_sub_ps(_mm_loadu_ps(a + j + 4), _mm_loadu_ps(b + j + 4))));
+            acc2 = _mm_max_ps(acc2, absSSE(_mm_sub_ps(_mm_loadu_ps(a + j + 8), _mm_loadu_ps(b + j + 8))));
+            acc3 = _mm_max_ps(acc3, absSSE(_mm_sub_ps(_mm_loadu_ps(a + j + 12), _mm_loadu_ps(b + j + 12))));
+        }
+        if (i + 32 == check && check < n) {
+            check *= 2;
+            float maxDiff = hmaxSSE(_mm_max_ps(_mm_max_ps(acc0, acc1), _mm_max_ps(acc2, acc3)));
+            if (maxDiff > bound) {
+                *evaluated = i + 32;
+                return maxDiff;
+            }
+        }
+    }
+    *evaluated = n;
+    float maxDiff = hmaxSSE(_mm_max_ps(_mm_max_ps(acc0, acc1), _mm_max_ps(acc2, acc3)));
+    if (i == n) {
+        return maxDiff;
+    }
+    float tail = lInfSSE(a + i, b + i, n - i);
+    return tail > maxDiff ? tail : maxDiff;
+}
+
+__attribute__((target("sse2"))) inline float weightedL2SquaredSSE(const float* w, const float* a, const float* b, size_t n) {
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps(), acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128 d0 = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+        __m128 d1 = _mm_sub_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4));
+        __m128 d2 = _mm_sub_ps(_mm_loadu_ps(a + i + 8), _mm_loadu_ps(b + i + 8));
+        __m128 d3 = _mm_sub_ps(_mm_loadu_ps(a + i + 12), _mm_loadu_ps(b + i + 12));
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(w + i), d0), d0));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(w + i + 4), d1), d1));
+        acc2 = _mm_add_ps(acc2, _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(w + i + 8), d2), d2));
+        acc3 = _mm_add_ps(acc3, _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(w + i + 12), d3), d3));
+    }
+    for (; i + 4 <= n; i += 4) {
+        __m128 d = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(w + i), d), d));
+    }
+    float sum = hsumSSE(_mm_add_ps(_mm_add_ps(acc0, acc1), _mm_add_ps(acc2, acc3)));
+    return sum + weightedL2SquaredScalar(w + i, a + i, b + i, n - i);
+}
+
+__attribute__((target("sse2"))) inline float weightedL2SquaredUpToSSE(const float* w, const float* a, const float* b, size_t n, float bound, size_t* evaluated) {
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps(), acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+    size_t i = 0;
+    size_t check = UPTO_FIRST_CHECK;
+    for (; i + 32 <= n; i += 32) {
+        for (size_t j = i; j < i + 32; j += 16) {
+            __m128 d0 = _mm_sub_ps(_mm_loadu_ps(a + j), _mm_loadu_ps(b + j));
+            __m128 d1 = _mm_sub_ps(_mm_loadu_ps(a + j + 4), _mm_loadu_ps(b + j + 4));
+            __m128 d2 = _mm_sub_ps(_mm_loadu_ps(a + j + 8), _mm_loadu_ps(b + j + 8));
+            __m128 d3 = _mm_sub_ps(_mm_loadu_ps(a + j + 12), _mm_loadu_ps(b + j + 12));
+            acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(w + j), d0), d0));
+            acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(w + j + 4), d1), d1));
+            acc2 = _mm_add_ps(acc2, _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(w + j + 8), d2), d2));
+            acc3 = _mm_add_ps(acc3, _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(w + j + 12), d3), d3));
+        }
+        if (i + 32 == check && check < n) {
+            check *= 2;
+            float sum = hsumSSE(_mm_add_ps(_mm_add_ps(acc0, acc1), _mm_add_ps(acc2, acc3)));
+            if (sum > bound) {
+                *evaluated = i + 32;
+                return sum;
+            }
+        }
+    }
+    *evaluated = n;
+    float sum = hsumSSE(_mm_add_ps(_mm_add_ps(acc0, acc1), _mm_add_ps(acc2, acc3)));
+    return i < n ? sum + weightedL2SquaredSSE(w + i, a + i, b + i, n - i) : sum;
+}
+
+/* ------------------------------------------------------------------------------------------------
+ * AVX2 + FMA: 8 floats per register, 4 accumulators, scalar tail
+ * ------------------------------------------------------------------------------------------------ */
+
+__attribute__((target("avx2,fma"))) inline float hsumAVX(__m256 v) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    return hsumSSE(sum);
+}
+
+__attribute__((target("avx2,fma"))) inline float hmaxAVX(__m256 v) {
+    __m128 maxs = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    return hmaxSSE(maxs);
+}
+
+__attribute__((target("avx2,fma"))) inline __m256 absAVX(__m256 v) {
+    return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), v);
+}
+
+__attribute__((target("avx2,fma"))) inline float l2SquaredAVX2(const float* a, const float* b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(), acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+        __m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16));
+        __m256 d3 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24));
+        acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+        acc2 = _mm256_fmadd_ps(d2, d2, acc2);
+        acc3 = _mm256_fmadd_ps(d3, d3, acc3);
+    }
+    for (; i + 8 <= n; i += 8) {
+        __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        acc0 = _mm256_fmadd_ps(d, d, acc0);
+    }
+    float sum = hsumAVX(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+    return sum + l2SquaredScalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2,fma"))) inline float l1AVX2(const float* a, const float* b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(), acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm256_add_ps(acc0, absAVX(_mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i))));
+        acc1 = _mm256_add_ps(acc1, absAVX(_mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8))));
+        acc2 = _mm256_add_ps(acc2, absAVX(_mm256_sub_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16))));
+        acc3 = _mm256_add_ps(acc3, absAVX(_mm256_sub_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24))));
+    }
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_add_ps(acc0, absAVX(_mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i))));
+    }
+    float sum = hsumAVX(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+    return sum + l1Scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2,fma"))) inline float lInfAVX2(const float* a, const float* b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(), acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm256_max_ps(acc0, absAVX(_mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i))));
+        acc1 = _mm256_max_ps(acc1, absAVX(_mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8))));
+        acc2 = _mm256_max_ps(acc2, absAVX(_mm256_sub_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16))));
+        acc3 = _mm256_max_ps(acc3, absAVX(_mm256_sub_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24))));
+    }
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_max_ps(acc0, absAVX(_mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i))));
+    }
+    float maxDiff = hmaxAVX(_mm256_max_ps(_mm256_max_ps(acc0, acc1), _mm256_max_ps(acc2, acc3)));
+    float tail = lInfScalar(a + i, b + i, n - i);
+    return tail > maxDiff ? tail : maxDiff;
+}
+
+__attribute__((target("avx2,fma"))) inline float dotAVX2(const float* a, const float* b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(), acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+        acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16), acc2);
+        acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24), acc3);
+    }
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    float sum = hsumAVX(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+    return sum + dotScalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2,fma"))) inline void cosineTermsAVX2(const float* a, const float* b, size_t n, float* ab, float* aa, float* bb) {
+    __m256 accAB0 = _mm256_setzero_ps(), accAA0 = _mm256_setzero_ps(), accBB0 = _mm256_setzero_ps();
+    __m256 accAB1 = _mm256_setzero_ps(), accAA1 = _mm256_setzero_ps(), accBB1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256 a0 = _mm256_loadu_ps(a + i), b0 = _mm256_loadu_ps(b + i);
+        __m256 a1 = _mm256_loadu_ps(a + i + 8), b1 = _mm256_loadu_ps(b + i + 8);
+        accAB0 = _mm256_fmadd_ps(a0, b0, accAB0);
+        accAA0 = _mm256_fmadd_ps(a0, a0, accAA0);
+        accBB0 = _mm256_fmadd_ps(b0, b0, accBB0);
+        accAB1 = _mm256_fmadd_ps(a1, b1, accAB1);
+        accAA1 = _mm256_fmadd_ps(a1, a1, accAA1);
+        accBB1 = _mm256_fmadd_ps(b1, b1, accBB1);
+    }
+    float tailAB, tailAA, tailBB;
+    cosineTermsScalar(a + i, b + i, n - i, &tailAB, &tailAA, &tailBB);
+    *ab = hsumAVX(_mm256_add_ps(accAB0, accAB1)) + tailAB;
+    *aa = hsumAVX(_mm256_add_ps(accAA0, accAA1)) + tailAA;
+    *bb = hsumAVX(_mm256_add_ps(accBB0, accBB1)) + tailBB;
+}
+
+/*
+ * Bounded AVX2 kernels: 32 floats per iteration, as the SSE ones.
+ */
+
+__attribute__((target("avx2,fma"))) inline float l2SquaredUpToAVX2(const float* a, const float* b, size_t n, float bound, size_t* evaluated) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(), acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    size_t i = 0;
+    size_t check = UPTO_FIRST_CHECK;
+    for (; i + 32 <= n; i += 32) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+        __m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16));
+        __m256 d3 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24));
+        acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+        acc2 = _mm256_fmadd_ps(d2, d2, acc2);
+        acc3 = _mm256_fmadd_ps(d3, d3, acc3);
+        if (i + 32 == check && check < n) {
+            check *= 2;
+            float sum = hsumAVX(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+            if (sum > bound) {
+                *evaluated = i + 32;
+                return sum;
+            }
+        }
+    }
+    *evaluated = n;
+    float sum = hsumAVX(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+    return i < n ? sum + l2SquaredAVX2(a + i, b + i, n - i) : sum;
+}
+
+__attribute__((target("avx2,fma"))) inline float l1UpToAVX2(const float* a, const float* b, size_t n, float bound, size_t* evaluated) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(), acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    size_t i = 0;
+    size_t check = UPTO_FIRST_CHECK;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm256_add_ps(acc0, absAVX(_mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i))));
+        acc1 = _mm256_add_ps(acc1, absAVX(_mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8))));
+        acc2 = _mm256_add_ps(acc2, absAVX(_mm256_sub_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16))));
+        acc3 = _mm256_add_ps(acc3, absAVX(_mm256_sub_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24))));
+        if (i + 32 == check && check < n) {
+            check *= 2;
+            float sum = hsumAVX(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+            if (sum > bound) {
+                *evaluated = i + 32;
+                return sum;
+            }
+        }
+    }
+    *evaluated = n;
+    float sum = hsumAVX(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+    return i < n ? sum + l1AVX2(a + i, b + i, n - i) : sum;
+}
+
+__attribute__((target("avx2,fma"))) inline float lInfUpToAVX2(const float* a, const float* b, size_t n, float bound, size_t* evaluated) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(), acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    size_t i = 0;
+    size_t check = UPTO_FIRST_CHECK;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm256_max_ps(acc0, absAVX(_mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i))));
+        acc1 = _mm256_max_ps(acc1, absAVX(_mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8))));
+        acc2 = _mm256_max_ps(acc2, absAVX(_mm256_sub_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16))));
+        acc3 = _mm256_max_ps(acc3, absAVX(_mm256_sub_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24))));
+        if (i + 32 == check && check < n) {
+            check *= 2;
+            float maxDiff = hmaxAVX(_mm256_max_ps(_mm256_max_ps(acc0, acc1), _mm256_max_ps(acc2, acc3)));
+            if (maxDiff > bound) {
+                *evaluated = i + 32;
+                return maxDiff;
+            }
+        }
+    }
+    *evaluated = n;
+    float maxDiff = hmaxAVX(_mm256_max_ps(_mm256_max_ps(acc0, acc1), _mm256_max_ps(acc2, acc3)));
+    if (i == n) {
+        return maxDiff;
+    }
+    float tail = lInfAVX2(a + i, b + i, n - i);
+    return tail > maxDiff ? tail : maxDiff;
+}
+
+__attribute__((target("avx2,fma"))) inline float weightedL2SquaredAVX2(const float* w, const float* a, const float* b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(), acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+        __m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16));
+        __m256 d3 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24));
+        acc0 = _mm256_fmadd_ps(_mm256_mul_ps(_mm256_loadu_ps(w + i), d0), d0, acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_mul_ps(_mm256_loadu_ps(w + i + 8), d1), d1, acc1);
+        acc2 = _mm256_fmadd_ps(_mm256_mul_ps(_mm256_loadu_ps(w + i + 16), d2), d2, acc2);
+        acc3 = _mm256_fmadd_ps(_mm256_mul_ps(_mm256_loadu_ps(w + i + 24), d3), d3, acc3);
+    }
+    for (; i + 8 <= n; i += 8) {
+        __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        acc0 = _mm256_fmadd_ps(_mm256_mul_ps(_mm256_loadu_ps(w + i), d), d, acc0);
+    }
+    float sum = hsumAVX(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+    return sum + weightedL2SquaredScalar(w + i, a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2,fma"))) inline float weightedL2SquaredUpToAVX2(const float* w, const float* a, const float* b, size_t n, float bound, size_t* evaluated) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(), acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    size_t i = 0;
+    size_t check = UPTO_FIRST_CHECK;
+    for (; i + 32 <= n; i += 32) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+        __m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16));
+        __m256 d3 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24));
+        acc0 = _mm256_fmadd_ps(_mm256_mul_ps(_mm256_loadu_ps(w + i), d0), d0, acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_mul_ps(_mm256_loadu_ps(w + i + 8), d1), d1, acc1);
+        acc2 = _mm256_fmadd_ps(_mm256_mul_ps(_mm256_loadu_ps(w + i + 16), d2), d2, acc2);
+        acc3 = _mm256_fmadd_ps(_mm256_mul_ps(_mm256_loadu_ps(w + i + 24), d3), d3, acc3);
+        if (i + 32 == check && check < n) {
+            check *= 2;
+            float sum = hsumAVX(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+            if (sum > bound) {
+                *evaluated = i + 32;
+                return sum;
+            }
+        }
+    }
+    *evaluated = n;
+    float sum = hsumAVX(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+    return i < n ? sum + weightedL2SquaredAVX2(w + i, a + i, b + i, n - i) : sum;
+}
+
+/* ------------------------------------------------------------------------------------------------
+ * AVX-512F: 16 floats per register, 4 accumulators, masked tail
+ * ------------------------------------------------------------------------------------------------ */
+
+// GCC 12 warns about the _mm512_undefined_ps() inside its own AVX-512 intrinsics
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx512f"))) inline __mmask16 tailMask(size_t remaining) {
+    return static_cast<__mmask16>((1u << remaining) - 1u);
+}
+
+__attribute__((target("avx512f"))) inline __m512 abs512(__m512 v) {
+    return _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(v), _mm512_set1_epi32(0x7fffffff)));
+}
+
+__attribute__((target("avx512f"))) inline float l2SquaredAVX512(const float* a, const float* b, size_t n) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps(), acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+        __m512 d2 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 32), _mm512_loadu_ps(b + i + 32));
+        __m512 d3 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 48), _mm512_loadu_ps(b + i + 48));
+        acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+        acc2 = _mm512_fmadd_ps(d2, d2, acc2);
+        acc3 = _mm512_fmadd_ps(d3, d3, acc3);
+    }
+    for (; i + 16 <= n; i += 16) {
+        __m512 d = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        acc0 = _mm512_fmadd_ps(d, d, acc0);
+    }
+    if (i < n) {
+        __mmask16 mask = tailMask(n - i);
+        __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i));
+        acc1 = _mm512_fmadd_ps(d, d, acc1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3)));
+}
+
+__attribute__((target("avx512f"))) inline float l1AVX512(const float* a, const float* b, size_t n) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps(), acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        acc0 = _mm512_add_ps(acc0, abs512(_mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i))));
+        acc1 = _mm512_add_ps(acc1, abs512(_mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16))));
+        acc2 = _mm512_add_ps(acc2, abs512(_mm512_sub_ps(_mm512_loadu_ps(a + i + 32), _mm512_loadu_ps(b + i + 32))));
+        acc3 = _mm512_add_ps(acc3, abs512(_mm512_sub_ps(_mm512_loadu_ps(a + i + 48), _mm512_loadu_ps(b + i + 48))));
+    }
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm512_add_ps(acc0, abs512(_mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i))));
+    }
+    if (i < n) {
+        __mmask16 mask = tailMask(n - i);
+        acc1 = _mm512_add_ps(acc1, abs512(_mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i))));
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3)));
+}
+
+__attribute__((target("avx512f"))) inline float lInfAVX512(const float* a, const float* b, size_t n) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps(), acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        acc0 = _mm512_max_ps(acc0, abs512(_mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i))));
+        acc1 = _mm512_max_ps(acc1, abs512(_mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16))));
+        acc2 = _mm512_max_ps(acc2, abs512(_mm512_sub_ps(_mm512_loadu_ps(a + i + 32), _mm512_loadu_ps(b + i + 32))));
+        acc3 = _mm512_max_ps(acc3, abs512(_mm512_sub_ps(_mm512_loadu_ps(a + i + 48), _mm512_loadu_ps(b + i + 48))));
+    }
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm512_max_ps(acc0, abs512(_mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i))));
+    }
+    if (i < n) {
+        __mmask16 mask = tailMask(n - i);
+        acc1 = _mm512_max_ps(acc1, abs512(_mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i))));
+    }
+    return _mm512_reduce_max_ps(_mm512_max_ps(_mm512_max_ps(acc0, acc1), _mm512_max_ps(acc2, acc3)));
+}
+
+__attribute__((target("avx512f"))) inline float dotAVX512(const float* a, const float* b, size_t n) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps(), acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+        acc2 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 32), _mm512_loadu_ps(b + i + 32), acc2);
+        acc3 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 48), _mm512_loadu_ps(b + i + 48), acc3);
+    }
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+    }
+    if (i < n) {
+        __mmask16 mask = tailMask(n - i);
+        acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i), acc1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3)));
+}
+
+__attribute__((target("avx512f"))) inline void cosineTermsAVX512(const float* a, const float* b, size_t n, float* ab, float* aa, float* bb) {
+    __m512 accAB0 = _mm512_setzero_ps(), accAA0 = _mm512_setzero_ps(), accBB0 = _mm512_setzero_ps();
+    __m512 accAB1 = _mm512_setzero_ps(), accAA1 = _mm512_setzero_ps(), accBB1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m512 a0 = _mm512_loadu_ps(a + i), b0 = _mm512_loadu_ps(b + i);
+        __m512 a1 = _mm512_loadu_ps(a + i + 16), b1 = _mm512_loadu_ps(b + i + 16);
+        accAB0 = _mm512_fmadd_ps(a0, b0, accAB0);
+        accAA0 = _mm512_fmadd_ps(a0, a0, accAA0);
+        accBB0 = _mm512_fmadd_ps(b0, b0, accBB0);
+        accAB1 = _mm512_fmadd_ps(a1, b1, accAB1);
+        accAA1 = _mm512_fmadd_ps(a1, a1, accAA1);
+        accBB1 = _mm512_fmadd_ps(b1, b1, accBB1);
+    }
+    for (; i < n; i += 16) {
+        __mmask16 mask = n - i >= 16 ? static_cast<__mmask16>(0xffff) : tailMask(n - i);
+        __m512 a0 = _mm512_maskz_loadu_ps(mask, a + i), b0 = _mm512_maskz_loadu_ps(mask, b + i);
+        accAB0 = _mm512_fmadd_ps(a0, b0, accAB0);
+        accAA0 = _mm512_fmadd_ps(a0, a0, accAA0);
+        accBB0 = _mm512_fmadd_ps(b0, b0, accBB0);
+    }
+    *ab = _mm512_reduce_add_ps(_mm512_add_ps(accAB0, accAB1));
+    *aa = _mm512_reduce_add_ps(_mm512_add_ps(accAA0, accAA1));
+    *bb = _mm512_reduce_add_ps(_mm512_add_ps(accBB0, accBB1));
+}
+
+/*
+ * Bounded AVX-512 kernels: the full kernels with a check at the end of the 64-float
+ * iterations. The check points are multiples of 64, so none falls in the tail.
+ */
+
+__attribute__((target("avx512f"))) inline float l2SquaredUpToAVX512(const float* a, const float* b, size_t n, float bound, size_t* evaluated) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps(), acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+    size_t i = 0;
+    size_t check = UPTO_FIRST_CHECK;
+    for (; i + 64 <= n; i += 64) {
+        __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+        __m512 d2 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 32), _mm512_loadu_ps(b + i + 32));
+        __m512 d3 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 48), _mm512_loadu_ps(b + i + 48));
+        acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+        acc2 = _mm512_fmadd_ps(d2, d2, acc2);
+        acc3 = _mm512_fmadd_ps(d3, d3, acc3);
+        if (i + 64 == check && check < n) {
+            check *= 2;
+            float sum = _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3)));
+            if (sum > bound) {
+                *evaluated = i + 64;
+                return sum;
+            }
+        }
+    }
+    for (; i + 16 <= n; i += 16) {
+        __m512 d = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        acc0 = _mm512_fmadd_ps(d, d, acc0);
+    }
+    if (i < n) {
+        __mmask16 mask = tailMask(n - i);
+        __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i));
+        acc1 = _mm512_fmadd_ps(d, d, acc1);
+    }
+    *evaluated = n;
+    return _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3)));
+}
+
+__attribute__((target("avx512f"))) inline float l1UpToAVX512(const float* a, const float* b, size_t n, float bound, size_t* evaluated) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps(), acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+    size_t i = 0;
+    size_t check = UPTO_FIRST_CHECK;
+    for (; i + 64 <= n; i += 64) {
+        acc0 = _mm512_add_ps(acc0, abs512(_mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i))));
+        acc1 = _mm512_add_ps(acc1, abs512(_mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16))));
+        acc2 = _mm512_add_ps(acc2, abs512(_mm512_sub_ps(_mm512_loadu_ps(a + i + 32), _mm512_loadu_ps(b + i + 32))));
+        acc3 = _mm512_add_ps(acc3, abs512(_mm512_sub_ps(_mm512_loadu_ps(a + i + 48), _mm512_loadu_ps(b + i + 48))));
+        if (i + 64 == check && check < n) {
+            check *= 2;
+            float sum = _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3)));
+            if (sum > bound) {
+                *evaluated = i + 64;
+                return sum;
+            }
+        }
+    }
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm512_add_ps(acc0, abs512(_mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i))));
+    }
+    if (i < n) {
+        __mmask16 mask = tailMask(n - i);
+        acc1 = _mm512_add_ps(acc1, abs512(_mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i))));
+    }
+    *evaluated = n;
+    return _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3)));
+}
+
+__attribute__((target("avx512f"))) inline float lInfUpToAVX512(const float* a, const float* b, size_t n, float bound, size_t* evaluated) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps(), acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+    size_t i = 0;
+    size_t check = UPTO_FIRST_CHECK;
+    for (; i + 64 <= n; i += 64) {
+        acc0 = _mm512_max_ps(acc0, abs512(_mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i))));
+        acc1 = _mm512_max_ps(acc1, abs512(_mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16))));
+        acc2 = _mm512_max_ps(acc2, abs512(_mm512_sub_ps(_mm512_loadu_ps(a + i + 32), _mm512_loadu_ps(b + i + 32))));
+        acc3 = _mm512_max_ps(acc3, abs512(_mm512_sub_ps(_mm512_loadu_ps(a + i + 48), _mm512_loadu_ps(b + i + 48))));
+        if (i + 64 == check && check < n) {
+            check *= 2;
+            float maxDiff = _mm512_reduce_max_ps(_mm512_max_ps(_mm512_max_ps(acc0, acc1), _mm512_max_ps(acc2, acc3)));
+            if (maxDiff > bound) {
+                *evaluated = i + 64;
+                return maxDiff;
+            }
+        }
+    }
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm512_max_ps(acc0, abs512(_mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i))));
+    }
+    if (i < n) {
+        __mmask16 mask = tailMask(n - i);
+        acc1 = _mm512_max_ps(acc1, abs512(_mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i))));
+    }
+    *evaluated = n;
+    return _mm512_reduce_max_ps(_mm512_max_ps(_mm512_max_ps(acc0, acc1), _mm512_max_ps(acc2, acc3)));
+}
+
+__attribute__((target("avx512f"))) inline float weightedL2SquaredAVX512(const float* w, const float* a, const float* b, size_t n) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps(), acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+        __m512 d2 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 32), _mm512_loadu_ps(b + i + 32));
+        __m512 d3 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 48), _mm512_loadu_ps(b + i + 48));
+        acc0 = _mm512_fmadd_ps(_mm512_mul_ps(_mm512_loadu_ps(w + i), d0), d0, acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_mul_ps(_mm512_loadu_ps(w + i + 16), d1), d1, acc1);
+        acc2 = _mm512_fmadd_ps(_mm512_mul_ps(_mm512_loadu_ps(w + i + 32), d2), d2, acc2);
+        acc3 = _mm512_fmadd_ps(_mm512_mul_ps(_mm512_loadu_ps(w + i + 48), d3), d3, acc3);
+    }
+    for (; i + 16 <= n; i += 16) {
+        __m512 d = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        acc0 = _mm512_fmadd_ps(_mm512_mul_ps(_mm512_loadu_ps(w + i), d), d, acc0);
+    }
+    if (i < n) {
+        __mmask16 mask = tailMask(n - i);
+        __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i));
+        acc1 = _mm512_fmadd_ps(_mm512_mul_ps(_mm512_maskz_loadu_ps(mask, w + i), d), d, acc1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3)));
+}
+
+__attribute__((target("avx512f"))) inline float weightedL2SquaredUpToAVX512(const float* w, const float* a, const float* b, size_t n, float bound, size_t* evaluated) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps(), acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+    size_t i = 0;
+    size_t check = UPTO_FIRST_CHECK;
+    for (; i + 64 <= n; i += 64) {
+        __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+        __m512 d2 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 32), _mm512_loadu_ps(b + i + 32));
+        __m512 d3 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 48), _mm512_loadu_ps(b + i + 48));
+        acc0 = _mm512_fmadd_ps(_mm512_mul_ps(_mm512_loadu_ps(w + i), d0), d0, acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_mul_ps(_mm512_loadu_ps(w + i + 16), d1), d1, acc1);
+        acc2 = _mm512_fmadd_ps(_mm512_mul_ps(_mm512_loadu_ps(w + i + 32), d2), d2, acc2);
+        acc3 = _mm512_fmadd_ps(_mm512_mul_ps(_mm512_loadu_ps(w + i + 48), d3), d3, acc3);
+        if (i + 64 == check && check < n) {
+            check *= 2;
+            float sum = _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3)));
+            if (sum > bound) {
+                *evaluated = i + 64;
+                return sum;
+            }
+        }
+    }
+    for (; i + 16 <= n; i += 16) {
+        __m512 d = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        acc0 = _mm512_fmadd_ps(_mm512_mul_ps(_mm512_loadu_ps(w + i), d), d, acc0);
+    }
+    if (i < n) {
+        __mmask16 mask = tailMask(n - i);
+        __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i));
+        acc1 = _mm512_fmadd_ps(_mm512_mul_ps(_mm512_maskz_loadu_ps(mask, w + i), d), d, acc1);
+    }
+    *evaluated = n;
+    return _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3)));
+}
+
+#pragma GCC diagnostic pop
+
+#endif // SIMD_KERNELS_X86
+
+} // namespace simd_detail
+
+/**
+ * @brief Checks if the CPU (and the OS) supports an instruction set.
+ *
+ * Uses CPUID through __builtin_cpu_supports, which also checks that the OS saves the
+ * AVX/AVX-512 registers.
+ */
+inline bool simdLevelSupported(SimdLevel level) {
+    switch (level) {
+    case SimdLevel::Scalar:
+        return true;
+#ifdef SIMD_KERNELS_X86
+    case SimdLevel::SSE:
+        return __builtin_cpu_supports("sse2");
+    case SimdLevel::AVX2:
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    case SimdLevel::AVX512:
+        return __builtin_cpu_supports("avx512f");
+#endif
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief Gets the kernels of an instruction set. The caller must check simdLevelSupported first.
+ */
+inline const SimdKernels& simdKernelsFor(SimdLevel level) {
+    using namespace simd_detail;
+    static const SimdKernels scalar = {SimdLevel::Scalar, "scalar", l2SquaredScalar, l1Scalar, lInfScalar, dotScalar, cosineTermsScalar,
+                                       l2SquaredUpToScalar, l1UpToScalar, lInfUpToScalar,
+                                       weightedL2SquaredScalar, weightedL2SquaredUpToScalar};
+#ifdef SIMD_KERNELS_X86
+    static const SimdKernels sse = {SimdLevel::SSE, "sse", l2SquaredSSE, l1SSE, lInfSSE, dotSSE, cosineTermsSSE,
+                                    l2SquaredUpToSSE, l1UpToSSE, lInfUpToSSE, weightedL2SquaredSSE, weightedL2SquaredUpToSSE};
+    static const SimdKernels avx2 = {SimdLevel::AVX2, "avx2", l2SquaredAVX2, l1AVX2, lInfAVX2, dotAVX2, cosineTermsAVX2,
+                                     l2SquaredUpToAVX2, l1UpToAVX2, lInfUpToAVX2, weightedL2SquaredAVX2, weightedL2SquaredUpToAVX2};
+    static const SimdKernels avx512 = {SimdLevel::AVX512, "avx512", l2SquaredAVX512, l1AVX512, lInfAVX512, dotAVX512, cosineTermsAVX512,
+                                       l2SquaredUpToAVX512, l1UpToAVX512, lInfUpToAVX512,
+                                       weightedL2SquaredAVX512, weightedL2SquaredUpToAVX512};
+    switch (level) {
+    case SimdLevel::SSE:
+        return sse;
+    case SimdLevel::AVX2:
+        return avx2;
+    case SimdLevel::AVX512:
+        return avx512;
+    default:
+        break;
+    }
+#endif
+    return scalar;
+}
+
+/**
+ * @brief Gets the instruction sets supported by this CPU, from the slowest to the fastest.
+ */
+inline std::vector<SimdLevel> supportedSimdLevels() {
+    std::vector<SimdLevel> levels;
+    for (SimdLevel level : {SimdLevel::Scalar, SimdLevel::SSE, SimdLevel::AVX2, SimdLevel::AVX512}) {
+        if (simdLevelSupported(level)) {
+            levels.push_back(level);
+        }
+    }
+    return levels;
+}
+
+/**
+ * @brief Gets the kernels of the best instruction set of this CPU.
+ *
+ * The CPU is queried on the first call only.
+ */
+inline const SimdKernels& simdKernels() {
+    static const SimdKernels& best = simdKernelsFor(supportedSimdLevels().back());
+    return best;
+}
+
+#endif // SIMD_KERNELS_HPP
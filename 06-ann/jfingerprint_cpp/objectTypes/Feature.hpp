@@ -185,6 +185,21 @@ public:
         return id;
     }
 
+    /**
+     * @brief Reserves a contiguous range of identifiers, for Features built without a constructor that assigns one.
+     *
+     * Not thread safe, like the constructors: reserve the range first, then assign
+     * it from any thread.
+     *
+     * @param count Number of identifiers to reserve.
+     * @return The first identifier of the range, which ends before first + count.
+     */
+    static uint32_t reserveIds(uint32_t count) {
+        uint32_t first = nextId;
+        nextId += count;
+        return first;
+    }
+
     /**
      * @brief Overload of the equality operator to compare Features by their ID.
      * @param other Feature to be compared.
@@ -0,0 +1,203 @@
+#ifndef FEATURE_MATRIX_HPP
+#define FEATURE_MATRIX_HPP
+
+#include <vector>
+#include <string>
+#include <memory>    // For std::unique_ptr, std::shared_ptr
+#include <new>       // For std::bad_alloc
+#include <cstdlib>   // For std::aligned_alloc, std::free
+#include <cstring>   // For std::memset
+#include <cstdint>   // For uint32_t
+#include <fstream>
+#include <typeindex> // For std::type_index
+#include <stdexcept>
+#include <algorithm> // For std::min
+#include <limits>    // For std::numeric_limits
+#include "FeatureView.hpp"
+#include "../includes/MappedFile.hpp"
+#include "../includes/npy.hpp"
+
+/**
+ * @brief A set of features of the same dimension stored as one row-major matrix.
+ *
+ * The rows live in a single buffer aligned to ALIGNMENT bytes, or directly
+ * in a memory mapped .npy file, so building the matrix does not allocate per row. The
+ * searchers index the rows through FeatureViews (see views()), which point into the matrix:
+ * the matrix must outlive them.
+ *
+ * Rows can be padded to a multiple of the alignment (the stride), so that every row starts
+ * on its own cache line. The padding is zero and is not part of the views.
+ *
+ * @tparam NumT Type of the values of the features.
+ */
+template <typename NumT>
+class FeatureMatrix {
+public:
+    static constexpr size_t ALIGNMENT = 64; ///< Alignment of the buffer and of padded rows, in bytes
+
+    /**
+     * @brief Constructs an empty matrix.
+     */
+    FeatureMatrix() : data(nullptr), numRows(0), numColumns(0), rowStride(0) {}
+
+    /**
+     * @brief Constructs a matrix of zeros.
+     *
+     * @param rows Number of rows (features).
+     * @param dimension Number of columns (values of each feature).
+     * @param padded If true, the stride is rounded up so that every row is aligned.
+     */
+    FeatureMatrix(size_t rows, size_t dimension, bool padded = false)
+        : numRows(rows), numColumns(dimension), rowStride(padded ? paddedStride(dimension) : dimension) {
+        // aligned_alloc needs a multiple of the alignment
+        size_t bytes = (numRows * rowStride * sizeof(NumT) + ALIGNMENT) / ALIGNMENT * ALIGNMENT;
+        buffer.reset(static_cast<NumT*>(std::aligned_alloc(ALIGNMENT, bytes)));
+        if (!buffer) {
+            throw std::bad_alloc();
+        }
+        std::memset(buffer.get(), 0, bytes);
+        data = buffer.get();
+    }
+
+    FeatureMatrix(FeatureMatrix&&) = default;
+    FeatureMatrix& operator=(FeatureMatrix&&) = default;
+    FeatureMatrix(const FeatureMatrix&) = delete;
+    FeatureMatrix& operator=(const FeatureMatrix&) = delete;
+
+    /**
+     * @brief Loads a 2-d, C-ordered .npy file.
+     *
+     * If the rows need no padding and the data starts at an aligned offset of the file
+     * (numpy aligns it to 64 bytes), the file is memory mapped and used in place. Otherwise
+     * the rows are read into the buffer: with a single read, or one read per row when padded.
+     *
+     * @param path The path of the file.
+     * @param maxRows Only the first maxRows rows are used.
+     * @param padded If true, the stride is rounded up so that every row is aligned.
+     * @return The matrix.
+     * @throws std::runtime_error if the file cannot be read or is not a 2-d array of NumT.
+     */
+    static FeatureMatrix fromNpy(const std::string& path, size_t maxRows = std::numeric_limits<size_t>::max(), bool padded = false) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            throw std::runtime_error("Cannot open " + path);
+        }
+        npy::header_t header = npy::parse_header(npy::read_header(in));
+        if (header.dtype.tie() != npy::dtype_map.at(std::type_index(typeid(NumT))).tie() || header.fortran_order || header.shape.size() != 2) {
+            throw std::runtime_error(path + " is not a C-ordered 2-d array of the matrix type");
+        }
+        size_t offset = static_cast<size_t>(in.tellg());
+        size_t rows = std::min<size_t>(header.shape[0], maxRows);
+        size_t dimension = header.shape[1];
+        size_t bytes = rows * dimension * sizeof(NumT);
+
+        if (!padded && bytes > 0 && offset % ALIGNMENT == 0) {
+            FeatureMatrix matrix;
+            matrix.file = std::make_shared<MappedFile>(path);
+            if (matrix.file->size() < offset + bytes) {
+                throw std::runtime_error(path + " is truncated");
+            }
+            matrix.data = reinterpret_cast<NumT*>(matrix.file->getData() + offset);
+            matrix.numRows = rows;
+            matrix.numColumns = matrix.rowStride = dimension;
+            return matrix;
+        }
+
+        FeatureMatrix matrix(rows, dimension, padded);
+        if (matrix.rowStride == dimension) {
+            in.read(reinterpret_cast<char*>(matrix.data), static_cast<std::streamsize>(bytes));
+        } else {
+            for (size_t i = 0; i < rows && in; i++) {
+                in.read(reinterpret_cast<char*>(matrix.row(i)), static_cast<std::streamsize>(dimension * sizeof(NumT)));
+            }
+        }
+        if (!in) {
+            throw std::runtime_error(path + " is truncated");
+        }
+        return matrix;
+    }
+
+    /**
+     * @brief Returns the number of rows (features).
+     */
+    size_t rows() const {
+        return numRows;
+    }
+
+    /**
+     * @brief Returns the number of columns (the dimension of the features).
+     */
+    size_t dimension() const {
+        return numColumns;
+    }
+
+    /**
+     * @brief Returns the distance, in values, between the starts of two consecutive rows.
+     */
+    size_t stride() const {
+        return rowStride;
+    }
+
+    /**
+     * @brief Returns true if the rows are read in place from a memory mapped file.
+     */
+    bool isMapped() const {
+        return file != nullptr;
+    }
+
+    /**
+     * @brief Returns the values of a row.
+     * @param i Index of the row.
+     */
+    NumT* row(size_t i) {
+        return data + i * rowStride;
+    }
+
+    /**
+     * @brief Returns the values of a row (const version).
+     * @param i Index of the row.
+     */
+    const NumT* row(size_t i) const {
+        return data + i * rowStride;
+    }
+
+    /**
+     * @brief Returns a view of a row, whose id is the index of the row.
+     * @param i Index of the row.
+     */
+    FeatureView<NumT> view(size_t i) const {
+        return FeatureView<NumT>(static_cast<uint32_t>(i), row(i), numColumns);
+    }
+
+    /**
+     * @brief Returns a view of every row, in order, to be indexed by a searcher.
+     */
+    std::vector<FeatureView<NumT>> views() const {
+        std::vector<FeatureView<NumT>> rowViews;
+        rowViews.reserve(numRows);
+        for (size_t i = 0; i < numRows; i++) {
+            rowViews.push_back(view(i));
+        }
+        return rowViews;
+    }
+
+private:
+    struct AlignedFree {
+        void operator()(NumT* p) const { std::free(p); }
+    };
+
+    // Smallest multiple of the alignment (in values) that holds a row
+    static size_t paddedStride(size_t dimension) {
+        const size_t valuesPerLine = ALIGNMENT / sizeof(NumT);
+        return (dimension + valuesPerLine - 1) / valuesPerLine * valuesPerLine;
+    }
+
+    std::unique_ptr<NumT, AlignedFree> buffer;   ///< The rows, unless the matrix is mapped
+    std::shared_ptr<MappedFile> file;            ///< The mapped .npy file, if the rows are read in place
+    NumT* data;                                  ///< The first row
+    size_t numRows;                              ///< Number of rows
+    size_t numColumns;                           ///< Number of values of each row
+    size_t rowStride;                            ///< Distance between the starts of consecutive rows, in values
+};
+
+#endif // FEATURE_MATRIX_HPP
@@ -70,6 +70,42 @@ public:
         std = Feature<NumT>(0, stdValues);
     }
 
+    /**
+     * @brief Calculates the mean and the standard deviation features of the Individual in one pass.
+     *
+     * Uses Welford's update, in double precision: the same statistics as calculateMean and
+     * calculateStd, without reading the features twice.
+     *
+     * @param features Pointer to the first feature.
+     * @param count Number of features.
+     */
+    void calculateMeanStd(const Feature<NumT>* features, size_t count) {
+        if (count == 0) return;
+
+        size_t featureSize = features[0].size();
+        std::vector<double> meanValues(featureSize, 0.0);
+        std::vector<double> squares(featureSize, 0.0); // Sum of squared differences to the mean
+
+        for (size_t n = 0; n < count; ++n) {
+            const Feature<NumT>& feature = features[n];
+            for (size_t i = 0; i < featureSize; ++i) {
+                double delta = feature[i] - meanValues[i];
+                meanValues[i] += delta / (n + 1);
+                squares[i] += delta * (feature[i] - meanValues[i]);
+            }
+        }
+
+        std::vector<NumT> meanOut(featureSize);
+        std::vector<NumT> stdOut(featureSize);
+        for (size_t i = 0; i < featureSize; ++i) {
+            meanOut[i] = static_cast<NumT>(meanValues[i]);
+            stdOut[i] = static_cast<NumT>(std::sqrt(squares[i] / count));
+        }
+
+        mean = Feature<NumT>(0, meanOut);
+        std = Feature<NumT>(0, stdOut);
+    }
+
     void print() const {
         std::cout << "Individual: " << name << "\n";
         std::cout << "ID: " << id << "\n";
@@ -35,9 +35,9 @@ int main(){
     // 4. Perform the queries
     std::vector<feature> queries = loadNpy("C:/Users/jfcmp/Documentos/Griaule/data/teste1/queries.npy", true);
 
-    std::vector<NNList<feature>> results;
+    std::vector<NNList> results;
     for (auto &q : queries){
-        NNList<feature> nnList = searcher.knn(q, 3);
+        NNList nnList = searcher.knn(q, 3);
         results.push_back(nnList);
 
         std::cout << "Query: " << q << "\n";
@@ -47,7 +47,7 @@ int main(){
     // 4. Create a class to store the results of each query.
     // This class should be able to go through all the KNN results and aggregate the results in a dict {individual: count/score} where the count is the number of times the individual appears in the KNN results.
     
-    KNNResult<feature> knnResult(results);
+    KNNResult<feature> knnResult(results, searcher);
 
     std::cout << knnResult << "\n\n";
 
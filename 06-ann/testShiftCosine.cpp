@@ -0,0 +1,122 @@
+// Checks ShiftSequentialSearcher against a brute-force search under the cosine distance,
+// which is not a metric: no individual may be skipped by the triangle inequality bound.
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <vector>
+#include "objectTypes/Feature.hpp"
+#include "objectTypes/Individual.hpp"
+#include "indexing/ShiftSequentialSearcher.hpp"
+#include "indexing/DistanceFunction.hpp"
+
+typedef Feature<float> feature;
+typedef Individual<float> individual;
+typedef ShiftSequentialSearcher<feature, CosineDistance<feature>> ssseacher;
+
+// Distances of the k nearest objects to the query shifted for their individual, by exhaustive search
+std::vector<float> bruteForce(const std::vector<feature> &objects, const feature &query, size_t k) {
+    CosineDistance<feature> distanceFunc;
+    std::vector<float> distances;
+    for (const auto &object : objects) {
+        const individual &ind = *object.representative;
+        std::vector<float> shifted(query.size());
+        for (size_t i = 0; i < query.size(); i++) {
+            shifted[i] = ind.mean[i] + query[i] * ind.std[i];
+        }
+        distances.push_back(distanceFunc(feature(std::move(shifted)), object));
+    }
+    std::sort(distances.begin(), distances.end());
+    distances.resize(std::min(k, distances.size()));
+    return distances;
+}
+
+// Number of queries whose k nearest distances differ from the brute-force ones
+size_t mismatches(const std::vector<feature> &objects, const std::vector<feature> &queries, size_t k) {
+    CosineDistance<feature> distanceFunc;
+    ssseacher searcher(distanceFunc);
+    searcher.addAll(objects);
+
+    size_t failed = 0;
+    for (const auto &query : queries) {
+        NNList nnList = searcher.knn(query, k);
+        std::vector<float> expected = bruteForce(objects, query, k);
+        bool same = nnList.size() == expected.size();
+        for (size_t i = 0; same && i < expected.size(); i++) {
+            same = std::fabs(nnList[i].distance - expected[i]) <= 1e-5f;
+        }
+        if (!same) {
+            failed++;
+        }
+    }
+    return failed;
+}
+
+int main() {
+    size_t failed = 0;
+
+    // Two individuals around (1, 0): the query shifted for them is at angle 0.6, 0.175 from
+    // the mean. The object at angle 0.3 is 0.0447 from the mean and from the query, so the
+    // triangle inequality bound 0.175 - 0.0447 would wrongly skip it once the object of the
+    // other individual, 0.1 from the query, was found.
+    {
+        std::vector<std::unique_ptr<individual>> individuals;
+        std::vector<feature> objects;
+        const float angles[] = {0.6f + std::acos(0.9f), 0.3f};
+        for (float angle : angles) {
+            individuals.push_back(std::make_unique<individual>());
+            individuals.back()->mean = feature(std::vector<float>{1.0f, 0.0f});
+            individuals.back()->std = feature(std::vector<float>{1.0f, 1.0f});
+            objects.emplace_back(std::vector<float>{std::cos(angle), std::sin(angle)}, individuals.back().get());
+        }
+        std::vector<feature> queries = {feature(std::vector<float>{std::cos(0.6f) - 1.0f, std::sin(0.6f)})};
+        size_t counterexample = mismatches(objects, queries, 1);
+        std::cout << "counterexample: " << counterexample << " mismatches" << std::endl;
+        failed += counterexample;
+    }
+
+    // Random individuals, each with its own objects, mean and std
+    {
+        const size_t dimension = 16, numIndividuals = 200, perIndividual = 8, numQueries = 100, k = 5;
+        std::mt19937 gen(42);
+        std::normal_distribution<float> normal;
+        std::uniform_real_distribution<float> spread(0.1f, 2.0f);
+
+        std::vector<std::unique_ptr<individual>> individuals;
+        std::vector<feature> objects;
+        for (size_t p = 0; p < numIndividuals; p++) {
+            individuals.push_back(std::make_unique<individual>());
+            std::vector<feature> own;
+            for (size_t j = 0; j < perIndividual; j++) {
+                std::vector<float> values(dimension);
+                float scale = spread(gen);
+                for (auto &v : values) {
+                    v = 1.0f + scale * normal(gen);
+                }
+                own.emplace_back(std::move(values));
+            }
+            individuals.back()->calculateMean(own);
+            individuals.back()->calculateStd(own);
+            for (auto &object : own) {
+                object.representative = individuals.back().get();
+                objects.push_back(object);
+            }
+        }
+        std::shuffle(objects.begin(), objects.end(), gen);
+
+        std::vector<feature> queries;
+        for (size_t q = 0; q < numQueries; q++) {
+            std::vector<float> values(dimension);
+            for (auto &v : values) {
+                v = normal(gen);
+            }
+            queries.emplace_back(std::move(values));
+        }
+        size_t random = mismatches(objects, queries, k);
+        std::cout << "random: " << random << "/" << numQueries << " mismatches" << std::endl;
+        failed += random;
+    }
+
+    return failed == 0 ? 0 : 1;
+}